@@ -0,0 +1,523 @@
+// benchmark.cpp
+
+// throughput of the capture hot path on synthetic packets
+//
+// sweeps packet sizes, sample formats and skip-first-sample modes through
+// each stage a capture packet goes through: repacking into stereo frames,
+// conversion to the output device's sample type, and channel phase
+// detection. repacking is timed through the generic copy, the kernel
+// specialized on the sample size and a sample at a time loop, and the
+// kernel again demultiplexing into 4 and 8 channels. stages with
+// vector kernels run at every SIMD level the CPU has, so scalar and vector
+// versions are timed on the same data. the packets
+// stage repacks one stream cut into packets of random size, where odd ones
+// carry half a frame into the next, against the same stream in even
+// packets, copied or taken in place
+//
+// a frame is one stereo output frame, i.e. two mono input samples; bytes/s
+// counts input bytes. cycles are TSC ticks, so they only track core cycles
+// while the clock isn't boosting or throttling
+//
+// builds on Windows from benchmark.vcxproj, and on Linux with
+//     g++ -std=c++17 -O2 -pthread -I mono-to-stereo -o repack-benchmark benchmark/benchmark.cpp mono-to-stereo/sampleconvert.cpp mono-to-stereo/phasedetect.cpp mono-to-stereo/messages.cpp mono-to-stereo/dsp.cpp
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "audioformat.h"
+#include "dsp.h"
+#include "messages.h"
+#include "phasedetect.h"
+#include "repack.h"
+#include "sampleconvert.h"
+#include "simd.h"
+
+#ifdef SIMD_X86
+#ifndef _MSC_VER
+#include <x86intrin.h>
+#endif
+#endif
+
+static uint64_t ReadCycles() {
+#ifdef SIMD_X86
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+struct BenchmarkResult {
+    double fNsPerFrame;
+    double fBytesPerSecond;
+    double fCyclesPerFrame;
+};
+
+// keeps the compiler from throwing the work away
+static volatile uint32_t g_nSink;
+
+// runs fn() until one batch takes at least fSeconds / 5, then takes the best
+// of five batches of that size
+template <class Fn>
+static BenchmarkResult Measure(Fn fn, uint32_t nFramesPerCall, size_t nBytesPerCall, double fSeconds) {
+    typedef std::chrono::steady_clock Clock;
+
+    uint64_t nCalls = 1;
+    for (;;) {
+        auto start = Clock::now();
+        for (uint64_t i = 0; i < nCalls; i++) {
+            fn();
+        }
+        if (std::chrono::duration<double>(Clock::now() - start).count() >= fSeconds / 5 || nCalls >= (1ull << 40)) {
+            break;
+        }
+        nCalls *= 2;
+    }
+
+    double fBestSeconds = 1e300;
+    uint64_t nBestCycles = 0;
+    for (int run = 0; run < 5; run++) {
+        auto start = Clock::now();
+        uint64_t nStartCycles = ReadCycles();
+        for (uint64_t i = 0; i < nCalls; i++) {
+            fn();
+        }
+        uint64_t nCycles = ReadCycles() - nStartCycles;
+        double fElapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        if (fElapsed < fBestSeconds) {
+            fBestSeconds = fElapsed;
+            nBestCycles = nCycles;
+        }
+    }
+
+    double fFrames = static_cast<double>(nCalls) * nFramesPerCall;
+    BenchmarkResult result;
+    result.fNsPerFrame = fBestSeconds * 1e9 / fFrames;
+    result.fBytesPerSecond = static_cast<double>(nCalls) * static_cast<double>(nBytesPerCall) / fBestSeconds;
+    result.fCyclesPerFrame = static_cast<double>(nBestCycles) / fFrames;
+    return result;
+}
+
+// the obvious sample at a time version, as a baseline for RepackFrames
+static uint32_t RepackLoop(RepackState &state, const uint8_t *pIn, uint32_t nInFrames, uint8_t *pOut) {
+    const uint32_t nOutFrames = RepackOutputFrames(state, nInFrames);
+    const uint32_t nSamples = nOutFrames * state.nFactor;
+    const size_t nBlockAlign = state.nBlockAlign;
+    const uint32_t nCarried = RepackCarried(state);
+    const uint8_t *pCarried = RepackCarriedFrames(state);
+
+    for (uint32_t i = 0; i < nSamples; i++) {
+        const uint8_t *pFrom = i < nCarried ? pCarried + i * nBlockAlign : pIn + (i - nCarried) * nBlockAlign;
+        for (size_t b = 0; b < nBlockAlign; b++) {
+            pOut[i * nBlockAlign + b] = pFrom[b];
+        }
+    }
+
+    RepackAdvance(state, pIn, nInFrames);
+    return nOutFrames;
+}
+
+// packet sizes from 1 to 2 * nMean - 1 samples, odd and even, adding up to
+// at most nTotal
+static std::vector<uint32_t> RandomPacketSizes(uint32_t nMean, uint32_t nTotal) {
+    std::vector<uint32_t> sizes;
+    uint32_t nRandom = nMean;
+    uint32_t nDone = 0;
+    for (;;) {
+        nRandom = nRandom * 1664525u + 1013904223u;
+        uint32_t n = nMean > 1 ? 1 + (nRandom >> 8) % (2 * nMean - 1) : 1;
+        if (nDone + n > nTotal) {
+            break;
+        }
+        sizes.push_back(n);
+        nDone += n;
+    }
+    return sizes;
+}
+
+// repacks packets of the given sizes, back to back from pIn, into pOut
+static void RepackPackets(RepackState &state, const uint8_t *pIn, const std::vector<uint32_t> &sizes, uint8_t *pOut) {
+    for (uint32_t n : sizes) {
+        uint32_t nFrames = RepackFrames(state, pIn, n, pOut);
+        pIn += static_cast<size_t>(n) * state.nBlockAlign;
+        pOut += static_cast<size_t>(nFrames) * 2 * state.nBlockAlign;
+    }
+}
+
+struct BenchmarkOptions {
+    double fSeconds;   // per case
+    bool bCsv;
+    const char *szStage; // NULL for all
+};
+
+static void PrintHeader(const BenchmarkOptions &options) {
+    if (options.bCsv) {
+        printf("stage,impl,format,packet,skip,ns_per_frame,bytes_per_second,cycles_per_frame\n");
+        return;
+    }
+
+    printf("%-8s %-7s %-7s %7s %-4s %12s %12s %14s\n", "stage", "impl", "format", "packet", "skip", "ns/frame", "MB/s", "cycles/frame");
+}
+
+static void PrintRow(
+    const BenchmarkOptions &options,
+    const char *szStage, const char *szImpl, const char *szFormat,
+    uint32_t nPacket, const char *szSkip, const BenchmarkResult &result
+) {
+    if (options.bCsv) {
+        printf(
+            "%s,%s,%s,%u,%s,%.4f,%.0f,%.3f\n",
+            szStage, szImpl, szFormat, nPacket, szSkip,
+            result.fNsPerFrame, result.fBytesPerSecond, result.fCyclesPerFrame
+        );
+        return;
+    }
+
+    printf(
+        "%-8s %-7s %-7s %7u %-4s %12.3f %12.1f %14.2f\n",
+        szStage, szImpl, szFormat, nPacket, szSkip,
+        result.fNsPerFrame, result.fBytesPerSecond / 1e6, result.fCyclesPerFrame
+    );
+}
+
+static bool Wanted(const BenchmarkOptions &options, const char *szStage) {
+    return options.szStage == NULL || 0 == strcmp(options.szStage, szStage);
+}
+
+// a clock a second further on at every reading, so no message is ever
+// over its call site's rate
+class SteppingClock : public StatsClock {
+public:
+    SteppingClock() : m_hnsNow(0) {}
+    int64_t NowHns() override { return m_hnsNow += HNS_PER_SECOND; }
+
+private:
+    int64_t m_hnsNow;
+};
+
+class NullMessageSink : public MessageSink {
+public:
+    void Write(bool, const char *szMessage) override { g_nSink = g_nSink + static_cast<uint8_t>(szMessage[0]); }
+};
+
+// times nBatch calls of fn(i) at a time until fSeconds have been timed and
+// reports the best batch; the queue is emptied between batches, without
+// timing that, unless bKeepFull
+template <class Fn>
+static BenchmarkResult MeasureMessages(AsyncMessageSink &sink, Fn fn, uint32_t nBatch, size_t nBytesPerCall, double fSeconds, bool bKeepFull = false) {
+    typedef std::chrono::steady_clock Clock;
+
+    double fTimed = 0;
+    double fBestSeconds = 1e300;
+    uint64_t nBestCycles = 0;
+    uint32_t nCall = 0;
+    while (fTimed < fSeconds) {
+        auto start = Clock::now();
+        uint64_t nStartCycles = ReadCycles();
+        for (uint32_t i = 0; i < nBatch; i++) {
+            fn(nCall++);
+        }
+        uint64_t nCycles = ReadCycles() - nStartCycles;
+        double fElapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+        // no thread, so this only empties the queue
+        if (!bKeepFull) {
+            sink.Stop();
+        }
+
+        fTimed += fElapsed;
+        if (fElapsed < fBestSeconds) {
+            fBestSeconds = fElapsed;
+            nBestCycles = nCycles;
+        }
+    }
+
+    BenchmarkResult result;
+    result.fNsPerFrame = fBestSeconds * 1e9 / nBatch;
+    result.fBytesPerSecond = static_cast<double>(nBatch) * static_cast<double>(nBytesPerCall) / fBestSeconds;
+    result.fCyclesPerFrame = static_cast<double>(nBestCycles) / nBatch;
+    return result;
+}
+
+static void BenchmarkMessages(const BenchmarkOptions &options) {
+    // as many as fit without dropping any
+    const uint32_t nBatch = ASYNCLOG_SLOTS;
+    static const char szMessage[] = "Ignoring capture packet flags 0x00000010 after 123456789 frames";
+    NullMessageSink null;
+
+    // what the capture thread does with a glitch
+    {
+        SteppingClock clock;
+        AsyncMessageSink sink(null, clock);
+        BenchmarkResult result = MeasureMessages(sink, [&](uint32_t i) {
+            sink.Log("Ignoring capture packet flags 0x%08x after %llu frames", 0x10u, static_cast<unsigned long long>(i));
+        }, nBatch, sizeof(szMessage) - 1, options.fSeconds);
+        PrintRow(options, "log", "format", "-", nBatch, "-", result);
+    }
+
+    {
+        SteppingClock clock;
+        AsyncMessageSink sink(null, clock);
+        BenchmarkResult result = MeasureMessages(sink, [&](uint32_t) {
+            sink.Write(false, szMessage);
+        }, nBatch, sizeof(szMessage) - 1, options.fSeconds);
+        PrintRow(options, "log", "write", "-", nBatch, "-", result);
+    }
+
+    // the clock never moves, so all but the first few are over the rate
+    {
+        SimulatedClock clock;
+        AsyncMessageSink sink(null, clock);
+        BenchmarkResult result = MeasureMessages(sink, [&](uint32_t i) {
+            sink.Log("Ignoring capture packet flags 0x%08x after %llu frames", 0x10u, static_cast<unsigned long long>(i));
+        }, nBatch, sizeof(szMessage) - 1, options.fSeconds);
+        PrintRow(options, "log", "limited", "-", nBatch, "-", result);
+    }
+
+    // nobody empties the queue, so every one is dropped and counted
+    {
+        SteppingClock clock;
+        AsyncMessageSink sink(null, clock);
+        for (uint32_t i = 0; i < ASYNCLOG_SLOTS; i++) {
+            sink.Write(false, szMessage);
+        }
+        BenchmarkResult result = MeasureMessages(sink, [&](uint32_t) {
+            sink.Write(false, szMessage);
+        }, nBatch, sizeof(szMessage) - 1, options.fSeconds, true);
+        PrintRow(options, "log", "full", "-", nBatch, "-", result);
+    }
+}
+
+static void usage(const char *exe) {
+    printf(
+        "%s [--quick] [--csv] [--stage repack|convert|phase|packets|dsp|log]\n"
+        "\n"
+        "    --quick spends about 10 ms on each case instead of 50 ms\n"
+        "    --csv prints comma separated values instead of a table\n"
+        "    --stage only runs one stage\n",
+        exe
+    );
+}
+
+int main(int argc, char *argv[]) {
+    BenchmarkOptions options;
+    options.fSeconds = 0.05;
+    options.bCsv = false;
+    options.szStage = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "--quick")) {
+            options.fSeconds = 0.01;
+        }
+        else if (0 == strcmp(argv[i], "--csv")) {
+            options.bCsv = true;
+        }
+        else if (0 == strcmp(argv[i], "--stage") && i + 1 < argc) {
+            options.szStage = argv[++i];
+        }
+        else {
+            usage(argv[0]);
+            return 0 == strcmp(argv[i], "-?") ? 0 : 1;
+        }
+    }
+
+    // mono samples per packet: tiny, 5 ms and 10 ms at 96 kHz, a large
+    // WASAPI packet, and one too big for L2
+    static const uint32_t packets[] = { 32, 480, 960, 4096, 262144 };
+    static const char *formats[] = { "s16", "s24", "s32", "f32", "f64" };
+
+    const uint32_t nMaxPacket = 262144;
+    SimdLevel best = DetectSimdLevel();
+
+    if (!options.bCsv) {
+        printf("best SIMD level: %s\n\n", SimdLevelName(best));
+    }
+    PrintHeader(options);
+
+    for (const char *szFormat : formats) {
+        AudioFormat format;
+        ParseSampleFormatName(szFormat, format.wFormatTag, format.wBitsPerSample);
+        format = MakeAudioFormat(format.wFormatTag, 1, 96000, format.wBitsPerSample);
+        SampleType type = SampleTypeOf(format);
+
+        // what an output device would most likely want instead
+        SampleType outType = SAMPLE_FLOAT32 == type ? SAMPLE_INT16 : SAMPLE_FLOAT32;
+
+        // a quiet noise signal, the same for every run
+        std::vector<float> noise(nMaxPacket);
+        uint32_t nRandom = 1;
+        for (float &f : noise) {
+            nRandom = nRandom * 1664525u + 1013904223u;
+            f = static_cast<float>(static_cast<int32_t>(nRandom)) / 4294967296.0f;
+        }
+
+        std::vector<uint8_t> in(static_cast<size_t>(nMaxPacket) * format.nBlockAlign);
+        SampleConverter fromFloat;
+        fromFloat.Init(SAMPLE_FLOAT32, type, false, SIMD_SCALAR);
+        fromFloat.FromFloat(noise.data(), in.data(), nMaxPacket);
+
+        // room for the part frame carried in front of the stream
+        std::vector<uint8_t> ring(in.size() + REPACK_MAX_CARRY_BYTES);
+        std::vector<uint8_t> out(static_cast<size_t>(nMaxPacket) * SampleTypeBytes(outType));
+
+        for (uint32_t nPacket : packets) {
+            uint32_t nFrames = nPacket / 2;
+            size_t nBytes = static_cast<size_t>(nPacket) * format.nBlockAlign;
+
+            for (int skip = 0; skip < 2; skip++) {
+                const char *szSkip = skip ? "yes" : "no";
+
+                if (Wanted(options, "repack")) {
+                    RepackState repack = {};
+                    RepackInit(repack, format.nBlockAlign, 2, skip);
+
+                    BenchmarkResult result = Measure([&]() {
+                        RepackFrames(repack, in.data(), nPacket, ring.data());
+                        g_nSink = g_nSink + ring[0];
+                    }, nFrames, nBytes, options.fSeconds);
+                    PrintRow(options, "repack", "memcpy", szFormat, nPacket, szSkip, result);
+
+                    RepackKernel pRepack = RepackKernelFor(format.nBlockAlign, 2);
+                    result = Measure([&]() {
+                        pRepack(repack, in.data(), nPacket, ring.data());
+                        g_nSink = g_nSink + ring[0];
+                    }, nFrames, nBytes, options.fSeconds);
+                    PrintRow(options, "repack", "kernel", szFormat, nPacket, szSkip, result);
+
+                    result = Measure([&]() {
+                        RepackLoop(repack, in.data(), nPacket, ring.data());
+                        g_nSink = g_nSink + ring[0];
+                    }, nFrames, nBytes, options.fSeconds);
+                    PrintRow(options, "repack", "loop", szFormat, nPacket, szSkip, result);
+
+                    // the same samples demultiplexed into 4 and 8 channels,
+                    // frames still counted in pairs of input samples so the
+                    // rows compare directly
+                    static const uint32_t wide[] = { 4, 8 };
+                    static const char *wideNames[] = { "kernel4", "kernel8" };
+                    for (size_t w = 0; w < sizeof(wide) / sizeof(wide[0]); w++) {
+                        RepackState wideRepack = {};
+                        RepackInit(wideRepack, format.nBlockAlign, wide[w], skip);
+                        RepackKernel pWide = RepackKernelFor(format.nBlockAlign, wide[w]);
+                        result = Measure([&]() {
+                            pWide(wideRepack, in.data(), nPacket, ring.data());
+                            g_nSink = g_nSink + ring[0];
+                        }, nFrames, nBytes, options.fSeconds);
+                        PrintRow(options, "repack", wideNames[w], szFormat, nPacket, szSkip, result);
+                    }
+                }
+
+                // repacking and conversion together, the way a render
+                // thread feeding a device of another sample type sees it
+                if (Wanted(options, "convert")) {
+                    for (int level = SIMD_SCALAR; level <= best; level++) {
+                        RepackState repack = {};
+                        RepackInit(repack, format.nBlockAlign, 2, skip);
+                        SampleConverter converter;
+                        converter.Init(type, outType, true, static_cast<SimdLevel>(level));
+
+                        BenchmarkResult result = Measure([&]() {
+                            RepackFrames(repack, in.data(), nPacket, ring.data());
+                            converter.Convert(ring.data(), out.data(), static_cast<size_t>(nFrames) * 2);
+                            g_nSink = g_nSink + out[0];
+                        }, nFrames, nBytes, options.fSeconds);
+                        PrintRow(options, "convert", SimdLevelName(static_cast<SimdLevel>(level)), szFormat, nPacket, szSkip, result);
+                    }
+                }
+
+                // the same stream three ways, nPacket samples a packet on
+                // average; needs a few packets to the stream
+                if (Wanted(options, "packets") && nPacket * 4 <= nMaxPacket) {
+                    std::vector<uint32_t> random = RandomPacketSizes(nPacket, nMaxPacket);
+                    std::vector<uint32_t> even(nMaxPacket / nPacket, nPacket);
+                    uint32_t nRandomSamples = 0;
+                    for (uint32_t n : random) {
+                        nRandomSamples += n;
+                    }
+                    uint32_t nEvenSamples = nPacket * static_cast<uint32_t>(even.size());
+
+                    RepackState repack = {};
+                    RepackInit(repack, format.nBlockAlign, 2, skip);
+
+                    BenchmarkResult result = Measure([&]() {
+                        RepackPackets(repack, in.data(), random, ring.data());
+                        g_nSink = g_nSink + ring[0];
+                    }, nRandomSamples / 2, static_cast<size_t>(nRandomSamples) * format.nBlockAlign, options.fSeconds);
+                    PrintRow(options, "packets", "random", szFormat, nPacket, szSkip, result);
+
+                    RepackInit(repack, format.nBlockAlign, 2, skip);
+                    result = Measure([&]() {
+                        RepackPackets(repack, in.data(), even, ring.data());
+                        g_nSink = g_nSink + ring[0];
+                    }, nEvenSamples / 2, static_cast<size_t>(nEvenSamples) * format.nBlockAlign, options.fSeconds);
+                    PrintRow(options, "packets", "even", szFormat, nPacket, szSkip, result);
+
+                    // whoever reads the frames reads them where they are;
+                    // skipping the first sample always needs the copy
+                    RepackInit(repack, format.nBlockAlign, 2, skip);
+                    result = Measure([&]() {
+                        const uint8_t *pIn = in.data();
+                        uint8_t *pOut = ring.data();
+                        for (uint32_t n : even) {
+                            const uint8_t *pFrames = RepackInPlace(repack, pIn, n);
+                            if (NULL == pFrames) {
+                                RepackFrames(repack, pIn, n, pOut);
+                                pFrames = pOut;
+                            }
+                            g_nSink = g_nSink + pFrames[0];
+                            pIn += static_cast<size_t>(n) * format.nBlockAlign;
+                            pOut += static_cast<size_t>(n) * format.nBlockAlign;
+                        }
+                    }, nEvenSamples / 2, static_cast<size_t>(nEvenSamples) * format.nBlockAlign, options.fSeconds);
+                    PrintRow(options, "packets", "inplace", szFormat, nPacket, szSkip, result);
+                }
+            }
+
+            // every stage on, on frames already in the ring; the noise is
+            // quiet enough that only the gain makes the limiter work
+            if (Wanted(options, "dsp")) {
+                DspOptions dsp;
+                dsp.bRemoveDc = true;
+                dsp.channels = DSP_CHANNELS_SWAP;
+                dsp.fGainDb = 20;
+                dsp.bLimit = true;
+
+                DspChain chain;
+                chain.Init(dsp, StereoOutputFormat(format));
+
+                BenchmarkResult result = Measure([&]() {
+                    chain.Process(ring.data(), nFrames);
+                    g_nSink = g_nSink + ring[0];
+                }, nFrames, nBytes, options.fSeconds);
+                PrintRow(options, "dsp", "fused", szFormat, nPacket, "-", result);
+
+                result = Measure([&]() {
+                    chain.ProcessStaged(ring.data(), nFrames);
+                    g_nSink = g_nSink + ring[0];
+                }, nFrames, nBytes, options.fSeconds);
+                PrintRow(options, "dsp", "staged", szFormat, nPacket, "-", result);
+            }
+
+            // doesn't depend on the skip mode
+            if (Wanted(options, "phase")) {
+                for (int level = SIMD_SCALAR; level <= best; level++) {
+                    PhaseDetector phase;
+                    phase.Init(format, static_cast<SimdLevel>(level));
+
+                    BenchmarkResult result = Measure([&]() {
+                        g_nSink = g_nSink + static_cast<uint32_t>(phase.Analyze(in.data(), nPacket));
+                    }, nFrames, nBytes, options.fSeconds);
+                    PrintRow(options, "phase", SimdLevelName(static_cast<SimdLevel>(level)), szFormat, nPacket, "-", result);
+                }
+            }
+        }
+    }
+
+    if (Wanted(options, "log")) {
+        BenchmarkMessages(options);
+    }
+
+    return 0;
+}
@@ -0,0 +1,64 @@
+#!/bin/sh
+# pipe-benchmark.sh
+
+# throughput of mono-to-stereo as a filter between two pipes, against cat in
+# the same place as the baseline:
+#
+#     cat capture | cat             | cat > /dev/null
+#     cat capture | mono-to-stereo  | cat > /dev/null
+#
+# the capture is noise written to a temporary file first, so making it isn't
+# timed. each is run a few times and the fastest kept
+#
+#     benchmark/pipe-benchmark.sh ./mono-to-stereo [megabytes] [runs]
+
+set -e
+
+exe=${1:?usage: $0 path/to/mono-to-stereo [megabytes] [runs]}
+megabytes=${2:-1024}
+runs=${3:-3}
+
+# 96 kHz 16-bit mono, the default raw format
+bytes_per_second=192000
+
+capture=$(mktemp "${TMPDIR:-/tmp}/pipe-benchmark.XXXXXX")
+trap 'rm -f "$capture"' EXIT
+head -c $((megabytes * 1024 * 1024)) /dev/urandom > "$capture"
+
+now_ns() {
+    date +%s%N
+}
+
+# prints the fastest of the runs in ns
+fastest() {
+    best=
+    i=0
+    while [ $i -lt "$runs" ]; do
+        start=$(now_ns)
+        "$@"
+        took=$(($(now_ns) - start))
+        if [ -z "$best" ] || [ $took -lt $best ]; then
+            best=$took
+        fi
+        i=$((i + 1))
+    done
+    echo $best
+}
+
+through_cat() {
+    cat "$capture" | cat | cat > /dev/null
+}
+
+through_filter() {
+    cat "$capture" | "$exe" --input-file - --output-file - --skip-first-sample 2> /dev/null | cat > /dev/null
+}
+
+report() {
+    awk -v name="$1" -v ns="$2" -v bytes=$((megabytes * 1024 * 1024)) -v rate=$bytes_per_second 'BEGIN {
+        seconds = ns / 1e9
+        printf "%-15s %8.3f s %10.1f MB/s %10.0fx real time\n", name, seconds, bytes / seconds / 1e6, bytes / rate / seconds
+    }'
+}
+
+report cat "$(fastest through_cat)"
+report mono-to-stereo "$(fastest through_filter)"
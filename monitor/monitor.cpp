@@ -0,0 +1,199 @@
+// monitor.cpp
+
+// watches the live statistics of any number of running instances
+//
+// each instance started with --shared-stats NAME keeps its statistics in a
+// block of shared memory (sharedstats.h); this polls the blocks, one line
+// per instance, without the instances doing anything for it. an instance
+// whose block hasn't changed since the last poll is shown as stale, and
+// one whose process has gone as gone. on Linux every block there is gets
+// found by itself; elsewhere the names have to be given
+//
+// builds on Windows from monitor.vcxproj, and on Linux with
+//     g++ -std=c++17 -O2 -I mono-to-stereo -o stats-monitor monitor/monitor.cpp mono-to-stereo/sharedstats.cpp
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sharedstats.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <dirent.h>
+#include <signal.h>
+#endif
+
+static bool ProcessRunning(uint32_t nProcessId) {
+#ifdef _WIN32
+    HANDLE hProcess = OpenProcess(SYNCHRONIZE, FALSE, nProcessId);
+    if (NULL == hProcess) {
+        return ERROR_ACCESS_DENIED == GetLastError();
+    }
+    bool bRunning = WAIT_TIMEOUT == WaitForSingleObject(hProcess, 0);
+    CloseHandle(hProcess);
+    return bRunning;
+#else
+    return 0 == kill(static_cast<pid_t>(nProcessId), 0) || EPERM == errno;
+#endif
+}
+
+// every block there is, sorted by name
+static std::vector<std::string> FindInstances() {
+    std::vector<std::string> names;
+#ifndef _WIN32
+    DIR *pDir = opendir("/dev/shm");
+    if (NULL == pDir) {
+        return names;
+    }
+
+    const size_t nPrefix = strlen(SHAREDSTATS_PREFIX);
+    while (struct dirent *pEntry = readdir(pDir)) {
+        if (0 == strncmp(pEntry->d_name, SHAREDSTATS_PREFIX, nPrefix) && IsValidSharedStatsName(pEntry->d_name + nPrefix)) {
+            names.push_back(pEntry->d_name + nPrefix);
+        }
+    }
+    closedir(pDir);
+    std::sort(names.begin(), names.end());
+#endif
+    return names;
+}
+
+static double Ms(int64_t hns) {
+    return static_cast<double>(hns) / 10000.0;
+}
+
+static void PrintHeader() {
+    printf(
+        "%-16s %8s %-7s %12s %4s %9s %8s %8s %8s %10s %10s %10s\n",
+        "name", "pid", "state", "frames", "outs", "min fill", "overruns", "underrun", "glitches",
+        "lat p99", "cap p99", "rend p99"
+    );
+}
+
+// one line; the figures of every output are folded together, worst first
+static void PrintInstance(const std::string &name, std::map<std::string, uint64_t> &lastUpdates) {
+    SharedStatsReader reader;
+    std::string error;
+    if (!reader.Open(name, error)) {
+        printf("%-16s %8s %-7s %s\n", name.c_str(), "-", "missing", error.c_str());
+        return;
+    }
+
+    SharedStats stats;
+    if (!reader.Read(stats)) {
+        printf("%-16s %8u %-7s\n", name.c_str(), reader.ProcessId(), "busy");
+        return;
+    }
+
+    const char *szState = "ok";
+    std::map<std::string, uint64_t>::iterator last = lastUpdates.find(name);
+    if (!ProcessRunning(reader.ProcessId())) {
+        szState = "gone";
+    }
+    else if (last != lastUpdates.end() && last->second == stats.nUpdates) {
+        szState = "stale";
+    }
+    lastUpdates[name] = stats.nUpdates;
+
+    uint32_t nMinFill = UINT32_MAX;
+    uint32_t nOverruns = 0;
+    uint32_t nUnderruns = 0;
+    int64_t hnsLatency = 0;
+    int64_t hnsRender = 0;
+    uint32_t nOutputs = (std::min)(stats.nOutputs, static_cast<uint32_t>(SHAREDSTATS_MAX_OUTPUTS));
+    for (uint32_t i = 0; i < nOutputs; i++) {
+        const SharedStatsOutput &output = stats.outputs[i];
+        nMinFill = (std::min)(nMinFill, output.ring.nMinFillFrames);
+        nOverruns += output.ring.nOverruns;
+        nUnderruns += output.ring.nUnderruns;
+        hnsLatency = (std::max)(hnsLatency, output.latency.hnsP99);
+        hnsRender = (std::max)(hnsRender, output.renderProcessing.hnsP99);
+    }
+
+    const GlitchStats &glitches = stats.glitches;
+    uint64_t nGlitches = glitches.nDiscontinuities + glitches.nSilentPackets + glitches.nUnknownFlagPackets;
+
+    printf(
+        "%-16s %8u %-7s %12llu %4u %9u %8u %8u %8llu %7.2f ms %7.2f ms %7.2f ms\n",
+        name.c_str(), reader.ProcessId(), szState,
+        static_cast<unsigned long long>(stats.nCapturedFrames), nOutputs,
+        nMinFill == UINT32_MAX ? 0 : nMinFill, nOverruns, nUnderruns,
+        static_cast<unsigned long long>(nGlitches),
+        Ms(hnsLatency), Ms(stats.captureProcessing.hnsP99), Ms(hnsRender)
+    );
+}
+
+static void usage(const char *exe) {
+    printf(
+        "%s [--interval 1] [--once] [name ...]\n"
+        "\n"
+        "    --interval seconds between polls (default 1)\n"
+        "    --once polls once and exits\n"
+        "    name what an instance was given with --shared-stats; every instance running if none are given (Linux only)\n",
+        exe
+    );
+}
+
+int main(int argc, char *argv[]) {
+    double fInterval = 1;
+    bool bOnce = false;
+    std::vector<std::string> names;
+
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "--once")) {
+            bOnce = true;
+        }
+        else if (0 == strcmp(argv[i], "--interval") && i + 1 < argc) {
+            fInterval = atof(argv[++i]);
+            if (fInterval <= 0) {
+                fprintf(stderr, "Error: invalid interval given\n");
+                return 1;
+            }
+        }
+        else if (argv[i][0] != '-' && IsValidSharedStatsName(argv[i])) {
+            names.push_back(argv[i]);
+        }
+        else {
+            usage(argv[0]);
+            return 0 == strcmp(argv[i], "-?") ? 0 : 1;
+        }
+    }
+
+    bool bFind = names.empty();
+#ifdef _WIN32
+    if (bFind) {
+        usage(argv[0]);
+        return 1;
+    }
+#endif
+
+    std::map<std::string, uint64_t> lastUpdates;
+    for (;;) {
+        // instances come and go between polls
+        if (bFind) {
+            names = FindInstances();
+        }
+
+        PrintHeader();
+        for (const std::string &name : names) {
+            PrintInstance(name, lastUpdates);
+        }
+
+        if (bOnce) {
+            return 0;
+        }
+
+        printf("\n");
+        fflush(stdout);
+        std::this_thread::sleep_for(std::chrono::duration<double>(fInterval));
+    }
+}
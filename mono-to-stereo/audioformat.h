@@ -0,0 +1,114 @@
+// audioformat.h
+
+// portable description of a PCM stream, and the checks we do on the
+// capture format before treating it as a disguised stereo (or wider) stream
+//
+// LoopbackCapture fills this in from the device's WAVEFORMATEX; the file
+// converter fills it in from a WAV header or the --raw-* switches
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#define AUDIOFORMAT_TAG_PCM 0x0001
+#define AUDIOFORMAT_TAG_IEEE_FLOAT 0x0003
+#define AUDIOFORMAT_TAG_EXTENSIBLE 0xFFFE
+
+// most channels a capture stream can be demultiplexed into
+#define AUDIOFORMAT_MAX_CHANNELS 8
+
+struct AudioFormat {
+    uint16_t wFormatTag; // AUDIOFORMAT_TAG_PCM or AUDIOFORMAT_TAG_IEEE_FLOAT, never extensible
+    uint16_t nChannels;
+    uint32_t nSamplesPerSec;
+    uint16_t wBitsPerSample;
+    uint16_t nBlockAlign;
+};
+
+static inline AudioFormat MakeAudioFormat(uint16_t wFormatTag, uint16_t nChannels, uint32_t nSamplesPerSec, uint16_t wBitsPerSample) {
+    AudioFormat format;
+    format.wFormatTag = wFormatTag;
+    format.nChannels = nChannels;
+    format.nSamplesPerSec = nSamplesPerSec;
+    format.wBitsPerSample = wBitsPerSample;
+    format.nBlockAlign = static_cast<uint16_t>(nChannels * wBitsPerSample / 8);
+    return format;
+}
+
+// the input must be whole-byte PCM or float samples, with few enough
+// channels that nMultiplex times as many fit in AUDIOFORMAT_MAX_CHANNELS
+static inline bool CheckMultiplexedInputFormat(const AudioFormat &format, uint32_t nMultiplex, std::string &error) {
+    if (nMultiplex < 2 || nMultiplex > AUDIOFORMAT_MAX_CHANNELS) {
+        error = "can't demultiplex by a factor of " + std::to_string(nMultiplex) + ", only 2 to " + std::to_string(AUDIOFORMAT_MAX_CHANNELS);
+        return false;
+    }
+
+    if (format.nChannels == 0 || format.nChannels * nMultiplex > AUDIOFORMAT_MAX_CHANNELS) {
+        error = "input has " + std::to_string(format.nChannels) + " channels, can't make " + std::to_string(nMultiplex) + " times as many";
+        return false;
+    }
+
+    if (format.wFormatTag != AUDIOFORMAT_TAG_PCM && format.wFormatTag != AUDIOFORMAT_TAG_IEEE_FLOAT) {
+        error = "input format not PCM, got " + std::to_string(format.wFormatTag);
+        return false;
+    }
+
+    if (format.wBitsPerSample == 0 || format.wBitsPerSample % 8 != 0 || format.wBitsPerSample > 64) {
+        error = "unsupported input sample size of " + std::to_string(format.wBitsPerSample) + " bits";
+        return false;
+    }
+
+    if (format.wFormatTag == AUDIOFORMAT_TAG_IEEE_FLOAT && format.wBitsPerSample != 32 && format.wBitsPerSample != 64) {
+        error = "unsupported float sample size of " + std::to_string(format.wBitsPerSample) + " bits";
+        return false;
+    }
+
+    if (format.nSamplesPerSec < nMultiplex) {
+        error = "invalid input sample rate " + std::to_string(format.nSamplesPerSec);
+        return false;
+    }
+
+    return true;
+}
+
+// what the multiplexed stream really is: nMultiplex times the channels at
+// 1 / nMultiplex of the rate
+static inline AudioFormat DemultiplexedFormat(const AudioFormat &input, uint32_t nMultiplex) {
+    AudioFormat output = input;
+    output.nChannels = static_cast<uint16_t>(input.nChannels * nMultiplex);
+    output.nSamplesPerSec = input.nSamplesPerSec / nMultiplex;
+    output.nBlockAlign = static_cast<uint16_t>(input.nBlockAlign * nMultiplex);
+    return output;
+}
+
+// the MS2109's: two channels at half the rate
+static inline AudioFormat StereoOutputFormat(const AudioFormat &input) {
+    return DemultiplexedFormat(input, 2);
+}
+
+// parses the --raw-format names: s16, s24, s32, f32, f64
+static inline bool ParseSampleFormatName(const char *szName, uint16_t &wFormatTag, uint16_t &wBitsPerSample) {
+    static const struct {
+        const char *szName;
+        uint16_t wFormatTag;
+        uint16_t wBitsPerSample;
+    } formats[] = {
+        { "s16", AUDIOFORMAT_TAG_PCM, 16 },
+        { "s24", AUDIOFORMAT_TAG_PCM, 24 },
+        { "s32", AUDIOFORMAT_TAG_PCM, 32 },
+        { "f32", AUDIOFORMAT_TAG_IEEE_FLOAT, 32 },
+        { "f64", AUDIOFORMAT_TAG_IEEE_FLOAT, 64 },
+    };
+
+    for (const auto &format : formats) {
+        if (0 == strcmp(format.szName, szName)) {
+            wFormatTag = format.wFormatTag;
+            wBitsPerSample = format.wBitsPerSample;
+            return true;
+        }
+    }
+
+    return false;
+}
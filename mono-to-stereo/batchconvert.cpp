@@ -0,0 +1,555 @@
+// batchconvert.cpp
+
+#include "batchconvert.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "fileio.h"
+#include "repack.h"
+#include "wavfile.h"
+
+// lists are small; anything this big is something else
+#define BATCH_LIST_MAX_BYTES (64 * 1024 * 1024)
+
+// how long an idle worker sleeps before looking for work again, in case
+// it missed being woken
+#define BATCH_IDLE_MS 50
+
+static std::string Trim(const std::string &s) {
+    size_t nBegin = 0;
+    size_t nEnd = s.size();
+    while (nBegin < nEnd && (' ' == s[nBegin] || '\t' == s[nBegin] || '\r' == s[nBegin])) {
+        nBegin++;
+    }
+    while (nEnd > nBegin && (' ' == s[nEnd - 1] || '\t' == s[nEnd - 1] || '\r' == s[nEnd - 1])) {
+        nEnd--;
+    }
+    return s.substr(nBegin, nEnd - nBegin);
+}
+
+static std::string BaseName(const std::string &path) {
+#ifdef _WIN32
+    size_t nSlash = path.find_last_of("/\\");
+#else
+    size_t nSlash = path.find_last_of('/');
+#endif
+    return std::string::npos == nSlash ? path : path.substr(nSlash + 1);
+}
+
+static std::string JoinPath(const std::string &dir, const std::string &name) {
+    if (dir.empty()) {
+        return name;
+    }
+    char last = dir[dir.size() - 1];
+#ifdef _WIN32
+    if ('\\' == last || '/' == last) {
+        return dir + name;
+    }
+    return dir + "\\" + name;
+#else
+    if ('/' == last) {
+        return dir + name;
+    }
+    return dir + "/" + name;
+#endif
+}
+
+bool ListBatchInputs(const std::string &path, std::vector<std::string> &inputs, std::string &error) {
+    if (IsDirectory(path)) {
+        std::vector<std::string> names;
+        if (!ListDirectory(path, names, error)) {
+            error = path + ": " + error;
+            return false;
+        }
+        for (const std::string &name : names) {
+            inputs.push_back(JoinPath(path, name));
+        }
+        return true;
+    }
+
+    MappedInputFile file;
+    if (!file.Open(path, error)) {
+        error = path + ": " + error;
+        return false;
+    }
+
+    if (file.Size() > BATCH_LIST_MAX_BYTES) {
+        error = path + ": too big for a list of files";
+        return false;
+    }
+
+    std::string text;
+    if (file.Size() > 0) {
+        const uint8_t *pData = file.Map(0, static_cast<size_t>(file.Size()), error);
+        if (NULL == pData) {
+            error = path + ": " + error;
+            return false;
+        }
+        text.assign(reinterpret_cast<const char *>(pData), static_cast<size_t>(file.Size()));
+    }
+
+    if (0 == text.compare(0, 3, "\xEF\xBB\xBF")) {
+        text.erase(0, 3);
+    }
+
+    size_t nPos = 0;
+    while (nPos < text.size()) {
+        size_t nNewline = text.find('\n', nPos);
+        if (std::string::npos == nNewline) {
+            nNewline = text.size();
+        }
+        std::string line = Trim(text.substr(nPos, nNewline - nPos));
+        nPos = nNewline + 1;
+
+        if (!line.empty() && '#' != line[0]) {
+            inputs.push_back(line);
+        }
+    }
+    return true;
+}
+
+BatchConverter::BatchConverter()
+    : m_nChunkBytes(0)
+    , m_nNextFile(0)
+    , m_nFilesLeft(0)
+    , m_nFilesFailed(0)
+    , m_bStopping(false)
+    , m_nInputBytes(0)
+    , m_nInputBytesDone(0)
+    , m_nOutputBytes(0)
+    , m_nCopiedBytes(0)
+    , m_nStolenChunks(0)
+    , m_nIdleGeneration(0)
+{}
+
+BatchConverter::~BatchConverter() {
+    Stop();
+    Join();
+}
+
+bool BatchConverter::Start(const BatchOptions &options, std::string &error) {
+    if (!m_workers.empty()) {
+        error = "batch already started";
+        return false;
+    }
+
+    if (!IsDirectory(options.outputDir)) {
+        error = options.outputDir + ": not a directory";
+        return false;
+    }
+
+    if (options.nChunkMB == 0) {
+        error = "chunks can't be empty";
+        return false;
+    }
+
+    m_options = options;
+    m_nChunkBytes = static_cast<uint64_t>(options.nChunkMB) * 1024 * 1024;
+
+    // every file gets an output of its own, and none of them is an input
+    std::vector<std::pair<std::string, size_t>> outputs;
+    m_results.resize(options.inputs.size());
+    for (size_t i = 0; i < options.inputs.size(); i++) {
+        BatchFileResult &result = m_results[i];
+        result.inputPath = options.inputs[i];
+        result.outputPath = JoinPath(options.outputDir, BaseName(options.inputs[i]));
+        result.bOk = false;
+        result.result = ConvertResult();
+
+        if (IsSameFile(result.inputPath, result.outputPath)) {
+            error = result.inputPath + " would be written over itself";
+            return false;
+        }
+        outputs.push_back(std::make_pair(result.outputPath, i));
+    }
+
+    std::sort(outputs.begin(), outputs.end());
+    for (size_t i = 1; i < outputs.size(); i++) {
+        if (outputs[i].first == outputs[i - 1].first) {
+            error = options.inputs[outputs[i - 1].second] + " and " + options.inputs[outputs[i].second] + " would both be written to " + outputs[i].first;
+            return false;
+        }
+    }
+
+    // sized up front so there's something to measure progress against
+    m_files.clear();
+    m_nInputBytes = 0;
+    for (size_t i = 0; i < options.inputs.size(); i++) {
+        m_files.emplace_back(new File);
+
+        MappedInputFile in;
+        std::string ignored;
+        if (in.Open(options.inputs[i], ignored)) {
+            m_nInputBytes += in.Size();
+        }
+    }
+
+    uint32_t nThreads = options.nThreads;
+    if (0 == nThreads) {
+        nThreads = std::thread::hardware_concurrency();
+    }
+    nThreads = (std::max)(1u, (std::min)(nThreads, static_cast<uint32_t>(BATCH_MAX_THREADS)));
+
+    m_nNextFile = 0;
+    m_nFilesLeft = static_cast<uint32_t>(options.inputs.size());
+    m_bStopping = false;
+
+    for (uint32_t i = 0; i < nThreads; i++) {
+        m_workers.emplace_back(new Worker);
+    }
+    for (uint32_t i = 0; i < nThreads; i++) {
+        m_workers[i]->thread = std::thread(&BatchConverter::WorkerThread, this, i);
+    }
+    return true;
+}
+
+bool BatchConverter::Wait(uint32_t nTimeoutMs) {
+    {
+        std::unique_lock<std::mutex> lock(m_doneLock);
+        if (!m_done.wait_for(lock, std::chrono::milliseconds(nTimeoutMs), [this] { return 0 == m_nFilesLeft.load(); })) {
+            return false;
+        }
+    }
+    Join();
+    return true;
+}
+
+void BatchConverter::Stop() {
+    m_bStopping = true;
+    {
+        std::lock_guard<std::mutex> lock(m_idleLock);
+        m_nIdleGeneration++;
+    }
+    m_idle.notify_all();
+}
+
+void BatchConverter::Join() {
+    for (auto &pWorker : m_workers) {
+        if (pWorker->thread.joinable()) {
+            pWorker->thread.join();
+        }
+    }
+}
+
+BatchProgress BatchConverter::Progress() const {
+    BatchProgress progress;
+    progress.nFiles = static_cast<uint32_t>(m_files.size());
+    progress.nFilesDone = progress.nFiles - m_nFilesLeft.load();
+    progress.nFilesFailed = m_nFilesFailed.load();
+    progress.nInputBytes = m_nInputBytes;
+    progress.nInputBytesDone = m_nInputBytesDone.load();
+    progress.nOutputBytes = m_nOutputBytes.load();
+    progress.nCopiedBytes = m_nCopiedBytes.load();
+    progress.nThreads = static_cast<uint32_t>(m_workers.size());
+    progress.nStolenChunks = m_nStolenChunks.load();
+    return progress;
+}
+
+void BatchConverter::WorkerThread(uint32_t nWorker) {
+    for (;;) {
+        uint64_t nGeneration;
+        {
+            std::lock_guard<std::mutex> lock(m_idleLock);
+            nGeneration = m_nIdleGeneration;
+        }
+
+        Task task;
+        if (TakeTask(nWorker, task)) {
+            RunChunk(task);
+            continue;
+        }
+
+        // nothing queued anywhere: start the next file, if there is one
+        uint32_t nFile = m_nNextFile.fetch_add(1);
+        if (nFile < m_files.size() && !m_bStopping) {
+            StartFile(nWorker, nFile);
+            continue;
+        }
+
+        // a stopped batch fails what nobody has started on
+        if (nFile < m_files.size()) {
+            Fail(nFile, "stopped");
+            FinishFile(nFile);
+            continue;
+        }
+
+        if (0 == m_nFilesLeft.load()) {
+            return;
+        }
+
+        // the last files' chunks are being written, and more may yet be queued
+        std::unique_lock<std::mutex> lock(m_idleLock);
+        m_idle.wait_for(lock, std::chrono::milliseconds(BATCH_IDLE_MS), [this, nGeneration] { return m_nIdleGeneration != nGeneration; });
+    }
+}
+
+bool BatchConverter::TakeTask(uint32_t nWorker, Task &task) {
+    // its own newest first, so a file it started goes out in order
+    {
+        Worker &self = *m_workers[nWorker];
+        std::lock_guard<std::mutex> lock(self.lock);
+        if (!self.tasks.empty()) {
+            task = self.tasks.back();
+            self.tasks.pop_back();
+            return true;
+        }
+    }
+
+    // then the oldest of someone else's, the far end of the file they're on
+    const size_t nWorkers = m_workers.size();
+    for (size_t i = 1; i < nWorkers; i++) {
+        Worker &victim = *m_workers[(nWorker + i) % nWorkers];
+        std::lock_guard<std::mutex> lock(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            m_nStolenChunks++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void BatchConverter::StartFile(uint32_t nWorker, uint32_t nFile) {
+    File &file = *m_files[nFile];
+    BatchFileResult &result = m_results[nFile];
+    std::string error;
+
+    MappedInputFile in;
+    if (!in.Open(result.inputPath, error)) {
+        Fail(nFile, result.inputPath + ": " + error);
+        FinishFile(nFile);
+        return;
+    }
+    file.nInputBytes = in.Size();
+
+    ConvertOptions options = m_options.convert;
+    options.inputPath = result.inputPath;
+    options.outputPath = result.outputPath;
+    if (!PlanConversion(options, in, file.plan, error)) {
+        Fail(nFile, result.inputPath + ": " + error);
+        FinishFile(nFile);
+        return;
+    }
+    in.Close();
+
+    const ConvertPlan &plan = file.plan;
+    file.nDataBytes = plan.nOutputFrames * plan.outputFormat.nBlockAlign;
+
+    // the header goes in with the size it will have; the file is written
+    // by the chunks after this, each through a handle of its own
+    OutputFile out;
+    if (!out.Open(result.outputPath, error)) {
+        Fail(nFile, result.outputPath + ": " + error);
+        FinishFile(nFile);
+        return;
+    }
+
+    if (IsWavPath(result.outputPath)) {
+        uint8_t header[WAV_HEADER_BYTES];
+        BuildWavHeader(plan.outputFormat, file.nDataBytes, header);
+        if (!out.Write(header, sizeof(header), error)) {
+            Fail(nFile, result.outputPath + ": " + error);
+            FinishFile(nFile);
+            return;
+        }
+        file.nHeaderBytes = sizeof(header);
+    }
+
+    if (!out.Close(error)) {
+        Fail(nFile, result.outputPath + ": " + error);
+        FinishFile(nFile);
+        return;
+    }
+
+    // whole output frames per chunk
+    const uint64_t nFrameBytes = plan.outputFormat.nBlockAlign;
+    const uint64_t nChunkBytes = (std::max)(m_nChunkBytes / nFrameBytes, static_cast<uint64_t>(1)) * nFrameBytes;
+    file.nChunks = static_cast<uint32_t>((file.nDataBytes + nChunkBytes - 1) / nChunkBytes);
+    if (0 == file.nChunks) {
+        FinishFile(nFile);
+        return;
+    }
+    file.nChunksLeft = file.nChunks;
+
+    // last first, so this worker takes them from the start and the others
+    // from the end
+    {
+        Worker &self = *m_workers[nWorker];
+        std::lock_guard<std::mutex> lock(self.lock);
+        for (uint32_t i = file.nChunks; i-- > 0; ) {
+            self.tasks.push_back(Task{ nFile, i });
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_idleLock);
+        m_nIdleGeneration++;
+    }
+    m_idle.notify_all();
+}
+
+void BatchConverter::RunChunk(const Task &task) {
+    File &file = *m_files[task.nFile];
+    const BatchFileResult &result = m_results[task.nFile];
+
+    // one chunk failing is enough for the file; the rest are just skipped
+    if (file.bFailed || m_bStopping) {
+        if (m_bStopping) {
+            Fail(task.nFile, "stopped");
+        }
+        FinishChunk(task.nFile);
+        return;
+    }
+
+    const ConvertPlan &plan = file.plan;
+    const uint64_t nFrameBytes = plan.outputFormat.nBlockAlign;
+    const uint64_t nChunkBytes = (std::max)(m_nChunkBytes / nFrameBytes, static_cast<uint64_t>(1)) * nFrameBytes;
+    const uint64_t nBegin = task.nChunk * nChunkBytes;
+    const uint64_t nEnd = (std::min)(nBegin + nChunkBytes, file.nDataBytes);
+
+    // output byte n is input byte n - nShift, nothing before the first
+    const uint32_t nInBlockAlign = plan.inputFormat.nBlockAlign;
+    const uint64_t nShift = static_cast<uint64_t>(plan.nSampleOffset) * nInBlockAlign;
+
+    std::string error;
+    MappedInputFile in;
+    if (!in.Open(result.inputPath, error)) {
+        Fail(task.nFile, result.inputPath + ": " + error);
+        FinishChunk(task.nFile);
+        return;
+    }
+
+    OutputFile out;
+    if (!out.OpenExisting(result.outputPath, error)) {
+        Fail(task.nFile, result.outputPath + ": " + error);
+        FinishChunk(task.nFile);
+        return;
+    }
+
+    uint64_t nPos = nBegin;
+
+    // only the very first frame is missing samples; the repack fills them in
+    if (0 == nPos && 0 != nShift) {
+        const uint32_t nFactor = m_options.convert.nMultiplex;
+        const uint32_t nFirstFrames = nFactor - plan.nSampleOffset;
+        const uint8_t *pIn = in.Map(plan.nDataOffset, static_cast<size_t>(nFirstFrames) * nInBlockAlign, error);
+        if (nullptr == pIn) {
+            Fail(task.nFile, result.inputPath + ": " + error);
+            FinishChunk(task.nFile);
+            return;
+        }
+
+        RepackState repack;
+        RepackInit(repack, nInBlockAlign, nFactor, plan.nSampleOffset);
+        uint8_t frame[AUDIOFORMAT_MAX_CHANNELS * REPACK_MAX_SAMPLE_BYTES];
+        RepackKernelFor(nInBlockAlign, nFactor)(repack, pIn, nFirstFrames, frame);
+
+        if (!out.WriteAt(file.nHeaderBytes, frame, static_cast<size_t>(nFrameBytes), error)) {
+            Fail(task.nFile, result.outputPath + ": " + error);
+            FinishChunk(task.nFile);
+            return;
+        }
+        nPos = nFrameBytes;
+    }
+
+    // the rest is the input as it is
+    if (nPos < nEnd) {
+        const uint64_t nInOffset = plan.nDataOffset + nPos - nShift;
+        const uint64_t nOutOffset = file.nHeaderBytes + nPos;
+        const uint64_t nBytes = nEnd - nPos;
+
+        bool bCopied;
+        if (!out.CopyRange(in, nInOffset, nOutOffset, nBytes, bCopied, error)) {
+            Fail(task.nFile, result.inputPath + " to " + result.outputPath + ": " + error);
+            FinishChunk(task.nFile);
+            return;
+        }
+
+        if (bCopied) {
+            m_nCopiedBytes += nBytes;
+        }
+        else {
+            const uint8_t *pIn = in.Map(nInOffset, static_cast<size_t>(nBytes), error);
+            if (nullptr == pIn) {
+                Fail(task.nFile, result.inputPath + ": " + error);
+                FinishChunk(task.nFile);
+                return;
+            }
+            if (!out.WriteAt(nOutOffset, pIn, static_cast<size_t>(nBytes), error)) {
+                Fail(task.nFile, result.outputPath + ": " + error);
+                FinishChunk(task.nFile);
+                return;
+            }
+        }
+    }
+
+    if (!out.Close(error)) {
+        Fail(task.nFile, result.outputPath + ": " + error);
+        FinishChunk(task.nFile);
+        return;
+    }
+
+    m_nOutputBytes += nEnd - nBegin;
+    file.nInputBytesDone += nEnd - nBegin;
+    m_nInputBytesDone += nEnd - nBegin;
+    FinishChunk(task.nFile);
+}
+
+void BatchConverter::Fail(uint32_t nFile, const std::string &error) {
+    File &file = *m_files[nFile];
+    std::lock_guard<std::mutex> lock(file.errorLock);
+    if (!file.bFailed) {
+        file.error = error;
+        file.bFailed = true;
+    }
+}
+
+void BatchConverter::FinishChunk(uint32_t nFile) {
+    if (1 == m_files[nFile]->nChunksLeft.fetch_sub(1)) {
+        FinishFile(nFile);
+    }
+}
+
+void BatchConverter::FinishFile(uint32_t nFile) {
+    File &file = *m_files[nFile];
+    BatchFileResult &result = m_results[nFile];
+    const ConvertPlan &plan = file.plan;
+
+    if (file.bFailed) {
+        std::lock_guard<std::mutex> lock(file.errorLock);
+        result.bOk = false;
+        result.error = file.error;
+        m_nFilesFailed++;
+    }
+    else {
+        result.bOk = true;
+        result.result.inputFormat = plan.inputFormat;
+        result.result.outputFormat = plan.outputFormat;
+        result.result.nInputFrames = plan.nInputFrames;
+        result.result.nOutputFrames = plan.nOutputFrames;
+        result.result.nOutputBytes = file.nDataBytes;
+        result.result.nMultiplex = m_options.convert.nMultiplex;
+        result.result.nSampleOffset = plan.nSampleOffset;
+        result.result.bPhaseDetected = plan.bPhaseDetected;
+        result.result.bSpliced = false;
+    }
+
+    // the rest of it (the header, a partial frame, what a failure skipped)
+    // is counted as done along with it
+    const uint64_t nCounted = file.nInputBytesDone.load();
+    if (file.nInputBytes > nCounted) {
+        m_nInputBytesDone += file.nInputBytes - nCounted;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_idleLock);
+        m_nIdleGeneration++;
+    }
+    m_idle.notify_all();
+
+    std::lock_guard<std::mutex> lock(m_doneLock);
+    m_nFilesLeft--;
+    m_done.notify_all();
+}
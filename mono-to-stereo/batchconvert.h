@@ -0,0 +1,165 @@
+// batchconvert.h
+
+// ConvertFile for a whole archive of captures at once: every file is cut
+// into chunks of whole output frames, and the chunks of all of them are
+// shared out between worker threads
+//
+// each worker keeps its own queue of chunks. one that runs out takes the
+// oldest chunk from another's queue, and only when there's nothing left
+// to take anywhere does it start on the next file: it works out the
+// file's phase and format (PlanConversion), writes the header and queues
+// the chunks, so only as many files are in flight as there are workers.
+// a chunk is a window of the input mapped by itself, and nothing of it
+// is kept once it's written, so memory stays at a chunk per worker
+//
+// no chunk waits for another. the samples carried into a chunk are the
+// last ones of the chunk before it, which are still there in the input,
+// so every output frame after the first is the input as it is, only a
+// sample or so further on (repack.h). those go from one file to the other
+// inside the kernel where it can (OutputFile::CopyRange), or are written
+// straight out of the mapped input where it can't
+//
+// no Windows dependencies
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fileconvert.h"
+
+// how much output each chunk writes, unless told otherwise
+#define BATCH_DEFAULT_CHUNK_MB 32
+
+// the most threads a batch asks for
+#define BATCH_MAX_THREADS 256
+
+struct BatchOptions {
+    ConvertOptions convert;           // how to convert; the paths in it aren't used
+    std::vector<std::string> inputs;  // the files to convert
+    std::string outputDir;            // each is written here under its own name
+    uint32_t nThreads;                // 0 for one per core
+    uint32_t nChunkMB;
+
+    BatchOptions()
+        : nThreads(0)
+        , nChunkMB(BATCH_DEFAULT_CHUNK_MB)
+    {}
+};
+
+struct BatchFileResult {
+    std::string inputPath;
+    std::string outputPath;
+    bool bOk;
+    std::string error;    // if not
+    ConvertResult result; // if it was
+};
+
+struct BatchProgress {
+    uint32_t nFiles;
+    uint32_t nFilesDone;     // failed ones included
+    uint32_t nFilesFailed;
+    uint64_t nInputBytes;    // of every file, as they were when the batch started
+    uint64_t nInputBytesDone;
+    uint64_t nOutputBytes;
+    uint64_t nCopiedBytes;   // of the output, copied in the kernel rather than by us
+    uint32_t nThreads;
+    uint64_t nStolenChunks;  // taken from another worker's queue
+};
+
+// the files to convert from a path: everything in it if it's a directory,
+// otherwise a list of them, one path per line (blank lines and lines
+// starting with '#' skipped). appends to inputs
+bool ListBatchInputs(const std::string &path, std::vector<std::string> &inputs, std::string &error);
+
+class BatchConverter {
+public:
+    BatchConverter();
+    ~BatchConverter();
+
+    // checks every file has an output of its own, not itself, then starts
+    // the workers; a file that can't be converted only fails that file
+    bool Start(const BatchOptions &options, std::string &error);
+
+    // true once every file is done, false if nTimeoutMs went by first
+    bool Wait(uint32_t nTimeoutMs);
+
+    // stops as soon as the chunks being written are; the files left
+    // unfinished fail
+    void Stop();
+
+    BatchProgress Progress() const;
+
+    // one per input, in the same order; complete once Wait returns true
+    const std::vector<BatchFileResult> &Results() const { return m_results; }
+
+private:
+    BatchConverter(const BatchConverter &) = delete;
+    BatchConverter &operator=(const BatchConverter &) = delete;
+
+    struct Task {
+        uint32_t nFile;
+        uint32_t nChunk;
+    };
+
+    struct Worker {
+        std::mutex lock;
+        std::deque<Task> tasks; // its own from the back, stolen from the front
+        std::thread thread;
+    };
+
+    struct File {
+        ConvertPlan plan;
+        uint64_t nInputBytes;
+        uint64_t nHeaderBytes;
+        uint64_t nDataBytes;      // of output
+        uint32_t nChunks;
+        std::atomic<uint32_t> nChunksLeft;
+        std::atomic<uint64_t> nInputBytesDone; // counted for progress so far
+        std::atomic<bool> bFailed;
+        std::mutex errorLock;
+        std::string error;        // the first thing that went wrong
+
+        File() : nInputBytes(0), nHeaderBytes(0), nDataBytes(0), nChunks(0), nChunksLeft(0), nInputBytesDone(0), bFailed(false) {}
+    };
+
+    void WorkerThread(uint32_t nWorker);
+    bool TakeTask(uint32_t nWorker, Task &task);
+    void StartFile(uint32_t nWorker, uint32_t nFile);
+    void RunChunk(const Task &task);
+    void Fail(uint32_t nFile, const std::string &error);
+    void FinishChunk(uint32_t nFile);
+    void FinishFile(uint32_t nFile);
+    void Join();
+
+    BatchOptions m_options;
+    uint64_t m_nChunkBytes;
+    std::vector<std::unique_ptr<File>> m_files;
+    std::vector<BatchFileResult> m_results;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+
+    std::atomic<uint32_t> m_nNextFile;   // the next one nobody has started
+    std::atomic<uint32_t> m_nFilesLeft;
+    std::atomic<uint32_t> m_nFilesFailed;
+    std::atomic<bool> m_bStopping;
+    uint64_t m_nInputBytes;
+    std::atomic<uint64_t> m_nInputBytesDone;
+    std::atomic<uint64_t> m_nOutputBytes;
+    std::atomic<uint64_t> m_nCopiedBytes;
+    std::atomic<uint64_t> m_nStolenChunks;
+
+    // idle workers wait here for chunks to be queued or files to finish
+    std::mutex m_idleLock;
+    std::condition_variable m_idle;
+    uint64_t m_nIdleGeneration;
+
+    std::mutex m_doneLock;
+    std::condition_variable m_done;
+};
@@ -0,0 +1,264 @@
+// buffertune.cpp
+
+#include "buffertune.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "simdevice.h"
+
+bool BufferTuner::Init(uint32_t nRate, uint32_t nBaseFrames, uint32_t nMaxFrames) {
+    if (nRate == 0 || nBaseFrames == 0 || nMaxFrames == 0) {
+        return false;
+    }
+
+    m_nRate = nRate;
+    m_nMaxFrames = nMaxFrames;
+    m_fGuardFrames = BUFFERTUNE_GUARD_MS * nRate / 1000.0;
+    m_fHysteresisFrames = BUFFERTUNE_HYSTERESIS_MS * nRate / 1000.0;
+    m_nFloorFrames = (std::min)(nBaseFrames + static_cast<uint32_t>(std::ceil(m_fGuardFrames)), nMaxFrames);
+    Reset((std::min)(nBaseFrames * BUFFERTUNE_START_MULTIPLE, nMaxFrames));
+    return true;
+}
+
+void BufferTuner::Reset(uint32_t nLevel) {
+    m_hnsQuiet = static_cast<int64_t>(BUFFERTUNE_QUIET_MS) * 10000;
+    m_hnsStretchStart = -1;
+    m_hnsLastWake = 0;
+    m_fStretchSlack = HUGE_VAL;
+
+    m_nLevel.store(nLevel, std::memory_order_relaxed);
+    m_nMinLevel.store(nLevel, std::memory_order_relaxed);
+    m_nMaxLevel.store(nLevel, std::memory_order_relaxed);
+    m_nGrows.store(0, std::memory_order_relaxed);
+    m_nShrinks.store(0, std::memory_order_relaxed);
+    m_nCloseCalls.store(0, std::memory_order_relaxed);
+    m_nEmptyWakeups.store(0, std::memory_order_relaxed);
+}
+
+void BufferTuner::SetLevel(uint32_t nLevel) {
+    m_nLevel.store(nLevel, std::memory_order_relaxed);
+    if (nLevel < m_nMinLevel.load(std::memory_order_relaxed)) {
+        m_nMinLevel.store(nLevel, std::memory_order_relaxed);
+    }
+    if (nLevel > m_nMaxLevel.load(std::memory_order_relaxed)) {
+        m_nMaxLevel.store(nLevel, std::memory_order_relaxed);
+    }
+}
+
+int BufferTuner::Update(double fSlackFrames, int64_t hnsNow) {
+    if (m_hnsStretchStart < 0) {
+        m_hnsStretchStart = hnsNow;
+        m_hnsLastWake = hnsNow;
+    }
+
+    uint32_t nLevel = m_nLevel.load(std::memory_order_relaxed);
+
+    // running dry only says it was short, not by how much; the time since
+    // the last wakeup, which topped it up to the level, does
+    if (fSlackFrames <= 0) {
+        double fPlayed = static_cast<double>(hnsNow - m_hnsLastWake) * m_nRate / 10000000.0;
+        fSlackFrames = (std::min)(fSlackFrames, nLevel - fPlayed);
+    }
+    m_hnsLastWake = hnsNow;
+
+    // too close: grow now, and want a longer quiet stretch before shrinking
+    if (fSlackFrames < m_fGuardFrames) {
+        m_nCloseCalls.fetch_add(1, std::memory_order_relaxed);
+        if (fSlackFrames <= 0) {
+            m_nEmptyWakeups.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        m_hnsQuiet = (std::min)(m_hnsQuiet * 2, static_cast<int64_t>(BUFFERTUNE_MAX_QUIET_MS) * 10000);
+        m_hnsStretchStart = hnsNow;
+        m_fStretchSlack = HUGE_VAL;
+
+        double fGrown = std::ceil(nLevel + (m_fGuardFrames - fSlackFrames) + m_fHysteresisFrames);
+        uint32_t nGrown = static_cast<uint32_t>((std::min)(fGrown, static_cast<double>(m_nMaxFrames)));
+        if (nGrown <= nLevel) {
+            return 0;
+        }
+        SetLevel(nGrown);
+        m_nGrows.fetch_add(1, std::memory_order_relaxed);
+        return 1;
+    }
+
+    m_fStretchSlack = (std::min)(m_fStretchSlack, fSlackFrames);
+    if (hnsNow - m_hnsStretchStart < m_hnsQuiet) {
+        return 0;
+    }
+
+    // a whole stretch without a close call; give back half of what it
+    // never touched
+    double fSpare = m_fStretchSlack - m_fGuardFrames;
+    m_hnsStretchStart = hnsNow;
+    m_fStretchSlack = HUGE_VAL;
+    if (fSpare < m_fHysteresisFrames) {
+        return 0;
+    }
+
+    uint32_t nGiveBack = static_cast<uint32_t>(fSpare / 2);
+    uint32_t nShrunk = nLevel > m_nFloorFrames + nGiveBack ? nLevel - nGiveBack : m_nFloorFrames;
+    if (nShrunk >= nLevel) {
+        return 0;
+    }
+    SetLevel(nShrunk);
+    m_nShrinks.fetch_add(1, std::memory_order_relaxed);
+    return -1;
+}
+
+BufferTuneStats BufferTuner::Stats() const {
+    BufferTuneStats stats = {};
+    if (m_nRate == 0) {
+        return stats;
+    }
+
+    double fMsPerFrame = 1000.0 / m_nRate;
+    stats.fLevelMs = m_nLevel.load(std::memory_order_relaxed) * fMsPerFrame;
+    stats.fMinLevelMs = m_nMinLevel.load(std::memory_order_relaxed) * fMsPerFrame;
+    stats.fMaxLevelMs = m_nMaxLevel.load(std::memory_order_relaxed) * fMsPerFrame;
+    stats.nGrows = m_nGrows.load(std::memory_order_relaxed);
+    stats.nShrinks = m_nShrinks.load(std::memory_order_relaxed);
+    stats.nCloseCalls = m_nCloseCalls.load(std::memory_order_relaxed);
+    stats.nEmptyWakeups = m_nEmptyWakeups.load(std::memory_order_relaxed);
+    return stats;
+}
+
+// ---- offline check ----
+
+BufferTuneSimulationResult SimulateBufferTuning(const std::vector<float> &profileMs, double fSeconds) {
+    const uint32_t nRate = 48000;
+    const int64_t hnsPeriod = HNS_PER_SECOND / 100;
+
+    BufferTuneSimulationResult result = {};
+    result.fSeconds = fSeconds;
+
+    // the device runs off the simulated clock, which only moves when it's
+    // set to the next wakeup, so no time passes while the tuner works
+    SimulatedClock clock;
+    SimulatedDeviceOptions options;
+    options.format = MakeAudioFormat(AUDIOFORMAT_TAG_PCM, 2, nRate, 16);
+    options.hnsPeriod = hnsPeriod;
+    options.jitterProfileMs = profileMs;
+
+    SimulatedRenderSink sink(clock, options);
+    BufferTuner tuner;
+    if (DEVICE_OK != sink.Open(options.format, BUFFERTUNE_MAX_MS) ||
+        !tuner.Init(nRate, static_cast<uint32_t>(nRate * hnsPeriod / HNS_PER_SECOND), sink.BufferFrames())) {
+        return result;
+    }
+
+    // the pipeline starts with the first level of silence too
+    uint8_t *pData;
+    if (DEVICE_OK != sink.GetBuffer(tuner.LevelFrames(), &pData) || DEVICE_OK != sink.ReleaseBuffer(tuner.LevelFrames(), true)) {
+        return result;
+    }
+    sink.Start();
+
+    const int64_t hnsEnd = static_cast<int64_t>(fSeconds * HNS_PER_SECOND);
+    const int64_t hnsTail = hnsEnd - static_cast<int64_t>(BUFFERTUNE_SIMULATION_TAIL_SEC) * HNS_PER_SECOND;
+    int64_t hnsLastWake = 0;
+    int64_t hnsTailGap = 0;
+    uint64_t nUnderrunsBeforeTail = UINT64_MAX;
+    double fLevelSum = 0;
+    uint64_t nWakes = 0;
+
+    for (;;) {
+        int64_t hnsWake = sink.NextEventHns();
+        if (hnsWake >= hnsEnd) {
+            break;
+        }
+        clock.Set(hnsWake);
+        if (DEVICE_OK != sink.Wait(0)) {
+            break;
+        }
+
+        uint32_t nPadding;
+        sink.GetPadding(nPadding);
+
+        if (hnsWake >= hnsTail) {
+            if (nUnderrunsBeforeTail == UINT64_MAX) {
+                nUnderrunsBeforeTail = sink.Stats().nUnderruns;
+            }
+            hnsTailGap = (std::max)(hnsTailGap, hnsWake - hnsLastWake);
+        }
+        hnsLastWake = hnsWake;
+
+        tuner.Update(nPadding, hnsWake);
+        uint32_t nLevel = tuner.LevelFrames();
+        if (nLevel > nPadding) {
+            if (DEVICE_OK != sink.GetBuffer(nLevel - nPadding, &pData) || DEVICE_OK != sink.ReleaseBuffer(nLevel - nPadding, true)) {
+                break;
+            }
+        }
+
+        fLevelSum += nLevel;
+        nWakes++;
+    }
+
+    const SimulatedDeviceStats &device = sink.Stats();
+    result.stats = tuner.Stats();
+    result.fMeanLevelMs = nWakes > 0 ? fLevelSum / nWakes * 1000.0 / nRate : 0;
+    result.fFinalLevelMs = result.stats.fLevelMs;
+    result.fFinalNeedMs = static_cast<double>(hnsTailGap) / 10000.0 + BUFFERTUNE_GUARD_MS;
+    result.nUnderruns = device.nUnderruns;
+    result.nUnderrunFrames = device.nUnderrunFrames;
+    result.nTailUnderruns = nUnderrunsBeforeTail == UINT64_MAX ? 0 : device.nUnderruns - nUnderrunsBeforeTail;
+    return result;
+}
+
+// a uniform value in [0, 1) from the seed and n
+static double ProfileRandom(uint32_t nSeed, uint64_t n) {
+    uint64_t x = static_cast<uint64_t>(nSeed) * 0x9E3779B97F4A7C15ull + n;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    return static_cast<double>(x >> 11) / 9007199254740992.0;
+}
+
+bool MakeJitterProfile(const char *szName, double fSeconds, uint32_t nSeed, std::vector<float> &profileMs) {
+    enum { QUIET, BUSY, STALLS, STEP } kind;
+    if (0 == strcmp(szName, "quiet")) {
+        kind = QUIET;
+    }
+    else if (0 == strcmp(szName, "busy")) {
+        kind = BUSY;
+    }
+    else if (0 == strcmp(szName, "stalls")) {
+        kind = STALLS;
+    }
+    else if (0 == strcmp(szName, "step")) {
+        kind = STEP;
+    }
+    else {
+        return false;
+    }
+
+    // a wakeup every 10 ms
+    uint64_t nWakes = static_cast<uint64_t>(fSeconds * 100) + 1;
+    profileMs.resize(static_cast<size_t>(nWakes));
+    for (uint64_t n = 0; n < nWakes; n++) {
+        double r = ProfileRandom(nSeed, n);
+        double fMs = 0.3 * r;
+        switch (kind) {
+        case QUIET:
+            break;
+        case BUSY:
+            fMs = 4.0 * r;
+            break;
+        case STALLS:
+            if (n % 2000 == 1000) {
+                fMs = 25.0;
+            }
+            break;
+        case STEP:
+            if (n >= 6000 && n < 12000) {
+                fMs = 4.0 * r;
+            }
+            break;
+        }
+        profileMs[static_cast<size_t>(n)] = static_cast<float>(fMs);
+    }
+    return true;
+}
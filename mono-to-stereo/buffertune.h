@@ -0,0 +1,127 @@
+// buffertune.h
+
+// sizes an output's buffering to the machine it runs on, for --buffer-size
+// auto: the device is opened with a large buffer, and the level the tuner
+// picks is the latency from capture to playback, which the pipeline
+// splits between the ring and the device
+//
+// every render wakeup tells the tuner how much was still buffered when it
+// woke: the device's padding, and what the ring holds beyond what's about
+// to be taken from it. a wakeup that finds less than a guard left grows
+// the level straight away, by the shortfall and the hysteresis. it only
+// shrinks after a quiet stretch, by half of what the stretch never needed,
+// and only if that is more than the hysteresis; each grow doubles how long
+// the stretches have to be from then on, so a machine that stalls now and
+// then soon settles on covering the stalls instead of running into them
+// over and over
+//
+// times are in 100 ns units on whatever clock the caller uses. Update is
+// only called from the render thread; Stats may be read from any thread
+//
+// no Windows dependencies
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// every wakeup should find at least this much still buffered
+#define BUFFERTUNE_GUARD_MS 2.0
+
+// spare buffering below this isn't worth shrinking for
+#define BUFFERTUNE_HYSTERESIS_MS 2.0
+
+// how long the first stretch without a close call has to be before
+// shrinking, and the longest any has to be
+#define BUFFERTUNE_QUIET_MS 4000
+#define BUFFERTUNE_MAX_QUIET_MS 256000
+
+// the level starts at this multiple of the latency it can't go below
+#define BUFFERTUNE_START_MULTIPLE 2
+
+// how big a buffer the device is opened with; the level never goes above it
+#define BUFFERTUNE_MAX_MS 250
+
+struct BufferTuneStats {
+    double fLevelMs;          // the latency the output keeps now; 0 if it isn't tuned
+    double fMinLevelMs;       // the lowest and highest it has been
+    double fMaxLevelMs;
+    uint32_t nGrows;
+    uint32_t nShrinks;
+    uint64_t nCloseCalls;     // wakeups that found less than the guard left
+    uint64_t nEmptyWakeups;   // of those, ones that found nothing at all
+};
+
+class BufferTuner {
+public:
+    BufferTuner() : m_nRate(0), m_nFloorFrames(0), m_nMaxFrames(0), m_fGuardFrames(0), m_fHysteresisFrames(0) {
+        Reset(0);
+    }
+
+    // nBaseFrames is the latency no buffering takes out: how much the
+    // device plays between wakeups, and in the pipeline a capture packet
+    // as well. the level starts at twice that and stays between it plus
+    // the guard and nMaxFrames, the size of the device buffer
+    bool Init(uint32_t nRate, uint32_t nBaseFrames, uint32_t nMaxFrames);
+
+    // the level to start with, before the first wakeup
+    uint32_t LevelFrames() const { return m_nLevel.load(std::memory_order_relaxed); }
+
+    // render thread, once a wakeup: fSlackFrames is the least that was
+    // still buffered; returns 1 if the level grew, -1 if it shrank, else 0
+    int Update(double fSlackFrames, int64_t hnsNow);
+
+    BufferTuneStats Stats() const;
+
+private:
+    void Reset(uint32_t nLevel);
+    void SetLevel(uint32_t nLevel);
+
+    uint32_t m_nRate;
+    uint32_t m_nFloorFrames;
+    uint32_t m_nMaxFrames;
+    double m_fGuardFrames;
+    double m_fHysteresisFrames;
+
+    int64_t m_hnsQuiet;         // how long this stretch has to be
+    int64_t m_hnsStretchStart;  // -1 before the first wakeup
+    int64_t m_hnsLastWake;
+    double m_fStretchSlack;     // the least any wakeup in it found
+
+    std::atomic<uint32_t> m_nLevel;
+    std::atomic<uint32_t> m_nMinLevel;
+    std::atomic<uint32_t> m_nMaxLevel;
+    std::atomic<uint32_t> m_nGrows;
+    std::atomic<uint32_t> m_nShrinks;
+    std::atomic<uint64_t> m_nCloseCalls;
+    std::atomic<uint64_t> m_nEmptyWakeups;
+};
+
+// ---- offline check ----
+
+struct BufferTuneSimulationResult {
+    double fSeconds;
+    BufferTuneStats stats;
+    double fMeanLevelMs;      // over the whole run
+    double fFinalLevelMs;
+    double fFinalNeedMs;      // the worst gap between wakeups over the last
+                              // BUFFERTUNE_SIMULATION_TAIL_SEC, plus the guard:
+                              // the least level that would have covered them
+    uint64_t nUnderruns;      // times the simulated device ran dry
+    uint64_t nUnderrunFrames;
+    uint64_t nTailUnderruns;  // of those, over the last BUFFERTUNE_SIMULATION_TAIL_SEC
+};
+
+#define BUFFERTUNE_SIMULATION_TAIL_SEC 60
+
+// a tuner driving a simulated 48 kHz stereo render device on a simulated
+// clock, woken every 10 ms and each time as late as the next entry of
+// profileMs says, over and over
+BufferTuneSimulationResult SimulateBufferTuning(const std::vector<float> &profileMs, double fSeconds);
+
+// made up lateness profiles for the check, a wakeup each: "quiet" is up to
+// a few tenths of a ms late, "busy" up to 4 ms, "stalls" quiet with a 25 ms
+// stall every 20 s, "step" quiet then busy for a minute each and quiet
+// again for the rest. false for any other name
+bool MakeJitterProfile(const char *szName, double fSeconds, uint32_t nSeed, std::vector<float> &profileMs);
@@ -7,8 +7,38 @@
 #include <audioclient.h>
 #include <avrt.h>
 #include <functiondiscoverykeys_devpkey.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "repack.h"
+#include "ring.h"
+#include "fanout.h"
+#include "audioformat.h"
+#include "sampleconvert.h"
+#include "phasedetect.h"
+#include "conceal.h"
+#include "fileconvert.h"
+#include "batchconvert.h"
+#include "fileio.h"
+#include "resampler.h"
+#include "drift.h"
+#include "buffertune.h"
+#include "latency.h"
+#include "device.h"
+#include "messages.h"
+#include "dsp.h"
+#include "recorder.h"
+#include "udpsocket.h"
+#include "rtp.h"
+#include "pipeline.h"
+#include "sharedstats.h"
+#include "supervisor.h"
+#include "configfile.h"
 
 #include "log.h"
 #include "cleanup.h"
+#include "wasapi.h"
+#include "deviceregistry.h"
 #include "prefs.h"
 #include "mono-to-stereo.h"
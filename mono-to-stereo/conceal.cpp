@@ -0,0 +1,397 @@
+// conceal.cpp
+
+#include "conceal.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "device.h"
+#include "phasedetect.h"
+
+GlitchConcealer::GlitchConcealer()
+    : m_nChannels(0)
+    , m_nFrameBytes(0)
+    , m_nFadeFrames(0)
+    , m_bStarted(false)
+    , m_bSilent(false)
+    , m_nNextPosition(UINT64_MAX)
+    , m_nFadeDone(0)
+    , m_stats()
+{
+    memset(m_fadeFrom, 0, sizeof(m_fadeFrom));
+    memset(m_last, 0, sizeof(m_last));
+}
+
+bool GlitchConcealer::Init(const AudioFormat &format, uint32_t nFadeFrames) {
+    SampleType type = SampleTypeOf(format);
+    if (format.nChannels == 0 || format.nChannels > AUDIOFORMAT_MAX_CHANNELS || !m_converter.Init(type, type, false)) {
+        return false;
+    }
+
+    m_nChannels = format.nChannels;
+    m_nFrameBytes = SampleTypeBytes(type) * m_nChannels;
+    m_nFadeFrames = (std::max)(nFadeFrames, 1u);
+    m_bStarted = false;
+    m_bSilent = false;
+    m_nNextPosition = UINT64_MAX;
+    m_nFadeDone = m_nFadeFrames;
+    memset(m_fadeFrom, 0, sizeof(m_fadeFrom));
+    memset(m_last, 0, sizeof(m_last));
+    m_stats = GlitchStats();
+    return true;
+}
+
+void GlitchConcealer::StartFade() {
+    memcpy(m_fadeFrom, m_last, sizeof(m_fadeFrom));
+    m_nFadeDone = 0;
+}
+
+uint32_t GlitchConcealer::NotePacket(uint32_t nFlags, uint64_t nDevicePosition, const uint8_t *pData, uint32_t nFrames, RepackState &repack) {
+    uint32_t nGlitches = 0;
+
+    const uint32_t nKnown = DEVICE_FLAG_DISCONTINUITY | DEVICE_FLAG_SILENT | DEVICE_FLAG_TIMESTAMP_ERROR;
+    if (0 != (nFlags & ~nKnown)) {
+        nGlitches |= GLITCH_UNKNOWN_FLAGS;
+        m_stats.nUnknownFlagPackets++;
+    }
+
+    // fade out into a run of silent packets and back in after it
+    bool bSilent = 0 != (nFlags & DEVICE_FLAG_SILENT);
+    bool bResumed = m_bSilent && !bSilent;
+    if (bSilent) {
+        nGlitches |= GLITCH_SILENT;
+        m_stats.nSilentPackets++;
+    }
+    if (bSilent != m_bSilent) {
+        StartFade();
+    }
+    m_bSilent = bSilent;
+
+    // most devices flag their very first packet; nothing was lost there
+    bool bDiscontinuity = m_bStarted && 0 != (nFlags & DEVICE_FLAG_DISCONTINUITY);
+    if (bDiscontinuity) {
+        nGlitches |= GLITCH_DISCONTINUITY;
+        m_stats.nDiscontinuities++;
+        StartFade();
+
+        // a gap that isn't whole output frames moves every later sample to
+        // another channel
+        if (UINT64_MAX != nDevicePosition && UINT64_MAX != m_nNextPosition && nDevicePosition > m_nNextPosition &&
+            RepackSkip(repack, nDevicePosition - m_nNextPosition, NULL)) {
+            nGlitches |= GLITCH_REALIGNED;
+            m_stats.nRealignments++;
+        }
+    }
+
+    // the carried samples belong to audio that isn't there any more; the
+    // fade covers the first frame, so repeating the new first sample is enough
+    if ((bDiscontinuity || bResumed) && nFrames > 0) {
+        RepackSkip(repack, 0, pData);
+    }
+
+    m_nNextPosition = UINT64_MAX != nDevicePosition ? nDevicePosition + nFrames : UINT64_MAX;
+    m_bStarted = true;
+    return nGlitches;
+}
+
+void GlitchConcealer::Fade(uint8_t *pFrames, uint32_t nFrames) {
+    const float fSteps = static_cast<float>(m_nFadeFrames + 1);
+
+    for (uint32_t nDone = 0; nDone < nFrames; ) {
+        uint32_t n = (std::min)(static_cast<uint32_t>(CONCEAL_BLOCK_FRAMES), nFrames - nDone);
+        uint8_t *p = pFrames + nDone * m_nFrameBytes;
+
+        if (m_bSilent) {
+            memset(m_block, 0, sizeof(float) * m_nChannels * n);
+        }
+        else {
+            m_converter.ToFloat(p, m_block, static_cast<size_t>(n) * m_nChannels);
+        }
+
+        for (uint32_t i = 0; i < n; i++) {
+            float w = static_cast<float>(m_nFadeDone + i + 1) / fSteps;
+            float *pFrame = m_block + static_cast<size_t>(i) * m_nChannels;
+            for (uint32_t c = 0; c < m_nChannels; c++) {
+                pFrame[c] = m_fadeFrom[c] + (pFrame[c] - m_fadeFrom[c]) * w;
+            }
+        }
+
+        m_converter.FromFloat(m_block, p, static_cast<size_t>(n) * m_nChannels);
+        m_nFadeDone += n;
+        nDone += n;
+    }
+}
+
+void GlitchConcealer::Process(uint8_t *pFrames, uint32_t nFrames) {
+    if (nFrames == 0) {
+        return;
+    }
+
+    uint32_t nFade = (std::min)(nFrames, m_nFadeFrames - m_nFadeDone);
+    if (nFade > 0) {
+        Fade(pFrames, nFade);
+    }
+
+    // silence is all zero bits in every format we handle
+    if (m_bSilent && nFade < nFrames) {
+        memset(pFrames + nFade * m_nFrameBytes, 0, (nFrames - nFade) * m_nFrameBytes);
+    }
+
+    m_stats.nConcealedFrames += m_bSilent ? nFrames : nFade;
+
+    // where the next fade starts from
+    m_converter.ToFloat(pFrames + (nFrames - 1) * m_nFrameBytes, m_last, m_nChannels);
+}
+
+// ---- offline check ----
+
+// random streams
+#define GLITCH_STREAM_SIZE 0
+#define GLITCH_STREAM_FAULT 1
+#define GLITCH_STREAM_KIND 2
+#define GLITCH_STREAM_GAP 3
+#define GLITCH_STREAM_NOISE 4
+
+// a flag no device sets
+#define GLITCH_FLAG_UNKNOWN 0x100
+
+#define GLITCH_TONE_HZ 997
+
+struct GlitchPacket {
+    uint64_t nPosition;  // of its first sample in the real stream
+    uint32_t nFrames;
+    uint32_t nFlags;
+};
+
+struct GlitchVariantResult {
+    GlitchStats stats;
+    uint64_t nOutputFrames;
+    double fWorstStep;
+    uint64_t nSwappedFrames;
+    uint64_t nLoudSilentFrames;
+};
+
+// uniform in [0, 1) from the seed, a stream and n; the same mix as the
+// simulated device uses
+static double GlitchRandom(uint32_t nSeed, uint32_t nStream, uint64_t n) {
+    uint64_t x = (static_cast<uint64_t>(nSeed) << 32 | nStream) * 0x9E3779B97F4A7C15ull + n;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    return static_cast<double>(x >> 11) / 9007199254740992.0;
+}
+
+// sample n of the real stream, which is missing its first left sample
+static float GlitchSample(uint64_t nSample, uint32_t nStereoRate) {
+    const double fTwoPi = 6.283185307179586;
+    uint64_t nReal = nSample + 1;
+    double fPhase = fTwoPi * GLITCH_TONE_HZ * static_cast<double>(nReal / 2) / nStereoRate;
+    return static_cast<float>(nReal & 1 ? 0.4 * std::sin(fPhase - 0.3) : 0.5 * std::sin(fPhase));
+}
+
+static GlitchVariantResult RunGlitchVariant(const AudioFormat &format, const std::vector<GlitchPacket> &packets, bool bConceal, uint32_t nSeed) {
+    GlitchVariantResult result = {};
+
+    const SampleType type = SampleTypeOf(format);
+    const uint32_t nStereoRate = format.nSamplesPerSec / 2;
+    const uint32_t nFadeFrames = nStereoRate * CONCEAL_FADE_MS / 1000;
+
+    SampleConverter toFormat;
+    SampleConverter toFloat;
+    toFormat.Init(SAMPLE_FLOAT32, type, false);
+    toFloat.Init(type, SAMPLE_FLOAT32, false);
+
+    RepackState repack;
+    RepackInit(repack, format.nBlockAlign, 2, 1);
+
+    PhaseDetector phase;
+    phase.Init(format);
+
+    GlitchConcealer concealer;
+    concealer.Init(MakeAudioFormat(format.wFormatTag, 2, nStereoRate, format.wBitsPerSample), nFadeFrames);
+
+    std::vector<float> signal;
+    std::vector<uint8_t> packet;
+    std::vector<uint8_t> stereo;
+    std::vector<float> output;
+    float last[2] = { 0, 0 };
+    bool bHaveLast = false;
+    uint32_t nSinceGlitch = UINT32_MAX;
+
+    for (size_t p = 0; p < packets.size(); p++) {
+        const GlitchPacket &g = packets[p];
+        bool bSilent = 0 != (g.nFlags & DEVICE_FLAG_SILENT);
+
+        // a silent packet's buffer can hold anything
+        signal.resize(g.nFrames);
+        for (uint32_t i = 0; i < g.nFrames; i++) {
+            signal[i] = bSilent
+                ? static_cast<float>(1.8 * GlitchRandom(nSeed, GLITCH_STREAM_NOISE, g.nPosition + i) - 0.9)
+                : GlitchSample(g.nPosition + i, nStereoRate);
+        }
+        packet.resize(static_cast<size_t>(g.nFrames) * format.nBlockAlign);
+        toFormat.FromFloat(signal.data(), packet.data(), g.nFrames);
+
+        // the same steps as the capture loop
+        uint32_t nGlitches = 0;
+        if (bConceal) {
+            nGlitches = concealer.NotePacket(g.nFlags, g.nPosition, packet.data(), g.nFrames, repack);
+            if (nGlitches & GLITCH_REALIGNED) {
+                phase.Flip();
+            }
+        }
+        else if (p > 0 && (g.nFlags & DEVICE_FLAG_DISCONTINUITY)) {
+            nGlitches = GLITCH_DISCONTINUITY;
+        }
+        if (nGlitches & GLITCH_DISCONTINUITY) {
+            phase.Reset();
+        }
+
+        if (!(bConceal && bSilent)) {
+            ChannelPhase detected = phase.Analyze(packet.data(), g.nFrames);
+            if (PHASE_UNKNOWN != detected) {
+                repack.nOffset = PHASE_SKIP_FIRST == detected ? 1 : 0;
+            }
+        }
+
+        uint32_t nOut = RepackOutputFrames(repack, g.nFrames);
+        stereo.resize(static_cast<size_t>(nOut) * 2 * format.nBlockAlign);
+        RepackFrames(repack, packet.data(), g.nFrames, stereo.data());
+        if (bConceal) {
+            concealer.Process(stereo.data(), nOut);
+        }
+
+        output.resize(static_cast<size_t>(nOut) * 2);
+        toFloat.Convert(stereo.data(), reinterpret_cast<uint8_t *>(output.data()), output.size());
+        result.nOutputFrames += nOut;
+
+        // clicks show up as steps the tone can't make on its own
+        for (uint32_t i = 0; i < nOut; i++) {
+            for (int c = 0; c < 2; c++) {
+                if (bHaveLast) {
+                    result.fWorstStep = (std::max)(result.fWorstStep, static_cast<double>(std::fabs(output[2 * i + c] - last[c])));
+                }
+                last[c] = output[2 * i + c];
+            }
+            bHaveLast = true;
+        }
+
+        if (bSilent) {
+            for (uint32_t i = 0; i < nOut; i++) {
+                if (bConceal ? (i >= nFadeFrames && (output[2 * i] != 0 || output[2 * i + 1] != 0)) : true) {
+                    result.nLoudSilentFrames++;
+                }
+            }
+            nSinceGlitch = 0;
+            continue;
+        }
+
+        // the left channel is the louder one; leave out the faded frames
+        if (0 != nGlitches) {
+            nSinceGlitch = 0;
+        }
+        uint32_t nSkip = nSinceGlitch < nFadeFrames ? nFadeFrames - nSinceGlitch : 0;
+        nSinceGlitch = nSinceGlitch == UINT32_MAX ? nSinceGlitch : nSinceGlitch + nOut;
+        if (nOut > nSkip + 64) {
+            double fLeft = 0, fRight = 0;
+            for (uint32_t i = nSkip; i < nOut; i++) {
+                fLeft += static_cast<double>(output[2 * i]) * output[2 * i];
+                fRight += static_cast<double>(output[2 * i + 1]) * output[2 * i + 1];
+            }
+            if (fLeft < fRight) {
+                result.nSwappedFrames += nOut;
+            }
+        }
+    }
+
+    result.stats = concealer.Stats();
+    return result;
+}
+
+GlitchSimulationResult SimulateGlitches(const AudioFormat &format, double fSeconds, uint32_t nSeed) {
+    GlitchSimulationResult result = {};
+
+    const uint32_t nStereoRate = format.nSamplesPerSec / 2;
+    const uint64_t nTotal = static_cast<uint64_t>(fSeconds * format.nSamplesPerSec);
+
+    // 5 to 15 ms packets of whole stereo frames, about one in twenty of
+    // them glitched
+    std::vector<GlitchPacket> packets;
+    uint64_t nPosition = 0;
+    uint32_t nSilentLeft = 0;
+    for (uint64_t n = 0; nPosition < nTotal; n++) {
+        GlitchPacket g;
+        g.nFrames = 2 * static_cast<uint32_t>(nStereoRate / 200 * (1.0 + 2.0 * GlitchRandom(nSeed, GLITCH_STREAM_SIZE, n)));
+        g.nFlags = n == 0 ? DEVICE_FLAG_DISCONTINUITY : 0;
+
+        if (nSilentLeft > 0) {
+            g.nFlags |= DEVICE_FLAG_SILENT;
+            result.nInjected[2]++;
+            nSilentLeft--;
+        }
+        else if (n > 0 && GlitchRandom(nSeed, GLITCH_STREAM_FAULT, n) < 0.05) {
+            double fGap = GlitchRandom(nSeed, GLITCH_STREAM_GAP, n);
+            switch (static_cast<int>(GlitchRandom(nSeed, GLITCH_STREAM_KIND, n) * 4)) {
+            case 0:
+            case 1: {
+                // up to 20 ms lost; half of the gaps odd
+                uint64_t nGap = 2 * static_cast<uint64_t>(fGap * nStereoRate / 50) + 2;
+                bool bOdd = GlitchRandom(nSeed, GLITCH_STREAM_KIND, n + nTotal) < 0.5;
+                nPosition += nGap + (bOdd ? 1 : 0);
+                g.nFlags |= DEVICE_FLAG_DISCONTINUITY;
+                result.nInjected[0]++;
+                result.nInjected[1] += bOdd ? 1 : 0;
+                break;
+            }
+            case 2:
+                g.nFlags |= DEVICE_FLAG_SILENT;
+                result.nInjected[2]++;
+                nSilentLeft = static_cast<uint32_t>(fGap * 3);
+                break;
+            default:
+                g.nFlags |= GLITCH_FLAG_UNKNOWN;
+                result.nInjected[3]++;
+                break;
+            }
+        }
+
+        g.nPosition = nPosition;
+        nPosition += g.nFrames;
+        packets.push_back(g);
+    }
+
+    // the tone's own worst step, at the quantization of the format
+    for (int c = 0; c < 2; c++) {
+        for (uint64_t i = 0; i < nStereoRate; i++) {
+            double fStep = std::fabs(GlitchSample(2 * (i + 1) + c, nStereoRate) - GlitchSample(2 * i + c, nStereoRate));
+            result.fCleanStep = (std::max)(result.fCleanStep, fStep);
+        }
+    }
+
+    GlitchVariantResult concealed = RunGlitchVariant(format, packets, true, nSeed);
+    GlitchVariantResult plain = RunGlitchVariant(format, packets, false, nSeed);
+
+    result.stats = concealed.stats;
+    result.nOutputFrames = concealed.nOutputFrames;
+    result.fWorstStep = concealed.fWorstStep;
+    result.fWorstStepPlain = plain.fWorstStep;
+    result.nSwappedFrames = concealed.nSwappedFrames;
+    result.nSwappedFramesPlain = plain.nSwappedFrames;
+    result.nLoudSilentFrames = concealed.nLoudSilentFrames;
+
+    // a fade can add at most a full scale swing spread over its length
+    const double fFadeFrames = nStereoRate * CONCEAL_FADE_MS / 1000.0;
+    const double fStepLimit = result.fCleanStep + 1.0 / fFadeFrames + 1e-3;
+
+    result.bPass =
+        result.stats.nDiscontinuities == result.nInjected[0] &&
+        result.stats.nRealignments == result.nInjected[1] &&
+        result.stats.nSilentPackets == result.nInjected[2] &&
+        result.stats.nUnknownFlagPackets == result.nInjected[3] &&
+        result.fWorstStep <= fStepLimit &&
+        result.nSwappedFrames == 0 &&
+        result.nLoudSilentFrames == 0;
+    return result;
+}
@@ -0,0 +1,110 @@
+// conceal.h
+
+// keeps the stream going across capture glitches instead of giving up
+//
+// a discontinuity means the device lost frames in front of the packet: the
+// output crossfades from the last frame it played into the new audio, and
+// if the device position says the gap wasn't a whole number of output
+// frames the grouping of input samples into output frames has moved, so
+// the repacker is moved with it straight away instead of waiting for the
+// phase detector to notice. a silent packet fades out to real silence whatever
+// the buffer holds, and the first packet after a run of them fades back in.
+// flags we don't know are counted and the audio played as it is
+//
+// the fades run on the repacked frames in the ring's sample format and
+// channel count, converted to float only while a fade is in progress
+//
+// no Windows dependencies
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "audioformat.h"
+#include "repack.h"
+#include "sampleconvert.h"
+
+// length of each crossfade
+#define CONCEAL_FADE_MS 5
+
+// output frames faded per block
+#define CONCEAL_BLOCK_FRAMES 256
+
+// what NotePacket found; any combination
+#define GLITCH_DISCONTINUITY 0x1   // frames were lost in front of the packet
+#define GLITCH_REALIGNED 0x2       // not whole output frames, so the grouping moved
+#define GLITCH_SILENT 0x4          // the packet is played as silence
+#define GLITCH_UNKNOWN_FLAGS 0x8   // the device set flags we don't know
+
+struct GlitchStats {
+    uint64_t nDiscontinuities;     // not counting the one most devices start with
+    uint64_t nRealignments;
+    uint64_t nSilentPackets;
+    uint64_t nUnknownFlagPackets;
+    uint64_t nConcealedFrames;     // output frames faded or silenced
+};
+
+class GlitchConcealer {
+public:
+    GlitchConcealer();
+
+    // format is the repacked format, of up to AUDIOFORMAT_MAX_CHANNELS
+    bool Init(const AudioFormat &format, uint32_t nFadeFrames);
+
+    // capture thread, before the packet is repacked. nFlags are its
+    // DEVICE_FLAG_* flags, nDevicePosition UINT64_MAX if it can't be
+    // trusted. on a discontinuity the carried samples are replaced with the
+    // packet's first one, and repack.nOffset moved by the part of the gap
+    // that isn't whole output frames
+    // returns GLITCH_* flags
+    uint32_t NotePacket(uint32_t nFlags, uint64_t nDevicePosition, const uint8_t *pData, uint32_t nFrames, RepackState &repack);
+
+    // capture thread: the packet's repacked frames, in order, in as many
+    // pieces as it takes; fixes them up in place
+    void Process(uint8_t *pFrames, uint32_t nFrames);
+
+    const GlitchStats &Stats() const { return m_stats; }
+
+private:
+    // fade from the last frame played to whatever comes next
+    void StartFade();
+    void Fade(uint8_t *pFrames, uint32_t nFrames);
+
+    SampleConverter m_converter;
+    uint32_t m_nChannels;
+    size_t m_nFrameBytes;
+    uint32_t m_nFadeFrames;
+
+    bool m_bStarted;
+    bool m_bSilent;           // the current packet plays as silence
+    uint64_t m_nNextPosition; // device position the next packet should start at
+    uint32_t m_nFadeDone;     // frames into the current fade, m_nFadeFrames if none
+    float m_fadeFrom[AUDIOFORMAT_MAX_CHANNELS];
+    float m_last[AUDIOFORMAT_MAX_CHANNELS]; // last frame played, as float
+
+    GlitchStats m_stats;
+    float m_block[CONCEAL_BLOCK_FRAMES * AUDIOFORMAT_MAX_CHANNELS];
+};
+
+// ---- offline check ----
+
+struct GlitchSimulationResult {
+    GlitchStats stats;
+    uint64_t nInjected[4];    // discontinuities, odd ones, silent packets, unknown flags
+    uint64_t nOutputFrames;
+    double fCleanStep;        // largest sample to sample step of the tone itself
+    double fWorstStep;        // largest one anywhere in the output
+    double fWorstStepPlain;   // the same without concealment
+    uint64_t nSwappedFrames;  // frames with the channels the wrong way round
+    uint64_t nSwappedFramesPlain;
+    uint64_t nLoudSilentFrames; // frames of silent packets that weren't silent
+    bool bPass;
+};
+
+// a synthetic stereo tone, interleaved into a mono stream in the given
+// format, in packets of varying even size; frames are dropped in front of
+// some packets (odd and even gaps), some are flagged silent and filled with
+// noise, some get flags nobody knows. runs the packets through repacking,
+// phase detection and concealment, and again without concealment
+GlitchSimulationResult SimulateGlitches(const AudioFormat &format, double fSeconds, uint32_t nSeed);
@@ -0,0 +1,98 @@
+// configfile.cpp
+
+#include "configfile.h"
+
+#include "fileio.h"
+
+// config files are small; anything this big is something else
+#define CONFIG_MAX_BYTES (1024 * 1024)
+
+static bool IsSpace(char c) {
+    return ' ' == c || '\t' == c || '\r' == c;
+}
+
+static std::string Trim(const std::string &s) {
+    size_t nBegin = 0;
+    size_t nEnd = s.size();
+    while (nBegin < nEnd && IsSpace(s[nBegin])) {
+        nBegin++;
+    }
+    while (nEnd > nBegin && IsSpace(s[nEnd - 1])) {
+        nEnd--;
+    }
+    return s.substr(nBegin, nEnd - nBegin);
+}
+
+bool ReadConfigFile(const std::string &path, std::vector<std::string> &args, std::string &error) {
+    MappedInputFile file;
+    if (!file.Open(path, error)) {
+        error = path + ": " + error;
+        return false;
+    }
+
+    if (file.Size() > CONFIG_MAX_BYTES) {
+        error = path + ": too big for a config file";
+        return false;
+    }
+
+    std::string text;
+    if (file.Size() > 0) {
+        const uint8_t *pData = file.Map(0, static_cast<size_t>(file.Size()), error);
+        if (NULL == pData) {
+            error = path + ": " + error;
+            return false;
+        }
+        text.assign(reinterpret_cast<const char *>(pData), static_cast<size_t>(file.Size()));
+    }
+
+    // Notepad likes to start UTF-8 files with a byte order mark
+    if (0 == text.compare(0, 3, "\xEF\xBB\xBF")) {
+        text.erase(0, 3);
+    }
+
+    size_t nLine = 0;
+    size_t nPos = 0;
+    while (nPos < text.size()) {
+        size_t nNewline = text.find('\n', nPos);
+        if (std::string::npos == nNewline) {
+            nNewline = text.size();
+        }
+        std::string line = Trim(text.substr(nPos, nNewline - nPos));
+        nPos = nNewline + 1;
+        nLine++;
+
+        if (line.empty() || '#' == line[0]) {
+            continue;
+        }
+
+        size_t nNameEnd = 0;
+        while (nNameEnd < line.size() && !IsSpace(line[nNameEnd]) && '=' != line[nNameEnd]) {
+            nNameEnd++;
+        }
+        std::string name = line.substr(0, nNameEnd);
+
+        size_t nValue = nNameEnd;
+        while (nValue < line.size() && IsSpace(line[nValue])) {
+            nValue++;
+        }
+        if (nValue < line.size() && '=' == line[nValue]) {
+            nValue++;
+        }
+        std::string value = Trim(line.substr(nValue));
+        if (value.size() >= 2 && '"' == value.front() && '"' == value.back()) {
+            value = value.substr(1, value.size() - 2);
+        }
+
+        if (name.empty() || '-' == name[0] || "config" == name) {
+            error = path + ":" + std::to_string(nLine) + ": expected a switch name without dashes, other than config";
+            return false;
+        }
+
+        args.push_back("--" + name);
+        if (!value.empty()) {
+            args.push_back(value);
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,28 @@
+// configfile.h
+
+// command line switches kept in a file, for running headless where
+// nobody types them
+//
+// one switch per line, without its dashes, and its value if it takes one:
+//
+//     # the interface on the desk
+//     in-device Digital Audio Interface (USB Digital Audio)
+//     buffer-size = 32
+//     daemon
+//
+// the value is everything after the name and the spaces or '=' following
+// it, so it can have spaces of its own; a value in double quotes loses
+// them. blank lines and lines starting with '#' are skipped
+//
+// the switches go where --config was on the command line, as if they had
+// been typed there
+//
+// paths are UTF-8; no Windows dependencies
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+// appends "--name" and its value, if it has one, for each line
+bool ReadConfigFile(const std::string &path, std::vector<std::string> &args, std::string &error);
@@ -0,0 +1,135 @@
+// device.h
+
+// the audio endpoints the pipeline talks to, independent of the audio API
+//
+// a capture source hands out packets of mono frames in the device's own
+// format; a render sink takes frames in whatever format it was opened with.
+// both work like an event-driven WASAPI stream: the thread that services
+// the endpoint blocks in Wait until the device wants attention, then
+// borrows the device's buffer directly
+//
+// WASAPI is one backend (wasapi.h), a simulated device another (simdevice.h)
+//
+// no Windows dependencies
+
+#pragma once
+
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "audioformat.h"
+
+// packet flags; the same values as the AUDCLNT_BUFFERFLAGS_* ones, so a
+// WASAPI packet's flags can be handed on unchanged
+#define DEVICE_FLAG_DISCONTINUITY 0x1
+#define DEVICE_FLAG_SILENT 0x2
+#define DEVICE_FLAG_TIMESTAMP_ERROR 0x4
+
+enum DeviceStatus {
+    DEVICE_OK,
+    DEVICE_TIMEOUT,  // Wait only: nothing happened in time
+    DEVICE_STOPPED,  // Wait only: Interrupt was called
+    DEVICE_LOST,     // unplugged, disabled or reconfigured; reopening may work
+    DEVICE_FAILED,   // anything else
+};
+
+static inline const char *DeviceStatusName(DeviceStatus status) {
+    switch (status) {
+    case DEVICE_OK: return "ok";
+    case DEVICE_TIMEOUT: return "timed out";
+    case DEVICE_STOPPED: return "stopped";
+    case DEVICE_LOST: return "device lost";
+    case DEVICE_FAILED: return "failed";
+    }
+    return "?";
+}
+
+struct CapturePacket {
+    const uint8_t *pData;
+    uint32_t nFrames;          // 0 if no packet is ready
+    uint32_t nFlags;           // DEVICE_FLAG_*, plus anything else the device set
+    uint64_t nDevicePosition;  // of the first frame, in frames since the stream started
+    int64_t hnsCapture;        // when the first frame was captured, on the pipeline's StatsClock
+};
+
+class AudioEndpoint {
+public:
+    AudioEndpoint() : m_nErrorCode(0) {}
+    virtual ~AudioEndpoint() {}
+
+    // only valid once opened
+    virtual const AudioFormat &Format() const = 0;
+    virtual int64_t PeriodHns() const = 0;
+
+    virtual DeviceStatus Start() = 0;
+    virtual void Stop() = 0;
+
+    // called on the thread that will service the endpoint before its first
+    // Wait, and on the same thread after its last one; a backend can set
+    // the thread up here (COM, scheduling class)
+    virtual DeviceStatus EnterThread() { return DEVICE_OK; }
+    virtual void LeaveThread() {}
+
+    // blocks until the device wants attention, nTimeoutMs passes or
+    // Interrupt is called
+    virtual DeviceStatus Wait(uint32_t nTimeoutMs) = 0;
+
+    // any thread: makes the current Wait and every later one return
+    // DEVICE_STOPPED
+    virtual void Interrupt() = 0;
+
+    // what went wrong with the last call that failed, and the backend's own
+    // code for it (an HRESULT for WASAPI, 0 if there is none)
+    const std::string &Error() const { return m_error; }
+    int32_t ErrorCode() const { return m_nErrorCode; }
+
+protected:
+    DeviceStatus Fail(DeviceStatus status, int32_t nErrorCode, const char *szFormat, ...) {
+        char szMessage[256];
+        va_list args;
+        va_start(args, szFormat);
+        vsnprintf(szMessage, sizeof(szMessage), szFormat, args);
+        va_end(args);
+
+        m_error = szMessage;
+        m_nErrorCode = nErrorCode;
+        return status;
+    }
+
+private:
+    std::string m_error;
+    int32_t m_nErrorCode;
+};
+
+class CaptureSource : public AudioEndpoint {
+public:
+    // opens the stream in the device's own format
+    virtual DeviceStatus Open() = 0;
+
+    // borrows the next packet; packet.nFrames is 0 if there isn't one yet
+    virtual DeviceStatus GetPacket(CapturePacket &packet) = 0;
+
+    // hands the packet back; nFrames must be the whole packet
+    virtual DeviceStatus ReleasePacket(uint32_t nFrames) = 0;
+};
+
+class RenderSink : public AudioEndpoint {
+public:
+    // opens the stream as close to desired as the device allows, with about
+    // nBufferMs of buffer; Format says what it settled on, which always has
+    // the same channel count and rate
+    virtual DeviceStatus Open(const AudioFormat &desired, uint32_t nBufferMs) = 0;
+
+    virtual uint32_t BufferFrames() const = 0;
+
+    // frames queued in the device that haven't been played yet
+    virtual DeviceStatus GetPadding(uint32_t &nPadding) = 0;
+
+    // borrows room for nFrames frames, at most BufferFrames() - padding
+    virtual DeviceStatus GetBuffer(uint32_t nFrames, uint8_t **ppData) = 0;
+
+    // queues them; bSilent plays silence whatever is in the buffer
+    virtual DeviceStatus ReleaseBuffer(uint32_t nFrames, bool bSilent) = 0;
+};
@@ -0,0 +1,384 @@
+// deviceregistry.cpp
+
+#include "common.h"
+
+#define REGISTRY_DIRECTORY L"mono-to-stereo"
+#define REGISTRY_FILE L"devices.txt"
+
+// measures how long each public call took, into the registry's stats
+class RegistryTimer {
+public:
+    RegistryTimer(DeviceRegistryStats &stats) : m_stats(stats) {
+        QueryPerformanceCounter(&m_start);
+    }
+
+    ~RegistryTimer() {
+        LARGE_INTEGER end, frequency;
+        QueryPerformanceCounter(&end);
+        QueryPerformanceFrequency(&frequency);
+        m_stats.hnsSpent += (end.QuadPart - m_start.QuadPart) * 10000000 / frequency.QuadPart;
+    }
+
+private:
+    DeviceRegistryStats &m_stats;
+    LARGE_INTEGER m_start;
+};
+
+static const char *DirectionName(EDataFlow direction) {
+    return eCapture == direction ? "capture" : "render";
+}
+
+// where the file lives; empty if there's nowhere to keep it
+static std::wstring RegistryPath(bool bCreateDirectory) {
+    WCHAR szAppData[MAX_PATH];
+    DWORD n = GetEnvironmentVariableW(L"LOCALAPPDATA", szAppData, ARRAYSIZE(szAppData));
+    if (0 == n || n >= ARRAYSIZE(szAppData)) {
+        return std::wstring();
+    }
+
+    std::wstring directory = std::wstring(szAppData) + L"\\" REGISTRY_DIRECTORY;
+    if (bCreateDirectory && !CreateDirectoryW(directory.c_str(), NULL) && ERROR_ALREADY_EXISTS != GetLastError()) {
+        return std::wstring();
+    }
+    return directory + L"\\" REGISTRY_FILE;
+}
+
+DeviceRegistry::DeviceRegistry()
+    : m_pEnumerator(NULL)
+    , m_bLoaded(false)
+{
+    ZeroMemory(&m_stats, sizeof(m_stats));
+}
+
+DeviceRegistry::~DeviceRegistry() {
+    if (NULL != m_pEnumerator) {
+        m_pEnumerator->Release();
+    }
+}
+
+HRESULT DeviceRegistry::Enumerator() {
+    if (NULL != m_pEnumerator) {
+        return S_OK;
+    }
+
+    HRESULT hr = CoCreateInstance(
+        __uuidof(MMDeviceEnumerator), NULL, CLSCTX_ALL,
+        __uuidof(IMMDeviceEnumerator),
+        (void**)&m_pEnumerator
+    );
+    if (FAILED(hr)) {
+        ERR(L"CoCreateInstance(IMMDeviceEnumerator) failed: hr = 0x%08x", hr);
+        m_pEnumerator = NULL;
+    }
+    return hr;
+}
+
+HRESULT DeviceRegistry::FriendlyName(IMMDevice *pMMDevice, std::wstring &name) {
+    m_stats.nEndpointsOpened++;
+
+    IPropertyStore *pPropertyStore;
+    HRESULT hr = pMMDevice->OpenPropertyStore(STGM_READ, &pPropertyStore);
+    if (FAILED(hr)) {
+        ERR(L"IMMDevice::OpenPropertyStore failed: hr = 0x%08x", hr);
+        return hr;
+    }
+    ReleaseOnExit releasePropertyStore(pPropertyStore);
+
+    PROPVARIANT pv; PropVariantInit(&pv);
+    hr = pPropertyStore->GetValue(PKEY_Device_FriendlyName, &pv);
+    if (FAILED(hr)) {
+        ERR(L"IPropertyStore::GetValue failed: hr = 0x%08x", hr);
+        return hr;
+    }
+    PropVariantClearOnExit clearPv(&pv);
+
+    if (VT_LPWSTR != pv.vt) {
+        ERR(L"PKEY_Device_FriendlyName variant type is %u - expected VT_LPWSTR", pv.vt);
+        return E_UNEXPECTED;
+    }
+
+    name = pv.pwszVal;
+    return S_OK;
+}
+
+// rebuilds both indexes from m_endpoints
+void DeviceRegistry::Index() {
+    m_byId.clear();
+    m_byName[eRender].clear();
+    m_byName[eCapture].clear();
+
+    for (const Endpoint &endpoint : m_endpoints) {
+        m_byId[endpoint.id] = endpoint;
+
+        std::map<std::wstring, std::wstring, LessIgnoringCase> &byName = m_byName[endpoint.direction];
+        std::map<std::wstring, std::wstring, LessIgnoringCase>::iterator it = byName.find(endpoint.name);
+        if (byName.end() == it) {
+            byName[endpoint.name] = endpoint.id;
+        }
+        else {
+            it->second.clear();
+        }
+    }
+}
+
+// replaces what is known about one direction with what is there now
+HRESULT DeviceRegistry::Walk(EDataFlow direction) {
+    HRESULT hr = Enumerator();
+    if (FAILED(hr)) {
+        return hr;
+    }
+    m_stats.nWalks++;
+
+    IMMDeviceCollection *pMMDeviceCollection;
+    hr = m_pEnumerator->EnumAudioEndpoints(direction, DEVICE_STATE_ACTIVE, &pMMDeviceCollection);
+    if (FAILED(hr)) {
+        ERR(L"IMMDeviceEnumerator::EnumAudioEndpoints failed: hr = 0x%08x", hr);
+        return hr;
+    }
+    ReleaseOnExit releaseMMDeviceCollection(pMMDeviceCollection);
+
+    UINT count;
+    hr = pMMDeviceCollection->GetCount(&count);
+    if (FAILED(hr)) {
+        ERR(L"IMMDeviceCollection::GetCount failed: hr = 0x%08x", hr);
+        return hr;
+    }
+
+    std::vector<Endpoint> endpoints;
+    for (const Endpoint &endpoint : m_endpoints) {
+        if (endpoint.direction != direction) {
+            endpoints.push_back(endpoint);
+        }
+    }
+
+    for (UINT i = 0; i < count; i++) {
+        IMMDevice *pMMDevice;
+        hr = pMMDeviceCollection->Item(i, &pMMDevice);
+        if (FAILED(hr)) {
+            ERR(L"IMMDeviceCollection::Item failed: hr = 0x%08x", hr);
+            return hr;
+        }
+        ReleaseOnExit releaseMMDevice(pMMDevice);
+
+        LPWSTR szId = NULL;
+        hr = pMMDevice->GetId(&szId);
+        if (FAILED(hr)) {
+            ERR(L"IMMDevice::GetId failed: hr = 0x%08x", hr);
+            return hr;
+        }
+        CoTaskMemFreeOnExit freeId(szId);
+
+        Endpoint endpoint;
+        endpoint.direction = direction;
+        endpoint.id = szId;
+        hr = FriendlyName(pMMDevice, endpoint.name);
+        if (FAILED(hr)) {
+            return hr;
+        }
+        endpoints.push_back(endpoint);
+    }
+
+    m_endpoints.swap(endpoints);
+    Index();
+    Save();
+    return S_OK;
+}
+
+// the endpoint, if it is still active and still called what it was
+HRESULT DeviceRegistry::Open(LPCWSTR szId, LPCWSTR szExpectedName, IMMDevice **ppMMDevice) {
+    IMMDevice *pMMDevice;
+    HRESULT hr = m_pEnumerator->GetDevice(szId, &pMMDevice);
+    if (FAILED(hr)) {
+        return hr;
+    }
+
+    DWORD dwState;
+    hr = pMMDevice->GetState(&dwState);
+    if (SUCCEEDED(hr) && DEVICE_STATE_ACTIVE != dwState) {
+        hr = HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
+    }
+
+    if (SUCCEEDED(hr) && NULL != szExpectedName) {
+        std::wstring name;
+        hr = FriendlyName(pMMDevice, name);
+        if (SUCCEEDED(hr) && 0 != _wcsicmp(name.c_str(), szExpectedName)) {
+            hr = HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
+        }
+    }
+
+    if (FAILED(hr)) {
+        pMMDevice->Release();
+        return hr;
+    }
+
+    *ppMMDevice = pMMDevice;
+    return S_OK;
+}
+
+HRESULT DeviceRegistry::Find(LPCWSTR szName, EDataFlow direction, IMMDevice **ppMMDevice, bool bQuiet) {
+    RegistryTimer timer(m_stats);
+    m_stats.nLookups++;
+    *ppMMDevice = NULL;
+
+    HRESULT hr = Enumerator();
+    if (FAILED(hr)) {
+        return hr;
+    }
+    Load();
+
+    // an endpoint ID needs no index at all
+    if (L'{' == szName[0]) {
+        hr = Open(szName, NULL, ppMMDevice);
+        if (SUCCEEDED(hr)) {
+            return hr;
+        }
+    }
+
+    // then what the last walk, or the last run, saw
+    std::map<std::wstring, std::wstring, LessIgnoringCase> &byName = m_byName[direction];
+    std::map<std::wstring, std::wstring, LessIgnoringCase>::iterator it = byName.find(szName);
+    if (byName.end() != it && !it->second.empty() && SUCCEEDED(Open(it->second.c_str(), szName, ppMMDevice))) {
+        m_stats.nFromFile++;
+        return S_OK;
+    }
+
+    // and only then every endpoint there is
+    hr = Walk(direction);
+    if (FAILED(hr)) {
+        return hr;
+    }
+
+    it = byName.find(szName);
+    if (byName.end() == it) {
+        if (!bQuiet) {
+            ERR(L"Could not find a device named %ls", szName);
+        }
+        return HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
+    }
+
+    if (it->second.empty()) {
+        ERR(L"Found (at least) two devices named %ls", szName);
+        return E_UNEXPECTED;
+    }
+
+    return Open(it->second.c_str(), NULL, ppMMDevice);
+}
+
+HRESULT DeviceRegistry::FindDefault(EDataFlow direction, IMMDevice **ppMMDevice) {
+    RegistryTimer timer(m_stats);
+    m_stats.nLookups++;
+
+    HRESULT hr = Enumerator();
+    if (FAILED(hr)) {
+        return hr;
+    }
+
+    hr = m_pEnumerator->GetDefaultAudioEndpoint(direction, eConsole, ppMMDevice);
+    if (FAILED(hr)) {
+        ERR(L"IMMDeviceEnumerator::GetDefaultAudioEndpoint failed: hr = 0x%08x", hr);
+        return hr;
+    }
+
+    return S_OK;
+}
+
+HRESULT DeviceRegistry::List(EDataFlow direction, std::vector<std::wstring> &names) {
+    RegistryTimer timer(m_stats);
+    Load();
+
+    HRESULT hr = Walk(direction);
+    if (FAILED(hr)) {
+        return hr;
+    }
+
+    names.clear();
+    for (const Endpoint &endpoint : m_endpoints) {
+        if (endpoint.direction == direction) {
+            names.push_back(endpoint.name);
+        }
+    }
+    return S_OK;
+}
+
+void DeviceRegistry::Load() {
+    if (m_bLoaded) {
+        return;
+    }
+    m_bLoaded = true;
+
+    std::wstring path = RegistryPath(false);
+    MappedInputFile file;
+    std::string error;
+    if (path.empty() || !file.Open(utf8_from_wide(path.c_str()), error) || 0 == file.Size() || file.Size() > 1024 * 1024) {
+        return;
+    }
+
+    const uint8_t *pData = file.Map(0, static_cast<size_t>(file.Size()), error);
+    if (NULL == pData) {
+        return;
+    }
+    std::string text(reinterpret_cast<const char *>(pData), static_cast<size_t>(file.Size()));
+
+    size_t nPos = 0;
+    while (nPos < text.size()) {
+        size_t nEnd = text.find('\n', nPos);
+        if (std::string::npos == nEnd) {
+            nEnd = text.size();
+        }
+        std::string line = text.substr(nPos, nEnd - nPos);
+        nPos = nEnd + 1;
+
+        size_t nTab1 = line.find('\t');
+        size_t nTab2 = std::string::npos == nTab1 ? std::string::npos : line.find('\t', nTab1 + 1);
+        if (std::string::npos == nTab2) {
+            continue;
+        }
+
+        Endpoint endpoint;
+        std::string direction = line.substr(0, nTab1);
+        if ("render" == direction) {
+            endpoint.direction = eRender;
+        }
+        else if ("capture" == direction) {
+            endpoint.direction = eCapture;
+        }
+        else {
+            continue;
+        }
+        endpoint.id = wide_from_utf8(line.substr(nTab1 + 1, nTab2 - nTab1 - 1));
+        endpoint.name = wide_from_utf8(line.substr(nTab2 + 1));
+        if (!endpoint.id.empty() && !endpoint.name.empty()) {
+            m_endpoints.push_back(endpoint);
+        }
+    }
+
+    Index();
+}
+
+// written next to the file and moved over it, so an instance starting at
+// the same time never reads half of it
+void DeviceRegistry::Save() {
+    std::wstring path = RegistryPath(true);
+    if (path.empty()) {
+        return;
+    }
+
+    std::string text;
+    for (const Endpoint &endpoint : m_endpoints) {
+        text += DirectionName(endpoint.direction);
+        text += '\t';
+        text += utf8_from_wide(endpoint.id.c_str());
+        text += '\t';
+        text += utf8_from_wide(endpoint.name.c_str());
+        text += '\n';
+    }
+
+    std::wstring temporary = path + L"." + std::to_wstring(GetCurrentProcessId());
+    OutputFile file;
+    std::string error;
+    bool bWritten = file.Open(utf8_from_wide(temporary.c_str()), error) && file.Write(text.data(), text.size(), error);
+    bWritten = file.Close(error) && bWritten;
+    if (!bWritten || !MoveFileExW(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        DeleteFileW(temporary.c_str());
+    }
+}
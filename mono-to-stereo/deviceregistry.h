@@ -0,0 +1,77 @@
+// deviceregistry.h
+
+// finds audio endpoints by friendly name without walking all of them
+// every time
+//
+// finding a device by name means opening the property store of every
+// active endpoint, which on a machine with dozens of them takes longer than
+// the rest of startup put together, and a daemon does it again on every
+// restart. the registry walks the endpoints once, indexes them by friendly
+// name and by endpoint ID, and keeps the mapping in a file for the next
+// start. after that a lookup is one GetDevice on the remembered ID, and a
+// check that the endpoint is still active and still has that name; only
+// when the check fails are the endpoints walked again
+//
+// the file is %LOCALAPPDATA%\mono-to-stereo\devices.txt, one endpoint per
+// line: "render" or "capture", the endpoint ID and the friendly name,
+// separated by tabs, in UTF-8. it's only ever a hint, so anything wrong
+// with it just means a walk
+//
+// one per thread; the enumerator it holds belongs to the thread's apartment
+
+struct DeviceRegistryStats {
+    UINT32 nLookups;
+    UINT32 nFromFile;     // lookups answered from the file without a walk
+    UINT32 nWalks;
+    UINT32 nEndpointsOpened;
+    LONGLONG hnsSpent;    // in all of the above
+};
+
+class DeviceRegistry {
+public:
+    DeviceRegistry();
+    ~DeviceRegistry();
+
+    // szName is a friendly name, compared without case, or an endpoint ID;
+    // HRESULT_FROM_WIN32(ERROR_NOT_FOUND) if there is no such active
+    // endpoint. bQuiet leaves reporting that to the caller
+    HRESULT Find(LPCWSTR szName, EDataFlow direction, IMMDevice **ppMMDevice, bool bQuiet = false);
+
+    HRESULT FindDefault(EDataFlow direction, IMMDevice **ppMMDevice);
+
+    // walks the active endpoints, refreshing the index on the way
+    HRESULT List(EDataFlow direction, std::vector<std::wstring> &names);
+
+    const DeviceRegistryStats &Stats() const { return m_stats; }
+
+private:
+    DeviceRegistry(const DeviceRegistry &) = delete;
+    DeviceRegistry &operator=(const DeviceRegistry &) = delete;
+
+    struct Endpoint {
+        EDataFlow direction;
+        std::wstring id;
+        std::wstring name;
+    };
+
+    struct LessIgnoringCase {
+        bool operator()(const std::wstring &a, const std::wstring &b) const {
+            return _wcsicmp(a.c_str(), b.c_str()) < 0;
+        }
+    };
+
+    HRESULT Enumerator();
+    HRESULT Walk(EDataFlow direction);
+    HRESULT Open(LPCWSTR szId, LPCWSTR szExpectedName, IMMDevice **ppMMDevice);
+    HRESULT FriendlyName(IMMDevice *pMMDevice, std::wstring &name);
+    void Index();
+    void Load();
+    void Save();
+
+    IMMDeviceEnumerator *m_pEnumerator;
+    std::vector<Endpoint> m_endpoints;
+    std::map<std::wstring, Endpoint, LessIgnoringCase> m_byId;
+    std::map<std::wstring, std::wstring, LessIgnoringCase> m_byName[2]; // eRender and eCapture; an empty ID if the name isn't unique
+    bool m_bLoaded;
+    DeviceRegistryStats m_stats;
+};
@@ -0,0 +1,242 @@
+// drift.h
+
+// render-side reader that pulls from the capture ring through the adaptive
+// resampler, plus an offline simulation of two drifting clocks to check it
+//
+// no Windows dependencies
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "audioformat.h"
+#include "resampler.h"
+#include "ring.h"
+#include "sampleconvert.h"
+
+class DriftCompensatedReader {
+public:
+    DriftCompensatedReader() : m_nMaxFrames(0), m_nLastFrames(0), m_nDroppedFrames(0) {}
+
+    // ringFormat is the format of the frames in the ring, outputFormat the
+    // format Read writes; they must have the same channel count and rate
+    // nMaxFrames is the most that will be asked for in one Read
+    // fTargetFrames is the latency to hold in the ring and in the device
+    // behind it, in frames
+    bool Init(const AudioFormat &ringFormat, const AudioFormat &outputFormat, uint32_t nMaxFrames, double fTargetFrames, double fMaxPpm = DRIFT_MAX_PPM) {
+        if (nMaxFrames == 0 || ringFormat.nChannels == 0 || ringFormat.nChannels != outputFormat.nChannels) {
+            return false;
+        }
+
+        if (!m_fromRing.Init(SampleTypeOf(ringFormat), SAMPLE_FLOAT32, false) ||
+            !m_toOutput.Init(SAMPLE_FLOAT32, SampleTypeOf(outputFormat), true)) {
+            return false;
+        }
+
+        // room for a full read at the fastest ratio plus the filter history
+        uint32_t nCapacity = nMaxFrames * 2 + RESAMPLER_TAPS * 2;
+        if (!m_resampler.Init(ringFormat.nChannels, nCapacity)) {
+            return false;
+        }
+
+        m_format = outputFormat;
+        m_nMaxFrames = nMaxFrames;
+        m_nLastFrames = 0;
+        m_nDroppedFrames = 0;
+        m_scratchIn.assign(static_cast<size_t>(nCapacity) * ringFormat.nChannels, 0.0f);
+        m_scratchOut.assign(static_cast<size_t>(nMaxFrames) * ringFormat.nChannels, 0.0f);
+        m_controller.Init(fTargetFrames, ringFormat.nSamplesPerSec, fMaxPpm);
+        return true;
+    }
+
+    // writes exactly nFrames frames to pOut, padding with silence if the
+    // ring runs dry; returns the number of frames that came from the ring
+    // Ring is an SpscRing or a FanoutReader
+    // nDeviceFrames is what the device still has to play ahead of pOut,
+    // which counts towards the latency held as much as the ring does
+    template <class Ring>
+    uint32_t Read(Ring &ring, uint8_t *pOut, uint32_t nFrames, uint32_t nDeviceFrames = 0) {
+        nFrames = (std::min)(nFrames, m_nMaxFrames);
+
+        double fQueued = QueuedFrames(ring) + nDeviceFrames;
+        bool bPriming = !m_controller.IsPrimed();
+        if (!m_controller.Primed(fQueued)) {
+            memset(pOut, 0, static_cast<size_t>(nFrames) * m_format.nBlockAlign);
+            return 0;
+        }
+
+        // nobody hears frames being skipped right after silence or a
+        // stall; see DriftController::Excess
+        uint32_t nExcess = static_cast<uint32_t>((std::min)(m_controller.Excess(fQueued, bPriming), static_cast<double>(ring.ReadAvailable())));
+        for (uint32_t nDone = 0; nDone < nExcess; ) {
+            const uint8_t *pData;
+            uint32_t n = (std::min)(ring.BeginRead(&pData), nExcess - nDone);
+            if (n == 0 || !ring.CommitRead(n)) {
+                break;
+            }
+            m_nDroppedFrames += n;
+            fQueued -= n;
+            nDone += n;
+        }
+        if (nExcess > 0) {
+            m_controller.Resync(fQueued);
+        }
+
+        m_resampler.SetRatio(m_controller.Update(fQueued, m_nLastFrames));
+        m_nLastFrames = nFrames;
+
+        // top up the resampler's input from the ring
+        uint32_t nNeeded = (std::min)(m_resampler.InputFramesNeeded(nFrames), m_resampler.FreeFrames());
+        while (nNeeded > 0) {
+            const uint8_t *pData;
+            uint32_t n = (std::min)(ring.BeginRead(&pData), nNeeded);
+            if (n == 0) {
+                break;
+            }
+
+            // a region the producer wrote over while it was being converted
+            // goes in as silence
+            m_fromRing.ToFloat(pData, m_scratchIn.data(), static_cast<size_t>(n) * m_format.nChannels);
+            if (!ring.CommitRead(n)) {
+                std::fill(m_scratchIn.begin(), m_scratchIn.begin() + static_cast<size_t>(n) * m_format.nChannels, 0.0f);
+            }
+            m_resampler.Push(m_scratchIn.data(), n);
+            nNeeded -= n;
+        }
+
+        uint32_t nProduced = m_resampler.Pull(m_scratchOut.data(), nFrames);
+        m_toOutput.FromFloat(m_scratchOut.data(), pOut, static_cast<size_t>(nProduced) * m_format.nChannels);
+
+        if (nProduced < nFrames) {
+            memset(
+                pOut + static_cast<size_t>(nProduced) * m_format.nBlockAlign, 0,
+                static_cast<size_t>(nFrames - nProduced) * m_format.nBlockAlign
+            );
+            ring.NoteUnderrun(nFrames - nProduced);
+        }
+
+        return nProduced;
+    }
+
+    // latency currently held between the clocks, in frames
+    template <class Ring>
+    double QueuedFrames(const Ring &ring) const {
+        return static_cast<double>(ring.ReadAvailable()) + m_resampler.BufferedFrames();
+    }
+
+    // frames already taken from the ring that haven't been played out yet
+    double HeldFrames() const { return m_resampler.BufferedFrames(); }
+
+    double Ratio() const { return m_resampler.Ratio(); }
+
+    // frames skipped to get back to the target after a stall
+    uint64_t DroppedFrames() const { return m_nDroppedFrames; }
+
+    const DriftController &Controller() const { return m_controller; }
+
+    // a new latency to hold; see DriftController::Retarget
+    void Retarget(double fTargetFrames, bool bRefill) { m_controller.Retarget(fTargetFrames, bRefill); }
+
+private:
+    AudioFormat m_format; // output
+    uint32_t m_nMaxFrames;
+    uint32_t m_nLastFrames;
+    uint64_t m_nDroppedFrames;
+    AdaptiveResampler m_resampler;
+    DriftController m_controller;
+    SampleConverter m_fromRing;
+    SampleConverter m_toOutput;
+    std::vector<float> m_scratchIn;
+    std::vector<float> m_scratchOut;
+};
+
+// ---- offline simulation ----
+
+struct DriftSimulationResult {
+    double fExpectedRatio;    // what the ratio should settle at
+    double fMeanRatio;        // the ratio applied, averaged over the second half
+    double fRatioTolerance;   // how far that may be from fExpectedRatio: the
+                              // producer's extra frames come a packet at a
+                              // time, so one packet over the second half
+    double fTargetMs;
+    double fFinalLatencyMs;
+    double fMeanLatencyMs;     // average over the second half
+    double fMaxLatencyErrorMs; // worst latency error over the second half; at
+                               // least one packet because data arrives in packets
+    uint64_t nUnderrunFrames;
+    uint64_t nOverrunFrames;
+};
+
+// how far the second half's mean latency may be from the target
+#define DRIFT_SIMULATION_LATENCY_TOLERANCE_MS 0.5
+
+// runs a synthetic 1 kHz stereo float stream from a producer whose clock is
+// fPpm faster than the consumer's through ring + DriftCompensatedReader,
+// using the same packet and period sizes as a typical shared mode stream
+static inline DriftSimulationResult SimulateDrift(double fPpm, double fSeconds, uint32_t nRate = 48000, uint32_t nPeriodFrames = 480, double fTargetMs = 32.0) {
+    AudioFormat format = MakeAudioFormat(AUDIOFORMAT_TAG_IEEE_FLOAT, 2, nRate, 32);
+    double fTargetFrames = fTargetMs * nRate / 1000.0;
+
+    SpscRing ring;
+    ring.Init(format.nBlockAlign, static_cast<uint32_t>(fTargetFrames * 4) + nPeriodFrames * 4);
+
+    DriftCompensatedReader reader;
+    reader.Init(format, format, nPeriodFrames, fTargetFrames);
+
+    std::vector<float> packet(static_cast<size_t>(nPeriodFrames) * 2);
+    std::vector<uint8_t> out(static_cast<size_t>(nPeriodFrames) * format.nBlockAlign);
+
+    const double fTwoPi = 6.28318530717958647692;
+    double fProducerFrames = 0; // frames the producer clock owes us
+    double fPhase = 0;
+
+    DriftSimulationResult result = {};
+    result.fExpectedRatio = 1.0 + fPpm * 1e-6;
+    result.fTargetMs = fTargetMs;
+
+    uint64_t nPeriods = static_cast<uint64_t>(fSeconds * nRate / nPeriodFrames);
+    uint64_t nMeasured = 0;
+    for (uint64_t i = 0; i < nPeriods; i++) {
+        // the producer delivers whole packets on its own clock
+        fProducerFrames += nPeriodFrames * (1.0 + fPpm * 1e-6);
+        while (fProducerFrames >= nPeriodFrames) {
+            for (uint32_t f = 0; f < nPeriodFrames; f++) {
+                float s = static_cast<float>(0.5 * std::sin(fPhase));
+                packet[2 * f] = s;
+                packet[2 * f + 1] = -s;
+                fPhase += fTwoPi * 1000.0 / nRate;
+            }
+            fPhase = std::fmod(fPhase, fTwoPi);
+            ring.Write(reinterpret_cast<const uint8_t *>(packet.data()), nPeriodFrames);
+            fProducerFrames -= nPeriodFrames;
+        }
+
+        // measured where the reader measures it, just before it pulls
+        double fLatencyMs = reader.QueuedFrames(ring) * 1000.0 / nRate;
+
+        // the consumer takes one period per wakeup on its clock
+        reader.Read(ring, out.data(), nPeriodFrames);
+
+        if (i >= nPeriods / 2) {
+            result.fMeanRatio += reader.Ratio();
+            result.fMaxLatencyErrorMs = (std::max)(result.fMaxLatencyErrorMs, std::fabs(fLatencyMs - fTargetMs));
+            result.fMeanLatencyMs += fLatencyMs;
+            nMeasured++;
+        }
+        result.fFinalLatencyMs = fLatencyMs;
+    }
+
+    if (nMeasured > 0) {
+        result.fMeanRatio /= static_cast<double>(nMeasured);
+        result.fRatioTolerance = 1.0 / static_cast<double>(nMeasured);
+        result.fMeanLatencyMs /= static_cast<double>(nMeasured);
+    }
+
+    RingStats stats = ring.GetStats();
+    result.nUnderrunFrames = stats.nUnderrunFrames;
+    result.nOverrunFrames = stats.nOverrunFrames;
+    return result;
+}
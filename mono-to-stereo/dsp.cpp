@@ -0,0 +1,533 @@
+// dsp.cpp
+
+#include "dsp.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "sampleconvert.h"
+
+// ---- sample formats ----
+
+// each one loads a sample as float in [-1, 1) and stores it back, rounded
+// and clamped to what the format holds
+
+struct Int16Samples {
+    enum { BYTES = 2 };
+
+    static inline float Load(const uint8_t *p) {
+        int16_t v;
+        memcpy(&v, p, sizeof(v));
+        return static_cast<float>(v) * (1.0f / 32768.0f);
+    }
+
+    static inline void Store(uint8_t *p, float f) {
+        float s = (std::min)((std::max)(f * 32768.0f, -32768.0f), 32767.0f);
+        int16_t v = static_cast<int16_t>(lrintf(s));
+        memcpy(p, &v, sizeof(v));
+    }
+};
+
+struct Int24Samples {
+    enum { BYTES = 3 };
+
+    static inline float Load(const uint8_t *p) {
+        int32_t v = static_cast<int32_t>((static_cast<uint32_t>(p[0]) << 8) | (static_cast<uint32_t>(p[1]) << 16) | (static_cast<uint32_t>(p[2]) << 24)) >> 8;
+        return static_cast<float>(v) * (1.0f / 8388608.0f);
+    }
+
+    static inline void Store(uint8_t *p, float f) {
+        float s = (std::min)((std::max)(f * 8388608.0f, -8388608.0f), 8388607.0f);
+        int32_t v = static_cast<int32_t>(lrintf(s));
+        p[0] = static_cast<uint8_t>(v);
+        p[1] = static_cast<uint8_t>(v >> 8);
+        p[2] = static_cast<uint8_t>(v >> 16);
+    }
+};
+
+struct Int32Samples {
+    enum { BYTES = 4 };
+
+    static inline float Load(const uint8_t *p) {
+        int32_t v;
+        memcpy(&v, p, sizeof(v));
+        return static_cast<float>(v) * (1.0f / 2147483648.0f);
+    }
+
+    // through double, since 2^31 - 1 isn't a float
+    static inline void Store(uint8_t *p, float f) {
+        double s = (std::min)((std::max)(static_cast<double>(f) * 2147483648.0, -2147483648.0), 2147483647.0);
+        int32_t v = static_cast<int32_t>(llrint(s));
+        memcpy(p, &v, sizeof(v));
+    }
+};
+
+struct Float32Samples {
+    enum { BYTES = 4 };
+
+    static inline float Load(const uint8_t *p) {
+        float f;
+        memcpy(&f, p, sizeof(f));
+        return f;
+    }
+
+    static inline void Store(uint8_t *p, float f) {
+        memcpy(p, &f, sizeof(f));
+    }
+};
+
+// worked in float like the rest
+struct Float64Samples {
+    enum { BYTES = 8 };
+
+    static inline float Load(const uint8_t *p) {
+        double d;
+        memcpy(&d, p, sizeof(d));
+        return static_cast<float>(d);
+    }
+
+    static inline void Store(uint8_t *p, float f) {
+        double d = f;
+        memcpy(p, &d, sizeof(d));
+    }
+};
+
+// ---- stages ----
+
+// one pole high pass: y = x - x[-1] + R * y[-1]
+struct DcStage {
+    static inline void Process(DspState &s, float &l, float &r) {
+        float yl = l - s.dcIn[0] + s.fDcCoefficient * s.dcOut[0];
+        float yr = r - s.dcIn[1] + s.fDcCoefficient * s.dcOut[1];
+        s.dcIn[0] = l;
+        s.dcIn[1] = r;
+        s.dcOut[0] = yl;
+        s.dcOut[1] = yr;
+        l = yl;
+        r = yr;
+    }
+};
+
+struct SwapStage {
+    static inline void Process(DspState &, float &l, float &r) {
+        float t = l;
+        l = r;
+        r = t;
+    }
+};
+
+struct MonoStage {
+    static inline void Process(DspState &, float &l, float &r) {
+        float m = 0.5f * (l + r);
+        l = m;
+        r = m;
+    }
+};
+
+struct GainStage {
+    static inline void Process(DspState &s, float &l, float &r) {
+        l *= s.fGain;
+        r *= s.fGain;
+    }
+};
+
+// linked stereo peak limiter without lookahead: turns down straight away
+// to keep the louder channel at the ceiling, then lets go exponentially
+struct LimitStage {
+    static inline void Process(DspState &s, float &l, float &r) {
+        float fPeak = (std::max)(fabsf(l), fabsf(r));
+        float fTarget = fPeak > s.fCeiling ? s.fCeiling / fPeak : 1.0f;
+
+        // the release never quite gets there by itself
+        float g = s.fLimitGain + (1.0f - s.fLimitGain) * s.fRelease;
+        if (g > 0.99999f) {
+            g = 1.0f;
+        }
+        if (g > fTarget) {
+            g = fTarget;
+        }
+        s.fLimitGain = g;
+
+        if (g < 1.0f) {
+            l *= g;
+            r *= g;
+            s.nLimitedFrames++;
+        }
+    }
+};
+
+// ---- kernels ----
+
+template <class... Stages>
+struct StageChain;
+
+template <>
+struct StageChain<> {
+    static inline void Process(DspState &, float &, float &) {}
+};
+
+template <class First, class... Rest>
+struct StageChain<First, Rest...> {
+    static inline void Process(DspState &s, float &l, float &r) {
+        First::Process(s, l, r);
+        StageChain<Rest...>::Process(s, l, r);
+    }
+};
+
+// the state is copied in and out so it can live in registers
+template <class Samples, class Chain>
+static void FusedKernel(DspState &state, uint8_t *pData, uint32_t nFrames) {
+    DspState s = state;
+
+    for (uint32_t i = 0; i < nFrames; i++) {
+        float l = Samples::Load(pData);
+        float r = Samples::Load(pData + Samples::BYTES);
+        Chain::Process(s, l, r);
+        Samples::Store(pData, l);
+        Samples::Store(pData + Samples::BYTES, r);
+        pData += 2 * Samples::BYTES;
+    }
+
+    state = s;
+}
+
+// decides one stage after another, adding each one that is on to the
+// chain, so every combination gets a kernel of its own
+#define DSP_STAGE_DC 0
+#define DSP_STAGE_CHANNELS 1
+#define DSP_STAGE_GAIN 2
+#define DSP_STAGE_LIMIT 3
+#define DSP_STAGE_DONE 4
+
+template <int STAGE, class Samples, class... Chosen>
+struct KernelPicker;
+
+template <class Samples, class... Chosen>
+struct KernelPicker<DSP_STAGE_DONE, Samples, Chosen...> {
+    static DspKernel Pick(const DspOptions &) {
+        return &FusedKernel<Samples, StageChain<Chosen...>>;
+    }
+};
+
+template <class Samples, class... Chosen>
+struct KernelPicker<DSP_STAGE_DC, Samples, Chosen...> {
+    static DspKernel Pick(const DspOptions &options) {
+        return options.bRemoveDc
+            ? KernelPicker<DSP_STAGE_CHANNELS, Samples, Chosen..., DcStage>::Pick(options)
+            : KernelPicker<DSP_STAGE_CHANNELS, Samples, Chosen...>::Pick(options);
+    }
+};
+
+template <class Samples, class... Chosen>
+struct KernelPicker<DSP_STAGE_CHANNELS, Samples, Chosen...> {
+    static DspKernel Pick(const DspOptions &options) {
+        switch (options.channels) {
+        case DSP_CHANNELS_SWAP:
+            return KernelPicker<DSP_STAGE_GAIN, Samples, Chosen..., SwapStage>::Pick(options);
+        case DSP_CHANNELS_MONO:
+            return KernelPicker<DSP_STAGE_GAIN, Samples, Chosen..., MonoStage>::Pick(options);
+        default:
+            return KernelPicker<DSP_STAGE_GAIN, Samples, Chosen...>::Pick(options);
+        }
+    }
+};
+
+template <class Samples, class... Chosen>
+struct KernelPicker<DSP_STAGE_GAIN, Samples, Chosen...> {
+    static DspKernel Pick(const DspOptions &options) {
+        return 0 != options.fGainDb
+            ? KernelPicker<DSP_STAGE_LIMIT, Samples, Chosen..., GainStage>::Pick(options)
+            : KernelPicker<DSP_STAGE_LIMIT, Samples, Chosen...>::Pick(options);
+    }
+};
+
+template <class Samples, class... Chosen>
+struct KernelPicker<DSP_STAGE_LIMIT, Samples, Chosen...> {
+    static DspKernel Pick(const DspOptions &options) {
+        return options.bLimit
+            ? KernelPicker<DSP_STAGE_DONE, Samples, Chosen..., LimitStage>::Pick(options)
+            : KernelPicker<DSP_STAGE_DONE, Samples, Chosen...>::Pick(options);
+    }
+};
+
+// the stages that are on, one kernel each
+template <class Samples>
+static uint32_t PickStaged(const DspOptions &options, DspKernel *pKernels) {
+    uint32_t n = 0;
+    if (options.bRemoveDc) {
+        pKernels[n++] = &FusedKernel<Samples, StageChain<DcStage>>;
+    }
+    if (DSP_CHANNELS_SWAP == options.channels) {
+        pKernels[n++] = &FusedKernel<Samples, StageChain<SwapStage>>;
+    }
+    if (DSP_CHANNELS_MONO == options.channels) {
+        pKernels[n++] = &FusedKernel<Samples, StageChain<MonoStage>>;
+    }
+    if (0 != options.fGainDb) {
+        pKernels[n++] = &FusedKernel<Samples, StageChain<GainStage>>;
+    }
+    if (options.bLimit) {
+        pKernels[n++] = &FusedKernel<Samples, StageChain<LimitStage>>;
+    }
+    return n;
+}
+
+template <class Samples>
+static DspKernel PickKernels(const DspOptions &options, DspKernel *pStaged, uint32_t &nStaged) {
+    nStaged = PickStaged<Samples>(options, pStaged);
+    return KernelPicker<DSP_STAGE_DC, Samples>::Pick(options);
+}
+
+// ---- DspChain ----
+
+DspChain::DspChain()
+    : m_initial()
+    , m_state()
+    , m_pFused(NULL)
+    , m_nStaged(0)
+{}
+
+bool DspChain::Init(const DspOptions &options, const AudioFormat &format) {
+    m_pFused = NULL;
+    m_nStaged = 0;
+    m_options = options;
+
+    if (!options.Any()) {
+        return true;
+    }
+
+    if (format.nChannels != 2 || format.nSamplesPerSec == 0 ||
+        options.fGainDb < -60 || options.fGainDb > 40 ||
+        options.fLimitDb < -60 || options.fLimitDb > 0) {
+        return false;
+    }
+
+    DspState &s = m_initial;
+    s = DspState();
+    s.fDcCoefficient = static_cast<float>(1.0 - 2.0 * 3.14159265358979323846 * DSP_DC_CUTOFF_HZ / format.nSamplesPerSec);
+    s.fGain = static_cast<float>(pow(10.0, options.fGainDb / 20.0));
+    s.fCeiling = static_cast<float>(pow(10.0, options.fLimitDb / 20.0));
+    s.fRelease = static_cast<float>(1.0 - exp(-1000.0 / (DSP_LIMIT_RELEASE_MS * static_cast<double>(format.nSamplesPerSec))));
+    s.fLimitGain = 1.0f;
+
+    switch (SampleTypeOf(format)) {
+    case SAMPLE_INT16:
+        m_pFused = PickKernels<Int16Samples>(options, m_staged, m_nStaged);
+        break;
+    case SAMPLE_INT24:
+        m_pFused = PickKernels<Int24Samples>(options, m_staged, m_nStaged);
+        break;
+    case SAMPLE_INT32:
+        m_pFused = PickKernels<Int32Samples>(options, m_staged, m_nStaged);
+        break;
+    case SAMPLE_FLOAT32:
+        m_pFused = PickKernels<Float32Samples>(options, m_staged, m_nStaged);
+        break;
+    case SAMPLE_FLOAT64:
+        m_pFused = PickKernels<Float64Samples>(options, m_staged, m_nStaged);
+        break;
+    default:
+        return false;
+    }
+
+    m_state = m_initial;
+    return true;
+}
+
+void DspChain::ProcessStaged(uint8_t *pData, uint32_t nFrames) {
+    for (uint32_t i = 0; i < m_nStaged; i++) {
+        m_staged[i](m_state, pData, nFrames);
+    }
+}
+
+void DspChain::Reset() {
+    m_state = m_initial;
+}
+
+std::string DspChain::Describe() const {
+    std::string description;
+    char szPart[64];
+
+    if (m_options.bRemoveDc) {
+        description += "DC removal";
+    }
+    if (DSP_CHANNELS_AS_IS != m_options.channels) {
+        description += description.empty() ? "" : ", ";
+        description += DSP_CHANNELS_SWAP == m_options.channels ? "channels swapped" : "mono sum";
+    }
+    if (0 != m_options.fGainDb) {
+        snprintf(szPart, sizeof(szPart), "gain %+.1f dB", m_options.fGainDb);
+        description += description.empty() ? "" : ", ";
+        description += szPart;
+    }
+    if (m_options.bLimit) {
+        snprintf(szPart, sizeof(szPart), "limiter at %.1f dBFS", m_options.fLimitDb);
+        description += description.empty() ? "" : ", ";
+        description += szPart;
+    }
+
+    return description.empty() ? "none" : description;
+}
+
+// ---- offline check ----
+
+// the stereo frames of the simulated stream
+#define DSP_SIMULATION_SECONDS 2
+
+static void SplitPackets(uint32_t nSeed, uint32_t nFrames, std::vector<uint32_t> &sizes) {
+    uint32_t x = nSeed * 2654435761u + 1;
+    sizes.clear();
+    for (uint32_t nDone = 0; nDone < nFrames; ) {
+        x = x * 1664525u + 1013904223u;
+        uint32_t n = (std::min)(1 + (x >> 8) % 2048, nFrames - nDone);
+        sizes.push_back(n);
+        nDone += n;
+    }
+}
+
+// runs the stream through a chain in the packets given, fused or staged
+static void RunChain(DspChain &chain, bool bStaged, const std::vector<uint32_t> &sizes, size_t nFrameBytes, std::vector<uint8_t> &data) {
+    uint8_t *p = data.data();
+    for (uint32_t n : sizes) {
+        if (bStaged) {
+            chain.ProcessStaged(p, n);
+        }
+        else {
+            chain.Process(p, n);
+        }
+        p += n * nFrameBytes;
+    }
+}
+
+DspSimulationResult SimulateDsp(const AudioFormat &format, uint32_t nSeed) {
+    DspSimulationResult result = {};
+
+    SampleType type = SampleTypeOf(format);
+    SampleConverter toFormat;
+    SampleConverter toFloat;
+    if (format.nChannels != 2 || !toFormat.Init(SAMPLE_FLOAT32, type, false) || !toFloat.Init(type, SAMPLE_FLOAT32, false)) {
+        return result;
+    }
+
+    const uint32_t nRate = format.nSamplesPerSec;
+    const uint32_t nFrames = nRate * DSP_SIMULATION_SECONDS;
+    const size_t nFrameBytes = format.nBlockAlign;
+
+    std::vector<float> signal(static_cast<size_t>(nFrames) * 2);
+    for (uint32_t i = 0; i < nFrames; i++) {
+        double t = static_cast<double>(i) / nRate;
+        signal[2 * i] = static_cast<float>(0.5 * sin(2 * 3.14159265358979323846 * 1000 * t) + 0.1);
+        signal[2 * i + 1] = static_cast<float>(0.3 * sin(2 * 3.14159265358979323846 * 1500 * t) - 0.05);
+    }
+    std::vector<uint8_t> input(nFrames * nFrameBytes);
+    toFormat.FromFloat(signal.data(), input.data(), signal.size());
+
+    std::vector<uint32_t> sizes;
+    SplitPackets(nSeed, nFrames, sizes);
+
+    std::vector<uint8_t> fused;
+    std::vector<uint8_t> staged;
+    std::vector<float> a(signal.size());
+    std::vector<float> b(signal.size());
+
+    // every combination, fused against staged; integer formats get
+    // requantized between stages, and the gain is kept small enough not to
+    // clip between them, which only the staged version would
+    bool bPass = true;
+    const double fLsb = SAMPLE_INT16 == type ? 1.0 / 32768 : SAMPLE_INT24 == type ? 1.0 / 8388608 : SAMPLE_INT32 == type ? 1.0 / 8388608 : 0;
+    for (uint32_t nCombination = 0; nCombination < 24; nCombination++) {
+        DspOptions options;
+        options.bRemoveDc = 0 != (nCombination & 1);
+        options.fGainDb = 0 != (nCombination & 2) ? 3 : 0;
+        options.bLimit = 0 != (nCombination & 4);
+        options.channels = static_cast<DspChannels>(nCombination / 8);
+
+        DspChain chain;
+        if (!chain.Init(options, format)) {
+            return result;
+        }
+        if (!chain.IsActive()) {
+            continue;
+        }
+
+        fused = input;
+        RunChain(chain, false, sizes, nFrameBytes, fused);
+        chain.Reset();
+        staged = input;
+        RunChain(chain, true, sizes, nFrameBytes, staged);
+
+        toFloat.ToFloat(fused.data(), a.data(), a.size());
+        toFloat.ToFloat(staged.data(), b.data(), b.size());
+        double fWorst = 0;
+        for (size_t i = 0; i < a.size(); i++) {
+            fWorst = (std::max)(fWorst, static_cast<double>(fabsf(a[i] - b[i])));
+        }
+
+        double fAllowed = fLsb * 4 * (options.fGainDb != 0 ? 2 : 1);
+        result.fWorstDifference = (std::max)(result.fWorstDifference, fWorst);
+        result.fAllowedDifference = (std::max)(result.fAllowedDifference, fAllowed);
+        bPass = bPass && fWorst <= fAllowed;
+        result.nKernels++;
+    }
+
+    // the limiter holds the ceiling against 20 dB too much
+    DspOptions limit;
+    limit.fGainDb = 20;
+    limit.bLimit = true;
+    DspChain chain;
+    chain.Init(limit, format);
+    fused = input;
+    RunChain(chain, false, sizes, nFrameBytes, fused);
+    toFloat.ToFloat(fused.data(), a.data(), a.size());
+    double fPeak = 0;
+    for (float f : a) {
+        fPeak = (std::max)(fPeak, static_cast<double>(fabsf(f)));
+    }
+    result.fPeakDb = 20 * log10((std::max)(fPeak, 1e-10));
+    bPass = bPass && fPeak <= pow(10.0, DSP_DEFAULT_LIMIT_DB / 20) + fLsb + 1e-6;
+
+    // a second to settle, then a second of whole tone periods
+    DspOptions dc;
+    dc.bRemoveDc = true;
+    chain.Init(dc, format);
+    fused = input;
+    RunChain(chain, false, sizes, nFrameBytes, fused);
+    toFloat.ToFloat(fused.data(), a.data(), a.size());
+    double sum[2] = { 0, 0 };
+    for (uint32_t i = nFrames - nRate; i < nFrames; i++) {
+        sum[0] += a[2 * i];
+        sum[1] += a[2 * i + 1];
+    }
+    result.fResidualDc[0] = sum[0] / nRate;
+    result.fResidualDc[1] = sum[1] / nRate;
+    bPass = bPass && fabs(result.fResidualDc[0]) < 0.002 && fabs(result.fResidualDc[1]) < 0.002;
+
+    DspOptions swap;
+    swap.channels = DSP_CHANNELS_SWAP;
+    chain.Init(swap, format);
+    fused = input;
+    RunChain(chain, false, sizes, nFrameBytes, fused);
+    toFloat.ToFloat(fused.data(), a.data(), a.size());
+    toFloat.ToFloat(input.data(), b.data(), b.size());
+    result.bSwapped = true;
+    for (uint32_t i = 0; i < nFrames; i++) {
+        result.bSwapped = result.bSwapped && fabsf(a[2 * i] - b[2 * i + 1]) <= 1e-6f && fabsf(a[2 * i + 1] - b[2 * i]) <= 1e-6f;
+    }
+
+    DspOptions mono;
+    mono.channels = DSP_CHANNELS_MONO;
+    chain.Init(mono, format);
+    fused = input;
+    RunChain(chain, false, sizes, nFrameBytes, fused);
+    toFloat.ToFloat(fused.data(), a.data(), a.size());
+    result.bMono = true;
+    for (uint32_t i = 0; i < nFrames; i++) {
+        result.bMono = result.bMono && a[2 * i] == a[2 * i + 1];
+    }
+
+    result.bPass = bPass && result.bSwapped && result.bMono && result.nKernels == 23;
+    return result;
+}
@@ -0,0 +1,126 @@
+// dsp.h
+
+// optional processing of the repaired stereo stream: DC offset removal, a
+// channel swap or mono sum, gain and a peak limiter, always in that order
+//
+// each stage is a small struct whose Process works on one stereo frame in
+// float. the stages that are switched on are strung together at compile
+// time into one kernel per sample format, so a packet is loaded, run
+// through every stage and stored in a single pass over the ring with the
+// stages inlined into the loop. every combination is compiled in and Init
+// picks the one the options call for, so nothing is decided per sample.
+// the samples stay in float from the first stage to the last, so a gain
+// that goes over full scale reaches the limiter intact instead of clipped
+//
+// no Windows dependencies
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "audioformat.h"
+
+enum DspChannels {
+    DSP_CHANNELS_AS_IS,
+    DSP_CHANNELS_SWAP,
+    DSP_CHANNELS_MONO, // both get the average of the two
+};
+
+// the high pass that takes out DC sits this far down
+#define DSP_DC_CUTOFF_HZ 10
+
+// how fast the limiter lets go again, to within 1/e
+#define DSP_LIMIT_RELEASE_MS 50
+
+// --limit without a ceiling of its own
+#define DSP_DEFAULT_LIMIT_DB -1.0
+
+struct DspOptions {
+    bool bRemoveDc;
+    DspChannels channels;
+    double fGainDb;  // 0 for none
+    bool bLimit;
+    double fLimitDb; // ceiling in dBFS, below 0
+
+    DspOptions()
+        : bRemoveDc(false)
+        , channels(DSP_CHANNELS_AS_IS)
+        , fGainDb(0)
+        , bLimit(false)
+        , fLimitDb(DSP_DEFAULT_LIMIT_DB)
+    {}
+
+    bool Any() const { return bRemoveDc || DSP_CHANNELS_AS_IS != channels || 0 != fGainDb || bLimit; }
+};
+
+// what the stages keep between frames, all in one place so a kernel can
+// keep it in registers for the length of a packet
+struct DspState {
+    float fDcCoefficient;
+    float dcIn[2];
+    float dcOut[2];
+    float fGain;
+    float fCeiling;
+    float fRelease;
+    float fLimitGain;
+    uint64_t nLimitedFrames;
+};
+
+typedef void (*DspKernel)(DspState &state, uint8_t *pData, uint32_t nFrames);
+
+class DspChain {
+public:
+    DspChain();
+
+    // format is the repacked stereo format; false if the options are out
+    // of range or the format can't be processed
+    bool Init(const DspOptions &options, const AudioFormat &format);
+
+    // false if every stage is off, in which case there is nothing to call
+    bool IsActive() const { return NULL != m_pFused; }
+
+    // in place, any number of whole frames
+    void Process(uint8_t *pData, uint32_t nFrames) { m_pFused(m_state, pData, nFrames); }
+
+    // the same stages one whole pass over the frames at a time, the way
+    // separate effects would run; for checking and benchmarking Process
+    void ProcessStaged(uint8_t *pData, uint32_t nFrames);
+
+    // back to how Init left it, for a new stream
+    void Reset();
+
+    // "DC removal, channels swapped, gain +3.0 dB, limiter at -1.0 dBFS"
+    std::string Describe() const;
+
+    // frames the limiter turned down
+    uint64_t LimitedFrames() const { return m_state.nLimitedFrames; }
+
+private:
+    DspOptions m_options;
+    DspState m_initial;
+    DspState m_state;
+    DspKernel m_pFused;
+    DspKernel m_staged[4];
+    uint32_t m_nStaged;
+};
+
+// ---- offline check ----
+
+struct DspSimulationResult {
+    uint32_t nKernels;         // combinations of stages checked against ProcessStaged
+    double fWorstDifference;   // between the two, as a fraction of full scale
+    double fAllowedDifference; // what requantizing between stages can account for
+    double fPeakDb;            // loudest output of +20 dB of gain into a limiter at -1 dBFS
+    double fResidualDc[2];     // mean of the last second after DC removal
+    bool bSwapped;             // each channel came out on the other side
+    bool bMono;                // both channels came out the same
+    bool bPass;
+};
+
+// two tones with a DC offset on each channel, in the given stereo format
+// and in packets of random size; runs every combination of stages through
+// the fused kernel and one stage at a time, and checks what the limiter,
+// DC removal, swap and mono sum each do on their own
+DspSimulationResult SimulateDsp(const AudioFormat &format, uint32_t nSeed);
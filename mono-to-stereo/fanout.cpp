@@ -0,0 +1,91 @@
+// fanout.cpp
+
+#include "fanout.h"
+
+#include <chrono>
+#include <thread>
+
+FanoutSimulationResult SimulateFanout(uint32_t nReaders, double fSeconds) {
+    const uint32_t nRate = 48000;
+    const uint32_t nPacket = nRate / 100;
+
+    FanoutSimulationResult result = {};
+    result.nReaders = (std::max)(nReaders, 2u);
+
+    // 4096 frames, about 85 ms
+    FanoutRing ring;
+    ring.Init(sizeof(uint32_t), nRate / 12, result.nReaders);
+
+    std::atomic<bool> bDone(false);
+    std::vector<uint64_t> errors(result.nReaders, 0);
+    std::vector<uint64_t> laps(result.nReaders, 0);
+    std::vector<std::thread> threads;
+
+    for (uint32_t r = 0; r < result.nReaders; r++) {
+        threads.emplace_back([&, r]() {
+            FanoutReader &reader = ring.Reader(r);
+            bool bStalls = r == result.nReaders - 1;
+            uint32_t nExpected = 0;
+            uint32_t nPolls = 0;
+
+            while (!bDone.load(std::memory_order_acquire) || reader.ReadAvailable() != 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(bStalls && ++nPolls % 50 == 0 ? 200 : 2));
+                reader.NoteReadFill(reader.ReadAvailable());
+
+                for (;;) {
+                    const uint8_t *pData;
+                    uint32_t nPosition = reader.ReadPosition();
+                    uint32_t n = reader.BeginRead(&pData);
+                    if (n == 0) {
+                        break;
+                    }
+
+                    // a lap shows up as a jump in the read position
+                    if (nPosition != nExpected && !bStalls) {
+                        errors[r] += nPosition - nExpected;
+                    }
+
+                    for (uint32_t i = 0; i < n; i++) {
+                        uint32_t nValue;
+                        memcpy(&nValue, pData + static_cast<size_t>(i) * sizeof(nValue), sizeof(nValue));
+                        if (nValue != nPosition + i && !bStalls) {
+                            errors[r]++;
+                        }
+                    }
+
+                    if (!reader.CommitRead(n)) {
+                        laps[r]++;
+                    }
+                    nExpected = reader.ReadPosition();
+                }
+            }
+        });
+    }
+
+    std::vector<uint32_t> packet(nPacket);
+    uint64_t nPackets = static_cast<uint64_t>(fSeconds * 100);
+    auto next = std::chrono::steady_clock::now();
+    for (uint64_t p = 0; p < nPackets; p++) {
+        next += std::chrono::milliseconds(10);
+        std::this_thread::sleep_until(next);
+
+        for (uint32_t i = 0; i < nPacket; i++) {
+            packet[i] = static_cast<uint32_t>(result.nFramesWritten) + i;
+        }
+        ring.Write(reinterpret_cast<const uint8_t *>(packet.data()), nPacket);
+        result.nFramesWritten += nPacket;
+    }
+
+    bDone.store(true, std::memory_order_release);
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+
+    for (uint32_t r = 0; r + 1 < result.nReaders; r++) {
+        result.nHealthyErrors += errors[r] + laps[r] + ring.Reader(r).GetStats().nOverrunFrames;
+    }
+    result.healthy = ring.Reader(0).GetStats();
+    result.stalled = ring.Reader(result.nReaders - 1).GetStats();
+    result.nStalledLaps = laps[result.nReaders - 1];
+    return result;
+}
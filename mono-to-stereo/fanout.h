@@ -0,0 +1,302 @@
+// fanout.h
+
+// lock-free single-producer/multi-consumer ring of fixed-size frames
+//
+// the capture thread repacks each packet into the ring once and every
+// output reads the same frames through its own cursor, straight into its
+// device buffer. the producer never waits for anyone: if an output falls a
+// whole ring behind, its cursor is pushed forward past the frames about to
+// be overwritten and they count as that output's overrun, so one slow or
+// dead output can't hold up the others
+//
+// each reader has the same consumer-side interface as SpscRing
+//
+// no Windows dependencies; usable without any audio device
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "ring.h"
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable: 4324) // structure was padded due to alignment specifier
+#endif
+
+class FanoutRing;
+
+class FanoutReader {
+public:
+    FanoutReader() : m_pRing(NULL), m_nReadStart(0) {
+        m_nTail.store(0, std::memory_order_relaxed);
+        ResetCounters();
+    }
+
+    uint32_t FrameBytes() const;
+    uint32_t CapacityFrames() const;
+
+    uint32_t ReadAvailable() const;
+
+    // borrows the next contiguous readable region
+    uint32_t BeginRead(const uint8_t **ppData);
+
+    // returns false if the producer lapped this reader while the region was
+    // borrowed, in which case some of it may already have been overwritten;
+    // the caller has to silence whatever it made of those nFrames, which
+    // count as torn
+    bool CommitRead(uint32_t nFrames) {
+        uint32_t nExpected = m_nReadStart;
+        m_nReadStart += nFrames;
+        if (!m_nTail.compare_exchange_strong(nExpected, m_nReadStart, std::memory_order_release, std::memory_order_relaxed)) {
+            m_nReadStart = nExpected;
+            m_nTornFrames.fetch_add(nFrames, std::memory_order_relaxed);
+            m_nTornReads.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    // position of the next frame to be read, see SpscRing::WritePosition
+    uint32_t ReadPosition() const {
+        return m_nTail.load(std::memory_order_relaxed);
+    }
+
+    void NoteUnderrun(uint32_t nFrames) {
+        m_nUnderrunFrames.fetch_add(nFrames, std::memory_order_relaxed);
+        m_nUnderruns.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // records the fill level this reader saw before draining
+    void NoteReadFill(uint32_t nFill) {
+        if (nFill < m_nMinFill.load(std::memory_order_relaxed)) {
+            m_nMinFill.store(nFill, std::memory_order_relaxed);
+        }
+        if (nFill > m_nMaxFill.load(std::memory_order_relaxed)) {
+            m_nMaxFill.store(nFill, std::memory_order_relaxed);
+        }
+    }
+
+    // copies up to nFrames out of the ring, torn ones as silence; returns
+    // the number read
+    uint32_t Read(uint8_t *pData, uint32_t nFrames);
+
+    // callable from either side; overruns are the frames this reader was
+    // pushed past
+    RingStats GetStats() const;
+
+private:
+    friend class FanoutRing;
+
+    FanoutReader(const FanoutReader &) = delete;
+    FanoutReader &operator=(const FanoutReader &) = delete;
+
+    void ResetCounters() {
+        m_nMaxFill.store(0, std::memory_order_relaxed);
+        m_nMinFill.store(UINT32_MAX, std::memory_order_relaxed);
+        m_nOverrunFrames.store(0, std::memory_order_relaxed);
+        m_nUnderrunFrames.store(0, std::memory_order_relaxed);
+        m_nOverruns.store(0, std::memory_order_relaxed);
+        m_nUnderruns.store(0, std::memory_order_relaxed);
+        m_nTornFrames.store(0, std::memory_order_relaxed);
+        m_nTornReads.store(0, std::memory_order_relaxed);
+    }
+
+    const FanoutRing *m_pRing;
+    uint32_t m_nReadStart; // tail when the current region was borrowed
+
+    // moved forward by the reader, and by the producer when it laps us
+    alignas(64) std::atomic<uint32_t> m_nTail;
+
+    // written by the producer
+    std::atomic<uint64_t> m_nOverrunFrames;
+    std::atomic<uint32_t> m_nOverruns;
+
+    // written by the reader
+    alignas(64) std::atomic<uint32_t> m_nMinFill;
+    std::atomic<uint32_t> m_nMaxFill;
+    std::atomic<uint64_t> m_nUnderrunFrames;
+    std::atomic<uint32_t> m_nUnderruns;
+    std::atomic<uint64_t> m_nTornFrames;
+    std::atomic<uint32_t> m_nTornReads;
+};
+
+class FanoutRing {
+public:
+    FanoutRing() : m_nFrameBytes(0), m_nCapacity(0), m_nMask(0), m_nReaders(0) {
+        m_nHead.store(0, std::memory_order_relaxed);
+    }
+
+    // capacity is rounded up to a power of two
+    // not thread safe; call before handing the ring to the threads
+    bool Init(uint32_t nFrameBytes, uint32_t nMinCapacityFrames, uint32_t nReaders) {
+        if (nFrameBytes == 0 || nMinCapacityFrames == 0 || nMinCapacityFrames > (1u << 30) || nReaders == 0) {
+            return false;
+        }
+
+        uint32_t nCapacity = 1;
+        while (nCapacity < nMinCapacityFrames) {
+            nCapacity <<= 1;
+        }
+
+        m_buffer.assign(static_cast<size_t>(nCapacity) * nFrameBytes, 0);
+        m_readers.reset(new FanoutReader[nReaders]);
+        m_nFrameBytes = nFrameBytes;
+        m_nCapacity = nCapacity;
+        m_nMask = nCapacity - 1;
+        m_nReaders = nReaders;
+        m_nHead.store(0, std::memory_order_relaxed);
+
+        for (uint32_t i = 0; i < nReaders; i++) {
+            m_readers[i].m_pRing = this;
+        }
+        return true;
+    }
+
+    uint32_t FrameBytes() const { return m_nFrameBytes; }
+    uint32_t CapacityFrames() const { return m_nCapacity; }
+    uint32_t Readers() const { return m_nReaders; }
+
+    FanoutReader &Reader(uint32_t nReader) { return m_readers[nReader]; }
+    const FanoutReader &Reader(uint32_t nReader) const { return m_readers[nReader]; }
+
+    // ---- producer side ----
+
+    // borrows a contiguous region for up to nFrames frames, which is shorter
+    // if it wraps; readers that would be overwritten are pushed past it first
+    uint32_t BeginWrite(uint8_t **ppData, uint32_t nFrames) {
+        uint32_t nHead = m_nHead.load(std::memory_order_relaxed);
+        uint32_t nOffset = nHead & m_nMask;
+        uint32_t n = (std::min)(nFrames, m_nCapacity - nOffset);
+
+        // every tail has to be at least this far along before we write
+        uint32_t nOldest = nHead + n - m_nCapacity;
+        for (uint32_t i = 0; i < m_nReaders; i++) {
+            FanoutReader &reader = m_readers[i];
+            uint32_t nTail = reader.m_nTail.load(std::memory_order_acquire);
+            while (static_cast<int32_t>(nOldest - nTail) > 0) {
+                if (reader.m_nTail.compare_exchange_weak(nTail, nOldest, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                    reader.m_nOverrunFrames.fetch_add(nOldest - nTail, std::memory_order_relaxed);
+                    reader.m_nOverruns.fetch_add(1, std::memory_order_relaxed);
+                    break;
+                }
+            }
+        }
+
+        *ppData = m_buffer.data() + static_cast<size_t>(nOffset) * m_nFrameBytes;
+        return n;
+    }
+
+    void CommitWrite(uint32_t nFrames) {
+        m_nHead.store(m_nHead.load(std::memory_order_relaxed) + nFrames, std::memory_order_release);
+    }
+
+    // running count of frames ever committed, wrapping at 2^32
+    uint32_t WritePosition() const {
+        return m_nHead.load(std::memory_order_relaxed);
+    }
+
+    // copies all nFrames in, lapping readers as needed
+    void Write(const uint8_t *pData, uint32_t nFrames) {
+        uint32_t nWritten = 0;
+        while (nWritten < nFrames) {
+            uint8_t *pDest;
+            uint32_t n = BeginWrite(&pDest, nFrames - nWritten);
+            memcpy(pDest, pData + static_cast<size_t>(nWritten) * m_nFrameBytes, static_cast<size_t>(n) * m_nFrameBytes);
+            CommitWrite(n);
+            nWritten += n;
+        }
+    }
+
+private:
+    friend class FanoutReader;
+
+    FanoutRing(const FanoutRing &) = delete;
+    FanoutRing &operator=(const FanoutRing &) = delete;
+
+    std::vector<uint8_t> m_buffer;
+    std::unique_ptr<FanoutReader[]> m_readers;
+    uint32_t m_nFrameBytes;
+    uint32_t m_nCapacity;
+    uint32_t m_nMask;
+    uint32_t m_nReaders;
+
+    alignas(64) std::atomic<uint32_t> m_nHead; // written by producer
+};
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+inline uint32_t FanoutReader::FrameBytes() const { return m_pRing->m_nFrameBytes; }
+inline uint32_t FanoutReader::CapacityFrames() const { return m_pRing->m_nCapacity; }
+
+inline uint32_t FanoutReader::ReadAvailable() const {
+    return m_pRing->m_nHead.load(std::memory_order_acquire) - m_nTail.load(std::memory_order_acquire);
+}
+
+inline uint32_t FanoutReader::BeginRead(const uint8_t **ppData) {
+    uint32_t nTail = m_nTail.load(std::memory_order_acquire);
+    uint32_t nFill = m_pRing->m_nHead.load(std::memory_order_acquire) - nTail;
+    uint32_t nOffset = nTail & m_pRing->m_nMask;
+    m_nReadStart = nTail;
+    *ppData = m_pRing->m_buffer.data() + static_cast<size_t>(nOffset) * m_pRing->m_nFrameBytes;
+    return (std::min)(nFill, m_pRing->m_nCapacity - nOffset);
+}
+
+inline uint32_t FanoutReader::Read(uint8_t *pData, uint32_t nFrames) {
+    uint32_t nFrameBytes = m_pRing->m_nFrameBytes;
+    uint32_t nRead = 0;
+    while (nRead < nFrames) {
+        const uint8_t *pSrc;
+        uint32_t n = (std::min)(BeginRead(&pSrc), nFrames - nRead);
+        if (n == 0) {
+            break;
+        }
+        uint8_t *pDest = pData + static_cast<size_t>(nRead) * nFrameBytes;
+        memcpy(pDest, pSrc, static_cast<size_t>(n) * nFrameBytes);
+        if (!CommitRead(n)) {
+            memset(pDest, 0, static_cast<size_t>(n) * nFrameBytes);
+        }
+        nRead += n;
+    }
+    return nRead;
+}
+
+inline RingStats FanoutReader::GetStats() const {
+    RingStats stats;
+    stats.nCapacityFrames = m_pRing->m_nCapacity;
+    stats.nFillFrames = ReadAvailable();
+    stats.nMaxFillFrames = m_nMaxFill.load(std::memory_order_relaxed);
+    stats.nMinFillFrames = m_nMinFill.load(std::memory_order_relaxed);
+    stats.nOverrunFrames = m_nOverrunFrames.load(std::memory_order_relaxed);
+    stats.nUnderrunFrames = m_nUnderrunFrames.load(std::memory_order_relaxed);
+    stats.nOverruns = m_nOverruns.load(std::memory_order_relaxed);
+    stats.nUnderruns = m_nUnderruns.load(std::memory_order_relaxed);
+    stats.nTornFrames = m_nTornFrames.load(std::memory_order_relaxed);
+    stats.nTornReads = m_nTornReads.load(std::memory_order_relaxed);
+    return stats;
+}
+
+// ---- offline check ----
+
+struct FanoutSimulationResult {
+    uint32_t nReaders;
+    uint64_t nFramesWritten;
+    uint64_t nHealthyErrors;   // frames the keeping-up readers got wrong or missed
+    RingStats healthy;         // the first reader's view
+    RingStats stalled;         // the last reader's view; it stops now and then
+    uint64_t nStalledLaps;     // reads the stalled reader had taken away from it
+};
+
+// real threads at real speed: a producer writes 10 ms packets of 48 kHz
+// frames that each hold their own index, nReaders - 1 readers drain the ring
+// every 2 ms and check every frame, and the last reader keeps stalling for
+// longer than the ring holds
+FanoutSimulationResult SimulateFanout(uint32_t nReaders, double fSeconds);
@@ -0,0 +1,369 @@
+// fileconvert.cpp
+
+#include "fileconvert.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "fileio.h"
+#include "phasedetect.h"
+#include "repack.h"
+#include "wavfile.h"
+
+// how much of the input is mapped at once
+#define CONVERT_WINDOW_BYTES (64u * 1024 * 1024)
+
+// how much output is collected before each write
+#define CONVERT_OUTPUT_BYTES (4u * 1024 * 1024)
+
+// how far into the file we look for the data chunk
+#define CONVERT_HEADER_PROBE_BYTES (64u * 1024)
+
+// how much of the start of the input decides the channel phase
+#define CONVERT_PHASE_SCAN_SECONDS 10
+
+bool IsWavPath(const std::string &path) {
+    if (path.size() < 4) {
+        return false;
+    }
+
+    std::string ext = path.substr(path.size() - 4);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) {
+        return static_cast<char>(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+    });
+    return ext == ".wav";
+}
+
+// the phase is decided from the first packets of the stream, and everything
+// after the first output frame is the input as it is, only a few samples
+// later (repack.h), so it's handed straight to the output
+static bool ConvertStream(const ConvertOptions &options, ConvertResult &result, std::string &error) {
+    const std::string inputName = "-" == options.inputPath ? "standard input" : options.inputPath;
+    const std::string outputName = "-" == options.outputPath ? "standard output" : options.outputPath;
+
+    StreamInput in;
+    if (!in.Open(options.inputPath, error)) {
+        error = inputName + ": " + error;
+        return false;
+    }
+
+    // a stream has no header to look at
+    AudioFormat format = options.rawFormat;
+    format.nBlockAlign = static_cast<uint16_t>(format.nChannels * format.wBitsPerSample / 8);
+
+    if (!CheckMultiplexedInputFormat(format, options.nMultiplex, error)) {
+        error = inputName + ": " + error;
+        return false;
+    }
+
+    AudioFormat outFormat = DemultiplexedFormat(format, options.nMultiplex);
+
+    // the only buffers; the phase scan and the copy when splicing can't be done
+    const bool bScan = options.bDetectPhase && 2 == options.nMultiplex && 1 == format.nChannels;
+    const size_t nScanBytes = bScan ? static_cast<size_t>(format.nSamplesPerSec) * CONVERT_PHASE_SCAN_SECONDS * format.nBlockAlign : 0;
+    std::vector<uint8_t> inBuffer((std::max)(nScanBytes, static_cast<size_t>(CONVERT_OUTPUT_BYTES)));
+    std::vector<uint8_t> outBuffer(nScanBytes + 2 * static_cast<size_t>(outFormat.nBlockAlign));
+
+    size_t nHeadBytes = 0;
+    if (bScan && !in.Read(inBuffer.data(), nScanBytes, nHeadBytes, error)) {
+        error = inputName + ": " + error;
+        return false;
+    }
+    uint64_t nInputBytes = nHeadBytes;
+
+    uint32_t nSampleOffset = options.nSampleOffset;
+    bool bPhaseDetected = false;
+    const uint32_t nHeadFrames = static_cast<uint32_t>(nHeadBytes / format.nBlockAlign);
+    if (nHeadFrames >= 2) {
+        // fed in device sized packets so it sees the same pairs as a capture
+        PhaseDetector detector;
+        detector.Init(format);
+        const uint32_t nPacket = (std::max)((format.nSamplesPerSec / 100) & ~1u, 2u);
+        for (uint32_t i = 0; i < nHeadFrames; i += nPacket) {
+            detector.Analyze(inBuffer.data() + static_cast<size_t>(i) * format.nBlockAlign, (std::min)(nPacket, nHeadFrames - i));
+        }
+
+        if (PHASE_UNKNOWN != detector.Phase()) {
+            nSampleOffset = PHASE_SKIP_FIRST == detector.Phase() ? 1 : 0;
+            bPhaseDetected = true;
+        }
+    }
+
+    RepackState repack;
+    if (!RepackInit(repack, format.nBlockAlign, options.nMultiplex, nSampleOffset)) {
+        error = "can't start " + std::to_string(nSampleOffset) + " samples into a frame of " + std::to_string(options.nMultiplex);
+        return false;
+    }
+    RepackKernel pRepack = RepackKernelFor(format.nBlockAlign, options.nMultiplex);
+
+    OutputFile out;
+    if (!out.Open(options.outputPath, error)) {
+        error = outputName + ": " + error;
+        return false;
+    }
+
+    bool bWav = IsWavPath(options.outputPath);
+    uint8_t header[WAV_HEADER_BYTES];
+    if (bWav) {
+        BuildWavHeader(outFormat, 0, header);
+        if (!out.Write(header, sizeof(header), error)) {
+            error = outputName + ": " + error;
+            return false;
+        }
+    }
+
+    // the scanned head, then just enough more to finish the frame the
+    // carried samples are part of. from there on input and output frames
+    // line up and nothing more is carried
+    uint32_t nFrames = pRepack(repack, inBuffer.data(), nHeadFrames, outBuffer.data());
+    bool bEnd = bScan && nHeadBytes < nScanBytes;
+    if (!bEnd && RepackCarried(repack) != 0) {
+        const size_t nMissingBytes = static_cast<size_t>(options.nMultiplex - RepackCarried(repack)) * format.nBlockAlign;
+        size_t nRead;
+        if (!in.Read(inBuffer.data(), nMissingBytes, nRead, error)) {
+            error = inputName + ": " + error;
+            return false;
+        }
+        nInputBytes += nRead;
+        nFrames += pRepack(repack, inBuffer.data(), static_cast<uint32_t>(nRead / format.nBlockAlign), outBuffer.data() + static_cast<size_t>(nFrames) * outFormat.nBlockAlign);
+        bEnd = nRead < nMissingBytes;
+    }
+
+    uint64_t nOutputBytes = static_cast<uint64_t>(nFrames) * outFormat.nBlockAlign;
+    if (!out.Write(outBuffer.data(), static_cast<size_t>(nOutputBytes), error)) {
+        error = outputName + ": " + error;
+        return false;
+    }
+
+    StreamCopyResult copy = {};
+    if (!bEnd) {
+        if (!in.CopyTo(out, outFormat.nBlockAlign, inBuffer.data(), inBuffer.size(), copy, error)) {
+            error = inputName + " to " + outputName + ": " + error;
+            return false;
+        }
+        nInputBytes += copy.nBytes + copy.nDroppedBytes;
+        nOutputBytes += copy.nBytes;
+    }
+
+    if (bWav) {
+        BuildWavHeader(outFormat, nOutputBytes, header);
+        if (!out.WriteAt(0, header, sizeof(header), error)) {
+            error = outputName + ": " + error;
+            return false;
+        }
+    }
+
+    if (!out.Close(error)) {
+        error = outputName + ": " + error;
+        return false;
+    }
+
+    result.inputFormat = format;
+    result.outputFormat = outFormat;
+    result.nInputFrames = nInputBytes / format.nBlockAlign;
+    result.nOutputFrames = nOutputBytes / outFormat.nBlockAlign;
+    result.nOutputBytes = nOutputBytes;
+    result.nMultiplex = options.nMultiplex;
+    result.nSampleOffset = nSampleOffset;
+    result.bPhaseDetected = bPhaseDetected;
+    result.bSpliced = !bEnd && copy.bZeroCopy;
+    return true;
+}
+
+bool PlanConversion(const ConvertOptions &options, MappedInputFile &in, ConvertPlan &plan, std::string &error) {
+    if (in.Size() == 0) {
+        error = "file is empty";
+        return false;
+    }
+
+    // work out what's in the file
+    AudioFormat format = options.rawFormat;
+    uint64_t nDataOffset = 0;
+    uint64_t nDataBytes = in.Size();
+
+    size_t nProbeBytes = static_cast<size_t>((std::min)(in.Size(), static_cast<uint64_t>(CONVERT_HEADER_PROBE_BYTES)));
+    const uint8_t *pProbe = in.Map(0, nProbeBytes, error);
+    if (nullptr == pProbe) {
+        return false;
+    }
+
+    if (LooksLikeWav(pProbe, nProbeBytes)) {
+        WavInfo info;
+        if (!ParseWavHeader(pProbe, nProbeBytes, in.Size(), info, error)) {
+            return false;
+        }
+        format = info.format;
+        nDataOffset = info.nDataOffset;
+        nDataBytes = info.nDataBytes;
+    }
+
+    // same fixup LoopbackCapture does on the mix format
+    format.nBlockAlign = static_cast<uint16_t>(format.nChannels * format.wBitsPerSample / 8);
+
+    if (!CheckMultiplexedInputFormat(format, options.nMultiplex, error)) {
+        return false;
+    }
+
+    const uint64_t nInputFrames = nDataBytes / format.nBlockAlign;
+
+    uint32_t nSampleOffset = options.nSampleOffset;
+    bool bPhaseDetected = false;
+    if (options.bDetectPhase && 2 == options.nMultiplex && 1 == format.nChannels && nInputFrames >= 2) {
+        uint64_t nScanFrames = (std::min)(nInputFrames, static_cast<uint64_t>(format.nSamplesPerSec) * CONVERT_PHASE_SCAN_SECONDS);
+        const uint8_t *pScan = in.Map(nDataOffset, static_cast<size_t>(nScanFrames * format.nBlockAlign), error);
+        if (nullptr == pScan) {
+            return false;
+        }
+
+        // fed in device sized packets so it sees the same pairs as a capture
+        PhaseDetector detector;
+        detector.Init(format);
+        const uint32_t nPacket = (std::max)((format.nSamplesPerSec / 100) & ~1u, 2u);
+        for (uint64_t i = 0; i < nScanFrames; i += nPacket) {
+            uint32_t n = static_cast<uint32_t>((std::min)(static_cast<uint64_t>(nPacket), nScanFrames - i));
+            detector.Analyze(pScan + i * format.nBlockAlign, n);
+        }
+
+        if (PHASE_UNKNOWN != detector.Phase()) {
+            nSampleOffset = PHASE_SKIP_FIRST == detector.Phase() ? 1 : 0;
+            bPhaseDetected = true;
+        }
+    }
+
+    if (nSampleOffset >= options.nMultiplex) {
+        error = "can't start " + std::to_string(nSampleOffset) + " samples into a frame of " + std::to_string(options.nMultiplex);
+        return false;
+    }
+
+    plan.inputFormat = format;
+    plan.outputFormat = DemultiplexedFormat(format, options.nMultiplex);
+    plan.nDataOffset = nDataOffset;
+    plan.nInputFrames = nInputFrames;
+    plan.nOutputFrames = (nInputFrames + nSampleOffset) / options.nMultiplex;
+    plan.nSampleOffset = nSampleOffset;
+    plan.bPhaseDetected = bPhaseDetected;
+    return true;
+}
+
+bool ConvertFile(const ConvertOptions &options, ConvertResult &result, std::string &error) {
+    if ("-" == options.inputPath) {
+        return ConvertStream(options, result, error);
+    }
+
+    MappedInputFile in;
+    if (!in.Open(options.inputPath, error)) {
+        error = options.inputPath + ": " + error;
+        return false;
+    }
+
+    ConvertPlan plan;
+    if (!PlanConversion(options, in, plan, error)) {
+        error = options.inputPath + ": " + error;
+        return false;
+    }
+
+    const AudioFormat &format = plan.inputFormat;
+    const AudioFormat &outFormat = plan.outputFormat;
+    const uint64_t nInputFrames = plan.nInputFrames;
+    const uint64_t nDataOffset = plan.nDataOffset;
+    const uint32_t nSampleOffset = plan.nSampleOffset;
+
+    RepackState repack;
+    if (!RepackInit(repack, format.nBlockAlign, options.nMultiplex, nSampleOffset)) {
+        error = "can't start " + std::to_string(nSampleOffset) + " samples into a frame of " + std::to_string(options.nMultiplex);
+        return false;
+    }
+    RepackKernel pRepack = RepackKernelFor(format.nBlockAlign, options.nMultiplex);
+
+    OutputFile out;
+    if (!out.Open(options.outputPath, error)) {
+        error = options.outputPath + ": " + error;
+        return false;
+    }
+
+    bool bWav = IsWavPath(options.outputPath);
+    uint8_t header[WAV_HEADER_BYTES];
+    if (bWav) {
+        // placeholder until we know how much data there is
+        BuildWavHeader(outFormat, 0, header);
+        if (!out.Write(header, sizeof(header), error)) {
+            error = options.outputPath + ": " + error;
+            return false;
+        }
+    }
+
+    // windows hold whole output frames, all but the last one; the carried
+    // samples are the only state between them. when nothing is carried the
+    // mapped input is written out as it is
+    const size_t nFrameBytes = outFormat.nBlockAlign;
+    const uint64_t nWindowBytes = CONVERT_WINDOW_BYTES / nFrameBytes * nFrameBytes;
+    const uint32_t nBlockOutFrames = CONVERT_OUTPUT_BYTES / outFormat.nBlockAlign;
+
+    std::vector<uint8_t> outBuffer(static_cast<size_t>(nBlockOutFrames) * outFormat.nBlockAlign);
+
+    const uint64_t nUsableBytes = nInputFrames * format.nBlockAlign;
+    uint64_t nOutputBytes = 0;
+
+    for (uint64_t nDone = 0; nDone < nUsableBytes; ) {
+        size_t nWindow = static_cast<size_t>((std::min)(nWindowBytes, nUsableBytes - nDone));
+        const uint8_t *pWindow = in.Map(nDataOffset + nDone, nWindow, error);
+        if (nullptr == pWindow) {
+            error = options.inputPath + ": " + error;
+            return false;
+        }
+
+        uint32_t nWindowSamples = static_cast<uint32_t>(nWindow / format.nBlockAlign);
+        uint32_t nWindowOutFrames = RepackOutputFrames(repack, nWindowSamples);
+        if (nullptr != RepackInPlace(repack, pWindow, nWindowSamples)) {
+            size_t nBytes = static_cast<size_t>(nWindowOutFrames) * outFormat.nBlockAlign;
+            if (!out.Write(pWindow, nBytes, error)) {
+                error = options.outputPath + ": " + error;
+                return false;
+            }
+
+            nOutputBytes += nBytes;
+            nDone += nWindow;
+            continue;
+        }
+
+        for (uint32_t nIn = 0; nIn < nWindowSamples; ) {
+            uint32_t nSamples = (std::min)(nBlockOutFrames * options.nMultiplex, nWindowSamples - nIn);
+            uint32_t nFrames = pRepack(repack, pWindow + static_cast<size_t>(nIn) * format.nBlockAlign, nSamples, outBuffer.data());
+
+            size_t nBytes = static_cast<size_t>(nFrames) * outFormat.nBlockAlign;
+            if (!out.Write(outBuffer.data(), nBytes, error)) {
+                error = options.outputPath + ": " + error;
+                return false;
+            }
+
+            nOutputBytes += nBytes;
+            nIn += nSamples;
+        }
+
+        nDone += nWindow;
+    }
+
+    if (bWav) {
+        BuildWavHeader(outFormat, nOutputBytes, header);
+        if (!out.WriteAt(0, header, sizeof(header), error)) {
+            error = options.outputPath + ": " + error;
+            return false;
+        }
+    }
+
+    if (!out.Close(error)) {
+        error = options.outputPath + ": " + error;
+        return false;
+    }
+
+    result.inputFormat = format;
+    result.outputFormat = outFormat;
+    result.nInputFrames = nInputFrames;
+    result.nOutputFrames = nOutputBytes / outFormat.nBlockAlign;
+    result.nOutputBytes = nOutputBytes;
+    result.nMultiplex = options.nMultiplex;
+    result.nSampleOffset = nSampleOffset;
+    result.bPhaseDetected = plan.bPhaseDetected;
+    result.bSpliced = false;
+    return true;
+}
@@ -0,0 +1,68 @@
+// fileconvert.h
+
+// offline version of the capture loop: streams a recorded capture (WAV or
+// headerless PCM) through the same repacking and writes the real stereo
+// (or wider) stream out, without touching any audio device
+//
+// an input path of "-" makes it a filter: headerless PCM from standard
+// input, written out as it arrives to the output, which can be "-" for
+// standard output. only the start of the stream is looked at and copied;
+// the rest is spliced across where the system allows it (fileio.h)
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "audioformat.h"
+
+struct ConvertOptions {
+    std::string inputPath;     // "-" for standard input
+    std::string outputPath;    // written as WAV if it ends in .wav, raw PCM otherwise; "-" for standard output
+    uint32_t nMultiplex;       // input samples per output frame; 2 for mono into stereo
+    uint32_t nSampleOffset;    // samples the first output frame is missing; used if bDetectPhase is off or can't tell
+    bool bDetectPhase;         // look at the start of the input to decide; only for a mono input carrying stereo
+    AudioFormat rawFormat;     // used when the input has no WAV header
+
+    ConvertOptions()
+        : nMultiplex(2)
+        , nSampleOffset(1)
+        , bDetectPhase(true)
+        , rawFormat(MakeAudioFormat(AUDIOFORMAT_TAG_PCM, 1, 96000, 16))
+    {}
+};
+
+struct ConvertResult {
+    AudioFormat inputFormat;
+    AudioFormat outputFormat;
+    uint64_t nInputFrames;
+    uint64_t nOutputFrames;
+    uint64_t nOutputBytes;
+    uint32_t nMultiplex;
+    uint32_t nSampleOffset;
+    bool bPhaseDetected;       // false if nSampleOffset came from the options
+    bool bSpliced;             // the stream after the first frame never went through a buffer
+};
+
+bool ConvertFile(const ConvertOptions &options, ConvertResult &result, std::string &error);
+
+class MappedInputFile;
+
+// what's worked out from a file before anything is written: where its
+// samples are, what they are and how they line up with output frames
+struct ConvertPlan {
+    AudioFormat inputFormat;
+    AudioFormat outputFormat;
+    uint64_t nDataOffset;      // of the first sample in the file
+    uint64_t nInputFrames;
+    uint64_t nOutputFrames;
+    uint32_t nSampleOffset;
+    bool bPhaseDetected;
+};
+
+// reads the header, if there is one, and the start of the samples of a
+// file opened for ConvertFile (batchconvert.h converts from the plan)
+bool PlanConversion(const ConvertOptions &options, MappedInputFile &in, ConvertPlan &plan, std::string &error);
+
+// true if the path ends in .wav, ignoring case
+bool IsWavPath(const std::string &path);
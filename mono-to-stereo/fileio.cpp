@@ -0,0 +1,833 @@
+// fileio.cpp
+
+#include "fileio.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+static std::wstring WideFromUtf8(const std::string &s) {
+    int n = MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, NULL, 0);
+    if (n <= 0) {
+        return std::wstring();
+    }
+    std::wstring w(static_cast<size_t>(n), L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, &w[0], n);
+    w.resize(static_cast<size_t>(n) - 1);
+    return w;
+}
+
+static std::string LastErrorString(const char *szWhat) {
+    return std::string(szWhat) + " failed: last error = " + std::to_string(GetLastError());
+}
+
+MappedInputFile::MappedInputFile()
+    : m_hFile(INVALID_HANDLE_VALUE)
+    , m_hMapping(NULL)
+    , m_nSize(0)
+    , m_pView(NULL)
+    , m_nViewBytes(0)
+{}
+
+MappedInputFile::~MappedInputFile() {
+    Close();
+}
+
+bool MappedInputFile::Open(const std::string &path, std::string &error) {
+    Close();
+
+    m_hFile = CreateFileW(
+        WideFromUtf8(path).c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL
+    );
+    if (INVALID_HANDLE_VALUE == m_hFile) {
+        error = LastErrorString("CreateFile");
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_hFile, &size)) {
+        error = LastErrorString("GetFileSizeEx");
+        Close();
+        return false;
+    }
+    m_nSize = static_cast<uint64_t>(size.QuadPart);
+
+    // can't map an empty file; Map will just fail for it
+    if (m_nSize == 0) {
+        return true;
+    }
+
+    m_hMapping = CreateFileMappingW(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (NULL == m_hMapping) {
+        error = LastErrorString("CreateFileMapping");
+        Close();
+        return false;
+    }
+
+    return true;
+}
+
+void MappedInputFile::Unmap() {
+    if (NULL != m_pView) {
+        UnmapViewOfFile(m_pView);
+        m_pView = NULL;
+        m_nViewBytes = 0;
+    }
+}
+
+void MappedInputFile::Close() {
+    Unmap();
+
+    if (NULL != m_hMapping) {
+        CloseHandle(m_hMapping);
+        m_hMapping = NULL;
+    }
+
+    if (INVALID_HANDLE_VALUE != m_hFile) {
+        CloseHandle(m_hFile);
+        m_hFile = INVALID_HANDLE_VALUE;
+    }
+
+    m_nSize = 0;
+}
+
+const uint8_t *MappedInputFile::Map(uint64_t nOffset, size_t nBytes, std::string &error) {
+    Unmap();
+
+    if (NULL == m_hMapping || nBytes == 0 || nOffset + nBytes > m_nSize) {
+        error = "mapping outside of the file";
+        return nullptr;
+    }
+
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    uint64_t nAligned = nOffset - nOffset % si.dwAllocationGranularity;
+    size_t nSlack = static_cast<size_t>(nOffset - nAligned);
+
+    m_pView = MapViewOfFile(
+        m_hMapping, FILE_MAP_READ,
+        static_cast<DWORD>(nAligned >> 32), static_cast<DWORD>(nAligned),
+        nBytes + nSlack
+    );
+    if (NULL == m_pView) {
+        error = LastErrorString("MapViewOfFile");
+        return nullptr;
+    }
+    m_nViewBytes = nBytes + nSlack;
+
+    return static_cast<const uint8_t *>(m_pView) + nSlack;
+}
+
+OutputFile::OutputFile() : m_hFile(INVALID_HANDLE_VALUE) {}
+
+OutputFile::~OutputFile() {
+    std::string ignored;
+    Close(ignored);
+}
+
+// a handle of our own to standard input or output, closed like any other
+static HANDLE DuplicateStdHandle(DWORD nStdHandle) {
+    HANDLE h = INVALID_HANDLE_VALUE;
+    if (!DuplicateHandle(GetCurrentProcess(), GetStdHandle(nStdHandle), GetCurrentProcess(), &h, 0, FALSE, DUPLICATE_SAME_ACCESS)) {
+        return INVALID_HANDLE_VALUE;
+    }
+    return h;
+}
+
+bool OutputFile::Open(const std::string &path, std::string &error) {
+    if ("-" == path) {
+        m_hFile = DuplicateStdHandle(STD_OUTPUT_HANDLE);
+        if (INVALID_HANDLE_VALUE == m_hFile) {
+            error = LastErrorString("DuplicateHandle");
+            return false;
+        }
+        return true;
+    }
+
+    m_hFile = CreateFileW(
+        WideFromUtf8(path).c_str(), GENERIC_WRITE, 0, NULL,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL
+    );
+    if (INVALID_HANDLE_VALUE == m_hFile) {
+        error = LastErrorString("CreateFile");
+        return false;
+    }
+    return true;
+}
+
+bool OutputFile::Close(std::string &error) {
+    if (INVALID_HANDLE_VALUE == m_hFile) {
+        return true;
+    }
+
+    bool bOk = true;
+    if (!CloseHandle(m_hFile)) {
+        error = LastErrorString("CloseHandle");
+        bOk = false;
+    }
+    m_hFile = INVALID_HANDLE_VALUE;
+    return bOk;
+}
+
+bool OutputFile::Write(const void *pData, size_t nBytes, std::string &error) {
+    const uint8_t *p = static_cast<const uint8_t *>(pData);
+    while (nBytes > 0) {
+        DWORD nChunk = nBytes > 0x40000000 ? 0x40000000 : static_cast<DWORD>(nBytes);
+        DWORD nWritten;
+        if (!WriteFile(m_hFile, p, nChunk, &nWritten, NULL)) {
+            error = LastErrorString("WriteFile");
+            return false;
+        }
+        p += nWritten;
+        nBytes -= nWritten;
+    }
+    return true;
+}
+
+bool OutputFile::WriteAt(uint64_t nOffset, const void *pData, size_t nBytes, std::string &error) {
+    LARGE_INTEGER current, zero, target;
+    zero.QuadPart = 0;
+    target.QuadPart = static_cast<LONGLONG>(nOffset);
+
+    if (!SetFilePointerEx(m_hFile, zero, &current, FILE_CURRENT) ||
+        !SetFilePointerEx(m_hFile, target, NULL, FILE_BEGIN)) {
+        error = LastErrorString("SetFilePointerEx");
+        return false;
+    }
+
+    bool bOk = Write(pData, nBytes, error);
+
+    if (!SetFilePointerEx(m_hFile, current, NULL, FILE_BEGIN) && bOk) {
+        error = LastErrorString("SetFilePointerEx");
+        bOk = false;
+    }
+    return bOk;
+}
+
+bool OutputFile::OpenExisting(const std::string &path, std::string &error) {
+    m_hFile = CreateFileW(
+        WideFromUtf8(path).c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL
+    );
+    if (INVALID_HANDLE_VALUE == m_hFile) {
+        error = LastErrorString("CreateFile");
+        return false;
+    }
+    return true;
+}
+
+bool OutputFile::CopyRange(MappedInputFile &, uint64_t, uint64_t, uint64_t, bool &bCopied, std::string &) {
+    bCopied = false;
+    return true;
+}
+
+static std::string Utf8FromWide(const wchar_t *sz) {
+    int n = WideCharToMultiByte(CP_UTF8, 0, sz, -1, NULL, 0, NULL, NULL);
+    if (n <= 0) {
+        return std::string();
+    }
+    std::string s(static_cast<size_t>(n), '\0');
+    WideCharToMultiByte(CP_UTF8, 0, sz, -1, &s[0], n, NULL, NULL);
+    s.resize(static_cast<size_t>(n) - 1);
+    return s;
+}
+
+bool ListDirectory(const std::string &path, std::vector<std::string> &names, std::string &error) {
+    names.clear();
+
+    WIN32_FIND_DATAW data;
+    HANDLE hFind = FindFirstFileW(WideFromUtf8(path + "\\*").c_str(), &data);
+    if (INVALID_HANDLE_VALUE == hFind) {
+        if (ERROR_FILE_NOT_FOUND == GetLastError()) {
+            return true;
+        }
+        error = LastErrorString("FindFirstFile");
+        return false;
+    }
+
+    do {
+        if (0 == (data.dwFileAttributes & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_DEVICE))) {
+            names.push_back(Utf8FromWide(data.cFileName));
+        }
+    } while (FindNextFileW(hFind, &data));
+
+    DWORD dwLastError = GetLastError();
+    FindClose(hFind);
+    if (ERROR_NO_MORE_FILES != dwLastError) {
+        SetLastError(dwLastError);
+        error = LastErrorString("FindNextFile");
+        return false;
+    }
+
+    std::sort(names.begin(), names.end());
+    return true;
+}
+
+bool IsDirectory(const std::string &path) {
+    DWORD dwAttributes = GetFileAttributesW(WideFromUtf8(path).c_str());
+    return INVALID_FILE_ATTRIBUTES != dwAttributes && 0 != (dwAttributes & FILE_ATTRIBUTE_DIRECTORY);
+}
+
+static bool GetFileIdentity(const std::string &path, BY_HANDLE_FILE_INFORMATION &info) {
+    HANDLE h = CreateFileW(
+        WideFromUtf8(path).c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+        OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL
+    );
+    if (INVALID_HANDLE_VALUE == h) {
+        return false;
+    }
+    BOOL bOk = GetFileInformationByHandle(h, &info);
+    CloseHandle(h);
+    return !!bOk;
+}
+
+bool IsSameFile(const std::string &a, const std::string &b) {
+    BY_HANDLE_FILE_INFORMATION infoA, infoB;
+    return GetFileIdentity(a, infoA) && GetFileIdentity(b, infoB) &&
+        infoA.dwVolumeSerialNumber == infoB.dwVolumeSerialNumber &&
+        infoA.nFileIndexHigh == infoB.nFileIndexHigh &&
+        infoA.nFileIndexLow == infoB.nFileIndexLow;
+}
+
+
+StreamInput::StreamInput() : m_hFile(INVALID_HANDLE_VALUE) {}
+
+StreamInput::~StreamInput() {
+    Close();
+}
+
+bool StreamInput::Open(const std::string &path, std::string &error) {
+    Close();
+
+    if ("-" == path) {
+        m_hFile = DuplicateStdHandle(STD_INPUT_HANDLE);
+        if (INVALID_HANDLE_VALUE == m_hFile) {
+            error = LastErrorString("DuplicateHandle");
+            return false;
+        }
+        return true;
+    }
+
+    m_hFile = CreateFileW(
+        WideFromUtf8(path).c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL
+    );
+    if (INVALID_HANDLE_VALUE == m_hFile) {
+        error = LastErrorString("CreateFile");
+        return false;
+    }
+    return true;
+}
+
+void StreamInput::Close() {
+    if (INVALID_HANDLE_VALUE != m_hFile) {
+        CloseHandle(m_hFile);
+        m_hFile = INVALID_HANDLE_VALUE;
+    }
+}
+
+bool StreamInput::ReadSome(void *pData, size_t nBytes, size_t &nRead, std::string &error) {
+    DWORD nChunk = nBytes > 0x40000000 ? 0x40000000 : static_cast<DWORD>(nBytes);
+    DWORD n = 0;
+    if (!ReadFile(m_hFile, pData, nChunk, &n, NULL)) {
+        // the writing end of a pipe went away: that's the end of the input
+        if (ERROR_BROKEN_PIPE != GetLastError()) {
+            error = LastErrorString("ReadFile");
+            return false;
+        }
+        n = 0;
+    }
+    nRead = n;
+    return true;
+}
+
+bool StreamInput::CopyTo(OutputFile &out, uint32_t nUnitBytes, uint8_t *pBuffer, size_t nBufferBytes, StreamCopyResult &result, std::string &error) {
+    result.nBytes = 0;
+    result.nDroppedBytes = 0;
+    return CopyBuffered(out, nUnitBytes, pBuffer, nBufferBytes, 0, result, error);
+}
+
+#else // POSIX
+
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static std::string ErrnoString(const char *szWhat) {
+    return std::string(szWhat) + " failed: " + strerror(errno);
+}
+
+MappedInputFile::MappedInputFile()
+    : m_fd(-1)
+    , m_nSize(0)
+    , m_pView(nullptr)
+    , m_nViewBytes(0)
+{}
+
+MappedInputFile::~MappedInputFile() {
+    Close();
+}
+
+bool MappedInputFile::Open(const std::string &path, std::string &error) {
+    Close();
+
+    m_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_fd < 0) {
+        error = ErrnoString("open");
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(m_fd, &st) != 0) {
+        error = ErrnoString("fstat");
+        Close();
+        return false;
+    }
+    m_nSize = static_cast<uint64_t>(st.st_size);
+
+    posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return true;
+}
+
+void MappedInputFile::Unmap() {
+    if (nullptr != m_pView) {
+        munmap(m_pView, m_nViewBytes);
+        m_pView = nullptr;
+        m_nViewBytes = 0;
+    }
+}
+
+void MappedInputFile::Close() {
+    Unmap();
+
+    if (m_fd >= 0) {
+        close(m_fd);
+        m_fd = -1;
+    }
+
+    m_nSize = 0;
+}
+
+const uint8_t *MappedInputFile::Map(uint64_t nOffset, size_t nBytes, std::string &error) {
+    Unmap();
+
+    if (m_fd < 0 || nBytes == 0 || nOffset + nBytes > m_nSize) {
+        error = "mapping outside of the file";
+        return nullptr;
+    }
+
+    uint64_t nPage = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    uint64_t nAligned = nOffset - nOffset % nPage;
+    size_t nSlack = static_cast<size_t>(nOffset - nAligned);
+
+    void *p = mmap(nullptr, nBytes + nSlack, PROT_READ, MAP_PRIVATE, m_fd, static_cast<off_t>(nAligned));
+    if (MAP_FAILED == p) {
+        error = ErrnoString("mmap");
+        return nullptr;
+    }
+    m_pView = p;
+    m_nViewBytes = nBytes + nSlack;
+
+    // we only ever walk forward through the window once
+    madvise(m_pView, m_nViewBytes, MADV_SEQUENTIAL);
+
+    return static_cast<const uint8_t *>(m_pView) + nSlack;
+}
+
+OutputFile::OutputFile() : m_fd(-1) {}
+
+OutputFile::~OutputFile() {
+    std::string ignored;
+    Close(ignored);
+}
+
+bool OutputFile::Open(const std::string &path, std::string &error) {
+    if ("-" == path) {
+        m_fd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+        if (m_fd < 0) {
+            error = ErrnoString("dup");
+            return false;
+        }
+        return true;
+    }
+
+    m_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_fd < 0) {
+        error = ErrnoString("open");
+        return false;
+    }
+    return true;
+}
+
+bool OutputFile::Close(std::string &error) {
+    if (m_fd < 0) {
+        return true;
+    }
+
+    bool bOk = true;
+    if (close(m_fd) != 0) {
+        error = ErrnoString("close");
+        bOk = false;
+    }
+    m_fd = -1;
+    return bOk;
+}
+
+bool OutputFile::Write(const void *pData, size_t nBytes, std::string &error) {
+    const uint8_t *p = static_cast<const uint8_t *>(pData);
+    while (nBytes > 0) {
+        ssize_t n = write(m_fd, p, nBytes);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error = ErrnoString("write");
+            return false;
+        }
+        p += n;
+        nBytes -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool OutputFile::WriteAt(uint64_t nOffset, const void *pData, size_t nBytes, std::string &error) {
+    const uint8_t *p = static_cast<const uint8_t *>(pData);
+    while (nBytes > 0) {
+        ssize_t n = pwrite(m_fd, p, nBytes, static_cast<off_t>(nOffset));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error = ErrnoString("pwrite");
+            return false;
+        }
+        p += n;
+        nBytes -= static_cast<size_t>(n);
+        nOffset += static_cast<uint64_t>(n);
+    }
+    return true;
+}
+
+bool OutputFile::OpenExisting(const std::string &path, std::string &error) {
+    m_fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (m_fd < 0) {
+        error = ErrnoString("open");
+        return false;
+    }
+    return true;
+}
+
+#ifdef __linux__
+
+bool OutputFile::CopyRange(MappedInputFile &in, uint64_t nInOffset, uint64_t nOutOffset, uint64_t nBytes, bool &bCopied, std::string &error) {
+    bCopied = true;
+
+    loff_t nIn = static_cast<loff_t>(nInOffset);
+    loff_t nOut = static_cast<loff_t>(nOutOffset);
+    bool bStarted = false;
+    while (nBytes > 0) {
+        ssize_t n = copy_file_range(in.m_fd, &nIn, m_fd, &nOut, static_cast<size_t>(nBytes), 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            // an older kernel, different filesystems, or a file system that
+            // can't; it can still be done the slow way if nothing was written
+            if (!bStarted && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) {
+                bCopied = false;
+                return true;
+            }
+
+            error = ErrnoString("copy_file_range");
+            return false;
+        }
+        if (0 == n) {
+            error = "copy_file_range stopped short of the end";
+            return false;
+        }
+        bStarted = true;
+        nBytes -= static_cast<uint64_t>(n);
+    }
+    return true;
+}
+
+#else
+
+bool OutputFile::CopyRange(MappedInputFile &, uint64_t, uint64_t, uint64_t, bool &bCopied, std::string &) {
+    bCopied = false;
+    return true;
+}
+
+#endif
+
+bool ListDirectory(const std::string &path, std::vector<std::string> &names, std::string &error) {
+    names.clear();
+
+    DIR *pDir = opendir(path.c_str());
+    if (NULL == pDir) {
+        error = ErrnoString("opendir");
+        return false;
+    }
+
+    for (;;) {
+        errno = 0;
+        struct dirent *pEntry = readdir(pDir);
+        if (NULL == pEntry) {
+            break;
+        }
+
+        // d_type isn't filled in by every file system
+        struct stat st;
+        std::string name = pEntry->d_name;
+        if (0 == stat((path + "/" + name).c_str(), &st) && S_ISREG(st.st_mode)) {
+            names.push_back(name);
+        }
+    }
+
+    int nErrno = errno;
+    closedir(pDir);
+    if (0 != nErrno) {
+        errno = nErrno;
+        error = ErrnoString("readdir");
+        return false;
+    }
+
+    std::sort(names.begin(), names.end());
+    return true;
+}
+
+bool IsDirectory(const std::string &path) {
+    struct stat st;
+    return 0 == stat(path.c_str(), &st) && S_ISDIR(st.st_mode);
+}
+
+bool IsSameFile(const std::string &a, const std::string &b) {
+    struct stat stA, stB;
+    return 0 == stat(a.c_str(), &stA) && 0 == stat(b.c_str(), &stB) &&
+        stA.st_dev == stB.st_dev && stA.st_ino == stB.st_ino;
+}
+
+
+StreamInput::StreamInput() : m_fd(-1) {}
+
+StreamInput::~StreamInput() {
+    Close();
+}
+
+bool StreamInput::Open(const std::string &path, std::string &error) {
+    Close();
+
+    if ("-" == path) {
+        m_fd = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+        if (m_fd < 0) {
+            error = ErrnoString("dup");
+            return false;
+        }
+        return true;
+    }
+
+    m_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_fd < 0) {
+        error = ErrnoString("open");
+        return false;
+    }
+
+    posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return true;
+}
+
+void StreamInput::Close() {
+    if (m_fd >= 0) {
+        close(m_fd);
+        m_fd = -1;
+    }
+}
+
+bool StreamInput::ReadSome(void *pData, size_t nBytes, size_t &nRead, std::string &error) {
+    for (;;) {
+        ssize_t n = read(m_fd, pData, nBytes);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error = ErrnoString("read");
+            return false;
+        }
+        nRead = static_cast<size_t>(n);
+        return true;
+    }
+}
+
+#ifdef __linux__
+
+// how much the pipe between the input and the output can hold; bigger
+// means fewer system calls, as long as the system lets us have it
+#define STREAM_SPLICE_PIPE_BYTES (1024 * 1024)
+
+bool StreamInput::CopyTo(OutputFile &out, uint32_t nUnitBytes, uint8_t *pBuffer, size_t nBufferBytes, StreamCopyResult &result, std::string &error) {
+    result.nBytes = 0;
+    result.nDroppedBytes = 0;
+    result.bZeroCopy = true;
+
+    // splice needs a pipe on one side, so the data goes from the input into
+    // a pipe of our own and from there to the output. the pages are moved,
+    // not copied, and a partial unit waits in the pipe for the rest of it
+    int pipeFds[2];
+    if (pipe2(pipeFds, O_CLOEXEC) != 0) {
+        return CopyBuffered(out, nUnitBytes, pBuffer, nBufferBytes, 0, result, error);
+    }
+
+    fcntl(pipeFds[1], F_SETPIPE_SZ, STREAM_SPLICE_PIPE_BYTES);
+    int nPipeBytes = fcntl(pipeFds[1], F_GETPIPE_SZ);
+    if (nPipeBytes <= 0) {
+        nPipeBytes = 64 * 1024;
+    }
+
+    // if the output can't be spliced to, what's in the pipe has to fit the buffer
+    const size_t nMaxInPipe = (std::min)(static_cast<size_t>(nPipeBytes), nBufferBytes);
+
+    size_t nInPipe = 0;
+    bool bOk = true;
+    for (;;) {
+        ssize_t n = splice(m_fd, nullptr, pipeFds[1], nullptr, nMaxInPipe - nInPipe, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            // the input is something splice doesn't read from, like a terminal
+            if (errno == EINVAL && 0 == nInPipe && 0 == result.nBytes) {
+                close(pipeFds[0]);
+                close(pipeFds[1]);
+                return CopyBuffered(out, nUnitBytes, pBuffer, nBufferBytes, 0, result, error);
+            }
+
+            error = ErrnoString("splice");
+            bOk = false;
+            break;
+        }
+
+        if (0 == n) {
+            break;
+        }
+        nInPipe += static_cast<size_t>(n);
+
+        size_t nWhole = nInPipe - nInPipe % nUnitBytes;
+        while (nWhole > 0) {
+            ssize_t m = splice(pipeFds[0], nullptr, out.m_fd, nullptr, nWhole, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (m < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                // the output is something splice doesn't write to (a file
+                // opened for appending, say): take back what's in the pipe
+                // and carry on without it
+                if (errno == EINVAL && 0 == result.nBytes) {
+                    size_t nPending = 0;
+                    while (nPending < nInPipe) {
+                        ssize_t r = read(pipeFds[0], pBuffer + nPending, nInPipe - nPending);
+                        if (r <= 0) {
+                            if (r < 0 && errno == EINTR) {
+                                continue;
+                            }
+                            error = ErrnoString("read");
+                            close(pipeFds[0]);
+                            close(pipeFds[1]);
+                            return false;
+                        }
+                        nPending += static_cast<size_t>(r);
+                    }
+                    close(pipeFds[0]);
+                    close(pipeFds[1]);
+                    return CopyBuffered(out, nUnitBytes, pBuffer, nBufferBytes, nPending, result, error);
+                }
+
+                error = ErrnoString("splice");
+                bOk = false;
+                break;
+            }
+
+            nWhole -= static_cast<size_t>(m);
+            nInPipe -= static_cast<size_t>(m);
+            result.nBytes += static_cast<uint64_t>(m);
+        }
+
+        if (!bOk) {
+            break;
+        }
+    }
+
+    close(pipeFds[0]);
+    close(pipeFds[1]);
+
+    result.nDroppedBytes = static_cast<uint32_t>(nInPipe);
+    return bOk;
+}
+
+#else
+
+bool StreamInput::CopyTo(OutputFile &out, uint32_t nUnitBytes, uint8_t *pBuffer, size_t nBufferBytes, StreamCopyResult &result, std::string &error) {
+    result.nBytes = 0;
+    result.nDroppedBytes = 0;
+    return CopyBuffered(out, nUnitBytes, pBuffer, nBufferBytes, 0, result, error);
+}
+
+#endif
+
+#endif
+
+bool StreamInput::Read(void *pData, size_t nBytes, size_t &nRead, std::string &error) {
+    uint8_t *p = static_cast<uint8_t *>(pData);
+    nRead = 0;
+    while (nRead < nBytes) {
+        size_t n;
+        if (!ReadSome(p + nRead, nBytes - nRead, n, error)) {
+            return false;
+        }
+        if (0 == n) {
+            break;
+        }
+        nRead += n;
+    }
+    return true;
+}
+
+bool StreamInput::CopyBuffered(OutputFile &out, uint32_t nUnitBytes, uint8_t *pBuffer, size_t nBufferBytes, size_t nPending, StreamCopyResult &result, std::string &error) {
+    result.bZeroCopy = false;
+
+    // writes whatever whole units each read completes rather than waiting
+    // for the buffer to fill, so a live stream isn't held up
+    for (;;) {
+        size_t nWhole = nPending - nPending % nUnitBytes;
+        if (nWhole > 0) {
+            if (!out.Write(pBuffer, nWhole, error)) {
+                return false;
+            }
+            result.nBytes += nWhole;
+            memmove(pBuffer, pBuffer + nWhole, nPending - nWhole);
+            nPending -= nWhole;
+        }
+
+        size_t nRead;
+        if (!ReadSome(pBuffer + nPending, nBufferBytes - nPending, nRead, error)) {
+            return false;
+        }
+        if (0 == nRead) {
+            break;
+        }
+        nPending += nRead;
+    }
+
+    result.nDroppedBytes = static_cast<uint32_t>(nPending);
+    return true;
+}
@@ -0,0 +1,140 @@
+// fileio.h
+
+// thin portable wrappers for streaming through large files
+//
+// MappedInputFile maps one window of the file at a time so address space
+// and resident memory stay bounded no matter how big the file is
+// OutputFile does large sequential writes plus the odd positioned write
+// for patching headers
+// StreamInput reads what can't be mapped (a pipe) from start to end, and
+// can hand the rest of it to an OutputFile without copying it through this
+// process where the system allows it
+// several OutputFiles can be open on one file at once for positioned
+// writes from different threads, and can copy ranges of a MappedInputFile
+// across without them passing through this process where the system allows
+//
+// paths are UTF-8 on every platform; "-" is standard input or output
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class MappedInputFile {
+public:
+    MappedInputFile();
+    ~MappedInputFile();
+
+    bool Open(const std::string &path, std::string &error);
+    void Close();
+
+    uint64_t Size() const { return m_nSize; }
+
+    // maps [nOffset, nOffset + nBytes) and returns a pointer to nOffset
+    // the previous window is unmapped; returns nullptr and fills error on failure
+    const uint8_t *Map(uint64_t nOffset, size_t nBytes, std::string &error);
+
+private:
+    MappedInputFile(const MappedInputFile &) = delete;
+    MappedInputFile &operator=(const MappedInputFile &) = delete;
+
+    void Unmap();
+
+    friend class OutputFile;
+
+#ifdef _WIN32
+    void *m_hFile;
+    void *m_hMapping;
+#else
+    int m_fd;
+#endif
+    uint64_t m_nSize;
+    void *m_pView;
+    size_t m_nViewBytes;
+};
+
+class StreamInput;
+
+class OutputFile {
+public:
+    OutputFile();
+    ~OutputFile();
+
+    bool Open(const std::string &path, std::string &error);
+    bool Close(std::string &error);
+
+    // opens a file that's already there without truncating it, alongside
+    // other OutputFiles on the same file, each with its own position
+    bool OpenExisting(const std::string &path, std::string &error);
+
+    bool Write(const void *pData, size_t nBytes, std::string &error);
+    bool WriteAt(uint64_t nOffset, const void *pData, size_t nBytes, std::string &error);
+
+    // copies nBytes of in from nInOffset to here at nOutOffset inside the
+    // kernel (copy_file_range on Linux). bCopied is false, with nothing
+    // written, where that can't be done and it has to go through a mapping
+    bool CopyRange(MappedInputFile &in, uint64_t nInOffset, uint64_t nOutOffset, uint64_t nBytes, bool &bCopied, std::string &error);
+
+private:
+    OutputFile(const OutputFile &) = delete;
+    OutputFile &operator=(const OutputFile &) = delete;
+
+    friend class StreamInput;
+
+#ifdef _WIN32
+    void *m_hFile;
+#else
+    int m_fd;
+#endif
+};
+
+struct StreamCopyResult {
+    uint64_t nBytes;        // written to the output
+    uint32_t nDroppedBytes; // the partial unit left at the end of the input
+    bool bZeroCopy;         // none of it went through the buffer
+};
+
+class StreamInput {
+public:
+    StreamInput();
+    ~StreamInput();
+
+    bool Open(const std::string &path, std::string &error);
+    void Close();
+
+    // reads until nBytes or the end of the input; nRead < nBytes only at the end
+    bool Read(void *pData, size_t nBytes, size_t &nRead, std::string &error);
+
+    // writes the rest of the input to out in whole units of nUnitBytes as it
+    // arrives, dropping a partial unit at the end. on Linux it's spliced
+    // through a pipe and never copied into this process; where that can't
+    // be done it goes through pBuffer in reads and writes of up to
+    // nBufferBytes, which has to hold a few units
+    bool CopyTo(OutputFile &out, uint32_t nUnitBytes, uint8_t *pBuffer, size_t nBufferBytes, StreamCopyResult &result, std::string &error);
+
+private:
+    StreamInput(const StreamInput &) = delete;
+    StreamInput &operator=(const StreamInput &) = delete;
+
+    // one read of whatever is there, up to nBytes; 0 at the end
+    bool ReadSome(void *pData, size_t nBytes, size_t &nRead, std::string &error);
+
+    // the rest of CopyTo through pBuffer, which already holds nPending bytes
+    bool CopyBuffered(OutputFile &out, uint32_t nUnitBytes, uint8_t *pBuffer, size_t nBufferBytes, size_t nPending, StreamCopyResult &result, std::string &error);
+
+#ifdef _WIN32
+    void *m_hFile;
+#else
+    int m_fd;
+#endif
+};
+
+// the regular files in a directory, by name, sorted
+bool ListDirectory(const std::string &path, std::vector<std::string> &names, std::string &error);
+
+bool IsDirectory(const std::string &path);
+
+// true if both paths are there and are the same file
+bool IsSameFile(const std::string &a, const std::string &b);
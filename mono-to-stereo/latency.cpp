@@ -0,0 +1,312 @@
+// latency.cpp
+
+#include "latency.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+// ---- histogram ----
+
+void Histogram::Reset() {
+    for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        m_buckets[i].store(0, std::memory_order_relaxed);
+    }
+    m_nCount.store(0, std::memory_order_relaxed);
+    m_hnsSum.store(0, std::memory_order_relaxed);
+    m_hnsMin.store(INT64_MAX, std::memory_order_relaxed);
+    m_hnsMax.store(0, std::memory_order_relaxed);
+}
+
+uint32_t Histogram::BucketOf(uint64_t nValue) {
+    const uint64_t nSub = 1u << HISTOGRAM_SUB_BITS;
+    if (nValue < nSub) {
+        return static_cast<uint32_t>(nValue);
+    }
+
+    nValue = (std::min)(nValue, (static_cast<uint64_t>(1) << HISTOGRAM_MAX_BITS) - 1);
+
+    uint32_t nTop = HISTOGRAM_SUB_BITS;
+    while ((nValue >> (nTop + 1)) != 0) {
+        nTop++;
+    }
+
+    // the bits just below the top one pick the bucket within the octave
+    uint32_t nShift = nTop - HISTOGRAM_SUB_BITS;
+    return ((nTop - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS) + static_cast<uint32_t>((nValue >> nShift) & (nSub - 1));
+}
+
+uint64_t Histogram::BucketMidpoint(uint32_t nBucket) {
+    const uint32_t nSub = 1u << HISTOGRAM_SUB_BITS;
+    if (nBucket < nSub) {
+        return nBucket;
+    }
+
+    uint32_t nShift = (nBucket >> HISTOGRAM_SUB_BITS) - 1;
+    uint64_t nLow = static_cast<uint64_t>(nSub + (nBucket & (nSub - 1))) << nShift;
+    return nLow + ((static_cast<uint64_t>(1) << nShift) >> 1);
+}
+
+void Histogram::Record(int64_t hns) {
+    hns = (std::max)(hns, static_cast<int64_t>(0));
+
+    // only one thread writes, so plain load/store pairs are enough and
+    // much cheaper than read-modify-write
+    std::atomic<uint32_t> &bucket = m_buckets[BucketOf(static_cast<uint64_t>(hns))];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    m_nCount.store(m_nCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    m_hnsSum.store(m_hnsSum.load(std::memory_order_relaxed) + hns, std::memory_order_relaxed);
+    if (hns < m_hnsMin.load(std::memory_order_relaxed)) {
+        m_hnsMin.store(hns, std::memory_order_relaxed);
+    }
+    if (hns > m_hnsMax.load(std::memory_order_relaxed)) {
+        m_hnsMax.store(hns, std::memory_order_relaxed);
+    }
+}
+
+HistogramSummary Histogram::Summary() const {
+    HistogramSummary summary = {};
+
+    // copy first so the percentiles come from one consistent set of counts
+    uint32_t counts[HISTOGRAM_BUCKETS];
+    uint64_t nTotal = 0;
+    for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        counts[i] = m_buckets[i].load(std::memory_order_relaxed);
+        nTotal += counts[i];
+    }
+
+    summary.nCount = nTotal;
+    if (nTotal == 0) {
+        return summary;
+    }
+
+    summary.hnsMin = m_hnsMin.load(std::memory_order_relaxed);
+    summary.hnsMax = m_hnsMax.load(std::memory_order_relaxed);
+    summary.fMeanHns = static_cast<double>(m_hnsSum.load(std::memory_order_relaxed)) / static_cast<double>(m_nCount.load(std::memory_order_relaxed));
+
+    uint64_t nP50 = (nTotal + 1) / 2;
+    uint64_t nP99 = nTotal - nTotal / 100;
+    uint64_t nSeen = 0;
+    bool bHaveP50 = false;
+    for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        nSeen += counts[i];
+        if (!bHaveP50 && nSeen >= nP50) {
+            summary.hnsP50 = static_cast<int64_t>(BucketMidpoint(i));
+            bHaveP50 = true;
+        }
+        if (nSeen >= nP99) {
+            summary.hnsP99 = static_cast<int64_t>(BucketMidpoint(i));
+            break;
+        }
+    }
+
+    // a bucket's midpoint can fall outside what was actually seen
+    summary.hnsP50 = (std::min)((std::max)(summary.hnsP50, summary.hnsMin), summary.hnsMax);
+    summary.hnsP99 = (std::min)((std::max)(summary.hnsP99, summary.hnsMin), summary.hnsMax);
+    return summary;
+}
+
+// ---- wakeups ----
+
+void WakeupTimer::Wake(int64_t hnsNow) {
+    if (m_hnsLastWake >= 0) {
+        int64_t hnsInterval = hnsNow - m_hnsLastWake;
+        m_jitter.Record(hnsInterval > m_hnsPeriod ? hnsInterval - m_hnsPeriod : m_hnsPeriod - hnsInterval);
+    }
+    m_hnsLastWake = hnsNow;
+}
+
+// ---- capture to render ----
+
+bool LatencyTracker::Init(uint32_t nRate) {
+    if (nRate == 0 || !m_anchors.Init(sizeof(LatencyAnchor), LATENCY_ANCHORS)) {
+        return false;
+    }
+
+    m_nRate = nRate;
+    m_bHaveAnchor = false;
+    m_latency.Reset();
+    m_nDroppedAnchors.store(0, std::memory_order_relaxed);
+    return true;
+}
+
+void LatencyTracker::NoteCapture(uint32_t nRingFrame, int64_t hnsCapture) {
+    LatencyAnchor anchor = {};
+    anchor.nRingFrame = nRingFrame;
+    anchor.hnsCapture = hnsCapture;
+
+    uint8_t *pSlot;
+    if (m_anchors.BeginWrite(&pSlot) == 0) {
+        m_nDroppedAnchors.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    memcpy(pSlot, &anchor, sizeof(anchor));
+    m_anchors.CommitWrite(1);
+}
+
+int64_t LatencyTracker::NoteRender(uint32_t nRingFrame, double fHeldFrames, uint32_t nPaddingFrames, int64_t hnsNow) {
+    // move up to the newest anchor at or before the next frame; positions
+    // wrap, so compare through a signed difference
+    for (;;) {
+        const uint8_t *pSlot;
+        if (m_anchors.BeginRead(&pSlot) == 0) {
+            break;
+        }
+
+        LatencyAnchor next;
+        memcpy(&next, pSlot, sizeof(next));
+        if (static_cast<double>(static_cast<int32_t>(nRingFrame - next.nRingFrame)) - fHeldFrames < 0) {
+            break;
+        }
+
+        m_anchor = next;
+        m_bHaveAnchor = true;
+        m_anchors.CommitRead(1);
+    }
+
+    if (!m_bHaveAnchor) {
+        return -1;
+    }
+
+    double fSinceAnchor = static_cast<double>(static_cast<int32_t>(nRingFrame - m_anchor.nRingFrame)) - fHeldFrames;
+    double hnsCaptured = static_cast<double>(m_anchor.hnsCapture) + fSinceAnchor * HNS_PER_SECOND / m_nRate;
+    double hnsHeard = static_cast<double>(hnsNow) + static_cast<double>(nPaddingFrames) * HNS_PER_SECOND / m_nRate;
+
+    int64_t hnsLatency = static_cast<int64_t>(std::llround(hnsHeard - hnsCaptured));
+    m_latency.Record(hnsLatency);
+    return hnsLatency;
+}
+
+// ---- everything for one stream ----
+
+StreamStatsSnapshot StreamStats::Snapshot(uint32_t nOutput, const RingStats &ring) const {
+    const OutputStats &output = m_outputs[nOutput];
+
+    StreamStatsSnapshot snapshot;
+    snapshot.nOutput = nOutput;
+    snapshot.nCapturedFrames = 0;
+    snapshot.latency = output.latency.Latency().Summary();
+    snapshot.captureJitter = m_capture.Jitter().Summary();
+    snapshot.captureProcessing = m_capture.Processing().Summary();
+    snapshot.renderJitter = output.render.Jitter().Summary();
+    snapshot.renderProcessing = output.render.Processing().Summary();
+    snapshot.ring = ring;
+    snapshot.nCaptureGapFrames = m_nCaptureGapFrames.load(std::memory_order_relaxed);
+    snapshot.nTimestampErrors = m_nTimestampErrors.load(std::memory_order_relaxed);
+    snapshot.nDroppedAnchors = output.latency.DroppedAnchors();
+    snapshot.glitches = GlitchStats();
+    snapshot.buffer = BufferTuneStats();
+    return snapshot;
+}
+
+// ---- offline check ----
+
+LatencySimulationResult SimulateLatency(double fSeconds, double fJitterMs) {
+    const uint32_t nRate = 48000;
+    const uint32_t nPacket = 480;                 // 10 ms
+    const uint32_t nDeviceBuffer = 1920;          // 40 ms
+    const int64_t hnsPeriod = HNS_PER_SECOND / 100;
+    const int64_t hnsRenderPhase = hnsPeriod / 3; // the two devices tick out of step
+
+    LatencySimulationResult result = {};
+
+    SimulatedClock clock;
+    StreamStats stats;
+    stats.Init(nRate, hnsPeriod, 1);
+    stats.Render(0).Init(hnsPeriod);
+
+    SpscRing ring;
+    ring.Init(4, nDeviceBuffer * 2);
+    std::vector<uint8_t> packet(static_cast<size_t>(nPacket) * 4);
+    std::vector<uint8_t> out(static_cast<size_t>(nDeviceBuffer) * 4);
+
+    // when each packet was really captured, indexed by ring position / nPacket
+    std::vector<int64_t> captured;
+
+    // xorshift, so every run sees the same jitter
+    uint32_t nRandom = 12345;
+    auto jitter = [&]() {
+        nRandom ^= nRandom << 13;
+        nRandom ^= nRandom >> 17;
+        nRandom ^= nRandom << 5;
+        return static_cast<int64_t>(fJitterMs * 10000.0 * (nRandom & 0xFFFF) / 65536.0);
+    };
+
+    // the device starts playing half a buffer of silence at time zero
+    uint64_t nDeviceWritten = nDeviceBuffer / 2;
+    uint64_t nSilenceFrames = nDeviceBuffer / 2;
+
+    const int64_t hnsEnd = static_cast<int64_t>(fSeconds * HNS_PER_SECOND);
+    int64_t hnsNextCapture = hnsPeriod + jitter();
+    int64_t hnsNextRender = hnsRenderPhase + jitter();
+    uint64_t nCaptured = 0;
+    uint64_t nRenderWakeups = 0;
+    double fRenderSeconds = 0;
+
+    while ((std::min)(hnsNextCapture, hnsNextRender) < hnsEnd) {
+        if (hnsNextCapture <= hnsNextRender) {
+            // packet n covers [n, n + 1) periods and shows up after it ends
+            clock.Set(hnsNextCapture);
+            stats.Capture().Wake(clock.NowHns());
+
+            int64_t hnsPacket = static_cast<int64_t>(nCaptured) * hnsPeriod;
+            if (ring.WriteAvailable() >= nPacket) {
+                stats.NoteCapture(ring.WritePosition(), hnsPacket);
+                captured.push_back(hnsPacket);
+            }
+            ring.Write(packet.data(), nPacket);
+
+            stats.Capture().Done(clock.NowHns() + 500);
+            nCaptured++;
+            hnsNextCapture = static_cast<int64_t>(nCaptured + 1) * hnsPeriod + jitter();
+            continue;
+        }
+
+        clock.Set(hnsNextRender);
+        stats.Render(0).Wake(clock.NowHns());
+
+        // the device plays continuously; anything it ran out of was silence
+        uint64_t nPlayed = static_cast<uint64_t>(clock.NowHns()) * nRate / HNS_PER_SECOND;
+        if (nPlayed > nDeviceWritten) {
+            nSilenceFrames += nPlayed - nDeviceWritten;
+            nDeviceWritten = nPlayed;
+        }
+        uint32_t nPadding = static_cast<uint32_t>(nDeviceWritten - nPlayed);
+        uint32_t nWanted = nDeviceBuffer - nPadding;
+
+        uint32_t nPosition = ring.ReadPosition();
+        auto start = std::chrono::steady_clock::now();
+        int64_t hnsLatency = stats.Latency(0).NoteRender(nPosition, 0, nPadding, clock.NowHns());
+        fRenderSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        nRenderWakeups++;
+
+        uint32_t nRead = ring.Read(out.data(), nWanted);
+        if (nRead > 0 && hnsLatency >= 0) {
+            // what the latency really is, from the simulation's side
+            size_t nIndex = nPosition / nPacket;
+            int64_t hnsFrame = captured[nIndex] + static_cast<int64_t>(nPosition % nPacket) * HNS_PER_SECOND / nRate;
+            int64_t hnsHeard = clock.NowHns() + static_cast<int64_t>(nPadding) * HNS_PER_SECOND / nRate;
+            double fErrorMs = std::fabs(static_cast<double>(hnsLatency - (hnsHeard - hnsFrame))) / 10000.0;
+            result.fMaxErrorMs = (std::max)(result.fMaxErrorMs, fErrorMs);
+            result.nMeasured++;
+        }
+        nDeviceWritten += nRead;
+
+        stats.Render(0).Done(clock.NowHns() + 300);
+        hnsNextRender = hnsRenderPhase + static_cast<int64_t>(nRenderWakeups) * hnsPeriod + jitter();
+    }
+
+    result.stats = stats.Snapshot(0, ring.GetStats());
+    result.fRenderNs = nRenderWakeups ? fRenderSeconds * 1e9 / static_cast<double>(nRenderWakeups) : 0;
+
+    // the recording path on its own, without clock reads in the way
+    Histogram histogram;
+    const uint32_t nRecords = 1000000;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < nRecords; i++) {
+        histogram.Record(static_cast<int64_t>(i * 2654435761u >> 12));
+    }
+    result.fRecordNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / nRecords;
+    return result;
+}
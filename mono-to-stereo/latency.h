@@ -0,0 +1,295 @@
+// latency.h
+
+// end to end latency, wakeup jitter and per-packet processing time
+//
+// the capture thread tags the ring with the time each packet was captured
+// (the QPC position the engine hands back with the packet), the render
+// thread works out when the next frame it takes from the ring will actually
+// be heard, and the difference goes into a histogram. every thread also
+// times its own wakeups and how long it spends on each one
+//
+// all times are in 100 ns units, the unit of the engine's QPC positions.
+// the clock is passed in so the same code runs against a simulated one,
+// and nothing here allocates or locks after Init so it is safe to call
+// from the audio threads
+//
+// no Windows dependencies
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+#include "buffertune.h"
+#include "conceal.h"
+#include "ring.h"
+
+#define HNS_PER_SECOND 10000000
+
+// ---- clocks ----
+
+class StatsClock {
+public:
+    virtual ~StatsClock() {}
+    virtual int64_t NowHns() = 0;
+};
+
+class SimulatedClock : public StatsClock {
+public:
+    SimulatedClock() : m_hnsNow(0) {}
+
+    int64_t NowHns() override { return m_hnsNow; }
+    void Set(int64_t hnsNow) { m_hnsNow = hnsNow; }
+    void Advance(int64_t hns) { m_hnsNow += hns; }
+
+private:
+    int64_t m_hnsNow;
+};
+
+// std::chrono::steady_clock, for systems without QueryPerformanceCounter
+class SteadyClock : public StatsClock {
+public:
+    int64_t NowHns() override {
+        return std::chrono::duration_cast<std::chrono::duration<int64_t, std::ratio<1, HNS_PER_SECOND>>>(
+            std::chrono::steady_clock::now().time_since_epoch()
+        ).count();
+    }
+};
+
+// ---- histogram ----
+
+// log-linear buckets: 16 per power of two, so any value is off by at most
+// about 3%, up to 2^40 hns (a day and a half)
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_MAX_BITS 40
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+
+struct HistogramSummary {
+    uint64_t nCount;
+    int64_t hnsMin;
+    int64_t hnsP50;
+    int64_t hnsP99;
+    int64_t hnsMax;
+    double fMeanHns;
+};
+
+// one thread records, any thread may take a summary
+class Histogram {
+public:
+    Histogram() { Reset(); }
+
+    // not thread safe
+    void Reset();
+
+    // negative values count as zero
+    void Record(int64_t hns);
+
+    HistogramSummary Summary() const;
+
+    static uint32_t BucketOf(uint64_t nValue);
+    static uint64_t BucketMidpoint(uint32_t nBucket);
+
+private:
+    Histogram(const Histogram &) = delete;
+    Histogram &operator=(const Histogram &) = delete;
+
+    std::atomic<uint32_t> m_buckets[HISTOGRAM_BUCKETS];
+    std::atomic<uint64_t> m_nCount;
+    std::atomic<int64_t> m_hnsSum;
+    std::atomic<int64_t> m_hnsMin;
+    std::atomic<int64_t> m_hnsMax;
+};
+
+// ---- per-thread wakeups ----
+
+class WakeupTimer {
+public:
+    WakeupTimer() : m_hnsPeriod(0), m_hnsLastWake(-1) {}
+
+    // hnsPeriod is how often the thread expects to be woken
+    void Init(int64_t hnsPeriod) { m_hnsPeriod = hnsPeriod; m_hnsLastWake = -1; }
+
+    // call as soon as the thread wakes; records how far the interval since
+    // the previous wakeup was from the period
+    void Wake(int64_t hnsNow);
+
+    // call when the wakeup's work is finished
+    void Done(int64_t hnsNow) { m_processing.Record(hnsNow - m_hnsLastWake); }
+
+    const Histogram &Jitter() const { return m_jitter; }
+    const Histogram &Processing() const { return m_processing; }
+
+private:
+    int64_t m_hnsPeriod;
+    int64_t m_hnsLastWake;
+    Histogram m_jitter;
+    Histogram m_processing;
+};
+
+// calls Done when the wakeup's scope ends, however it ends
+class WakeupTimerDoneOnExit {
+public:
+    WakeupTimerDoneOnExit(WakeupTimer &timer, StatsClock &clock) : m_timer(timer), m_clock(clock) {}
+    ~WakeupTimerDoneOnExit() {
+        m_timer.Done(m_clock.NowHns());
+    }
+
+private:
+    WakeupTimer &m_timer;
+    StatsClock &m_clock;
+};
+
+// ---- capture to render ----
+
+struct LatencyAnchor {
+    uint32_t nRingFrame;
+    uint32_t nReserved;
+    int64_t hnsCapture;
+};
+
+// how many capture timestamps can be in flight between the threads
+#define LATENCY_ANCHORS 256
+
+class LatencyTracker {
+public:
+    LatencyTracker() : m_nRate(0), m_bHaveAnchor(false) { m_nDroppedAnchors.store(0, std::memory_order_relaxed); }
+
+    // nRate is the frame rate of the ring
+    bool Init(uint32_t nRate);
+
+    // capture thread: the first frame this packet puts in the ring goes in
+    // at ring position nRingFrame and was captured at hnsCapture
+    void NoteCapture(uint32_t nRingFrame, int64_t hnsCapture);
+
+    // render thread, before taking frames from the ring: nRingFrame is the
+    // ring's read position, fHeldFrames how many frames already read are
+    // still held back (by the resampler), and nPaddingFrames how much the
+    // device has queued in front of what we are about to write
+    // records and returns the latency of the next frame, or -1 if no capture
+    // time is known yet
+    int64_t NoteRender(uint32_t nRingFrame, double fHeldFrames, uint32_t nPaddingFrames, int64_t hnsNow);
+
+    const Histogram &Latency() const { return m_latency; }
+
+    // capture timestamps that didn't fit; latency is extrapolated from the
+    // last one that did
+    uint64_t DroppedAnchors() const { return m_nDroppedAnchors.load(std::memory_order_relaxed); }
+
+private:
+    uint32_t m_nRate;
+    SpscRing m_anchors;
+    LatencyAnchor m_anchor; // latest one the render side has reached
+    bool m_bHaveAnchor;
+    Histogram m_latency;
+    std::atomic<uint64_t> m_nDroppedAnchors;
+};
+
+// ---- everything for one stream ----
+
+// capture side figures plus the render side ones of one output
+struct StreamStatsSnapshot {
+    uint32_t nOutput;
+    uint64_t nCapturedFrames;     // mono frames, filled in by whoever captures them
+    HistogramSummary latency;
+    HistogramSummary captureJitter;
+    HistogramSummary captureProcessing;
+    HistogramSummary renderJitter;
+    HistogramSummary renderProcessing;
+    RingStats ring;               // as seen by this output
+    uint64_t nCaptureGapFrames;   // frames the device position skipped over
+    uint64_t nTimestampErrors;    // packets flagged with a bad timestamp
+    uint64_t nDroppedAnchors;
+    GlitchStats glitches;         // filled in by whoever conceals them
+    BufferTuneStats buffer;       // filled in by whoever renders, if the output's buffering is tuned
+};
+
+// where snapshots go; implementations decide what to do with them
+class StatsSink {
+public:
+    virtual ~StatsSink() {}
+    virtual void Publish(const StreamStatsSnapshot &snapshot) = 0;
+};
+
+// one capture thread feeding nOutputs render threads
+class StreamStats {
+public:
+    StreamStats() : m_nOutputs(0), m_nNextDevicePosition(UINT64_MAX) {
+        m_nCaptureGapFrames.store(0, std::memory_order_relaxed);
+        m_nTimestampErrors.store(0, std::memory_order_relaxed);
+    }
+
+    // each output's render period is set through Render(nOutput).Init
+    bool Init(uint32_t nRate, int64_t hnsCapturePeriod, uint32_t nOutputs) {
+        if (nOutputs == 0) {
+            return false;
+        }
+
+        m_capture.Init(hnsCapturePeriod);
+        m_outputs.reset(new OutputStats[nOutputs]);
+        m_nOutputs = nOutputs;
+        m_nNextDevicePosition = UINT64_MAX;
+        for (uint32_t i = 0; i < nOutputs; i++) {
+            if (!m_outputs[i].latency.Init(nRate)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    uint32_t Outputs() const { return m_nOutputs; }
+
+    WakeupTimer &Capture() { return m_capture; }
+    WakeupTimer &Render(uint32_t nOutput) { return m_outputs[nOutput].render; }
+    LatencyTracker &Latency(uint32_t nOutput) { return m_outputs[nOutput].latency; }
+
+    // capture thread: hands the packet's capture time to every output
+    void NoteCapture(uint32_t nRingFrame, int64_t hnsCapture) {
+        for (uint32_t i = 0; i < m_nOutputs; i++) {
+            m_outputs[i].latency.NoteCapture(nRingFrame, hnsCapture);
+        }
+    }
+
+    // capture thread: checks the device position of each packet against the
+    // end of the previous one
+    void NoteCapturePosition(uint64_t nDevicePosition, uint32_t nFrames) {
+        if (m_nNextDevicePosition != UINT64_MAX && nDevicePosition > m_nNextDevicePosition) {
+            m_nCaptureGapFrames.fetch_add(nDevicePosition - m_nNextDevicePosition, std::memory_order_relaxed);
+        }
+        m_nNextDevicePosition = nDevicePosition + nFrames;
+    }
+
+    void NoteTimestampError() { m_nTimestampErrors.fetch_add(1, std::memory_order_relaxed); }
+
+    // ring is the ring's stats from the output's side
+    StreamStatsSnapshot Snapshot(uint32_t nOutput, const RingStats &ring) const;
+
+private:
+    struct OutputStats {
+        WakeupTimer render;
+        LatencyTracker latency;
+    };
+
+    WakeupTimer m_capture;
+    std::unique_ptr<OutputStats[]> m_outputs;
+    uint32_t m_nOutputs;
+    uint64_t m_nNextDevicePosition;
+    std::atomic<uint64_t> m_nCaptureGapFrames;
+    std::atomic<uint64_t> m_nTimestampErrors;
+};
+
+// ---- offline check ----
+
+struct LatencySimulationResult {
+    StreamStatsSnapshot stats;
+    double fMaxErrorMs;       // tracker against the simulation's own bookkeeping
+    uint64_t nMeasured;
+    double fRecordNs;         // cost of one Histogram::Record
+    double fRenderNs;         // cost of one LatencyTracker::NoteRender
+};
+
+// a capture and a render thread on a simulated clock, each woken every
+// 10 ms with up to fJitterMs of random lateness, 48 kHz stereo through a
+// ring into a 40 ms device buffer
+LatencySimulationResult SimulateLatency(double fSeconds, double fJitterMs);
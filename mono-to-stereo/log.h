@@ -1,22 +1,31 @@
 // log.h
 
+// straight to the console, from threads that can afford to wait for it;
+// the audio threads write to a MessageSink (messages.h) instead
+
 #include <Windows.h>
-#include <vector>
 #include <cstdarg>
+#include <cwchar>
+
+// longest line written, newline included; longer ones are cut short
+#define LOG_MAX_CHARS 4096
 
-static inline void LOG(wchar_t* fmt...) {
+static inline void LOG(const wchar_t* fmt...) {
+    wchar_t buffer[LOG_MAX_CHARS];
     va_list args;
-    size_t len;
 
+    // leaves room for the newline
     va_start(args, fmt);
-    len = _vscwprintf(fmt, args);
-
-    std::vector<wchar_t> buffer(len + 1);
-    vswprintf_s(buffer.data(), len + 1, fmt, args);
+    int len = _vsnwprintf_s(buffer, LOG_MAX_CHARS - 1, _TRUNCATE, fmt, args);
     va_end(args);
 
-    WriteConsoleW(GetStdHandle(STD_OUTPUT_HANDLE), buffer.data(), static_cast<DWORD>(len), nullptr, nullptr);
-    WriteConsoleW(GetStdHandle(STD_OUTPUT_HANDLE), L"\n", 1, nullptr, nullptr);
+    if (len < 0) {
+        len = static_cast<int>(wcslen(buffer));
+    }
+
+    // one write, so lines from different threads don't run into each other
+    buffer[len] = L'\n';
+    WriteConsoleW(GetStdHandle(STD_OUTPUT_HANDLE), buffer, static_cast<DWORD>(len + 1), nullptr, nullptr);
 }
 
 #define ERR(...) LOG(L"Error: " __VA_ARGS__)
@@ -3,6 +3,29 @@
 #include "common.h"
 
 int do_everything(int argc, LPCWSTR argv[]);
+int convert_file(const ConvertOptions &options);
+int convert_batch(const BatchOptions &options);
+int wait_for_daemon(HANDLE hThread, const LoopbackCaptureThreadFunctionArguments &threadArgs);
+
+// what the console control handler sets, and waits for, in daemon mode
+static HANDLE g_hStopEvent = NULL;
+static HANDLE g_hCaptureThread = NULL;
+
+// Ctrl+C, Ctrl+Break, closing the console, logging off or shutting down
+BOOL WINAPI stop_on_console_event(DWORD dwCtrlType) {
+    if (NULL == g_hStopEvent) {
+        return FALSE;
+    }
+
+    SetEvent(g_hStopEvent);
+
+    // the process is killed as soon as this returns for these, so give the
+    // capture thread a moment to stop cleanly first
+    if (CTRL_CLOSE_EVENT == dwCtrlType || CTRL_LOGOFF_EVENT == dwCtrlType || CTRL_SHUTDOWN_EVENT == dwCtrlType) {
+        WaitForSingleObject(g_hCaptureThread, 5000);
+    }
+    return TRUE;
+}
 
 int _cdecl wmain(int argc, LPCWSTR argv[]) {
     HRESULT hr = S_OK;
@@ -31,6 +54,14 @@ int do_everything(int argc, LPCWSTR argv[]) {
         return 0;
     }
 
+    if (prefs.m_bConvert) {
+        return convert_file(prefs.m_convert);
+    }
+
+    if (prefs.m_bBatch) {
+        return convert_batch(prefs.m_batch);
+    }
+
     // create a "loopback capture has started" event
     HANDLE hStartedEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
     if (NULL == hStartedEvent) {
@@ -39,8 +70,13 @@ int do_everything(int argc, LPCWSTR argv[]) {
     }
     CloseHandleOnExit closeStartedEvent(hStartedEvent);
 
-    // create a "stop capturing now" event
-    HANDLE hStopEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    // create a "stop capturing now" event; a daemon's is manual reset, since
+    // more than one thread watches it, and can be named so something else
+    // can set it
+    HANDLE hStopEvent = CreateEventW(
+        NULL, prefs.m_bDaemon ? TRUE : FALSE, FALSE,
+        prefs.m_stopEventName.empty() ? NULL : prefs.m_stopEventName.c_str()
+    );
     if (NULL == hStopEvent) {
         ERR(L"CreateEvent failed: last error is %u", GetLastError());
         return -__LINE__;
@@ -51,9 +87,29 @@ int do_everything(int argc, LPCWSTR argv[]) {
     LoopbackCaptureThreadFunctionArguments threadArgs;
     threadArgs.hr = E_UNEXPECTED; // thread will overwrite this
     threadArgs.pMMInDevice = prefs.m_pMMInDevice;
-    threadArgs.pMMOutDevice = prefs.m_pMMOutDevice;
+    for (UINT32 i = 0; i < prefs.m_nOutDevices; i++) {
+        threadArgs.pMMOutDevices[i] = prefs.m_pMMOutDevices[i];
+    }
+    threadArgs.nOutDevices = prefs.m_nOutDevices;
+    threadArgs.bDaemon = prefs.m_bDaemon;
+    threadArgs.szInDeviceName = prefs.m_inDeviceName.c_str();
+    for (UINT32 i = 0; i < prefs.m_nOutDevices; i++) {
+        threadArgs.szOutDeviceNames[i] = prefs.m_outDeviceNames[i].c_str();
+    }
     threadArgs.iBufferMs = prefs.m_iBufferMs;
-    threadArgs.bSkipFirstSample = prefs.m_bSkipFirstSample;
+    threadArgs.bAutoBuffer = prefs.m_bAutoBuffer;
+    threadArgs.nMultiplex = prefs.m_nMultiplex;
+    threadArgs.nSampleOffset = prefs.m_nSampleOffset;
+    threadArgs.bDetectPhase = prefs.m_bDetectPhase;
+    threadArgs.bDriftCompensation = prefs.m_bDriftCompensation;
+    threadArgs.dsp = prefs.m_dsp;
+    threadArgs.iStatsIntervalSec = prefs.m_iStatsIntervalSec;
+    threadArgs.szSharedStatsName = prefs.m_sharedStatsName.empty() ? NULL : prefs.m_sharedStatsName.c_str();
+    threadArgs.szRecordPath = prefs.m_recordPath.empty() ? NULL : prefs.m_recordPath.c_str();
+    threadArgs.szRtpSendAddress = prefs.m_rtpSendAddress.empty() ? NULL : prefs.m_rtpSendAddress.c_str();
+    threadArgs.rtpSend = prefs.m_rtpSend;
+    threadArgs.szRtpReceiveAddress = prefs.m_rtpReceiveAddress.empty() ? NULL : prefs.m_rtpReceiveAddress.c_str();
+    threadArgs.rtpReceive = prefs.m_rtpReceive;
     threadArgs.hStartedEvent = hStartedEvent;
     threadArgs.hStopEvent = hStopEvent;
     threadArgs.nFrames = 0;
@@ -87,6 +143,20 @@ int do_everything(int argc, LPCWSTR argv[]) {
         return -__LINE__;
     }
 
+    if (prefs.m_bDaemon) {
+        g_hStopEvent = hStopEvent;
+        g_hCaptureThread = hThread;
+        if (!SetConsoleCtrlHandler(stop_on_console_event, TRUE)) {
+            ERR(L"SetConsoleCtrlHandler failed: last error is %u", GetLastError());
+            SetEvent(hStopEvent);
+        }
+
+        int iResult = wait_for_daemon(hThread, threadArgs);
+        SetConsoleCtrlHandler(stop_on_console_event, FALSE);
+        g_hStopEvent = NULL;
+        return iResult;
+    }
+
     // at this point capture is running
     // wait for the user to press a key or for capture to error out
     {
@@ -172,3 +242,112 @@ int do_everything(int argc, LPCWSTR argv[]) {
 
     return 0;
 }
+
+// the supervisor is running, or waiting for the devices to turn up; it
+// only stops when the stop event is set or it can't use them at all
+int wait_for_daemon(HANDLE hThread, const LoopbackCaptureThreadFunctionArguments &threadArgs) {
+    LOG(L"%s", L"Running until stopped...");
+
+    if (WAIT_OBJECT_0 != WaitForSingleObject(hThread, INFINITE)) {
+        ERR(L"WaitForSingleObject failed: last error is %u", GetLastError());
+        return -__LINE__;
+    }
+
+    DWORD exitCode;
+    if (!GetExitCodeThread(hThread, &exitCode)) {
+        ERR(L"GetExitCodeThread failed: last error is %u", GetLastError());
+        return -__LINE__;
+    }
+
+    if (0 != exitCode) {
+        ERR(L"Capture thread exit code is %u; expected 0", exitCode);
+        return -__LINE__;
+    }
+
+    if (S_OK != threadArgs.hr) {
+        ERR(L"Thread HRESULT is 0x%08x", threadArgs.hr);
+        return -__LINE__;
+    }
+
+    return 0;
+}
+
+int convert_file(const ConvertOptions &options) {
+    ConvertResult result;
+    std::string error;
+
+    ULONGLONG ullStart = GetTickCount64();
+    if (!ConvertFile(options, result, error)) {
+        ERR(L"%hs", error.c_str());
+        return -__LINE__;
+    }
+    double seconds = (GetTickCount64() - ullStart) / 1000.0;
+
+    LOG(
+        L"Converted %llu %u channel frames into %llu %u channel frames (%u Hz, %u bits) in %.3f s, %.1f MB/s",
+        result.nInputFrames, result.inputFormat.nChannels,
+        result.nOutputFrames, result.outputFormat.nChannels,
+        result.outputFormat.nSamplesPerSec, result.outputFormat.wBitsPerSample,
+        seconds, seconds > 0 ? static_cast<double>(result.nOutputBytes) / seconds / 1e6 : 0.0
+    );
+    if (2 == result.nMultiplex) {
+        LOG(
+            L"First sample %hs (%hs)",
+            result.nSampleOffset ? "skipped" : "kept",
+            result.bPhaseDetected ? "detected" : "as configured"
+        );
+    }
+    else {
+        LOG(L"Started %u samples into the first frame (as configured)", result.nSampleOffset);
+    }
+
+    return 0;
+}
+
+int convert_batch(const BatchOptions &options) {
+    BatchConverter batch;
+    std::string error;
+
+    ULONGLONG ullStart = GetTickCount64();
+    if (!batch.Start(options, error)) {
+        ERR(L"%hs", error.c_str());
+        return -__LINE__;
+    }
+
+    // a line a second while it goes
+    while (!batch.Wait(1000)) {
+        BatchProgress progress = batch.Progress();
+        double seconds = (GetTickCount64() - ullStart) / 1000.0;
+        LOG(
+            L"%u/%u files, %.1f/%.1f MB, %.1f MB/s",
+            progress.nFilesDone, progress.nFiles,
+            progress.nInputBytesDone / 1e6, progress.nInputBytes / 1e6,
+            seconds > 0 ? progress.nInputBytesDone / seconds / 1e6 : 0.0
+        );
+    }
+    double seconds = (GetTickCount64() - ullStart) / 1000.0;
+
+    UINT32 nSkipped = 0;
+    UINT32 nDetected = 0;
+    for (const BatchFileResult &result : batch.Results()) {
+        if (!result.bOk) {
+            ERR(L"%hs", result.error.c_str());
+            continue;
+        }
+        nSkipped += 0 != result.result.nSampleOffset ? 1 : 0;
+        nDetected += result.result.bPhaseDetected ? 1 : 0;
+    }
+
+    BatchProgress progress = batch.Progress();
+    LOG(
+        L"Converted %u of %u files, %.1f MB into %.1f MB in %.3f s, %.1f MB/s, on %u threads",
+        progress.nFiles - progress.nFilesFailed, progress.nFiles,
+        progress.nInputBytes / 1e6, progress.nOutputBytes / 1e6,
+        seconds, seconds > 0 ? progress.nInputBytesDone / seconds / 1e6 : 0.0, progress.nThreads
+    );
+    LOG(
+        L"First sample skipped in %u, phase detected in %u; %llu parts taken by idle threads",
+        nSkipped, nDetected, progress.nStolenChunks
+    );
+    return 0 == progress.nFilesFailed ? 0 : -__LINE__;
+}
@@ -0,0 +1,1833 @@
+// main_posix.cpp
+
+// entry point for systems without WASAPI
+// there are no audio devices here, only file conversion and the
+// simulations, one of which runs the whole pipeline against simulated
+// devices; the Windows build uses wmain in main.cpp and ignores this file
+
+#ifndef _WIN32
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <signal.h>
+
+#include "batchconvert.h"
+#include "buffertune.h"
+#include "conceal.h"
+#include "configfile.h"
+#include "drift.h"
+#include "dsp.h"
+#include "fanout.h"
+#include "fileconvert.h"
+#include "latency.h"
+#include "messages.h"
+#include "phasedetect.h"
+#include "pipeline.h"
+#include "recorder.h"
+#include "repack.h"
+#include "rtp.h"
+#include "sharedstats.h"
+#include "simdevice.h"
+#include "supervisor.h"
+#include "wavfile.h"
+
+// the same limit as --out-device on Windows
+#define MAX_SIMULATED_OUTPUTS 8
+
+static void usage(const char *exe) {
+    printf(
+        "%s -?\n"
+        "%s --input-file capture.wav --output-file fixed.wav [--raw-format s16] [--raw-rate 96000] [--raw-channels 1]\n"
+        "    [--multiplex 2] [--skip-first-sample | --no-skip-first-sample | --sample-offset 1]\n"
+        "%s --batch captures/ [--batch list.txt ...] --output-dir fixed/ [--threads 0] [--chunk-size %d] [--raw-format s16] ...\n"
+        "%s --simulate-drift 100 [--simulate-seconds 600]\n"
+        "%s --simulate-phase s16\n"
+        "%s --simulate-packets 1000 [--device-seed 1]\n"
+        "%s --simulate-latency 2 [--simulate-seconds 600]\n"
+        "%s --simulate-fanout 3 [--simulate-seconds 10]\n"
+        "%s --simulate-glitches s16 [--simulate-seconds 600] [--device-seed 1]\n"
+        "%s --simulate-dsp s16 [--device-seed 1]\n"
+        "%s --simulate-device s16 [--outputs 2] [--device-jitter 3] [--device-drift 50] [--device-packet-variation 0.2]\n"
+        "    [--device-discontinuities 6] [--device-faults 6] [--device-seed 1] [--jitter-profile jitter.txt] [--device-channels 1] [--missing-first-sample]\n"
+        "    [--buffer-size 64 | auto] [--stats-interval 5]\n"
+        "    [--remove-dc] [--swap-channels | --mono] [--gain 6] [--limit -1]\n"
+        "    [--no-drift-compensation] [--multiplex 2] [--skip-first-sample | --no-skip-first-sample | --sample-offset 1] [--shared-stats name] [--record out.wav] [--simulate-seconds 10 | --daemon]\n"
+        "    [--rtp-send 127.0.0.1:5004 [--rtp-format l16] [--rtp-ptime 5] [--rtp-batch 64] [--rtp-receive 5004 [--rtp-jitter 20]]]\n"
+        "%s --rtp-receive [host:]5004 [--rtp-format l16] [--rtp-rate 48000] [--rtp-channels 2] [--rtp-jitter 20] [--simulate-seconds 10 | --daemon]\n"
+        "%s --simulate-rtp s16 [--rtp-format l16] [--device-seed 1]\n"
+        "%s --simulate-restarts 6 [--device-away 50] [--outputs 2] [--device-jitter 3] ...\n"
+        "%s --simulate-buffer-tuning all [--simulate-seconds 600] [--device-seed 1]\n"
+        "%s --record-jitter jitter.txt [--simulate-seconds 10]\n"
+        "%s --config switches.conf ...\n"
+        "\n"
+        "    -? prints this message.\n"
+        "    --input-file capture to convert, WAV or headerless PCM; - reads headerless PCM from standard input\n"
+        "    --output-file where to write the stereo (or wider) stream (WAV if it ends in .wav, headerless PCM otherwise); - for standard output\n"
+        "    --batch converts every file in this directory, or every file listed in this file, one path per line; can be repeated\n"
+        "    --output-dir where --batch writes each file, under the same name\n"
+        "    --threads how many files or parts of files --batch converts at once (default 0, one per core)\n"
+        "    --chunk-size megabytes of output each part of a file --batch converts is (default %d)\n"
+        "    --raw-format sample format of headerless input: s16, s24, s32, f32 or f64 (default s16)\n"
+        "    --raw-rate sample rate of headerless input (default 96000)\n"
+        "    --raw-channels channels of headerless input (default 1)\n"
+        "    --multiplex how many channels are time multiplexed onto each input channel (default 2, at most %d in all)\n"
+        "    --skip-first-sample always skip the first channel sample instead of working it out from the audio\n"
+        "    --no-skip-first-sample never skip the first channel sample\n"
+        "    --sample-offset how many samples the input's first frame is missing, for a multiplex other than 2 (default 1)\n"
+        "    --simulate-drift runs the drift compensation against a synthetic stream whose clock is off by this many ppm, up to %.0f either way\n"
+        "    --simulate-seconds how much audio to simulate (default 600, or 10 for --simulate-fanout and --simulate-device, which run in real time)\n"
+        "    --simulate-phase checks channel phase detection on synthetic 96 kHz input in this sample format\n"
+        "    --simulate-packets checks repacking of this many random streams split into packets of random size\n"
+        "    --simulate-latency checks the latency measurements against simulated threads woken up to this many ms late\n"
+        "    --simulate-fanout feeds this many outputs from one capture thread, in real time, with the last one stalling\n"
+        "    --simulate-glitches checks glitch concealment against a synthetic stream in this sample format with faults injected\n"
+        "    --simulate-dsp checks the fused processing kernels against running one stage at a time, on a synthetic stream in this sample format\n"
+        "    --simulate-device runs the whole capture pipeline, in real time, against a simulated device producing this sample format\n"
+        "    --outputs how many simulated output devices to render to (default 1, at most %d)\n"
+        "    --device-jitter how late, in ms, each simulated device may wake its thread up (default 0)\n"
+        "    --device-drift how many ppm the simulated capture clock runs fast (default 0)\n"
+        "    --device-packet-variation how much simulated capture packet sizes vary, as a fraction of a period (default 0)\n"
+        "    --device-discontinuities how many times a minute the simulated capture device loses frames (default 0)\n"
+        "    --device-faults how many capture packets a minute the simulated device flags as silent, with a bad timestamp or with an unknown flag (default 0)\n"
+        "    --device-seed picks a different but repeatable schedule of simulated events (default 1)\n"
+        "    --device-channels how many channels the simulated capture device has (default 1)\n"
+        "    --missing-first-sample makes the simulated stream start on its right channel, or its second sample for other multiplexes\n"
+        "    --buffer-size set the size of each output buffer in milliseconds (default %d), or auto to keep each as small as\n"
+        "        this machine's wakeups allow, up to %d ms; auto needs drift compensation\n"
+        "    --stats-interval print latency statistics every this many seconds\n"
+        "    --shared-stats keep live statistics in shared memory under this name, for stats-monitor to read\n"
+        "    --record also writes the stereo stream to this WAV file, and checks it afterwards unless running as a daemon\n"
+        "    --remove-dc takes out any DC offset with a %d Hz high pass\n"
+        "    --swap-channels plays the left channel on the right and the other way round\n"
+        "    --mono plays the average of both channels on each\n"
+        "    --gain amplifies (or with a negative value attenuates) by this many dB, up to 40\n"
+        "    --limit keeps peaks at or below this many dBFS, without clipping\n"
+        "    --no-drift-compensation copy samples to the outputs without resampling for clock drift\n"
+        "    --daemon keeps the simulated devices running, restarting them if they go away, until SIGINT or SIGTERM\n"
+        "    --rtp-send also sends the stereo stream as RTP to this host:port, from the capture thread\n"
+        "    --rtp-format l16 or l24, big-endian 16 or 24 bit PCM on the wire (default l16)\n"
+        "    --rtp-ptime how many ms of audio go in each packet (default %g)\n"
+        "    --rtp-batch most packets handed to the kernel in one system call, 1 to %d (default %d)\n"
+        "    --rtp-receive plays an RTP stream arriving on this port (and address) to a simulated output, or with --rtp-send\n"
+        "        checks the pipeline's own stream end to end over the network, with the latency from capture to output\n"
+        "    --rtp-rate, --rtp-channels what the stream being received is (default 48000 Hz, 2 channels)\n"
+        "    --rtp-jitter how many ms of the received stream are buffered before it plays (default %g)\n"
+        "    --simulate-rtp checks packetizing, batched sending and the jitter buffer over 127.0.0.1 on a synthetic stereo stream in this sample format\n"
+        "    --simulate-restarts runs the pipeline under the supervisor, in real time, taking a simulated device away this many times\n"
+        "    --device-away how long, in ms, each simulated device stays away (default 50)\n"
+        "    --simulate-buffer-tuning checks --buffer-size auto on a simulated clock against a made up lateness profile, quiet, busy,\n"
+        "        stalls, step or all of them, or one recorded with --record-jitter\n"
+        "    --jitter-profile wakes the simulated devices up as late as this file says, in ms, one wakeup a line, over and over\n"
+        "    --record-jitter writes how late, in ms, a thread woken every 10 ms on this machine is, one wakeup a line\n"
+        "    --config reads more switches from this file, one per line without the dashes (see configfile.h)\n",
+        exe, exe, exe, BATCH_DEFAULT_CHUNK_MB, exe, exe, exe, exe, exe, exe, exe, exe, exe, exe, exe, exe, exe, exe, BATCH_DEFAULT_CHUNK_MB, AUDIOFORMAT_MAX_CHANNELS, DRIFT_MAX_SKEW_PPM, MAX_SIMULATED_OUTPUTS,
+        static_cast<int>(PipelineOptions().nBufferMs), BUFFERTUNE_MAX_MS, DSP_DC_CUTOFF_HZ,
+        RTP_DEFAULT_PACKET_MS, UDP_MAX_BATCH, UDP_MAX_BATCH, RTP_DEFAULT_JITTER_MS
+    );
+}
+
+static int convert_file(const ConvertOptions &options) {
+    ConvertResult result;
+    std::string error;
+
+    auto start = std::chrono::steady_clock::now();
+    if (!ConvertFile(options, result, error)) {
+        fprintf(stderr, "Error: %s\n", error.c_str());
+        return 1;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // the converted stream may be going to standard output itself
+    FILE *report = "-" == options.outputPath ? stderr : stdout;
+
+    fprintf(
+        report,
+        "Converted %llu %u channel frames into %llu %u channel frames (%u Hz, %u bits) in %.3f s, %.1f MB/s\n",
+        static_cast<unsigned long long>(result.nInputFrames), result.inputFormat.nChannels,
+        static_cast<unsigned long long>(result.nOutputFrames), result.outputFormat.nChannels,
+        result.outputFormat.nSamplesPerSec, result.outputFormat.wBitsPerSample,
+        seconds, seconds > 0 ? static_cast<double>(result.nOutputBytes) / seconds / 1e6 : 0.0
+    );
+    if (2 == result.nMultiplex) {
+        fprintf(report, "First sample %s (%s)\n", result.nSampleOffset ? "skipped" : "kept", result.bPhaseDetected ? "detected" : "as configured");
+    }
+    else {
+        fprintf(report, "Started %u samples into the first frame (as configured)\n", result.nSampleOffset);
+    }
+    if (result.bSpliced) {
+        fprintf(report, "Stream after the first frame spliced without copying\n");
+    }
+    return 0;
+}
+
+static int convert_batch(const BatchOptions &options) {
+    BatchConverter batch;
+    std::string error;
+
+    auto start = std::chrono::steady_clock::now();
+    if (!batch.Start(options, error)) {
+        fprintf(stderr, "Error: %s\n", error.c_str());
+        return 1;
+    }
+
+    // a line a second while it goes
+    while (!batch.Wait(1000)) {
+        BatchProgress progress = batch.Progress();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf(
+            "%u/%u files, %.1f/%.1f MB, %.1f MB/s\n",
+            progress.nFilesDone, progress.nFiles,
+            static_cast<double>(progress.nInputBytesDone) / 1e6, static_cast<double>(progress.nInputBytes) / 1e6,
+            seconds > 0 ? static_cast<double>(progress.nInputBytesDone) / seconds / 1e6 : 0.0
+        );
+        fflush(stdout);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    uint32_t nSkipped = 0;
+    uint32_t nDetected = 0;
+    for (const BatchFileResult &result : batch.Results()) {
+        if (!result.bOk) {
+            fprintf(stderr, "Error: %s\n", result.error.c_str());
+            continue;
+        }
+        nSkipped += 0 != result.result.nSampleOffset ? 1 : 0;
+        nDetected += result.result.bPhaseDetected ? 1 : 0;
+    }
+
+    BatchProgress progress = batch.Progress();
+    printf(
+        "Converted %u of %u files, %.1f MB into %.1f MB in %.3f s, %.1f MB/s, on %u threads\n",
+        progress.nFiles - progress.nFilesFailed, progress.nFiles,
+        static_cast<double>(progress.nInputBytes) / 1e6, static_cast<double>(progress.nOutputBytes) / 1e6,
+        seconds, seconds > 0 ? static_cast<double>(progress.nInputBytesDone) / seconds / 1e6 : 0.0, progress.nThreads
+    );
+    printf(
+        "First sample skipped in %u, phase detected in %u; %llu parts taken by idle threads, %.0f%% copied without passing through this process\n",
+        nSkipped, nDetected, static_cast<unsigned long long>(progress.nStolenChunks),
+        progress.nOutputBytes > 0 ? 100.0 * static_cast<double>(progress.nCopiedBytes) / static_cast<double>(progress.nOutputBytes) : 0.0
+    );
+    return 0 == progress.nFilesFailed ? 0 : 1;
+}
+
+static int simulate_drift(double fPpm, double fSeconds) {
+    DriftSimulationResult result = SimulateDrift(fPpm, fSeconds);
+
+    double fRatioErrorPpm = (result.fMeanRatio - result.fExpectedRatio) * 1e6;
+    double fLatencyErrorMs = result.fMeanLatencyMs - result.fTargetMs;
+    bool bPass =
+        std::fabs(fRatioErrorPpm) <= result.fRatioTolerance * 1e6 &&
+        std::fabs(fLatencyErrorMs) <= DRIFT_SIMULATION_LATENCY_TOLERANCE_MS &&
+        result.nUnderrunFrames == 0 && result.nOverrunFrames == 0;
+
+    printf(
+        "%s Simulated %.0f s at %+.1f ppm: mean ratio %.6f (expected %.6f, off by %+.1f ppm of %.1f allowed), mean latency %.2f ms "
+        "(target %.2f ms, off by %+.2f ms of %.1f allowed, worst error %.2f ms), %llu frames underrun, %llu frames overrun\n",
+        bPass ? "ok  " : "FAIL", fSeconds, fPpm, result.fMeanRatio, result.fExpectedRatio, fRatioErrorPpm, result.fRatioTolerance * 1e6,
+        result.fMeanLatencyMs, result.fTargetMs, fLatencyErrorMs, DRIFT_SIMULATION_LATENCY_TOLERANCE_MS, result.fMaxLatencyErrorMs,
+        static_cast<unsigned long long>(result.nUnderrunFrames),
+        static_cast<unsigned long long>(result.nOverrunFrames)
+    );
+    return bPass ? 0 : 1;
+}
+
+// the built in profiles, and how many times the device may run dry on
+// each: the first stall finds the level too low, and so does the step up
+// to a busier machine
+static const struct {
+    const char *szName;
+    uint64_t nMaxUnderruns;
+} g_jitterProfiles[] = {
+    { "quiet", 0 },
+    { "busy", 0 },
+    { "stalls", 3 },
+    { "step", 2 },
+};
+
+static bool simulate_buffer_tuning_with(const char *szName, const std::vector<float> &profileMs, uint64_t nMaxUnderruns, double fSeconds) {
+    BufferTuneSimulationResult result = SimulateBufferTuning(profileMs, fSeconds);
+
+    // whatever it settles on has to cover the last minute without running
+    // dry, and not by much more than the hysteresis either way of the guard
+    bool bPass = result.nUnderruns <= nMaxUnderruns && 0 == result.nTailUnderruns &&
+        result.fFinalLevelMs <= result.fFinalNeedMs + 2 * BUFFERTUNE_HYSTERESIS_MS;
+
+    printf(
+        "%-4s %-8s %.0f s: buffering %.1f ms at the end (last minute needed %.1f ms), %.1f ms on average, %.1f to %.1f ms, "
+        "grew %u times, shrank %u times, %llu close calls, %llu underruns (%llu frames, %llu in the last minute)\n",
+        bPass ? "ok" : "FAIL", szName, result.fSeconds, result.fFinalLevelMs, result.fFinalNeedMs, result.fMeanLevelMs,
+        result.stats.fMinLevelMs, result.stats.fMaxLevelMs, result.stats.nGrows, result.stats.nShrinks,
+        static_cast<unsigned long long>(result.stats.nCloseCalls), static_cast<unsigned long long>(result.nUnderruns),
+        static_cast<unsigned long long>(result.nUnderrunFrames), static_cast<unsigned long long>(result.nTailUnderruns)
+    );
+    return bPass;
+}
+
+// szProfile is one of the built in profiles, "all" of them, or a file
+// recorded with --record-jitter, which may run dry once at the start
+static int simulate_buffer_tuning(const char *szProfile, double fSeconds, uint32_t nSeed) {
+    bool bPass = true;
+    bool bFound = false;
+    for (const auto &builtIn : g_jitterProfiles) {
+        if (0 == strcmp(szProfile, "all") || 0 == strcmp(szProfile, builtIn.szName)) {
+            std::vector<float> profileMs;
+            MakeJitterProfile(builtIn.szName, fSeconds, nSeed, profileMs);
+            bPass = simulate_buffer_tuning_with(builtIn.szName, profileMs, builtIn.nMaxUnderruns, fSeconds) && bPass;
+            bFound = true;
+        }
+    }
+    if (bFound) {
+        return bPass ? 0 : 1;
+    }
+
+    std::vector<float> profileMs;
+    std::string error;
+    if (!LoadJitterProfile(szProfile, profileMs, error)) {
+        fprintf(stderr, "Error: %s\n", error.c_str());
+        return 1;
+    }
+    return simulate_buffer_tuning_with("recorded", profileMs, 1, fSeconds) ? 0 : 1;
+}
+
+// how late this machine wakes a thread that asks to be woken every 10 ms,
+// like a render thread, written out as a profile for --jitter-profile
+static int record_jitter(const std::string &path, double fSeconds) {
+    FILE *pFile = fopen(path.c_str(), "w");
+    if (NULL == pFile) {
+        fprintf(stderr, "Error: couldn't create %s: %s\n", path.c_str(), strerror(errno));
+        return 1;
+    }
+    fprintf(pFile, "# ms late for each 10 ms wakeup, %.0f s recorded by mono-to-stereo --record-jitter\n", fSeconds);
+
+    const auto period = std::chrono::milliseconds(10);
+    const uint64_t nWakes = static_cast<uint64_t>(fSeconds * 100);
+    double fWorstMs = 0;
+    auto due = std::chrono::steady_clock::now();
+    for (uint64_t n = 0; n < nWakes; n++) {
+        due += period;
+        std::this_thread::sleep_until(due);
+        double fLateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - due).count();
+        fprintf(pFile, "%.3f\n", fLateMs);
+        fWorstMs = (std::max)(fWorstMs, fLateMs);
+
+        // a wakeup missed altogether is lost, like an event nobody waited for
+        while (std::chrono::steady_clock::now() >= due + period) {
+            due += period;
+        }
+    }
+
+    if (0 != fclose(pFile)) {
+        fprintf(stderr, "Error: couldn't write %s: %s\n", path.c_str(), strerror(errno));
+        return 1;
+    }
+    printf("Recorded %llu wakeups to %s, the latest %.3f ms late\n", static_cast<unsigned long long>(nWakes), path.c_str(), fWorstMs);
+    return 0;
+}
+
+static int simulate_phase(const AudioFormat &format) {
+    bool bPass = true;
+
+    // every kernel the CPU has, so a broken vector path shows up here
+    for (int level = SIMD_SCALAR; level <= DetectSimdLevel(); level++) {
+        PhaseSimulationResult result = SimulatePhaseDetection(format, static_cast<SimdLevel>(level));
+
+        printf(
+            "%s: %.2f ns/sample, %.4f%% of a core at %u Hz\n",
+            SimdLevelName(static_cast<SimdLevel>(level)), result.fNsPerSample, result.fCpuPercent, format.nSamplesPerSec
+        );
+        for (uint32_t i = 0; i < result.nCases; i++) {
+            const PhaseSimulationCase &c = result.cases[i];
+            printf(
+                "    %-4s %-26s expected %-17s got %-17s after %.0f ms\n",
+                c.bPass ? "ok" : "FAIL", c.szSignal,
+                ChannelPhaseName(c.expected), ChannelPhaseName(c.detected), c.fDecisionMs
+            );
+        }
+
+        bPass = bPass && result.bPass;
+    }
+
+    return bPass ? 0 : 1;
+}
+
+static void print_summary(const char *szName, const HistogramSummary &summary) {
+    printf(
+        "    %-18s p50 %7.3f ms, p99 %7.3f ms, max %7.3f ms (%llu samples)\n",
+        szName, static_cast<double>(summary.hnsP50) / 10000.0, static_cast<double>(summary.hnsP99) / 10000.0,
+        static_cast<double>(summary.hnsMax) / 10000.0,
+        static_cast<unsigned long long>(summary.nCount)
+    );
+}
+
+static int simulate_latency(double fJitterMs, double fSeconds) {
+    LatencySimulationResult result = SimulateLatency(fSeconds, fJitterMs);
+
+    printf(
+        "Simulated %.0f s with up to %.2f ms wakeup jitter: worst measurement error %.4f ms over %llu packets, "
+        "%.1f ns per histogram sample, %.1f ns per render measurement\n",
+        fSeconds, fJitterMs, result.fMaxErrorMs, static_cast<unsigned long long>(result.nMeasured),
+        result.fRecordNs, result.fRenderNs
+    );
+    print_summary("latency", result.stats.latency);
+    print_summary("capture jitter", result.stats.captureJitter);
+    print_summary("capture processing", result.stats.captureProcessing);
+    print_summary("render jitter", result.stats.renderJitter);
+    print_summary("render processing", result.stats.renderProcessing);
+    printf(
+        "    %u underruns, %u overruns, %llu capture timestamps dropped\n",
+        result.stats.ring.nUnderruns, result.stats.ring.nOverruns,
+        static_cast<unsigned long long>(result.stats.nDroppedAnchors)
+    );
+
+    // the tracker only rounds to the nearest 100 ns
+    return (result.nMeasured != 0 && result.fMaxErrorMs < 0.001) ? 0 : 1;
+}
+
+static int simulate_fanout(uint32_t nReaders, double fSeconds) {
+    FanoutSimulationResult result = SimulateFanout(nReaders, fSeconds);
+
+    printf(
+        "Fed %u outputs %llu frames in %.0f s: %llu frames wrong or missing on the outputs keeping up "
+        "(min fill %u, max fill %u of %u), stalled output overran %u times (%llu frames, %llu reads lapped, %u counted torn)\n",
+        result.nReaders, static_cast<unsigned long long>(result.nFramesWritten), fSeconds,
+        static_cast<unsigned long long>(result.nHealthyErrors),
+        result.healthy.nMinFillFrames, result.healthy.nMaxFillFrames, result.healthy.nCapacityFrames,
+        result.stalled.nOverruns, static_cast<unsigned long long>(result.stalled.nOverrunFrames),
+        static_cast<unsigned long long>(result.nStalledLaps), result.stalled.nTornReads
+    );
+
+    // the stalled output has to have been lapped for the check to mean
+    // anything, and every read lapped has to have been counted
+    return (result.nHealthyErrors == 0 && result.stalled.nOverruns != 0 && result.stalled.nTornReads == result.nStalledLaps) ? 0 : 1;
+}
+
+static int simulate_packets(uint32_t nTrials, uint32_t nSeed) {
+    RepackSimulationResult result = SimulateRepacking(nTrials, nSeed);
+
+    printf(
+        "Repacked %llu streams (%llu into more than two channels, %llu by specialized kernels) in %llu packets "
+        "(%llu not whole frames, %llu taken in place): %llu streams wrong; phase decided wrong in %u of %u cases\n",
+        static_cast<unsigned long long>(result.nTrials), static_cast<unsigned long long>(result.nWideTrials),
+        static_cast<unsigned long long>(result.nKernelTrials),
+        static_cast<unsigned long long>(result.nPackets),
+        static_cast<unsigned long long>(result.nOddPackets), static_cast<unsigned long long>(result.nInPlacePackets),
+        static_cast<unsigned long long>(result.nFailedTrials), result.nPhaseFailures, result.nPhaseCases
+    );
+
+    return result.bPass ? 0 : 1;
+}
+
+static int simulate_glitches(const AudioFormat &format, double fSeconds, uint32_t nSeed) {
+    GlitchSimulationResult result = SimulateGlitches(format, fSeconds, nSeed);
+
+    printf(
+        "Injected %llu discontinuities (%llu odd), %llu silent packets, %llu packets with unknown flags; "
+        "counted %llu discontinuities (%llu realigned), %llu silent packets, %llu packets with unknown flags, %llu frames concealed\n",
+        static_cast<unsigned long long>(result.nInjected[0]), static_cast<unsigned long long>(result.nInjected[1]),
+        static_cast<unsigned long long>(result.nInjected[2]), static_cast<unsigned long long>(result.nInjected[3]),
+        static_cast<unsigned long long>(result.stats.nDiscontinuities), static_cast<unsigned long long>(result.stats.nRealignments),
+        static_cast<unsigned long long>(result.stats.nSilentPackets), static_cast<unsigned long long>(result.stats.nUnknownFlagPackets),
+        static_cast<unsigned long long>(result.stats.nConcealedFrames)
+    );
+    printf(
+        "Over %llu frames: largest step %.4f concealed, %.4f without (%.4f in the tone itself), "
+        "%llu frames with swapped channels concealed, %llu without, %llu frames of silent packets not silent\n",
+        static_cast<unsigned long long>(result.nOutputFrames),
+        result.fWorstStep, result.fWorstStepPlain, result.fCleanStep,
+        static_cast<unsigned long long>(result.nSwappedFrames), static_cast<unsigned long long>(result.nSwappedFramesPlain),
+        static_cast<unsigned long long>(result.nLoudSilentFrames)
+    );
+
+    return result.bPass ? 0 : 1;
+}
+
+static int simulate_dsp(const AudioFormat &format, uint32_t nSeed) {
+    DspSimulationResult result = SimulateDsp(format, nSeed);
+
+    printf(
+        "Checked %u kernels against one stage at a time: worst difference %.2e (allowed %.2e); "
+        "limiter peak %.2f dBFS (ceiling %.1f); DC left %.5f, %.5f; channels %s; mono sum %s\n",
+        result.nKernels, result.fWorstDifference, result.fAllowedDifference,
+        result.fPeakDb, DSP_DEFAULT_LIMIT_DB, result.fResidualDc[0], result.fResidualDc[1],
+        result.bSwapped ? "swapped" : "NOT swapped", result.bMono ? "the same on both" : "NOT the same on both"
+    );
+
+    return result.bPass ? 0 : 1;
+}
+
+static int simulate_rtp(const AudioFormat &format, RtpEncoding encoding, uint32_t nSeed) {
+    RtpSimulationResult result = SimulateRtp(format, encoding, nSeed);
+
+    printf(
+        "Batched: %llu packets of %u frames in %llu send calls, %.2f us a packet to send, %.0f packets/s end to end\n",
+        static_cast<unsigned long long>(result.nBatchedPackets), result.nPacketFrames,
+        static_cast<unsigned long long>(result.nBatchedCalls), result.fBatchedUsPerPacket, result.fBatchedPacketsPerSec
+    );
+    printf(
+        "One at a time: %llu packets in %llu send calls, %.2f us a packet to send, %.0f packets/s end to end\n",
+        static_cast<unsigned long long>(result.nSinglePackets), static_cast<unsigned long long>(result.nSingleCalls),
+        result.fSingleUsPerPacket, result.fSinglePacketsPerSec
+    );
+    print_summary("transit", result.transit);
+    printf(
+        "%s %s: %llu frames came out different, %u of %u jitter buffer cases played wrong\n",
+        SampleTypeName(SampleTypeOf(format)), RtpEncodingName(encoding),
+        static_cast<unsigned long long>(result.nWrongFrames), result.nFaultFailures, result.nFaultCases
+    );
+
+    return result.bPass ? 0 : 1;
+}
+
+// prints each snapshot, like the console sink on Windows, and keeps each
+// output's last one for the checks once the pipeline has stopped
+class StdoutStatsSink : public StatsSink {
+public:
+    void Publish(const StreamStatsSnapshot &snapshot) override {
+        if (snapshot.nOutput >= m_last.size()) {
+            m_last.resize(snapshot.nOutput + 1);
+        }
+        m_last[snapshot.nOutput] = snapshot;
+
+        printf("Output %u:\n", snapshot.nOutput + 1);
+        print_summary("latency", snapshot.latency);
+        print_summary("capture jitter", snapshot.captureJitter);
+        print_summary("capture processing", snapshot.captureProcessing);
+        print_summary("render jitter", snapshot.renderJitter);
+        print_summary("render processing", snapshot.renderProcessing);
+        printf(
+            "    ring %u frames, min fill %u, max fill %u, %u overruns (%llu frames), %u underruns (%llu frames), %u torn reads (%llu frames silenced), "
+            "%llu capture gap frames\n",
+            snapshot.ring.nCapacityFrames,
+            snapshot.ring.nMinFillFrames == UINT32_MAX ? 0 : snapshot.ring.nMinFillFrames, snapshot.ring.nMaxFillFrames,
+            snapshot.ring.nOverruns, static_cast<unsigned long long>(snapshot.ring.nOverrunFrames),
+            snapshot.ring.nUnderruns, static_cast<unsigned long long>(snapshot.ring.nUnderrunFrames),
+            snapshot.ring.nTornReads, static_cast<unsigned long long>(snapshot.ring.nTornFrames),
+            static_cast<unsigned long long>(snapshot.nCaptureGapFrames)
+        );
+        printf(
+            "    %llu discontinuities (%llu realigned), %llu silent packets, %llu packets with unknown flags, %llu frames concealed\n",
+            static_cast<unsigned long long>(snapshot.glitches.nDiscontinuities),
+            static_cast<unsigned long long>(snapshot.glitches.nRealignments),
+            static_cast<unsigned long long>(snapshot.glitches.nSilentPackets),
+            static_cast<unsigned long long>(snapshot.glitches.nUnknownFlagPackets),
+            static_cast<unsigned long long>(snapshot.glitches.nConcealedFrames)
+        );
+        if (snapshot.buffer.fLevelMs > 0) {
+            printf(
+                "    buffering %.1f ms (%.1f to %.1f ms), grew %u times, shrank %u times, %llu close calls (%llu ran dry)\n",
+                snapshot.buffer.fLevelMs, snapshot.buffer.fMinLevelMs, snapshot.buffer.fMaxLevelMs,
+                snapshot.buffer.nGrows, snapshot.buffer.nShrinks,
+                static_cast<unsigned long long>(snapshot.buffer.nCloseCalls),
+                static_cast<unsigned long long>(snapshot.buffer.nEmptyWakeups)
+            );
+        }
+    }
+
+    // NULL if nothing was published for it
+    const StreamStatsSnapshot *Last(uint32_t nOutput) const {
+        return nOutput < m_last.size() ? &m_last[nOutput] : NULL;
+    }
+
+private:
+    std::vector<StreamStatsSnapshot> m_last;
+};
+
+// where the message queue is emptied to, from its own thread
+class StdoutMessageSink : public MessageSink {
+public:
+    void Write(bool bError, const char *szMessage) override {
+        if (bError) {
+            fprintf(stderr, "Error: %s\n", szMessage);
+        }
+        else {
+            printf("%s\n", szMessage);
+        }
+    }
+};
+
+// reads back what the tap wrote: a header that parses, and every frame the
+// pipeline repacked, in time. a realignment after a discontinuity can move
+// the stereo frames a sample either way
+// levels are only checked when nothing changes them; the first half second
+// is left out while the channel phase settles
+static bool check_recording_levels(MappedInputFile &file, const WavInfo &info) {
+    const uint32_t nChannels = info.format.nChannels;
+    const uint64_t nFrames = info.nDataBytes / info.format.nBlockAlign;
+    const uint64_t nSkip = (std::min)(nFrames, static_cast<uint64_t>(info.format.nSamplesPerSec / 2));
+
+    std::string error;
+    const uint8_t *pData = file.Map(info.nDataOffset, static_cast<size_t>(nFrames * info.format.nBlockAlign), error);
+    SampleConverter toFloat;
+    if (nullptr == pData || !toFloat.Init(SampleTypeOf(info.format), SAMPLE_FLOAT32, false)) {
+        fprintf(stderr, "Error: can't read the recording back: %s\n", error.c_str());
+        return false;
+    }
+
+    double sums[AUDIOFORMAT_MAX_CHANNELS] = {};
+    std::vector<float> block(4096 * nChannels);
+    for (uint64_t i = nSkip; i < nFrames; i += 4096) {
+        uint32_t n = static_cast<uint32_t>((std::min)(static_cast<uint64_t>(4096), nFrames - i));
+        toFloat.ToFloat(pData + i * info.format.nBlockAlign, block.data(), static_cast<size_t>(n) * nChannels);
+        for (uint32_t f = 0; f < n; f++) {
+            for (uint32_t c = 0; c < nChannels; c++) {
+                double x = block[static_cast<size_t>(f) * nChannels + c];
+                sums[c] += x * x;
+            }
+        }
+    }
+
+    // each channel's level against the first, which doesn't depend on
+    // how much was faded or silenced
+    bool bPass = sums[0] > 0;
+    printf("Channel levels against the first:");
+    for (uint32_t c = 0; c < nChannels && bPass; c++) {
+        double fLevel = std::sqrt(sums[c] / sums[0]);
+        double fExpected = SimulatedChannelLevel(c) / SimulatedChannelLevel(0);
+        printf(" %.3f (%.3f)", fLevel, fExpected);
+        bPass = std::fabs(fLevel - fExpected) < 0.03 * fExpected;
+    }
+    printf(": %s\n", bPass ? "ok" : "FAIL");
+    return bPass;
+}
+
+static bool check_recording(const RecordingTap &tap, uint32_t nMultiplex, bool bCheckLevels, uint64_t nCapturedFrames, uint64_t nDiscontinuities) {
+    RecordingStats stats = tap.Stats();
+    printf(
+        "Recording: %llu frames in %llu blocks, %llu dropped, %llu header updates\n",
+        static_cast<unsigned long long>(stats.nFrames), static_cast<unsigned long long>(stats.nBlocks),
+        static_cast<unsigned long long>(stats.nDroppedFrames), static_cast<unsigned long long>(stats.nHeaderUpdates)
+    );
+
+    MappedInputFile file;
+    std::string error;
+    if (!file.Open(tap.Path(), error)) {
+        fprintf(stderr, "Error: %s: %s\n", tap.Path().c_str(), error.c_str());
+        return false;
+    }
+
+    WavInfo info;
+    size_t nHeaderBytes = static_cast<size_t>((std::min)(file.Size(), static_cast<uint64_t>(WAV_HEADER_BYTES)));
+    const uint8_t *pHeader = file.Map(0, nHeaderBytes, error);
+    if (nullptr == pHeader || !ParseWavHeader(pHeader, nHeaderBytes, file.Size(), info, error)) {
+        fprintf(stderr, "Error: %s: %s\n", tap.Path().c_str(), error.c_str());
+        return false;
+    }
+
+    // skipped first samples and those still carried at the end never make
+    // it into a frame
+    uint64_t nFrames = info.nDataBytes / info.format.nBlockAlign;
+    int64_t nMissing = static_cast<int64_t>(nCapturedFrames) - static_cast<int64_t>(nFrames * nMultiplex);
+    int64_t nAllowed = nMultiplex + static_cast<int64_t>(nDiscontinuities) * (nMultiplex - 1);
+    bool bPass = nFrames == stats.nFrames && nMissing >= -nAllowed && nMissing <= nAllowed;
+    printf(
+        "Recorded %llu frames of %u channels from %llu captured: %s\n",
+        static_cast<unsigned long long>(nFrames), info.format.nChannels, static_cast<unsigned long long>(nCapturedFrames), bPass ? "ok" : "FAIL"
+    );
+
+    if (bPass && bCheckLevels) {
+        bPass = check_recording_levels(file, info);
+    }
+    return bPass;
+}
+
+// where the stream goes over the network, and where one comes in
+struct NetworkOptions {
+    std::string sendTo;       // "host:port", empty not to send
+    RtpSendOptions send;
+    std::string receiveOn;    // "[host:]port", empty not to receive
+    RtpReceiveOptions receive;
+};
+
+static void print_rtp_send_stats(const RtpSender &sender) {
+    RtpSendStats stats = sender.Stats();
+    printf(
+        "Sent to %s: %llu packets (%llu bytes) in %llu send calls, %llu dropped, %llu refused, %llu failed\n",
+        sender.Destination().c_str(), static_cast<unsigned long long>(stats.nPackets), static_cast<unsigned long long>(stats.nBytes),
+        static_cast<unsigned long long>(stats.nSendCalls), static_cast<unsigned long long>(stats.nDroppedPackets),
+        static_cast<unsigned long long>(stats.nRefusedPackets), static_cast<unsigned long long>(stats.nFailedPackets)
+    );
+    print_summary("send", stats.sendTime);
+}
+
+static void print_rtp_receive_stats(const RtpReceiver &receiver) {
+    RtpReceiveStats stats = receiver.Stats();
+    printf(
+        "Received: %llu packets of %u frames in %llu batches (%llu receive calls), %llu reordered, %llu duplicates, %llu late, "
+        "%llu overflowed, %llu invalid, %llu streams\n",
+        static_cast<unsigned long long>(stats.nPackets), stats.nPacketFrames,
+        static_cast<unsigned long long>(stats.nBatches), static_cast<unsigned long long>(stats.nReceiveCalls),
+        static_cast<unsigned long long>(stats.nReorderedPackets), static_cast<unsigned long long>(stats.nDuplicatePackets),
+        static_cast<unsigned long long>(stats.nLatePackets), static_cast<unsigned long long>(stats.nOverflowPackets),
+        static_cast<unsigned long long>(stats.nInvalidPackets), static_cast<unsigned long long>(stats.nStreams)
+    );
+    printf(
+        "Played: %llu frames (%llu silent), %llu packets lost, %llu skipped, %llu underruns\n",
+        static_cast<unsigned long long>(stats.nFrames), static_cast<unsigned long long>(stats.nSilentFrames),
+        static_cast<unsigned long long>(stats.nLostPackets), static_cast<unsigned long long>(stats.nSkippedPackets),
+        static_cast<unsigned long long>(stats.nUnderruns)
+    );
+    print_summary("capture to arrival", stats.transit);
+    print_summary("capture to output", stats.latency);
+}
+
+static int simulate_device(const SimulatedDeviceOptions &device, uint32_t nOutputs, const PipelineOptions &options, const std::string &sharedStatsName, const std::string &recordPath, const NetworkOptions &network, double fSeconds) {
+    SteadyClock clock;
+    StdoutStatsSink statsSink;
+    StdoutMessageSink stdoutMessages;
+    AsyncMessageSink messages(stdoutMessages, clock);
+    messages.Start();
+
+    SimulatedCaptureSource source(clock, device);
+
+    // the outputs take the demultiplexed stream in the capture's sample
+    // type, without any of the capture side's faults
+    SimulatedDeviceOptions renderDevice;
+    renderDevice.format = DemultiplexedFormat(device.format, device.nMultiplex);
+    renderDevice.hnsPeriod = device.hnsPeriod;
+    renderDevice.fJitterMs = device.fJitterMs;
+    renderDevice.jitterProfileMs = device.jitterProfileMs;
+
+    std::unique_ptr<SimulatedRenderSink> sinks[MAX_SIMULATED_OUTPUTS];
+    RenderSink *pSinks[MAX_SIMULATED_OUTPUTS];
+    for (uint32_t i = 0; i < nOutputs; i++) {
+        renderDevice.nSeed = device.nSeed + 1 + i;
+        sinks[i].reset(new SimulatedRenderSink(clock, renderDevice));
+        pSinks[i] = sinks[i].get();
+    }
+
+    SharedStatsWriter sharedStats(clock);
+    if (!sharedStatsName.empty()) {
+        std::string error;
+        if (!sharedStats.Create(sharedStatsName, error)) {
+            fprintf(stderr, "Error: couldn't set up shared statistics %s: %s\n", sharedStatsName.c_str(), error.c_str());
+            return 1;
+        }
+    }
+
+    RecordingTap recording(clock, messages);
+    if (!recordPath.empty()) {
+        std::string error;
+        if (!recording.Open(recordPath, error)) {
+            fprintf(stderr, "Error: couldn't record: %s\n", error.c_str());
+            return 1;
+        }
+    }
+
+    RtpSender sender(clock, messages);
+    if (!network.sendTo.empty()) {
+        std::string error;
+        if (!sender.Open(network.sendTo, network.send, error)) {
+            fprintf(stderr, "Error: couldn't stream: %s\n", error.c_str());
+            return 1;
+        }
+    }
+
+    // the stream can be played back here, on one more simulated output,
+    // which is what measures it from capture to output
+    RtpReceiver receiver(clock, messages);
+    RtpPlayer player(clock, messages);
+    std::unique_ptr<SimulatedRenderSink> listener;
+    std::thread playerThread;
+    if (!network.receiveOn.empty()) {
+        RtpReceiveOptions receiveOptions = network.receive;
+        receiveOptions.encoding = network.send.encoding;
+        receiveOptions.nRate = renderDevice.format.nSamplesPerSec;
+        receiveOptions.nChannels = renderDevice.format.nChannels;
+        std::string error;
+        if (!receiver.Open(network.receiveOn, receiveOptions, error)) {
+            fprintf(stderr, "Error: couldn't receive the stream: %s\n", error.c_str());
+            return 1;
+        }
+        receiver.Start();
+
+        renderDevice.nSeed = device.nSeed + 1 + nOutputs;
+        listener.reset(new SimulatedRenderSink(clock, renderDevice));
+        if (DEVICE_OK != player.Start(receiver, *listener, options.nBufferMs)) {
+            fprintf(stderr, "Error: couldn't play the stream: %s\n", player.Error().c_str());
+            return 1;
+        }
+        playerThread = std::thread([&]() { player.Run(); });
+    }
+
+    StreamPipeline pipeline(clock, statsSink, messages);
+    if (!sharedStatsName.empty()) {
+        pipeline.SetLiveStats(sharedStats, SHAREDSTATS_INTERVAL_MS);
+    }
+    if (recording.IsOpen()) {
+        pipeline.SetRecording(recording);
+    }
+    if (sender.IsOpen()) {
+        pipeline.SetStreaming(sender);
+    }
+
+    DeviceStatus status = pipeline.Start(source, pSinks, nOutputs, options);
+    if (DEVICE_OK != status) {
+        if (playerThread.joinable()) {
+            player.Stop();
+            playerThread.join();
+        }
+        return 1;
+    }
+
+    // stops the pipeline once the time is up, or as soon as it stops by itself
+    std::mutex mutex;
+    std::condition_variable done;
+    bool bDone = false;
+    std::thread stopper([&]() {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait_for(lock, std::chrono::duration<double>(fSeconds), [&]() { return bDone; });
+        pipeline.Stop();
+    });
+
+    status = pipeline.Run();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        bDone = true;
+    }
+    done.notify_all();
+    stopper.join();
+
+    // nothing writes to it once Run has returned
+    bool bRecorded = true;
+    if (recording.IsOpen()) {
+        std::string error;
+        if (!recording.Stop(error)) {
+            fprintf(stderr, "Error: %s\n", error.c_str());
+            bRecorded = false;
+        }
+    }
+
+    // whatever is still on its way over loopback is given a moment to arrive
+    if (playerThread.joinable()) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(200);
+        while (receiver.Stats().nPackets < sender.Stats().nPackets && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        player.Stop();
+        playerThread.join();
+        receiver.Stop();
+    }
+    messages.Stop();
+
+    const SimulatedDeviceStats &capture = source.Stats();
+    printf(
+        "Capture: %llu packets, %llu frames, %llu events (%llu late), %llu discontinuities (%llu frames lost), %llu odd packets, %llu faults\n",
+        static_cast<unsigned long long>(capture.nPackets), static_cast<unsigned long long>(capture.nFrames),
+        static_cast<unsigned long long>(capture.nEvents), static_cast<unsigned long long>(capture.nLateEvents),
+        static_cast<unsigned long long>(capture.nDiscontinuities), static_cast<unsigned long long>(capture.nLostFrames),
+        static_cast<unsigned long long>(capture.nOddPackets), static_cast<unsigned long long>(capture.nFaults)
+    );
+    AsyncMessageStats messageStats = messages.Stats();
+    printf(
+        "Messages: %llu written, %llu dropped, %llu rate limited\n",
+        static_cast<unsigned long long>(messageStats.nWritten), static_cast<unsigned long long>(messageStats.nDropped),
+        static_cast<unsigned long long>(messageStats.nSuppressed)
+    );
+    for (uint32_t i = 0; i < nOutputs; i++) {
+        const SimulatedDeviceStats &render = sinks[i]->Stats();
+        printf(
+            "Output %u device: %llu frames written, %llu events (%llu late), %llu underruns (%llu frames of silence)\n",
+            i + 1, static_cast<unsigned long long>(render.nFrames),
+            static_cast<unsigned long long>(render.nEvents), static_cast<unsigned long long>(render.nLateEvents),
+            static_cast<unsigned long long>(render.nUnderruns), static_cast<unsigned long long>(render.nUnderrunFrames)
+        );
+    }
+
+    // what's heard has to be about as late as asked for, half a buffer or
+    // the most a tuned output's level got to: give or take a capture
+    // packet, which the ring's share moves by between render wakeups, and
+    // a period for stalls that are still being drained
+    bool bLatency = true;
+    double fOverMs = 2 * device.hnsPeriod / 10000.0;
+    for (uint32_t i = 0; i < nOutputs; i++) {
+        const StreamStatsSnapshot *pLast = statsSink.Last(i);
+        if (NULL == pLast || 0 == pLast->latency.nCount) {
+            continue;
+        }
+        double fTargetMs = options.bAutoBuffer ? pLast->buffer.fMaxLevelMs : options.nBufferMs / 2.0;
+        double fP50Ms = pLast->latency.hnsP50 / 10000.0;
+        bool bPass = fP50Ms <= fTargetMs + fOverMs;
+        printf(
+            "Output %u latency: p50 %.1f ms, asked for %.1f ms, at most %.1f ms over: %s\n",
+            i + 1, fP50Ms, fTargetMs, fOverMs, bPass ? "ok" : "FAIL"
+        );
+        bLatency = bLatency && bPass;
+    }
+
+    if (!recordPath.empty()) {
+        bRecorded = bRecorded && check_recording(recording, options.nMultiplex, !options.dsp.Any(), pipeline.CapturedFrames(), capture.nDiscontinuities);
+    }
+
+    // over loopback every packet sent has to arrive and play, with nothing
+    // lost that a sender can't be blamed for
+    bool bStreamed = true;
+    if (sender.IsOpen()) {
+        print_rtp_send_stats(sender);
+        RtpSendStats sent = sender.Stats();
+        bStreamed = 0 != sent.nPackets && 0 == sent.nFailedPackets;
+        if (!network.receiveOn.empty()) {
+            print_rtp_receive_stats(receiver);
+            RtpReceiveStats received = receiver.Stats();
+            bStreamed = bStreamed && received.nPackets == sent.nPackets && 0 == received.nLostPackets && 0 != received.latency.nCount;
+        }
+    }
+
+    return (DEVICE_OK == status && pipeline.CapturedFrames() != 0 && bLatency && bRecorded && bStreamed) ? 0 : 1;
+}
+
+// makes simulated endpoints for the supervisor, and takes them away again:
+// each set it hands out has one device, the input or an output in turn,
+// that goes away fIntervalSec later and stays away for fAwayMs, until
+// nLosses have been lost
+class SimulatedEndpointProvider : public EndpointProvider {
+public:
+    SimulatedEndpointProvider(StatsClock &clock, const SimulatedDeviceOptions &device, uint32_t nOutputs, uint32_t nLosses, double fIntervalSec, double fAwayMs)
+        : m_clock(clock)
+        , m_device(device)
+        , m_nOutputs(nOutputs)
+        , m_nLosses(nLosses)
+        , m_hnsInterval(static_cast<int64_t>(fIntervalSec * HNS_PER_SECOND))
+        , m_hnsAway(static_cast<int64_t>(fAwayMs * 10000))
+        , m_nLost(0)
+        , m_hnsBack(0)
+        , m_nCreated(0)
+    {}
+
+    DeviceStatus Create(std::unique_ptr<CaptureSource> &source, std::vector<std::unique_ptr<RenderSink>> &sinks, std::string &error) override {
+        int64_t hnsNow = m_clock.NowHns();
+        if (hnsNow < m_hnsBack) {
+            error = "simulated device is away";
+            return DEVICE_LOST;
+        }
+
+        // the next loss, if there is one, and which device it takes
+        int64_t hnsLoseAt = INT64_MAX;
+        uint32_t nVictim = m_nLost % (m_nOutputs + 1);
+        if (m_nLost < m_nLosses) {
+            hnsLoseAt = hnsNow + m_hnsInterval;
+            m_hnsBack = hnsLoseAt + m_hnsAway;
+            m_nLost++;
+        }
+
+        // a new set of devices, with its own schedule of events
+        SimulatedDeviceOptions capture = m_device;
+        capture.nSeed = m_device.nSeed + 100 * m_nCreated;
+        capture.hnsLoseAt = 0 == nVictim ? hnsLoseAt : INT64_MAX;
+        source.reset(new SimulatedCaptureSource(m_clock, capture));
+
+        SimulatedDeviceOptions render;
+        render.format = DemultiplexedFormat(m_device.format, m_device.nMultiplex);
+        render.hnsPeriod = m_device.hnsPeriod;
+        render.fJitterMs = m_device.fJitterMs;
+        render.jitterProfileMs = m_device.jitterProfileMs;
+        sinks.clear();
+        for (uint32_t i = 0; i < m_nOutputs; i++) {
+            render.nSeed = capture.nSeed + 1 + i;
+            render.hnsLoseAt = i + 1 == nVictim ? hnsLoseAt : INT64_MAX;
+            sinks.emplace_back(new SimulatedRenderSink(m_clock, render));
+        }
+
+        m_nCreated++;
+        return DEVICE_OK;
+    }
+
+    // every loss has been handed out and the last device is back
+    bool Done() {
+        return m_nLost == m_nLosses && m_clock.NowHns() >= m_hnsBack;
+    }
+
+private:
+    StatsClock &m_clock;
+    SimulatedDeviceOptions m_device;
+    uint32_t m_nOutputs;
+    uint32_t m_nLosses;
+    int64_t m_hnsInterval;
+    int64_t m_hnsAway;
+    std::atomic<uint32_t> m_nLost;
+    std::atomic<int64_t> m_hnsBack;
+    uint32_t m_nCreated;
+};
+
+class NullStatsSink : public StatsSink {
+public:
+    void Publish(const StreamStatsSnapshot &) override {}
+};
+
+// the loss of one device has to cost less than this much audio, on top of
+// the time it was away
+#define SIMULATED_MAX_GAP_MS 200
+
+// and stopping has to take less than this
+#define SIMULATED_MAX_STOP_MS 500
+
+static void print_supervisor_stats(const SupervisorStats &stats) {
+    printf("Supervisor: %u restarts, %u failed attempts\n", stats.nRestarts, stats.nFailedAttempts);
+    print_summary("restart", stats.restart);
+    print_summary("audio gap", stats.gap);
+}
+
+static int simulate_restarts(const SimulatedDeviceOptions &device, uint32_t nOutputs, const PipelineOptions &options, uint32_t nLosses, double fAwayMs) {
+    SteadyClock clock;
+    NullStatsSink statsSink;
+    StdoutMessageSink stdoutMessages;
+    AsyncMessageSink messages(stdoutMessages, clock);
+    messages.Start();
+
+    SimulatedEndpointProvider provider(clock, device, nOutputs, nLosses, 0.5, fAwayMs);
+    StreamSupervisor supervisor(clock, statsSink, messages, provider);
+
+    // stops the supervisor once every device has come back and had a
+    // while to settle, or after long enough that something is stuck
+    std::mutex mutex;
+    std::condition_variable done;
+    bool bDone = false;
+    int64_t hnsStopCalled = 0;
+    std::thread stopper([&]() {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(nLosses * (0.5 + fAwayMs / 1000.0) * 2 + 5);
+        while (!bDone && std::chrono::steady_clock::now() < deadline) {
+            if (provider.Done() && SUPERVISOR_RUNNING == supervisor.State() && supervisor.Stats().nRestarts == nLosses) {
+                done.wait_for(lock, std::chrono::milliseconds(300), [&]() { return bDone; });
+                break;
+            }
+            done.wait_for(lock, std::chrono::milliseconds(10), [&]() { return bDone; });
+        }
+        hnsStopCalled = clock.NowHns();
+        supervisor.Stop();
+    });
+
+    DeviceStatus status = supervisor.Run(options);
+    int64_t hnsStopped = clock.NowHns();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        bDone = true;
+    }
+    done.notify_all();
+    stopper.join();
+    messages.Stop();
+
+    SupervisorStats stats = supervisor.Stats();
+    double fStopMs = static_cast<double>(hnsStopped - hnsStopCalled) / 10000.0;
+    print_supervisor_stats(stats);
+    printf(
+        "Lost %u devices, away %.0f ms each: %llu frames captured, worst gap %.1f ms (limit %.0f ms), stopped in %.1f ms\n",
+        nLosses, fAwayMs, static_cast<unsigned long long>(supervisor.CapturedFrames()),
+        static_cast<double>(stats.gap.hnsMax) / 10000.0, fAwayMs + SIMULATED_MAX_GAP_MS, fStopMs
+    );
+
+    bool bPass =
+        DEVICE_OK == status &&
+        stats.nRestarts == nLosses &&
+        stats.gap.nCount == nLosses &&
+        stats.gap.hnsMax < static_cast<int64_t>((fAwayMs + SIMULATED_MAX_GAP_MS) * 10000) &&
+        fStopMs < SIMULATED_MAX_STOP_MS;
+    return bPass ? 0 : 1;
+}
+
+// runs under the supervisor until SIGINT or SIGTERM, like a service would
+static int run_daemon(StatsClock &clock, EndpointProvider &provider, const PipelineOptions &options, const std::string &sharedStatsName, const std::string &recordPath, const NetworkOptions &network) {
+    // every thread started from here on leaves the signals to sigwait
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    StdoutStatsSink statsSink;
+    StdoutMessageSink stdoutMessages;
+    AsyncMessageSink messages(stdoutMessages, clock);
+    messages.Start();
+
+    SharedStatsWriter sharedStats(clock);
+    if (!sharedStatsName.empty()) {
+        std::string error;
+        if (!sharedStats.Create(sharedStatsName, error)) {
+            fprintf(stderr, "Error: couldn't set up shared statistics %s: %s\n", sharedStatsName.c_str(), error.c_str());
+            return 1;
+        }
+    }
+
+    RecordingTap recording(clock, messages);
+    if (!recordPath.empty()) {
+        std::string error;
+        if (!recording.Open(recordPath, error)) {
+            fprintf(stderr, "Error: couldn't record: %s\n", error.c_str());
+            return 1;
+        }
+    }
+
+    RtpSender sender(clock, messages);
+    if (!network.sendTo.empty()) {
+        std::string error;
+        if (!sender.Open(network.sendTo, network.send, error)) {
+            fprintf(stderr, "Error: couldn't stream: %s\n", error.c_str());
+            return 1;
+        }
+    }
+
+    StreamSupervisor supervisor(clock, statsSink, messages, provider);
+    if (!sharedStatsName.empty()) {
+        supervisor.SetLiveStats(sharedStats, SHAREDSTATS_INTERVAL_MS);
+    }
+    if (recording.IsOpen()) {
+        supervisor.SetRecording(recording);
+    }
+    if (sender.IsOpen()) {
+        supervisor.SetStreaming(sender);
+    }
+
+    std::atomic<bool> bGaveUp(false);
+    std::thread waiter([&]() {
+        int iSignal = 0;
+        sigwait(&signals, &iSignal);
+        if (!bGaveUp.load()) {
+            messages.Log("Stopping on signal %d", iSignal);
+        }
+        supervisor.Stop();
+    });
+
+    DeviceStatus status = supervisor.Run(options);
+
+    // the waiter is still waiting if the supervisor gave up by itself
+    bGaveUp.store(true);
+    pthread_kill(waiter.native_handle(), SIGTERM);
+    waiter.join();
+
+    bool bRecorded = true;
+    if (recording.IsOpen()) {
+        std::string error;
+        if (!recording.Stop(error)) {
+            fprintf(stderr, "Error: %s\n", error.c_str());
+            bRecorded = false;
+        }
+    }
+    messages.Stop();
+
+    print_supervisor_stats(supervisor.Stats());
+    if (sender.IsOpen()) {
+        print_rtp_send_stats(sender);
+    }
+    return DEVICE_OK == status && bRecorded ? 0 : 1;
+}
+
+static int simulate_daemon(const SimulatedDeviceOptions &device, uint32_t nOutputs, const PipelineOptions &options, const std::string &sharedStatsName, const std::string &recordPath, const NetworkOptions &network) {
+    SteadyClock clock;
+    SimulatedEndpointProvider provider(clock, device, nOutputs, 0, 0, 0);
+    return run_daemon(clock, provider, options, sharedStatsName, recordPath, network);
+}
+
+// plays a stream from the network on a simulated output, standing in for a
+// real one, for as long as asked or until SIGINT or SIGTERM as a daemon
+static int receive_rtp(const NetworkOptions &network, uint32_t nBufferMs, bool bDaemon, double fSeconds) {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    if (bDaemon) {
+        pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    }
+
+    SteadyClock clock;
+    StdoutMessageSink stdoutMessages;
+    AsyncMessageSink messages(stdoutMessages, clock);
+    messages.Start();
+
+    RtpReceiver receiver(clock, messages);
+    std::string error;
+    if (!receiver.Open(network.receiveOn, network.receive, error)) {
+        fprintf(stderr, "Error: couldn't receive the stream: %s\n", error.c_str());
+        return 1;
+    }
+    receiver.Start();
+    messages.Log(
+        "Listening on port %u for %s at %u Hz, %u channels, playing %.1f ms behind",
+        receiver.Port(), RtpEncodingName(network.receive.encoding), network.receive.nRate, network.receive.nChannels, network.receive.fJitterMs
+    );
+
+    SimulatedDeviceOptions outputDevice;
+    outputDevice.format = receiver.Format();
+    SimulatedRenderSink output(clock, outputDevice);
+    RtpPlayer player(clock, messages);
+    if (DEVICE_OK != player.Start(receiver, output, nBufferMs)) {
+        fprintf(stderr, "Error: couldn't play the stream: %s\n", player.Error().c_str());
+        return 1;
+    }
+
+    std::mutex mutex;
+    std::condition_variable done;
+    bool bDone = false;
+    std::thread stopper([&]() {
+        if (bDaemon) {
+            int iSignal = 0;
+            sigwait(&signals, &iSignal);
+        }
+        else {
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait_for(lock, std::chrono::duration<double>(fSeconds), [&]() { return bDone; });
+        }
+        player.Stop();
+    });
+
+    DeviceStatus status = player.Run();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        bDone = true;
+    }
+    done.notify_all();
+    if (bDaemon) {
+        pthread_kill(stopper.native_handle(), SIGTERM);
+    }
+    stopper.join();
+    receiver.Stop();
+    messages.Stop();
+
+    if (DEVICE_STOPPED != status) {
+        fprintf(stderr, "Error: %s\n", player.Error().c_str());
+    }
+    print_rtp_receive_stats(receiver);
+    return DEVICE_STOPPED == status ? 0 : 1;
+}
+
+// puts the switches from each --config file where it was
+static bool expand_config_files(int argc, char *argv[], std::vector<std::string> &args) {
+    for (int i = 0; i < argc; i++) {
+        if (0 == strcmp(argv[i], "--config") && i + 1 < argc) {
+            std::string error;
+            if (!ReadConfigFile(argv[++i], args, error)) {
+                fprintf(stderr, "Error: %s\n", error.c_str());
+                return false;
+            }
+            continue;
+        }
+        args.push_back(argv[i]);
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    ConvertOptions convert;
+    BatchOptions batch;
+    bool bBatch = false;
+    bool bSimulateDrift = false;
+    bool bSimulatePhase = false;
+    bool bSimulateLatency = false;
+    double fLatencyJitterMs = 0;
+    bool bSimulateFanout = false;
+    uint32_t nFanoutReaders = 0;
+    AudioFormat phaseFormat = MakeAudioFormat(AUDIOFORMAT_TAG_PCM, 1, 96000, 16);
+    double fDriftPpm = 0;
+    bool bSimulatePackets = false;
+    uint32_t nPacketTrials = 0;
+    bool bSimulateGlitches = false;
+    bool bSimulateDsp = false;
+    bool bSimulateDevice = false;
+    SimulatedDeviceOptions device;
+    uint32_t nDeviceOutputs = 1;
+    PipelineOptions pipeline;
+    std::string sharedStatsName;
+    std::string recordPath;
+    NetworkOptions network;
+    bool bSimulateRtp = false;
+    bool bDaemon = false;
+    bool bSimulateRestarts = false;
+    const char *szTuningProfile = NULL;
+    std::string recordJitterPath;
+    uint32_t nRestartLosses = 0;
+    double fDeviceAwayMs = 50;
+    double fSimulateSeconds = 0; // 0 for the mode's default
+    uint16_t nRawChannels = 1;
+    uint16_t nDeviceChannels = 1;
+
+    if (argc == 2 && (0 == strcmp(argv[1], "-?") || 0 == strcmp(argv[1], "--help"))) {
+        usage(argv[0]);
+        return 0;
+    }
+
+    std::vector<std::string> args;
+    if (!expand_config_files(argc, argv, args)) {
+        return 1;
+    }
+    std::vector<char *> expanded;
+    for (std::string &arg : args) {
+        expanded.push_back(&arg[0]);
+    }
+    argc = static_cast<int>(expanded.size());
+    argv = expanded.data();
+
+    for (int i = 1; i < argc; i++) {
+        // every switch but these takes an argument
+        bool bHasValue = i + 1 < argc;
+
+        if (0 == strcmp(argv[i], "--skip-first-sample")) {
+            convert.nSampleOffset = 1;
+            convert.bDetectPhase = false;
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--no-skip-first-sample")) {
+            convert.nSampleOffset = 0;
+            convert.bDetectPhase = false;
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--no-drift-compensation")) {
+            pipeline.bDriftCompensation = false;
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--remove-dc")) {
+            pipeline.dsp.bRemoveDc = true;
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--swap-channels")) {
+            pipeline.dsp.channels = DSP_CHANNELS_SWAP;
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--mono")) {
+            pipeline.dsp.channels = DSP_CHANNELS_MONO;
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--daemon")) {
+            bDaemon = true;
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--missing-first-sample")) {
+            device.bMissingFirstSample = true;
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--input-file") && bHasValue) {
+            convert.inputPath = argv[++i];
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--output-file") && bHasValue) {
+            convert.outputPath = argv[++i];
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--batch") && bHasValue) {
+            std::string error;
+            if (!ListBatchInputs(argv[++i], batch.inputs, error)) {
+                fprintf(stderr, "Error: %s\n", error.c_str());
+                return 1;
+            }
+            bBatch = true;
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--output-dir") && bHasValue) {
+            batch.outputDir = argv[++i];
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--threads") && bHasValue) {
+            int iThreads = atoi(argv[++i]);
+            if (iThreads < 0 || iThreads > BATCH_MAX_THREADS) {
+                fprintf(stderr, "Error: --threads takes 0 to %d\n", BATCH_MAX_THREADS);
+                return 1;
+            }
+            batch.nThreads = static_cast<uint32_t>(iThreads);
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--chunk-size") && bHasValue) {
+            int iChunkMB = atoi(argv[++i]);
+            if (iChunkMB <= 0 || iChunkMB > 1024) {
+                fprintf(stderr, "Error: invalid chunk size given\n");
+                return 1;
+            }
+            batch.nChunkMB = static_cast<uint32_t>(iChunkMB);
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--raw-format") && bHasValue) {
+            if (!ParseSampleFormatName(argv[++i], convert.rawFormat.wFormatTag, convert.rawFormat.wBitsPerSample)) {
+                fprintf(stderr, "Error: unknown raw format %s\n", argv[i]);
+                return 1;
+            }
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--raw-rate") && bHasValue) {
+            int iRate = atoi(argv[++i]);
+            if (iRate <= 0) {
+                fprintf(stderr, "Error: invalid raw sample rate given\n");
+                return 1;
+            }
+            convert.rawFormat.nSamplesPerSec = static_cast<uint32_t>(iRate);
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--raw-channels") && bHasValue) {
+            int iChannels = atoi(argv[++i]);
+            if (iChannels < 1 || iChannels > AUDIOFORMAT_MAX_CHANNELS / 2) {
+                fprintf(stderr, "Error: headerless input can have between 1 and %d channels\n", AUDIOFORMAT_MAX_CHANNELS / 2);
+                return 1;
+            }
+            nRawChannels = static_cast<uint16_t>(iChannels);
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--multiplex") && bHasValue) {
+            int iMultiplex = atoi(argv[++i]);
+            if (iMultiplex < 2 || iMultiplex > AUDIOFORMAT_MAX_CHANNELS) {
+                fprintf(stderr, "Error: multiplex must be between 2 and %d\n", AUDIOFORMAT_MAX_CHANNELS);
+                return 1;
+            }
+            convert.nMultiplex = static_cast<uint32_t>(iMultiplex);
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--sample-offset") && bHasValue) {
+            int iOffset = atoi(argv[++i]);
+            if (iOffset < 0 || iOffset >= AUDIOFORMAT_MAX_CHANNELS) {
+                fprintf(stderr, "Error: invalid sample offset given\n");
+                return 1;
+            }
+            convert.nSampleOffset = static_cast<uint32_t>(iOffset);
+            convert.bDetectPhase = false;
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--device-channels") && bHasValue) {
+            int iChannels = atoi(argv[++i]);
+            if (iChannels < 1 || iChannels > AUDIOFORMAT_MAX_CHANNELS / 2) {
+                fprintf(stderr, "Error: the simulated capture device can have between 1 and %d channels\n", AUDIOFORMAT_MAX_CHANNELS / 2);
+                return 1;
+            }
+            nDeviceChannels = static_cast<uint16_t>(iChannels);
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--simulate-drift") && bHasValue) {
+            bSimulateDrift = true;
+            fDriftPpm = atof(argv[++i]);
+            if (std::fabs(fDriftPpm) > DRIFT_MAX_SKEW_PPM) {
+                fprintf(stderr, "Error: --simulate-drift can be at most %.0f ppm either way\n", DRIFT_MAX_SKEW_PPM);
+                return 1;
+            }
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--simulate-phase") && bHasValue) {
+            bSimulatePhase = true;
+            if (!ParseSampleFormatName(argv[++i], phaseFormat.wFormatTag, phaseFormat.wBitsPerSample)) {
+                fprintf(stderr, "Error: unknown sample format %s\n", argv[i]);
+                return 1;
+            }
+            phaseFormat = MakeAudioFormat(phaseFormat.wFormatTag, 1, phaseFormat.nSamplesPerSec, phaseFormat.wBitsPerSample);
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--simulate-latency") && bHasValue) {
+            bSimulateLatency = true;
+            fLatencyJitterMs = atof(argv[++i]);
+            if (fLatencyJitterMs < 0 || fLatencyJitterMs > 10) {
+                fprintf(stderr, "Error: simulated jitter must be between 0 and 10 ms\n");
+                return 1;
+            }
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--simulate-fanout") && bHasValue) {
+            bSimulateFanout = true;
+            int iReaders = atoi(argv[++i]);
+            if (iReaders < 2 || iReaders > 64) {
+                fprintf(stderr, "Error: need between 2 and 64 simulated outputs\n");
+                return 1;
+            }
+            nFanoutReaders = static_cast<uint32_t>(iReaders);
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--simulate-packets") && bHasValue) {
+            bSimulatePackets = true;
+            int iTrials = atoi(argv[++i]);
+            if (iTrials <= 0) {
+                fprintf(stderr, "Error: invalid number of streams given\n");
+                return 1;
+            }
+            nPacketTrials = static_cast<uint32_t>(iTrials);
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--simulate-glitches") && bHasValue) {
+            bSimulateGlitches = true;
+            if (!ParseSampleFormatName(argv[++i], phaseFormat.wFormatTag, phaseFormat.wBitsPerSample)) {
+                fprintf(stderr, "Error: unknown sample format %s\n", argv[i]);
+                return 1;
+            }
+            phaseFormat = MakeAudioFormat(phaseFormat.wFormatTag, 1, phaseFormat.nSamplesPerSec, phaseFormat.wBitsPerSample);
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--simulate-dsp") && bHasValue) {
+            bSimulateDsp = true;
+            if (!ParseSampleFormatName(argv[++i], phaseFormat.wFormatTag, phaseFormat.wBitsPerSample)) {
+                fprintf(stderr, "Error: unknown sample format %s\n", argv[i]);
+                return 1;
+            }
+            phaseFormat = MakeAudioFormat(phaseFormat.wFormatTag, 1, phaseFormat.nSamplesPerSec, phaseFormat.wBitsPerSample);
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--simulate-device") && bHasValue) {
+            bSimulateDevice = true;
+            if (!ParseSampleFormatName(argv[++i], device.format.wFormatTag, device.format.wBitsPerSample)) {
+                fprintf(stderr, "Error: unknown sample format %s\n", argv[i]);
+                return 1;
+            }
+            device.format = MakeAudioFormat(device.format.wFormatTag, 1, device.format.nSamplesPerSec, device.format.wBitsPerSample);
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--simulate-restarts") && bHasValue) {
+            bSimulateRestarts = true;
+            int iLosses = atoi(argv[++i]);
+            if (iLosses <= 0) {
+                fprintf(stderr, "Error: invalid number of device losses given\n");
+                return 1;
+            }
+            nRestartLosses = static_cast<uint32_t>(iLosses);
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--simulate-buffer-tuning") && bHasValue) {
+            szTuningProfile = argv[++i];
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--jitter-profile") && bHasValue) {
+            std::string error;
+            if (!LoadJitterProfile(argv[++i], device.jitterProfileMs, error)) {
+                fprintf(stderr, "Error: %s\n", error.c_str());
+                return 1;
+            }
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--record-jitter") && bHasValue) {
+            recordJitterPath = argv[++i];
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--device-away") && bHasValue) {
+            fDeviceAwayMs = atof(argv[++i]);
+            if (fDeviceAwayMs < 0 || fDeviceAwayMs > 10000) {
+                fprintf(stderr, "Error: a simulated device can be away between 0 and 10000 ms\n");
+                return 1;
+            }
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--outputs") && bHasValue) {
+            int iOutputs = atoi(argv[++i]);
+            if (iOutputs < 1 || iOutputs > MAX_SIMULATED_OUTPUTS) {
+                fprintf(stderr, "Error: need between 1 and %d simulated outputs\n", MAX_SIMULATED_OUTPUTS);
+                return 1;
+            }
+            nDeviceOutputs = static_cast<uint32_t>(iOutputs);
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--device-jitter") && bHasValue) {
+            device.fJitterMs = atof(argv[++i]);
+            if (device.fJitterMs < 0 || device.fJitterMs > 100) {
+                fprintf(stderr, "Error: simulated device jitter must be between 0 and 100 ms\n");
+                return 1;
+            }
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--device-drift") && bHasValue) {
+            device.fPpm = atof(argv[++i]);
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--device-packet-variation") && bHasValue) {
+            device.fPacketVariation = atof(argv[++i]);
+            if (device.fPacketVariation < 0 || device.fPacketVariation > 1) {
+                fprintf(stderr, "Error: packet variation must be between 0 and 1\n");
+                return 1;
+            }
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--device-discontinuities") && bHasValue) {
+            device.fDiscontinuitiesPerMinute = atof(argv[++i]);
+            if (device.fDiscontinuitiesPerMinute < 0) {
+                fprintf(stderr, "Error: invalid discontinuity rate given\n");
+                return 1;
+            }
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--device-faults") && bHasValue) {
+            device.fFaultsPerMinute = atof(argv[++i]);
+            if (device.fFaultsPerMinute < 0) {
+                fprintf(stderr, "Error: invalid fault rate given\n");
+                return 1;
+            }
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--device-seed") && bHasValue) {
+            device.nSeed = static_cast<uint32_t>(strtoul(argv[++i], NULL, 10));
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--gain") && bHasValue) {
+            pipeline.dsp.fGainDb = atof(argv[++i]);
+            if (pipeline.dsp.fGainDb < -60 || pipeline.dsp.fGainDb > 40) {
+                fprintf(stderr, "Error: gain must be between -60 and 40 dB\n");
+                return 1;
+            }
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--limit") && bHasValue) {
+            pipeline.dsp.bLimit = true;
+            pipeline.dsp.fLimitDb = atof(argv[++i]);
+            if (pipeline.dsp.fLimitDb < -60 || pipeline.dsp.fLimitDb > 0) {
+                fprintf(stderr, "Error: the limiter ceiling must be between -60 and 0 dBFS\n");
+                return 1;
+            }
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--buffer-size") && bHasValue) {
+            if (0 == strcmp(argv[i + 1], "auto")) {
+                pipeline.bAutoBuffer = true;
+                i++;
+                continue;
+            }
+            pipeline.bAutoBuffer = false;
+            int iBufferMs = atoi(argv[++i]);
+            if (iBufferMs <= 0) {
+                fprintf(stderr, "Error: invalid buffer size given\n");
+                return 1;
+            }
+            pipeline.nBufferMs = static_cast<uint32_t>(iBufferMs);
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--stats-interval") && bHasValue) {
+            int iStatsIntervalSec = atoi(argv[++i]);
+            if (iStatsIntervalSec <= 0) {
+                fprintf(stderr, "Error: invalid stats interval given\n");
+                return 1;
+            }
+            pipeline.nStatsIntervalSec = static_cast<uint32_t>(iStatsIntervalSec);
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--shared-stats") && bHasValue) {
+            sharedStatsName = argv[++i];
+            if (!IsValidSharedStatsName(sharedStatsName)) {
+                fprintf(stderr, "Error: shared statistics names can only have letters, digits, '-', '_' and '.'\n");
+                return 1;
+            }
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--record") && bHasValue) {
+            recordPath = argv[++i];
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--rtp-send") && bHasValue) {
+            network.sendTo = argv[++i];
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--rtp-receive") && bHasValue) {
+            network.receiveOn = argv[++i];
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--rtp-format") && bHasValue) {
+            if (!ParseRtpEncodingName(argv[++i], network.send.encoding)) {
+                fprintf(stderr, "Error: unknown RTP format %s\n", argv[i]);
+                return 1;
+            }
+            network.receive.encoding = network.send.encoding;
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--rtp-ptime") && bHasValue) {
+            network.send.fPacketMs = atof(argv[++i]);
+            if (network.send.fPacketMs <= 0) {
+                fprintf(stderr, "Error: invalid packet time given\n");
+                return 1;
+            }
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--rtp-batch") && bHasValue) {
+            int iBatch = atoi(argv[++i]);
+            if (iBatch < 1 || iBatch > UDP_MAX_BATCH) {
+                fprintf(stderr, "Error: invalid batch size given; must be between 1 and %d\n", UDP_MAX_BATCH);
+                return 1;
+            }
+            network.send.nMaxBatch = static_cast<uint32_t>(iBatch);
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--rtp-rate") && bHasValue) {
+            int iRate = atoi(argv[++i]);
+            if (iRate <= 0) {
+                fprintf(stderr, "Error: invalid stream rate given\n");
+                return 1;
+            }
+            network.receive.nRate = static_cast<uint32_t>(iRate);
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--rtp-channels") && bHasValue) {
+            int iChannels = atoi(argv[++i]);
+            if (iChannels < 1 || iChannels > AUDIOFORMAT_MAX_CHANNELS) {
+                fprintf(stderr, "Error: invalid stream channel count given; must be between 1 and %d\n", AUDIOFORMAT_MAX_CHANNELS);
+                return 1;
+            }
+            network.receive.nChannels = static_cast<uint16_t>(iChannels);
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--rtp-jitter") && bHasValue) {
+            network.receive.fJitterMs = atof(argv[++i]);
+            if (network.receive.fJitterMs < 0) {
+                fprintf(stderr, "Error: invalid jitter buffer delay given\n");
+                return 1;
+            }
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--simulate-rtp") && bHasValue) {
+            bSimulateRtp = true;
+            if (!ParseSampleFormatName(argv[++i], phaseFormat.wFormatTag, phaseFormat.wBitsPerSample)) {
+                fprintf(stderr, "Error: unknown sample format %s\n", argv[i]);
+                return 1;
+            }
+            phaseFormat = MakeAudioFormat(phaseFormat.wFormatTag, 1, phaseFormat.nSamplesPerSec, phaseFormat.wBitsPerSample);
+            continue;
+        }
+
+        if (0 == strcmp(argv[i], "--simulate-seconds") && bHasValue) {
+            fSimulateSeconds = atof(argv[++i]);
+            if (fSimulateSeconds <= 0) {
+                fprintf(stderr, "Error: invalid simulation length given\n");
+                return 1;
+            }
+            continue;
+        }
+
+        fprintf(stderr, "Error: invalid argument %s\n", argv[i]);
+        return 1;
+    }
+
+    // the channel counts apply whatever order the format switches came in
+    convert.rawFormat = MakeAudioFormat(convert.rawFormat.wFormatTag, nRawChannels, convert.rawFormat.nSamplesPerSec, convert.rawFormat.wBitsPerSample);
+    device.format = MakeAudioFormat(device.format.wFormatTag, nDeviceChannels, device.format.nSamplesPerSec, device.format.wBitsPerSample);
+    device.nMultiplex = convert.nMultiplex;
+    pipeline.nMultiplex = convert.nMultiplex;
+    pipeline.nSampleOffset = convert.nSampleOffset;
+    pipeline.bDetectPhase = convert.bDetectPhase;
+
+    if (bSimulatePhase) {
+        return simulate_phase(phaseFormat);
+    }
+
+    if (bSimulatePackets) {
+        return simulate_packets(nPacketTrials, device.nSeed);
+    }
+
+    if (bSimulateGlitches) {
+        return simulate_glitches(phaseFormat, fSimulateSeconds > 0 ? fSimulateSeconds : 600, device.nSeed);
+    }
+
+    if (bSimulateDsp) {
+        return simulate_dsp(StereoOutputFormat(phaseFormat), device.nSeed);
+    }
+
+    if (bSimulateRtp) {
+        return simulate_rtp(StereoOutputFormat(phaseFormat), network.send.encoding, device.nSeed);
+    }
+
+    if (NULL != szTuningProfile) {
+        return simulate_buffer_tuning(szTuningProfile, fSimulateSeconds > 0 ? fSimulateSeconds : 600, device.nSeed);
+    }
+
+    if (!recordJitterPath.empty()) {
+        return record_jitter(recordJitterPath, fSimulateSeconds > 0 ? fSimulateSeconds : 10);
+    }
+
+    if (pipeline.bAutoBuffer && !pipeline.bDriftCompensation) {
+        fprintf(stderr, "Error: --buffer-size auto needs drift compensation\n");
+        return 1;
+    }
+
+    if (bSimulateRestarts) {
+        return simulate_restarts(device, nDeviceOutputs, pipeline, nRestartLosses, fDeviceAwayMs);
+    }
+
+    if (bSimulateDevice && bDaemon) {
+        return simulate_daemon(device, nDeviceOutputs, pipeline, sharedStatsName, recordPath, network);
+    }
+
+    if (bSimulateDevice) {
+        return simulate_device(device, nDeviceOutputs, pipeline, sharedStatsName, recordPath, network, fSimulateSeconds > 0 ? fSimulateSeconds : 10);
+    }
+
+    if (!network.receiveOn.empty()) {
+        return receive_rtp(network, pipeline.nBufferMs, bDaemon, fSimulateSeconds > 0 ? fSimulateSeconds : 10);
+    }
+
+    if (bSimulateFanout) {
+        return simulate_fanout(nFanoutReaders, fSimulateSeconds > 0 ? fSimulateSeconds : 10);
+    }
+
+    if (bSimulateLatency) {
+        return simulate_latency(fLatencyJitterMs, fSimulateSeconds > 0 ? fSimulateSeconds : 600);
+    }
+
+    if (bSimulateDrift) {
+        return simulate_drift(fDriftPpm, fSimulateSeconds > 0 ? fSimulateSeconds : 600);
+    }
+
+    if (bBatch) {
+        if (batch.outputDir.empty()) {
+            fprintf(stderr, "Error: --batch needs --output-dir\n");
+            return 1;
+        }
+        batch.convert = convert;
+        return convert_batch(batch);
+    }
+
+    if (convert.inputPath.empty() || convert.outputPath.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    return convert_file(convert);
+}
+
+#endif
@@ -0,0 +1,239 @@
+// messages.cpp
+
+#include "messages.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+// ---- messages ----
+
+void MessageSink::Log(const char *szFormat, ...) {
+    va_list args;
+    va_start(args, szFormat);
+    WriteFormatted(false, szFormat, args);
+    va_end(args);
+}
+
+void MessageSink::Error(const char *szFormat, ...) {
+    va_list args;
+    va_start(args, szFormat);
+    WriteFormatted(true, szFormat, args);
+    va_end(args);
+}
+
+void MessageSink::WriteFormatted(bool bError, const char *szFormat, va_list args) {
+    char szMessage[512];
+    vsnprintf(szMessage, sizeof(szMessage), szFormat, args);
+    Write(bError, szMessage);
+}
+
+// ---- async ----
+
+AsyncMessageSink::AsyncMessageSink(MessageSink &next, StatsClock &clock)
+    : m_next(next)
+    , m_clock(clock)
+    , m_slots(new Slot[ASYNCLOG_SLOTS])
+    , m_nEnqueue(0)
+    , m_nDequeue(0)
+    , m_sites(new Site[ASYNCLOG_SITES])
+    , m_nWritten(0)
+    , m_nDropped(0)
+    , m_nSuppressed(0)
+    , m_nReportedDrops(0)
+    , m_bStop(false)
+{
+    for (uint32_t i = 0; i < ASYNCLOG_SLOTS; i++) {
+        m_slots[i].nSequence.store(i, std::memory_order_relaxed);
+    }
+
+    for (uint32_t i = 0; i < ASYNCLOG_SITES; i++) {
+        m_sites[i].szFormat.store(NULL, std::memory_order_relaxed);
+        m_sites[i].hnsWindowStart.store(0, std::memory_order_relaxed);
+        m_sites[i].nInWindow.store(0, std::memory_order_relaxed);
+        m_sites[i].nSuppressed.store(0, std::memory_order_relaxed);
+    }
+}
+
+AsyncMessageSink::~AsyncMessageSink() {
+    Stop();
+}
+
+void AsyncMessageSink::Start() {
+    if (m_thread.joinable()) {
+        return;
+    }
+
+    m_bStop.store(false, std::memory_order_relaxed);
+    m_thread = std::thread(&AsyncMessageSink::DrainThread, this);
+}
+
+void AsyncMessageSink::Stop() {
+    if (m_thread.joinable()) {
+        m_bStop.store(true, std::memory_order_release);
+        m_thread.join();
+    }
+
+    // messages written without a thread, or after it finished
+    Drain();
+}
+
+AsyncMessageStats AsyncMessageSink::Stats() const {
+    AsyncMessageStats stats;
+    stats.nWritten = m_nWritten.load(std::memory_order_relaxed);
+    stats.nDropped = m_nDropped.load(std::memory_order_relaxed);
+    stats.nSuppressed = m_nSuppressed.load(std::memory_order_relaxed);
+    return stats;
+}
+
+// a bounded queue after Dmitry Vyukov's: each slot's sequence number says
+// whether the writer or the reader is next, so a writer only ever races
+// other writers for the enqueue position
+AsyncMessageSink::Slot *AsyncMessageSink::BeginEnqueue() {
+    uint64_t nPosition = m_nEnqueue.load(std::memory_order_relaxed);
+    for (;;) {
+        Slot *pSlot = &m_slots[nPosition & (ASYNCLOG_SLOTS - 1)];
+        uint64_t nSequence = pSlot->nSequence.load(std::memory_order_acquire);
+        int64_t nDiff = static_cast<int64_t>(nSequence - nPosition);
+
+        if (nDiff == 0) {
+            if (m_nEnqueue.compare_exchange_weak(nPosition, nPosition + 1, std::memory_order_relaxed)) {
+                return pSlot;
+            }
+        }
+        else if (nDiff < 0) {
+            // the reader hasn't got to it since the last time round
+            return NULL;
+        }
+        else {
+            nPosition = m_nEnqueue.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void AsyncMessageSink::CommitEnqueue(Slot *pSlot) {
+    uint64_t nSequence = pSlot->nSequence.load(std::memory_order_relaxed);
+    pSlot->nSequence.store(nSequence + 1, std::memory_order_release);
+}
+
+AsyncMessageSink::Site *AsyncMessageSink::Admit(const char *szFormat) {
+    // open addressing on the format string's address; a full table makes
+    // the last site probed take the call site's messages too
+    size_t nHash = static_cast<size_t>((static_cast<uint64_t>(reinterpret_cast<uintptr_t>(szFormat)) >> 3) * 0x9E3779B97F4A7C15ull >> 32);
+    Site *pSite = NULL;
+    for (uint32_t nProbe = 0; nProbe < 8; nProbe++) {
+        pSite = &m_sites[(nHash + nProbe) & (ASYNCLOG_SITES - 1)];
+        const char *szSite = pSite->szFormat.load(std::memory_order_relaxed);
+        if (szSite == szFormat) {
+            break;
+        }
+        if (NULL == szSite && pSite->szFormat.compare_exchange_strong(szSite, szFormat, std::memory_order_relaxed)) {
+            break;
+        }
+
+        // another thread may just have claimed it for the same call site
+        if (szSite == szFormat) {
+            break;
+        }
+    }
+
+    // a window starts with the first message after the last one ended;
+    // racing writers may both start one, which only lets a few more through
+    const int64_t hnsWindow = static_cast<int64_t>(ASYNCLOG_RATE_MS) * (HNS_PER_SECOND / 1000);
+    int64_t hnsNow = m_clock.NowHns();
+    int64_t hnsStart = pSite->hnsWindowStart.load(std::memory_order_relaxed);
+    if (hnsNow - hnsStart >= hnsWindow &&
+        pSite->hnsWindowStart.compare_exchange_strong(hnsStart, hnsNow, std::memory_order_relaxed)) {
+        pSite->nInWindow.store(0, std::memory_order_relaxed);
+    }
+
+    if (pSite->nInWindow.fetch_add(1, std::memory_order_relaxed) >= ASYNCLOG_BURST) {
+        pSite->nSuppressed.fetch_add(1, std::memory_order_relaxed);
+        m_nSuppressed.fetch_add(1, std::memory_order_relaxed);
+        return NULL;
+    }
+
+    return pSite;
+}
+
+void AsyncMessageSink::Write(bool bError, const char *szMessage) {
+    Slot *pSlot = BeginEnqueue();
+    if (NULL == pSlot) {
+        m_nDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    pSlot->bError = bError;
+    pSlot->nSuppressed = 0;
+    size_t nLength = (std::min)(strlen(szMessage), static_cast<size_t>(ASYNCLOG_MESSAGE_BYTES - 1));
+    memcpy(pSlot->szMessage, szMessage, nLength);
+    pSlot->szMessage[nLength] = '\0';
+    CommitEnqueue(pSlot);
+}
+
+void AsyncMessageSink::WriteFormatted(bool bError, const char *szFormat, va_list args) {
+    Site *pSite = Admit(szFormat);
+    if (NULL == pSite) {
+        return;
+    }
+
+    Slot *pSlot = BeginEnqueue();
+    if (NULL == pSlot) {
+        m_nDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // the call site's count of left out messages goes with the first one
+    // through, so a burst of errors still shows up as such
+    pSlot->bError = bError;
+    pSlot->nSuppressed = pSite->nSuppressed.exchange(0, std::memory_order_relaxed);
+    vsnprintf(pSlot->szMessage, sizeof(pSlot->szMessage), szFormat, args);
+    CommitEnqueue(pSlot);
+}
+
+bool AsyncMessageSink::Drain() {
+    bool bAny = false;
+
+    for (;;) {
+        Slot *pSlot = &m_slots[m_nDequeue & (ASYNCLOG_SLOTS - 1)];
+        if (pSlot->nSequence.load(std::memory_order_acquire) != m_nDequeue + 1) {
+            break;
+        }
+
+        if (pSlot->nSuppressed != 0) {
+            char szMessage[ASYNCLOG_MESSAGE_BYTES + 64];
+            snprintf(szMessage, sizeof(szMessage), "%s (%u more like it left out)", pSlot->szMessage, pSlot->nSuppressed);
+            m_next.Write(pSlot->bError, szMessage);
+        }
+        else {
+            m_next.Write(pSlot->bError, pSlot->szMessage);
+        }
+
+        // free for the writer that gets this far round the queue next
+        pSlot->nSequence.store(m_nDequeue + ASYNCLOG_SLOTS, std::memory_order_release);
+        m_nDequeue++;
+        m_nWritten.fetch_add(1, std::memory_order_relaxed);
+        bAny = true;
+    }
+
+    uint64_t nDropped = m_nDropped.load(std::memory_order_relaxed);
+    if (nDropped != m_nReportedDrops) {
+        char szMessage[128];
+        snprintf(szMessage, sizeof(szMessage), "%llu messages dropped, the queue was full", static_cast<unsigned long long>(nDropped - m_nReportedDrops));
+        m_next.Write(true, szMessage);
+        m_nReportedDrops = nDropped;
+    }
+
+    return bAny;
+}
+
+void AsyncMessageSink::DrainThread() {
+    while (!m_bStop.load(std::memory_order_acquire)) {
+        if (!Drain()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(ASYNCLOG_DRAIN_MS));
+        }
+    }
+
+    Drain();
+}
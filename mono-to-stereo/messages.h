@@ -0,0 +1,129 @@
+// messages.h
+
+// where the pipeline's messages go, and a sink the audio threads can write
+// to without blocking or allocating
+//
+// AsyncMessageSink formats each message straight into a slot of a fixed
+// size lock-free queue (any number of writers, one reader) and a thread of
+// its own passes them on to another sink, so the console or whatever else
+// is behind it is never waited for. when the queue is full the message is
+// dropped and counted. every Log or Error call site, told apart by its
+// format string, gets ASYNCLOG_BURST messages every ASYNCLOG_RATE_MS; the
+// ones over that are counted and mentioned along with the next one to get
+// through. Write isn't rate limited, it is for lines formatted elsewhere
+//
+// no Windows dependencies
+
+#pragma once
+
+#include <atomic>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+#include "latency.h"
+
+// called from any of the pipeline's threads
+class MessageSink {
+public:
+    virtual ~MessageSink() {}
+    virtual void Write(bool bError, const char *szMessage) = 0;
+
+    void Log(const char *szFormat, ...);
+    void Error(const char *szFormat, ...);
+
+protected:
+    // Log and Error end up here; formats into a buffer on the stack and
+    // calls Write
+    virtual void WriteFormatted(bool bError, const char *szFormat, va_list args);
+};
+
+// longest message passed on, terminator included; longer ones are cut short
+#define ASYNCLOG_MESSAGE_BYTES 256
+
+// messages that can wait to be written; a power of two
+#define ASYNCLOG_SLOTS 256
+
+// how many messages each call site may write per window
+#define ASYNCLOG_BURST 10
+#define ASYNCLOG_RATE_MS 1000
+
+// call sites rate limited on their own; any more share their limits
+#define ASYNCLOG_SITES 64
+
+// how often the queue is emptied
+#define ASYNCLOG_DRAIN_MS 10
+
+struct AsyncMessageStats {
+    uint64_t nWritten;    // passed on
+    uint64_t nDropped;    // the queue was full
+    uint64_t nSuppressed; // over their call site's rate
+};
+
+class AsyncMessageSink : public MessageSink {
+public:
+    // messages go on to next, from the sink's own thread once started
+    AsyncMessageSink(MessageSink &next, StatsClock &clock);
+    ~AsyncMessageSink();
+
+    void Start();
+
+    // passes on whatever is still queued and stops the thread
+    void Stop();
+
+    // any thread; never blocks or allocates
+    void Write(bool bError, const char *szMessage) override;
+
+    AsyncMessageStats Stats() const;
+
+protected:
+    void WriteFormatted(bool bError, const char *szFormat, va_list args) override;
+
+private:
+    AsyncMessageSink(const AsyncMessageSink &) = delete;
+    AsyncMessageSink &operator=(const AsyncMessageSink &) = delete;
+
+    struct Slot {
+        std::atomic<uint64_t> nSequence; // queue position it can next be written (== position) or read (== position + 1) at
+        bool bError;
+        uint32_t nSuppressed;            // messages from the same call site left out before this one
+        char szMessage[ASYNCLOG_MESSAGE_BYTES];
+    };
+
+    struct Site {
+        std::atomic<const char *> szFormat;
+        std::atomic<int64_t> hnsWindowStart;
+        std::atomic<uint32_t> nInWindow;
+        std::atomic<uint32_t> nSuppressed;
+    };
+
+    // NULL if the queue is full
+    Slot *BeginEnqueue();
+    void CommitEnqueue(Slot *pSlot);
+
+    // NULL if the site is over its rate
+    Site *Admit(const char *szFormat);
+
+    // reader side
+    bool Drain();
+    void DrainThread();
+
+    MessageSink &m_next;
+    StatsClock &m_clock;
+
+    std::unique_ptr<Slot[]> m_slots;
+    std::atomic<uint64_t> m_nEnqueue;
+    uint64_t m_nDequeue;
+
+    std::unique_ptr<Site[]> m_sites;
+
+    std::atomic<uint64_t> m_nWritten;
+    std::atomic<uint64_t> m_nDropped;
+    std::atomic<uint64_t> m_nSuppressed;
+    uint64_t m_nReportedDrops;
+
+    std::atomic<bool> m_bStop;
+    std::thread m_thread;
+};
@@ -1,342 +1,525 @@
 // mono-to-stereo.cpp
 
 #include "common.h"
-#include <vector>
 
-HRESULT LoopbackCapture(
-    IMMDevice* pMMInDevice,
+HRESULT LoopbackCapture(const LoopbackCaptureThreadFunctionArguments& args, PUINT32 pnFrames);
+
+HRESULT PlayNetworkStream(
     IMMDevice* pMMOutDevice,
     int iBufferMs,
-    bool bSkipFirstSample,
+    const char* szRtpReceiveAddress,
+    const RtpReceiveOptions& rtpReceive,
     HANDLE hStartedEvent,
     HANDLE hStopEvent,
     PUINT32 pnFrames
 );
 
-DWORD WINAPI LoopbackCaptureThreadFunction(LPVOID pContext) {
-    LoopbackCaptureThreadFunctionArguments* pArgs =
-        (LoopbackCaptureThreadFunctionArguments*)pContext;
+HRESULT SupervisedCapture(const LoopbackCaptureThreadFunctionArguments& args, PUINT32 pnFrames);
 
-    pArgs->hr = CoInitialize(NULL);
-    if (FAILED(pArgs->hr)) {
-        ERR(L"CoInitialize failed: hr = 0x%08x", pArgs->hr);
-        return 0;
+// QueryPerformanceCounter in 100 ns units, the same clock the audio engine
+// stamps capture packets with
+class QpcClock : public StatsClock {
+public:
+    QpcClock() {
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency(&frequency);
+        m_nFrequency = frequency.QuadPart;
     }
-    CoUninitializeOnExit cuoe;
-
-    pArgs->hr = LoopbackCapture(
-        pArgs->pMMInDevice,
-        pArgs->pMMOutDevice,
-        pArgs->iBufferMs,
-        pArgs->bSkipFirstSample,
-        pArgs->hStartedEvent,
-        pArgs->hStopEvent,
-        &pArgs->nFrames
-    );
 
-    return 0;
-}
+    int64_t NowHns() override {
+        LARGE_INTEGER counter;
+        QueryPerformanceCounter(&counter);
 
-HRESULT LoopbackCapture(
-    IMMDevice* pMMInDevice,
-    IMMDevice* pMMOutDevice,
-    int iBufferMs,
-    bool bSkipFirstSample,
-    HANDLE hStartedEvent,
-    HANDLE hStopEvent,
-    PUINT32 pnFrames
-) {
-    HRESULT hr;
-
-    // activate an IAudioClient
-    IAudioClient* pAudioClient;
-    hr = pMMInDevice->Activate(
-        __uuidof(IAudioClient),
-        CLSCTX_ALL, NULL,
-        (void**)&pAudioClient
-    );
-    if (FAILED(hr)) {
-        ERR(L"IMMDevice::Activate(IAudioClient) failed: hr = 0x%08x", hr);
-        return hr;
+        // split up so the multiplication can't overflow
+        int64_t nSeconds = counter.QuadPart / m_nFrequency;
+        int64_t nRemainder = counter.QuadPart % m_nFrequency;
+        return nSeconds * HNS_PER_SECOND + nRemainder * HNS_PER_SECOND / m_nFrequency;
     }
-    ReleaseOnExit releaseAudioClient(pAudioClient);
 
-    // get the default device periodicity
-    REFERENCE_TIME hnsDefaultDevicePeriod;
-    hr = pAudioClient->GetDevicePeriod(&hnsDefaultDevicePeriod, NULL);
-    if (FAILED(hr)) {
-        ERR(L"IAudioClient::GetDevicePeriod failed: hr = 0x%08x", hr);
-        return hr;
+private:
+    int64_t m_nFrequency;
+};
+
+// passes each snapshot on as messages; it is published from the capture
+// thread, so it goes through the same queue as everything else
+class MessageStatsSink : public StatsSink {
+public:
+    explicit MessageStatsSink(MessageSink& messages) : m_messages(messages) {}
+
+    void Publish(const StreamStatsSnapshot& snapshot) override {
+        Line("Output %u:", snapshot.nOutput + 1);
+        LogSummary("Latency", snapshot.latency);
+        LogSummary("Capture wakeup jitter", snapshot.captureJitter);
+        LogSummary("Capture processing", snapshot.captureProcessing);
+        LogSummary("Render wakeup jitter", snapshot.renderJitter);
+        LogSummary("Render processing", snapshot.renderProcessing);
+
+        const RingStats& stats = snapshot.ring;
+        Line(
+            "Ring buffer: %u frames, max fill %u, min fill %u, %u overruns (%llu frames dropped), %u underruns (%llu frames short), "
+            "%u torn reads (%llu frames silenced)",
+            stats.nCapacityFrames, stats.nMaxFillFrames,
+            stats.nMinFillFrames == UINT32_MAX ? 0 : stats.nMinFillFrames,
+            stats.nOverruns, stats.nOverrunFrames,
+            stats.nUnderruns, stats.nUnderrunFrames,
+            stats.nTornReads, stats.nTornFrames
+        );
+        Line(
+            "Capture gaps: %llu frames, %llu timestamp errors, %llu timestamps dropped",
+            snapshot.nCaptureGapFrames, snapshot.nTimestampErrors, snapshot.nDroppedAnchors
+        );
+
+        const GlitchStats& glitches = snapshot.glitches;
+        Line(
+            "Glitches: %llu discontinuities (%llu realigned), %llu silent packets, %llu packets with unknown flags, %llu frames concealed",
+            glitches.nDiscontinuities, glitches.nRealignments, glitches.nSilentPackets,
+            glitches.nUnknownFlagPackets, glitches.nConcealedFrames
+        );
+
+        const BufferTuneStats& buffer = snapshot.buffer;
+        if (buffer.fLevelMs > 0) {
+            Line(
+                "Buffering: %.1f ms (%.1f to %.1f ms), grew %u times, shrank %u times, %llu close calls (%llu ran dry)",
+                buffer.fLevelMs, buffer.fMinLevelMs, buffer.fMaxLevelMs, buffer.nGrows, buffer.nShrinks,
+                buffer.nCloseCalls, buffer.nEmptyWakeups
+            );
+        }
     }
 
-    // get the default device format
-    WAVEFORMATEX* pwfx;
-    hr = pAudioClient->GetMixFormat(&pwfx);
-    if (FAILED(hr)) {
-        ERR(L"IAudioClient::GetMixFormat failed: hr = 0x%08x", hr);
-        return hr;
+private:
+    void LogSummary(const char* szName, const HistogramSummary& summary) {
+        if (0 == summary.nCount) {
+            Line("%s: no samples", szName);
+            return;
+        }
+
+        Line(
+            "%s: p50 %.2f ms, p99 %.2f ms, max %.2f ms",
+            szName,
+            static_cast<double>(summary.hnsP50) / 10000.0,
+            static_cast<double>(summary.hnsP99) / 10000.0,
+            static_cast<double>(summary.hnsMax) / 10000.0
+        );
     }
-    CoTaskMemFreeOnExit freeMixFormat(pwfx);
 
-    if (pwfx->nChannels != 1) {
-        ERR(L"device doesn't have 1 channel, has %d", pwfx->nChannels);
-        return E_UNEXPECTED;
+    // Write rather than Log, since a snapshot is many lines from the same
+    // few call sites and shouldn't be rate limited
+    void Line(const char* szFormat, ...) {
+        char szMessage[ASYNCLOG_MESSAGE_BYTES];
+        va_list args;
+        va_start(args, szFormat);
+        vsnprintf(szMessage, sizeof(szMessage), szFormat, args);
+        va_end(args);
+        m_messages.Write(false, szMessage);
     }
 
-    if (pwfx->wFormatTag == WAVE_FORMAT_EXTENSIBLE) {
-        auto pwfxExtensible = reinterpret_cast<PWAVEFORMATEXTENSIBLE>(pwfx);
-        if (!IsEqualGUID(KSDATAFORMAT_SUBTYPE_IEEE_FLOAT, pwfxExtensible->SubFormat) && !IsEqualGUID(KSDATAFORMAT_SUBTYPE_IEEE_FLOAT, pwfxExtensible->SubFormat)) {
-            OLECHAR subFormatGUID[39];
-            StringFromGUID2(pwfxExtensible->SubFormat, subFormatGUID, _countof(subFormatGUID));
-            ERR(L"extensible input format not PCM, got %s", subFormatGUID);
-            return E_UNEXPECTED;
+    MessageSink& m_messages;
+};
+
+// where the message queue is emptied to, from its own thread
+class ConsoleMessageSink : public MessageSink {
+public:
+    void Write(bool bError, const char* szMessage) override {
+        if (bError) {
+            ERR(L"%hs", szMessage);
+        }
+        else {
+            LOG(L"%hs", szMessage);
         }
     }
-    else if (pwfx->wFormatTag != WAVE_FORMAT_PCM && pwfx->wFormatTag != WAVE_FORMAT_IEEE_FLOAT) {
-        ERR(L"input format not PCM, got %d", pwfx->wFormatTag);
-        return E_UNEXPECTED;
+};
+
+// looks the devices up by name every time the supervisor asks, so one that
+// was unplugged and comes back is found under its new IMMDevice, and an
+// output without a name follows the default device; the registry is made
+// on the supervisor's thread, like everything else COM here
+class WasapiEndpointProvider : public EndpointProvider {
+public:
+    WasapiEndpointProvider(LPCWSTR szInDeviceName, const LPCWSTR* pszOutDeviceNames, UINT32 nOutDevices)
+        : m_szInDeviceName(szInDeviceName)
+        , m_pszOutDeviceNames(pszOutDeviceNames)
+        , m_nOutDevices(nOutDevices)
+        , m_pMMInDevice(NULL)
+        , m_nFound(0)
+    {}
+
+    ~WasapiEndpointProvider() {
+        Release();
     }
 
-    pwfx->nBlockAlign = pwfx->nChannels * pwfx->wBitsPerSample / 8;
+    DeviceStatus Create(std::unique_ptr<CaptureSource>& source, std::vector<std::unique_ptr<RenderSink>>& sinks, std::string& error) override {
+        // the endpoints made last time are gone by now
+        Release();
 
-    UINT32 nBlockAlign = pwfx->nBlockAlign;
-    *pnFrames = 0;
+        HRESULT hr = m_registry.Find(m_szInDeviceName, eCapture, &m_pMMInDevice, true);
+        if (FAILED(hr)) {
+            return Missing(hr, m_szInDeviceName, error);
+        }
 
-    // call IAudioClient::Initialize
-    hr = pAudioClient->Initialize(
-        AUDCLNT_SHAREMODE_SHARED,
-        AUDCLNT_STREAMFLAGS_EVENTCALLBACK,
-        0, 0, pwfx, 0
-    );
-    if (FAILED(hr)) {
-        ERR(L"IAudioClient::Initialize failed: hr = 0x%08x", hr);
-        return hr;
-    }
+        for (m_nFound = 0; m_nFound < m_nOutDevices; m_nFound++) {
+            LPCWSTR szName = m_pszOutDeviceNames[m_nFound];
+            if (L'\0' == szName[0]) {
+                hr = m_registry.FindDefault(eRender, &m_pMMOutDevices[m_nFound]);
+            }
+            else {
+                hr = m_registry.Find(szName, eRender, &m_pMMOutDevices[m_nFound], true);
+            }
+            if (FAILED(hr)) {
+                return Missing(hr, L'\0' == szName[0] ? L"the default output" : szName, error);
+            }
+        }
 
-    // activate an IAudioCaptureClient
-    IAudioCaptureClient* pAudioCaptureClient;
-    hr = pAudioClient->GetService(
-        __uuidof(IAudioCaptureClient),
-        (void**)&pAudioCaptureClient
-    );
-    if (FAILED(hr)) {
-        ERR(L"IAudioClient::GetService(IAudioCaptureClient) failed: hr = 0x%08x", hr);
-        return hr;
+        source.reset(new WasapiCaptureSource(m_pMMInDevice, NULL));
+        sinks.clear();
+        for (UINT32 i = 0; i < m_nOutDevices; i++) {
+            sinks.emplace_back(new WasapiRenderSink(m_pMMOutDevices[i]));
+        }
+        return DEVICE_OK;
     }
-    ReleaseOnExit releaseAudioCaptureClient(pAudioCaptureClient);
-
-    // register with MMCSS
-    DWORD nTaskIndex = 0;
-    HANDLE hTask = AvSetMmThreadCharacteristics(L"Audio", &nTaskIndex);
-    if (NULL == hTask) {
-        DWORD dwErr = GetLastError();
-        ERR(L"AvSetMmThreadCharacteristics failed: last error = %u", dwErr);
-        return HRESULT_FROM_WIN32(dwErr);
+
+private:
+    DeviceStatus Missing(HRESULT hr, LPCWSTR szName, std::string& error) {
+        char szMessage[512];
+        _snprintf_s(szMessage, _countof(szMessage), _TRUNCATE, "can't find %s: hr = 0x%08x", utf8_from_wide(szName).c_str(), hr);
+        error = szMessage;
+
+        // not being there is what the supervisor waits out
+        return HRESULT_FROM_WIN32(ERROR_NOT_FOUND) == hr ? DEVICE_LOST : DeviceStatusFromHresult(hr);
     }
-    AvRevertMmThreadCharacteristicsOnExit unregisterMmcss(hTask);
 
-    // create the event timer
-    HANDLE hEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
-    if (hEvent == NULL)
-    {
-        DWORD dwErr = GetLastError();
-        ERR(L"CreateEvent failed: last error = %u", dwErr);
-        return HRESULT_FROM_WIN32(dwErr);
+    void Release() {
+        if (NULL != m_pMMInDevice) {
+            m_pMMInDevice->Release();
+            m_pMMInDevice = NULL;
+        }
+        for (UINT32 i = 0; i < m_nFound; i++) {
+            m_pMMOutDevices[i]->Release();
+        }
+        m_nFound = 0;
     }
-    CloseHandleOnExit closeEvent(hEvent);
 
-    pAudioClient->SetEventHandle(hEvent);
+    DeviceRegistry m_registry;
+    LPCWSTR m_szInDeviceName;
+    const LPCWSTR* m_pszOutDeviceNames;
+    UINT32 m_nOutDevices;
+    IMMDevice* m_pMMInDevice;
+    IMMDevice* m_pMMOutDevices[MAX_OUTPUT_DEVICES];
+    UINT32 m_nFound; // of m_pMMOutDevices
+};
 
-    // call IAudioClient::Start
-    hr = pAudioClient->Start();
-    if (FAILED(hr)) {
-        ERR(L"IAudioClient::Start failed: hr = 0x%08x", hr);
-        return hr;
+DWORD WINAPI LoopbackCaptureThreadFunction(LPVOID pContext) {
+    LoopbackCaptureThreadFunctionArguments* pArgs =
+        (LoopbackCaptureThreadFunctionArguments*)pContext;
+
+    pArgs->hr = CoInitialize(NULL);
+    if (FAILED(pArgs->hr)) {
+        ERR(L"CoInitialize failed: hr = 0x%08x", pArgs->hr);
+        return 0;
     }
-    AudioClientStopOnExit stopAudioClient(pAudioClient);
-
-    // update format for stereo conversion
-    pwfx->nChannels *= 2;
-    pwfx->nSamplesPerSec /= 2;
-    pwfx->nBlockAlign *= 2;
-    UINT32 OutputBlockAlign = pwfx->nBlockAlign;
-
-    // set up output device
-    IAudioClient* pAudioOutClient;
-    hr = pMMOutDevice->Activate(
-        __uuidof(IAudioClient), CLSCTX_ALL,
-        NULL, (void**)&pAudioOutClient);
-    if (FAILED(hr)) {
-        ERR(L"IMMDevice::Activate(IAudioClient) failed (output): hr = 0x%08x", hr);
-        return hr;
+    CoUninitializeOnExit cuoe;
+
+    if (NULL != pArgs->szRtpReceiveAddress) {
+        pArgs->hr = PlayNetworkStream(
+            pArgs->pMMOutDevices[0],
+            pArgs->iBufferMs,
+            pArgs->szRtpReceiveAddress,
+            pArgs->rtpReceive,
+            pArgs->hStartedEvent,
+            pArgs->hStopEvent,
+            &pArgs->nFrames
+        );
+        return 0;
     }
 
-    hr = pAudioOutClient->Initialize(
-        AUDCLNT_SHAREMODE_SHARED,
-        0,
-        static_cast<REFERENCE_TIME>(iBufferMs) * 10000,
-        0,
-        pwfx,
-        NULL);
-    if (FAILED(hr)) {
-        ERR(L"IAudioClient::Initialize failed (output): hr = 0x%08x", hr);
-        return hr;
+    if (pArgs->bDaemon) {
+        pArgs->hr = SupervisedCapture(*pArgs, &pArgs->nFrames);
+        return 0;
     }
 
-    IAudioRenderClient* pRenderClient;
-    hr = pAudioOutClient->GetService(
-        __uuidof(IAudioRenderClient),
-        (void**)&pRenderClient);
+    pArgs->hr = LoopbackCapture(*pArgs, &pArgs->nFrames);
 
-    // Get the actual size of the allocated buffer.
-    UINT32 clientBufferFrameCount;
-    hr = pAudioOutClient->GetBufferSize(&clientBufferFrameCount);
-    if (FAILED(hr)) {
-        ERR(L"IAudioClient::GetBufferSize failed (output): hr = 0x%08x", hr);
-        return hr;
+    return 0;
+}
+
+// what a capture needs besides its endpoints, with or without a
+// supervisor: the pipeline options, the clock, the message queue, and
+// whichever of shared statistics, recording and streaming were asked for.
+// it's declared before the pipeline so all of it outlives the pipeline's
+// threads; those only ever queue messages, the console is written from
+// the queue's thread
+class CaptureSession {
+public:
+    explicit CaptureSession(const LoopbackCaptureThreadFunctionArguments& args)
+        : m_args(args)
+        , m_messages(m_console, m_clock)
+        , m_statsSink(m_messages)
+        , m_sharedStats(m_clock)
+        , m_recording(m_clock, m_messages)
+        , m_sender(m_clock, m_messages)
+    {
+        m_options.nBufferMs = static_cast<uint32_t>(args.iBufferMs);
+        m_options.bAutoBuffer = args.bAutoBuffer;
+        m_options.nMultiplex = args.nMultiplex;
+        m_options.nSampleOffset = args.nSampleOffset;
+        m_options.bDetectPhase = args.bDetectPhase;
+        m_options.bDriftCompensation = args.bDriftCompensation;
+        m_options.nStatsIntervalSec = static_cast<uint32_t>(args.iStatsIntervalSec);
+        m_options.dsp = args.dsp;
     }
 
-    // Grab half the buffer for the initial fill operation.
-    BYTE* tmp;
-    hr = pRenderClient->GetBuffer(clientBufferFrameCount / 2, &tmp);
-    if (FAILED(hr)) {
-        ERR(L"IAudioClient::GetBuffer failed (output): hr = 0x%08x", hr);
-        return hr;
+    // starts the message queue and opens whatever else was asked for;
+    // fails, having said why, if any of it can't be
+    HRESULT Open() {
+        m_messages.Start();
+
+        std::string error;
+        if (NULL != m_args.szSharedStatsName && !m_sharedStats.Create(m_args.szSharedStatsName, error)) {
+            ERR(L"couldn't set up shared statistics %hs: %hs", m_args.szSharedStatsName, error.c_str());
+            return E_FAIL;
+        }
+        if (NULL != m_args.szRecordPath && !m_recording.Open(m_args.szRecordPath, error)) {
+            ERR(L"couldn't record: %hs", error.c_str());
+            return E_FAIL;
+        }
+        if (NULL != m_args.szRtpSendAddress && !m_sender.Open(m_args.szRtpSendAddress, m_args.rtpSend, error)) {
+            ERR(L"couldn't stream: %hs", error.c_str());
+            return E_FAIL;
+        }
+        return S_OK;
     }
 
-    hr = pRenderClient->ReleaseBuffer(clientBufferFrameCount / 2, AUDCLNT_BUFFERFLAGS_SILENT);
-    if (FAILED(hr)) {
-        ERR(L"IAudioCaptureClient::ReleaseBuffer failed (output): hr = 0x%08x", hr);
-        return hr;
+    // hands what was opened to a StreamPipeline or a StreamSupervisor
+    template <class Stream>
+    void Attach(Stream& stream) {
+        if (NULL != m_args.szSharedStatsName) {
+            stream.SetLiveStats(m_sharedStats, SHAREDSTATS_INTERVAL_MS);
+        }
+        if (m_recording.IsOpen()) {
+            stream.SetRecording(m_recording);
+        }
+        if (m_sender.IsOpen()) {
+            stream.SetStreaming(m_sender);
+        }
     }
 
-    hr = pAudioOutClient->Start();
-    if (FAILED(hr)) {
-        ERR(L"IAudioClient::Start failed (output): hr = 0x%08x", hr);
-        return hr;
+    // once the stream has stopped, when nothing writes to the recording
+    // any more: closes it, says what was recorded and sent, and passes on
+    // whatever is still queued
+    void Finish() {
+        if (m_recording.IsOpen()) {
+            std::string error;
+            if (!m_recording.Stop(error)) {
+                m_messages.Error("%s", error.c_str());
+            }
+            else {
+                RecordingStats recorded = m_recording.Stats();
+                m_messages.Log(
+                    "Recorded %llu frames to %s (%llu dropped)",
+                    static_cast<unsigned long long>(recorded.nFrames), m_args.szRecordPath,
+                    static_cast<unsigned long long>(recorded.nDroppedFrames)
+                );
+            }
+        }
+
+        if (m_sender.IsOpen()) {
+            RtpSendStats sent = m_sender.Stats();
+            m_messages.Log(
+                "Sent %llu packets to %s in %llu calls (%llu dropped, %llu refused, %llu failed)",
+                static_cast<unsigned long long>(sent.nPackets), m_sender.Destination().c_str(),
+                static_cast<unsigned long long>(sent.nSendCalls), static_cast<unsigned long long>(sent.nDroppedPackets),
+                static_cast<unsigned long long>(sent.nRefusedPackets), static_cast<unsigned long long>(sent.nFailedPackets)
+            );
+        }
+
+        m_messages.Stop();
     }
 
-    SetEvent(hStartedEvent);
+    const PipelineOptions& Options() const { return m_options; }
+    StatsClock& Clock() { return m_clock; }
+    MessageSink& Messages() { return m_messages; }
+    StatsSink& Stats() { return m_statsSink; }
+
+private:
+    CaptureSession(const CaptureSession&) = delete;
+    CaptureSession& operator=(const CaptureSession&) = delete;
+
+    const LoopbackCaptureThreadFunctionArguments& m_args;
+    PipelineOptions m_options;
+    QpcClock m_clock;
+    ConsoleMessageSink m_console;
+    AsyncMessageSink m_messages;
+    MessageStatsSink m_statsSink;
+    SharedStatsWriter m_sharedStats;
+    RecordingTap m_recording;
+    RtpSender m_sender;
+};
+
+// what a pipeline or supervisor that stopped with status comes to
+static HRESULT HresultFromStatus(DeviceStatus status, int32_t nErrorCode) {
+    if (DEVICE_OK == status) {
+        return S_OK;
+    }
 
-    // loopback capture loop
-    HANDLE waitArray[2] = { hStopEvent, hEvent };
-    DWORD dwWaitResult;
+    HRESULT hr = static_cast<HRESULT>(nErrorCode);
+    return FAILED(hr) ? hr : E_FAIL;
+}
 
-    bool bDone = false;
+// the pipeline itself is in pipeline.cpp; this only puts WASAPI endpoints
+// under it and runs it on this thread until the stop event is set
+HRESULT LoopbackCapture(const LoopbackCaptureThreadFunctionArguments& args, PUINT32 pnFrames) {
+    *pnFrames = 0;
 
-    std::vector<BYTE> lastSample;
-    if (bSkipFirstSample) {
-        lastSample.resize(nBlockAlign);
+    CaptureSession session(args);
+    HRESULT hr = session.Open();
+    if (FAILED(hr)) {
+        return hr;
     }
 
-    while (!bDone) {
-        dwWaitResult = WaitForMultipleObjects(
-            ARRAYSIZE(waitArray), waitArray,
-            FALSE, INFINITE
-        );
+    // the endpoints have to outlive the pipeline's threads as well
+    WasapiCaptureSource source(args.pMMInDevice, args.hStopEvent);
+    std::unique_ptr<std::unique_ptr<WasapiRenderSink>[]> sinks(new std::unique_ptr<WasapiRenderSink>[args.nOutDevices]);
+    RenderSink* pSinks[MAX_OUTPUT_DEVICES];
+    for (UINT32 i = 0; i < args.nOutDevices; i++) {
+        sinks[i].reset(new WasapiRenderSink(args.pMMOutDevices[i]));
+        pSinks[i] = sinks[i].get();
+    }
 
-        if (WAIT_OBJECT_0 == dwWaitResult) {
-            LOG(L"Received stop event after %u frames", *pnFrames);
-            bDone = true;
-            continue; // exits loop
-        }
+    StreamPipeline pipeline(session.Clock(), session.Stats(), session.Messages());
+    session.Attach(pipeline);
 
-        if (WAIT_OBJECT_0 + 1 != dwWaitResult) {
-            ERR(L"Unexpected WaitForMultipleObjects return value %u after %u frames", dwWaitResult, *pnFrames);
-            return E_UNEXPECTED;
-        }
+    DeviceStatus status = pipeline.Start(source, pSinks, args.nOutDevices, session.Options());
+    if (DEVICE_OK == status) {
+        SetEvent(args.hStartedEvent);
+        status = pipeline.Run();
+    }
 
-        for (;;) {
-            // get the captured data
-            BYTE* pData;
-            BYTE* pOutData;
-            UINT32 nNextPacketSize;
-            UINT32 nNumFramesToRead;
-            DWORD dwFlags;
+    // whatever the pipeline said on its way down
+    session.Finish();
 
-            hr = pAudioCaptureClient->GetNextPacketSize(&nNextPacketSize);
-            if (FAILED(hr)) {
-                ERR(L"IAudioCaptureClient::GetNextPacketSize failed after %u frames: hr = 0x%08x", *pnFrames, hr);
-                return hr;
-            }
+    *pnFrames = static_cast<UINT32>(pipeline.CapturedFrames());
+    return HresultFromStatus(status, pipeline.ErrorCode());
+}
 
-            if (nNextPacketSize == 0) {
-                break;
-            }
+static void LogSupervisorSummary(MessageSink& messages, const char* szName, const HistogramSummary& summary) {
+    if (0 == summary.nCount) {
+        return;
+    }
 
-            hr = pAudioCaptureClient->GetBuffer(
-                &pData,
-                &nNumFramesToRead,
-                &dwFlags,
-                NULL,
-                NULL
-            );
-            if (FAILED(hr)) {
-                ERR(L"IAudioCaptureClient::GetBuffer failed after %u frames: hr = 0x%08x", *pnFrames, hr);
-                return hr;
-            }
+    messages.Log(
+        "%s: p50 %.1f ms, p99 %.1f ms, max %.1f ms",
+        szName,
+        static_cast<double>(summary.hnsP50) / 10000.0,
+        static_cast<double>(summary.hnsP99) / 10000.0,
+        static_cast<double>(summary.hnsMax) / 10000.0
+    );
+}
 
-            if (nNextPacketSize != nNumFramesToRead) {
-                ERR(L"GetNextPacketSize and GetBuffer values don't match (%u and %u) after %u frames", nNextPacketSize, nNumFramesToRead, *pnFrames);
-                return E_UNEXPECTED;
-            }
+// the same, but under a supervisor that finds the devices itself and
+// starts the pipeline again whenever one of them goes away; the started
+// event is set straight away, since the devices may not be there yet
+HRESULT SupervisedCapture(const LoopbackCaptureThreadFunctionArguments& args, PUINT32 pnFrames) {
+    *pnFrames = 0;
 
-            if (AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY == dwFlags) {
-                if (*pnFrames != 0) {
-                    LOG(L"Probably spurious glitch reported after %u frames", *pnFrames);
-                }
-            }
-            else if (0 != dwFlags) {
-                LOG(L"IAudioCaptureClient::GetBuffer set flags to 0x%08x after %u frames", dwFlags, *pnFrames);
-                return E_UNEXPECTED;
-            }
+    CaptureSession session(args);
+    HRESULT hr = session.Open();
+    if (FAILED(hr)) {
+        return hr;
+    }
 
-            if (nNumFramesToRead % 1 != 0) {
-                ERR("frames to output is odd (%u), will miss the last sample after %u frames", nNumFramesToRead, *pnFrames);
-            }
+    WasapiEndpointProvider provider(args.szInDeviceName, args.szOutDeviceNames, args.nOutDevices);
+    StreamSupervisor supervisor(session.Clock(), session.Stats(), session.Messages(), provider);
+    session.Attach(supervisor);
+
+    // the endpoints the supervisor makes don't watch the stop event, so it
+    // gets a thread of its own; setting it here lets that thread go if the
+    // supervisor gives up by itself
+    std::thread watcher([&]() {
+        WaitForSingleObject(args.hStopEvent, INFINITE);
+        supervisor.Stop();
+    });
+
+    SetEvent(args.hStartedEvent);
+    DeviceStatus status = supervisor.Run(session.Options());
+    SetEvent(args.hStopEvent);
+    watcher.join();
+
+    SupervisorStats stats = supervisor.Stats();
+    session.Messages().Log("%u restarts, %u failed attempts to start", stats.nRestarts, stats.nFailedAttempts);
+    LogSupervisorSummary(session.Messages(), "Restart time", stats.restart);
+    LogSupervisorSummary(session.Messages(), "Audio missed per restart", stats.gap);
+    session.Finish();
+
+    *pnFrames = static_cast<UINT32>(supervisor.CapturedFrames());
+    return HresultFromStatus(status, supervisor.ErrorCode());
+}
 
-            UINT32 output_frames_to_write = nNumFramesToRead / 2;
-
-            LONG lBytesToWrite = output_frames_to_write * OutputBlockAlign;
-
-            for (;;) {
-                hr = pRenderClient->GetBuffer(output_frames_to_write, &pOutData);
-                if (hr == AUDCLNT_E_BUFFER_TOO_LARGE) {
-                    ERR(L"%s", L"buffer overflow!");
-                    Sleep(1);
-                    continue;
-                }
-                if (FAILED(hr)) {
-                    ERR(L"IAudioCaptureClient::GetBuffer failed (output) after %u frames: hr = 0x%08x", *pnFrames, hr);
-                    return hr;
-                }
-                break;
-            }
+// plays a stream from the network on one output until the stop event is
+// set; the receiver takes packets on a thread of its own and this one
+// services the device
+HRESULT PlayNetworkStream(
+    IMMDevice* pMMOutDevice,
+    int iBufferMs,
+    const char* szRtpReceiveAddress,
+    const RtpReceiveOptions& rtpReceive,
+    HANDLE hStartedEvent,
+    HANDLE hStopEvent,
+    PUINT32 pnFrames
+) {
+    *pnFrames = 0;
 
-            if (bSkipFirstSample) {
-                memcpy(pOutData, lastSample.data(), nBlockAlign);
-                memcpy(pOutData + nBlockAlign, pData, static_cast<size_t>(lBytesToWrite) - nBlockAlign);
-                memcpy(lastSample.data(), pData + lBytesToWrite - nBlockAlign, nBlockAlign);
-            }
-            else {
-                memcpy(pOutData, pData, lBytesToWrite);
-            }
+    QpcClock clock;
+    ConsoleMessageSink console;
+    AsyncMessageSink messages(console, clock);
+    messages.Start();
 
-            hr = pRenderClient->ReleaseBuffer(output_frames_to_write, 0);
-            if (FAILED(hr)) {
-                ERR(L"IAudioCaptureClient::ReleaseBuffer failed (output) after %u frames: hr = 0x%08x", *pnFrames, hr);
-                return hr;
-            }
+    RtpReceiver receiver(clock, messages);
+    std::string error;
+    if (!receiver.Open(szRtpReceiveAddress, rtpReceive, error)) {
+        ERR(L"couldn't receive the stream: %hs", error.c_str());
+        return E_FAIL;
+    }
+    receiver.Start();
+    messages.Log(
+        "Listening on port %u for %s at %u Hz, %u channels, playing %.1f ms behind",
+        receiver.Port(), RtpEncodingName(rtpReceive.encoding), rtpReceive.nRate, rtpReceive.nChannels, rtpReceive.fJitterMs
+    );
 
-            hr = pAudioCaptureClient->ReleaseBuffer(nNumFramesToRead);
-            if (FAILED(hr)) {
-                ERR(L"IAudioCaptureClient::ReleaseBuffer failed after %u frames: hr = 0x%08x", *pnFrames, hr);
-                return hr;
-            }
+    WasapiRenderSink sink(pMMOutDevice);
+    RtpPlayer player(clock, messages);
+    DeviceStatus status = player.Start(receiver, sink, static_cast<uint32_t>(iBufferMs));
+    if (DEVICE_OK != status) {
+        ERR(L"couldn't play the stream: %hs", player.Error().c_str());
+        receiver.Stop();
+        return E_FAIL;
+    }
 
-            *pnFrames += nNumFramesToRead;
-        }
-    } // capture loop
+    std::thread watcher([&]() {
+        WaitForSingleObject(hStopEvent, INFINITE);
+        player.Stop();
+    });
+
+    SetEvent(hStartedEvent);
+    status = player.Run();
+    SetEvent(hStopEvent);
+    watcher.join();
+    sink.Stop();
+    receiver.Stop();
+
+    if (DEVICE_STOPPED != status) {
+        messages.Error("%s", player.Error().c_str());
+    }
+    RtpReceiveStats stats = receiver.Stats();
+    messages.Log(
+        "Received %llu packets (%llu late, %llu reordered, %llu duplicates), %llu lost, %llu skipped, %llu underruns",
+        static_cast<unsigned long long>(stats.nPackets), static_cast<unsigned long long>(stats.nLatePackets),
+        static_cast<unsigned long long>(stats.nReorderedPackets), static_cast<unsigned long long>(stats.nDuplicatePackets),
+        static_cast<unsigned long long>(stats.nLostPackets), static_cast<unsigned long long>(stats.nSkippedPackets),
+        static_cast<unsigned long long>(stats.nUnderruns)
+    );
+    LogSupervisorSummary(messages, "Capture to arrival", stats.transit);
+    LogSupervisorSummary(messages, "Capture to output", stats.latency);
+    messages.Stop();
 
-    return hr;
+    *pnFrames = static_cast<UINT32>(stats.nFrames);
+    return DEVICE_STOPPED == status ? S_OK : E_FAIL;
 }
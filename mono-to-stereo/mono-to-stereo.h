@@ -6,14 +6,34 @@
 // and dump output to the HMMIO
 // until the stop event is set
 // any failures will be propagated back via hr
+// with bDaemon it keeps going through device loss (supervisor.h) and only
+// fails if the devices can't be used at all
+// with szRtpReceiveAddress it captures nothing and plays a stream from the
+// network (rtp.h) on the first output device instead
 
 #define VERSION L"0.5"
 
 struct LoopbackCaptureThreadFunctionArguments {
     IMMDevice *pMMInDevice;
-    IMMDevice *pMMOutDevice;
+    IMMDevice *pMMOutDevices[MAX_OUTPUT_DEVICES];
+    UINT32 nOutDevices;
+    bool bDaemon; // find the devices by name instead, and again whenever one goes away
+    LPCWSTR szInDeviceName;
+    LPCWSTR szOutDeviceNames[MAX_OUTPUT_DEVICES]; // empty for the default
     int iBufferMs;
-    bool bSkipFirstSample;
+    bool bAutoBuffer;      // tune each output's buffering instead (buffertune.h)
+    UINT32 nMultiplex;     // input samples per output frame
+    UINT32 nSampleOffset;  // starting guess if bDetectPhase is set
+    bool bDetectPhase;
+    bool bDriftCompensation;
+    DspOptions dsp;
+    int iStatsIntervalSec; // 0 to only print stats when stopping
+    const char *szSharedStatsName; // NULL for none
+    const char *szRecordPath; // UTF-8, NULL for none
+    const char *szRtpSendAddress; // NULL for none
+    RtpSendOptions rtpSend;
+    const char *szRtpReceiveAddress; // NULL to capture
+    RtpReceiveOptions rtpReceive;
     HANDLE hStartedEvent;
     HANDLE hStopEvent;
     UINT32 nFrames;
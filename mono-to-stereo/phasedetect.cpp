@@ -0,0 +1,401 @@
+// phasedetect.cpp
+
+#include "phasedetect.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+#include "simd.h"
+
+const char *ChannelPhaseName(ChannelPhase phase) {
+    switch (phase) {
+    case PHASE_ALIGNED: return "aligned";
+    case PHASE_SKIP_FIRST: return "skip first sample";
+    default: return "unknown";
+    }
+}
+
+// ---- kernels ----
+
+static void PhaseSumsScalar(const float *pIn, size_t nSamples, float sums[4]) {
+    float energy[2] = { 0, 0 };
+    float cross[2] = { 0, 0 };
+    for (size_t i = 0; i + 1 < nSamples; i++) {
+        energy[i & 1] += pIn[i] * pIn[i];
+        cross[i & 1] += pIn[i] * pIn[i + 1];
+    }
+    sums[0] = energy[0];
+    sums[1] = energy[1];
+    sums[2] = cross[0];
+    sums[3] = cross[1];
+}
+
+#ifdef SIMD_X86
+
+// even lanes see even i, odd lanes odd i, as long as i starts at zero and
+// steps by the vector width
+
+TARGET_SSE2 static void PhaseSumsSse2(const float *pIn, size_t nSamples, float sums[4]) {
+    __m128 energy = _mm_setzero_ps();
+    __m128 cross = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 5 <= nSamples; i += 4) {
+        __m128 a = _mm_loadu_ps(pIn + i);
+        __m128 b = _mm_loadu_ps(pIn + i + 1);
+        energy = _mm_add_ps(energy, _mm_mul_ps(a, a));
+        cross = _mm_add_ps(cross, _mm_mul_ps(a, b));
+    }
+
+    float e[4], c[4];
+    _mm_storeu_ps(e, energy);
+    _mm_storeu_ps(c, cross);
+
+    PhaseSumsScalar(pIn + i, nSamples - i, sums);
+    sums[0] += e[0] + e[2];
+    sums[1] += e[1] + e[3];
+    sums[2] += c[0] + c[2];
+    sums[3] += c[1] + c[3];
+}
+
+TARGET_AVX2 static void PhaseSumsAvx2(const float *pIn, size_t nSamples, float sums[4]) {
+    __m256 energy = _mm256_setzero_ps();
+    __m256 cross = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 9 <= nSamples; i += 8) {
+        __m256 a = _mm256_loadu_ps(pIn + i);
+        __m256 b = _mm256_loadu_ps(pIn + i + 1);
+        energy = _mm256_add_ps(energy, _mm256_mul_ps(a, a));
+        cross = _mm256_add_ps(cross, _mm256_mul_ps(a, b));
+    }
+
+    float e[8], c[8];
+    _mm256_storeu_ps(e, energy);
+    _mm256_storeu_ps(c, cross);
+
+    PhaseSumsScalar(pIn + i, nSamples - i, sums);
+    sums[0] += (e[0] + e[2]) + (e[4] + e[6]);
+    sums[1] += (e[1] + e[3]) + (e[5] + e[7]);
+    sums[2] += (c[0] + c[2]) + (c[4] + c[6]);
+    sums[3] += (c[1] + c[3]) + (c[5] + c[7]);
+}
+
+#endif // SIMD_X86
+
+static PhaseKernel PickPhaseKernel(SimdLevel level) {
+#ifdef SIMD_X86
+    if (level >= SIMD_AVX2) return PhaseSumsAvx2;
+    if (level >= SIMD_SSE2) return PhaseSumsSse2;
+#else
+    (void)level;
+#endif
+    return PhaseSumsScalar;
+}
+
+// ---- detector ----
+
+PhaseDetector::PhaseDetector()
+    : m_pKernel(nullptr)
+    , m_level(SIMD_SCALAR)
+    , m_nSampleBytes(0)
+    , m_fDecayPerSample(1.0)
+    , m_fMinSamples(0)
+    , m_bOddPosition(false)
+    , m_phase(PHASE_UNKNOWN)
+    , m_fRatio(1.0)
+    , m_nChanges(0)
+{
+    Reset();
+}
+
+bool PhaseDetector::Init(const AudioFormat &format, SimdLevel level) {
+    if (format.nChannels != 1 || format.nSamplesPerSec == 0) {
+        return false;
+    }
+
+    if (!m_toFloat.Init(SampleTypeOf(format), SAMPLE_FLOAT32, false, level)) {
+        return false;
+    }
+
+    m_pKernel = PickPhaseKernel(level);
+    m_level = level;
+    m_nSampleBytes = SampleTypeBytes(SampleTypeOf(format));
+    m_fDecayPerSample = std::exp(-1000.0 / (PHASE_WINDOW_MS * static_cast<double>(format.nSamplesPerSec)));
+    m_fMinSamples = PHASE_MIN_MS * static_cast<double>(format.nSamplesPerSec) / 1000.0;
+    m_bOddPosition = false;
+    m_phase = PHASE_UNKNOWN;
+    m_nChanges = 0;
+    Reset();
+    return true;
+}
+
+void PhaseDetector::Reset() {
+    m_fWeight = 0;
+    m_fEven = 0;
+    m_fOdd = 0;
+    m_fAligned = 0;
+    m_fSkipped = 0;
+    m_fSinceReset = 0;
+    m_fRatio = 1.0;
+    m_fLast = 0;
+    m_bHaveLast = false;
+}
+
+void PhaseDetector::Flip() {
+    std::swap(m_fEven, m_fOdd);
+    std::swap(m_fAligned, m_fSkipped);
+    if (PHASE_ALIGNED == m_phase) {
+        m_phase = PHASE_SKIP_FIRST;
+    }
+    else if (PHASE_SKIP_FIRST == m_phase) {
+        m_phase = PHASE_ALIGNED;
+    }
+}
+
+ChannelPhase PhaseDetector::Analyze(const uint8_t *pData, uint32_t nSamples) {
+    // pairs are counted from the start of the stream
+    bool bOddStart = m_bOddPosition;
+    m_bOddPosition = m_bOddPosition != ((nSamples & 1) != 0);
+
+    if (nullptr == m_pKernel || nSamples == 0) {
+        return m_phase;
+    }
+
+    // every block starts with the sample in front of it, the last packet's
+    // included, so no pair is missed whatever the packet sizes
+    double fEven = 0, fOdd = 0, fAligned = 0, fSkipped = 0;
+    size_t nDone = 0;
+    while (nDone < nSamples) {
+        size_t nOverlap = m_bHaveLast ? 1 : 0;
+        size_t n = (std::min)(static_cast<size_t>(nSamples) - nDone, static_cast<size_t>(SAMPLECONVERT_BLOCK) - nOverlap);
+        m_block[0] = m_fLast;
+        m_toFloat.ToFloat(pData + nDone * m_nSampleBytes, m_block + nOverlap, n);
+
+        // m_block[0] sits at packet index nDone - nOverlap
+        float sums[4];
+        m_pKernel(m_block, n + nOverlap, sums);
+        bool bSwap = (((nDone + 2 - nOverlap) & 1) != 0) != bOddStart;
+        fEven += sums[bSwap ? 1 : 0];
+        fOdd += sums[bSwap ? 0 : 1];
+        fAligned += sums[bSwap ? 3 : 2];
+        fSkipped += sums[bSwap ? 2 : 3];
+
+        m_fLast = m_block[nOverlap + n - 1];
+        m_bHaveLast = true;
+        nDone += n;
+    }
+
+    double fDecay = std::pow(m_fDecayPerSample, static_cast<double>(nSamples));
+    m_fWeight = m_fWeight * fDecay + nSamples;
+    m_fEven = m_fEven * fDecay + fEven;
+    m_fOdd = m_fOdd * fDecay + fOdd;
+    m_fAligned = m_fAligned * fDecay + fAligned;
+    m_fSkipped = m_fSkipped * fDecay + fSkipped;
+    m_fSinceReset += nSamples;
+
+    if (m_fSinceReset < m_fMinSamples || m_fEven + m_fOdd < PHASE_SILENCE * m_fWeight) {
+        return m_phase;
+    }
+
+    // both pairings match an even sample with an odd one, so they share the
+    // normalization; what's left after taking out the correlation is small
+    // for the right pairing whatever the relative channel levels. the
+    // absolute value also catches channels that are inverted
+    double fNorm = std::sqrt(m_fEven * m_fOdd);
+    if (fNorm <= 0) {
+        return m_phase;
+    }
+    double fAlignedResidual = (std::max)(0.0, 1.0 - std::fabs(m_fAligned) / fNorm);
+    double fSkippedResidual = (std::max)(0.0, 1.0 - std::fabs(m_fSkipped) / fNorm);
+
+    ChannelPhase best = fAlignedResidual <= fSkippedResidual ? PHASE_ALIGNED : PHASE_SKIP_FIRST;
+    double fMax = (std::max)(fAlignedResidual, fSkippedResidual);
+    m_fRatio = fMax > 0 ? (std::min)(fAlignedResidual, fSkippedResidual) / fMax : 1.0;
+
+    double fThreshold = m_phase == PHASE_UNKNOWN ? PHASE_DECIDE_RATIO : PHASE_FLIP_RATIO;
+    if (best != m_phase && m_fRatio < fThreshold) {
+        m_phase = best;
+        m_nChanges++;
+    }
+
+    return m_phase;
+}
+
+// ---- offline check ----
+
+struct NoiseSource {
+    uint32_t x;
+    explicit NoiseSource(uint32_t seed) : x(seed) {}
+
+    // uniform in [-1, 1)
+    float Next() {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        return static_cast<float>(static_cast<int32_t>(x)) * (1.0f / 2147483648.0f);
+    }
+};
+
+enum SimSignal {
+    SIM_SINE,        // same tone in both channels at different levels
+    SIM_MUSIC,       // band limited noise, mostly common to both channels
+    SIM_INVERTED,    // right is the left channel upside down
+    SIM_PANNED,      // mostly left with some independent noise on the right
+    SIM_INDEPENDENT, // nothing in common, must not decide
+    SIM_SILENCE,     // must not decide
+};
+
+static const char *SimSignalName(SimSignal signal) {
+    switch (signal) {
+    case SIM_SINE: return "sine";
+    case SIM_MUSIC: return "correlated noise";
+    case SIM_INVERTED: return "inverted";
+    case SIM_PANNED: return "panned";
+    case SIM_INDEPENDENT: return "independent noise";
+    default: return "silence";
+    }
+}
+
+// nFrames stereo frames of the signal, interleaved
+static void MakeStereo(SimSignal signal, uint32_t nRate, size_t nFrames, std::vector<float> &out) {
+    out.assign(nFrames * 2, 0.0f);
+    NoiseSource common(1), left(2), right(3);
+    const double fTwoPi = 6.28318530717958647692;
+    float fLow = 0, fLowL = 0, fLowR = 0;
+
+    for (size_t i = 0; i < nFrames; i++) {
+        float l = 0, r = 0;
+        // one pole low pass at a few kHz, roughly the spectrum of music
+        fLow += 0.3f * (common.Next() - fLow);
+        fLowL += 0.3f * (left.Next() - fLowL);
+        fLowR += 0.3f * (right.Next() - fLowR);
+
+        switch (signal) {
+        case SIM_SINE:
+            l = static_cast<float>(0.5 * std::sin(fTwoPi * 997.0 * static_cast<double>(i) / nRate));
+            r = 0.7f * l;
+            break;
+        case SIM_MUSIC:
+            l = 0.8f * fLow + 0.2f * fLowL;
+            r = 0.8f * fLow + 0.2f * fLowR;
+            break;
+        case SIM_INVERTED:
+            l = 0.8f * fLow;
+            r = -l;
+            break;
+        case SIM_PANNED:
+            l = 0.9f * fLow;
+            r = 0.3f * fLow + 0.05f * fLowR;
+            break;
+        case SIM_INDEPENDENT:
+            l = 0.5f * left.Next();
+            r = 0.5f * right.Next();
+            break;
+        default:
+            break;
+        }
+
+        out[2 * i] = l;
+        out[2 * i + 1] = r;
+    }
+}
+
+// runs mono samples [nStart, end) through the detector in 10 ms packets;
+// returns the sample, counted from nStart, at which the detector last
+// changed its mind, or -1 if it never did
+static double RunDetector(PhaseDetector &detector, SampleConverter &toDevice, const float *pMono, size_t nStart, size_t nEnd, uint32_t nRate, std::vector<uint8_t> &packet, double &fSeconds) {
+    const size_t nPacket = (nRate / 100) & ~static_cast<size_t>(1);
+    double fDecidedAt = -1;
+    uint32_t nChanges = detector.Changes();
+
+    for (size_t i = nStart; i < nEnd; i += nPacket) {
+        size_t n = (std::min)(nPacket, nEnd - i);
+        toDevice.FromFloat(pMono + i, packet.data(), n);
+
+        auto start = std::chrono::steady_clock::now();
+        detector.Analyze(packet.data(), static_cast<uint32_t>(n));
+        fSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (detector.Changes() != nChanges) {
+            nChanges = detector.Changes();
+            fDecidedAt = static_cast<double>(i + n - nStart);
+        }
+    }
+
+    return fDecidedAt;
+}
+
+PhaseSimulationResult SimulatePhaseDetection(const AudioFormat &format, SimdLevel level) {
+    PhaseSimulationResult result = {};
+    result.bPass = true;
+
+    const uint32_t nRate = format.nSamplesPerSec;
+    const size_t nFrames = static_cast<size_t>(nRate) / 2 * 2; // two seconds of stereo frames
+
+    SampleConverter toDevice;
+    toDevice.Init(SAMPLE_FLOAT32, SampleTypeOf(format), false, level);
+    std::vector<uint8_t> packet(static_cast<size_t>(nRate) * SampleTypeBytes(SampleTypeOf(format)));
+
+    double fSeconds = 0;
+    uint64_t nAnalyzed = 0;
+    std::vector<float> stereo;
+
+    const SimSignal signals[] = { SIM_SINE, SIM_MUSIC, SIM_INVERTED, SIM_PANNED, SIM_INDEPENDENT, SIM_SILENCE };
+    for (SimSignal signal : signals) {
+        MakeStereo(signal, nRate / 2, nFrames, stereo);
+        bool bDecidable = signal != SIM_INDEPENDENT && signal != SIM_SILENCE;
+
+        // offset 1 is a stream whose first left sample went missing
+        for (size_t nOffset = 0; nOffset < 2; nOffset++) {
+            PhaseDetector detector;
+            detector.Init(format, level);
+
+            double fAt = RunDetector(detector, toDevice, stereo.data(), nOffset, stereo.size(), nRate, packet, fSeconds);
+            nAnalyzed += stereo.size() - nOffset;
+
+            PhaseSimulationCase &c = result.cases[result.nCases++];
+            c.szSignal = SimSignalName(signal);
+            c.expected = !bDecidable ? PHASE_UNKNOWN : nOffset ? PHASE_SKIP_FIRST : PHASE_ALIGNED;
+            c.detected = detector.Phase();
+            c.fDecisionMs = fAt < 0 ? 0 : fAt * 1000.0 / nRate;
+            c.bPass = c.detected == c.expected && detector.Changes() <= 1;
+            result.bPass = result.bPass && c.bPass;
+        }
+    }
+
+    // the device losing one sample half way through, so the other pairing
+    // is the right one from there on; that comes with a discontinuity flag
+    // and so a reset
+    MakeStereo(SIM_MUSIC, nRate / 2, nFrames, stereo);
+    for (size_t nFirst = 0; nFirst < 2; nFirst++) {
+        size_t nHalf = stereo.size() / 2;
+
+        // pairs are counted from the start of the stream, so the lost
+        // sample flips them either way
+        std::vector<float> mono(stereo.begin() + static_cast<std::ptrdiff_t>(nFirst), stereo.begin() + static_cast<std::ptrdiff_t>(nHalf));
+        mono.insert(mono.end(), stereo.begin() + static_cast<std::ptrdiff_t>(nHalf + 1), stereo.end());
+        size_t nRestart = nHalf - nFirst;
+
+        PhaseDetector detector;
+        detector.Init(format, level);
+        RunDetector(detector, toDevice, mono.data(), 0, nRestart, nRate, packet, fSeconds);
+        ChannelPhase before = detector.Phase();
+
+        detector.Reset();
+        double fAt = RunDetector(detector, toDevice, mono.data(), nRestart, mono.size(), nRate, packet, fSeconds);
+        nAnalyzed += mono.size();
+
+        PhaseSimulationCase &c = result.cases[result.nCases++];
+        c.szSignal = nFirst ? "restart, skip to aligned" : "restart, aligned to skip";
+        c.expected = nFirst ? PHASE_ALIGNED : PHASE_SKIP_FIRST;
+        c.detected = detector.Phase();
+        c.fDecisionMs = fAt < 0 ? 0 : fAt * 1000.0 / nRate;
+        c.bPass = before != c.expected && before != PHASE_UNKNOWN && c.detected == c.expected;
+        result.bPass = result.bPass && c.bPass;
+    }
+
+    result.fNsPerSample = nAnalyzed ? fSeconds * 1e9 / static_cast<double>(nAnalyzed) : 0;
+    result.fCpuPercent = result.fNsPerSample * nRate / 1e9 * 100.0;
+    return result;
+}
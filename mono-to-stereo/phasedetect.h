@@ -0,0 +1,133 @@
+// phasedetect.h
+
+// works out whether the capture stream is missing its first sample, from
+// the audio itself
+//
+// every stereo frame arrives as two consecutive mono samples, but nothing
+// in the stream says where a frame starts. left and right are almost always
+// correlated, so the pairing that has the most in common between its two
+// halves is the real one: we track the correlation of samples (2k, 2k+1)
+// against that of (2k+1, 2k+2) over a sliding window and pick the stronger,
+// with some hysteresis. uncorrelated or silent input gives no answer and
+// leaves the current choice alone
+//
+// no Windows dependencies
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "audioformat.h"
+#include "sampleconvert.h"
+
+enum ChannelPhase {
+    PHASE_UNKNOWN,
+    PHASE_ALIGNED,    // pairs start on even samples, nothing to skip
+    PHASE_SKIP_FIRST, // pairs start on odd samples, delay by one sample
+};
+
+const char *ChannelPhaseName(ChannelPhase phase);
+
+// time constant of the sliding window
+#define PHASE_WINDOW_MS 500
+
+// how much audio has to be seen after a reset before deciding
+#define PHASE_MIN_MS 50
+
+// how much smaller one pairing's 1 - |correlation| has to be than the other's
+// to pick it from scratch, and to switch away from an earlier choice
+#define PHASE_DECIDE_RATIO 0.5
+#define PHASE_FLIP_RATIO 0.25
+
+// mean square level below which the input counts as silence (-80 dBFS)
+#define PHASE_SILENCE 1e-8
+
+// sums over i in [0, n - 1) for a run of float samples x[0..n):
+// sums[0] and sums[1] x[i] * x[i] for even and odd i,
+// sums[2] and sums[3] x[i] * x[i + 1] for even and odd i
+typedef void (*PhaseKernel)(const float *pIn, size_t nSamples, float sums[4]);
+
+class PhaseDetector {
+public:
+    PhaseDetector();
+
+    // format is the mono capture format
+    bool Init(const AudioFormat &format, SimdLevel level);
+    bool Init(const AudioFormat &format) { return Init(format, DetectSimdLevel()); }
+
+    // forgets everything seen so far but the stream position, e.g. after a
+    // discontinuity; the last decision stays in Phase() until a new one is made
+    void Reset();
+
+    // the stream skipped an odd number of samples, so the other pairing is
+    // now the right one; swaps the decision and what has been seen so far
+    void Flip();
+
+    // looks at one capture packet of any size; pairs are counted from the
+    // start of the stream the same way RepackFrames counts them, including
+    // the one straddling two packets
+    // returns the current decision
+    ChannelPhase Analyze(const uint8_t *pData, uint32_t nSamples);
+
+    ChannelPhase Phase() const { return m_phase; }
+
+    // 1 - |correlation| of the chosen pairing over the other one's, 1 if
+    // there is nothing to go on
+    double Ratio() const { return m_fRatio; }
+
+    // times the decision has changed, including the first one
+    uint32_t Changes() const { return m_nChanges; }
+
+    SimdLevel Level() const { return m_level; }
+
+private:
+    SampleConverter m_toFloat;
+    PhaseKernel m_pKernel;
+    SimdLevel m_level;
+    size_t m_nSampleBytes;
+    double m_fDecayPerSample;
+    double m_fMinSamples;
+    bool m_bOddPosition;  // an odd number of samples has gone by
+
+    // decayed sums over the window
+    double m_fWeight;
+    double m_fEven;     // energy of even samples
+    double m_fOdd;      // energy of odd samples
+    double m_fAligned;  // correlation of (2k, 2k + 1)
+    double m_fSkipped;  // correlation of (2k + 1, 2k + 2)
+    double m_fSinceReset;
+    float m_fLast;      // the last sample seen, paired with the next packet's first
+    bool m_bHaveLast;
+
+    ChannelPhase m_phase;
+    double m_fRatio;
+    uint32_t m_nChanges;
+
+    float m_block[SAMPLECONVERT_BLOCK];
+};
+
+// ---- offline check ----
+
+struct PhaseSimulationCase {
+    const char *szSignal;
+    ChannelPhase expected;
+    ChannelPhase detected;
+    double fDecisionMs;    // from the start (or the reset) to the decision
+    bool bPass;
+};
+
+#define PHASE_SIMULATION_CASES 14
+
+struct PhaseSimulationResult {
+    PhaseSimulationCase cases[PHASE_SIMULATION_CASES];
+    uint32_t nCases;
+    double fNsPerSample;   // cost of Analyze, conversion included
+    double fCpuPercent;    // of one core at the simulated rate
+    bool bPass;
+};
+
+// feeds synthetic stereo signals, interleaved with and without the first
+// sample missing, through a detector in the given mono format; also checks
+// that the detector follows a phase change after a reset
+PhaseSimulationResult SimulatePhaseDetection(const AudioFormat &format, SimdLevel level);
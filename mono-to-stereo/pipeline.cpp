@@ -0,0 +1,719 @@
+// pipeline.cpp
+
+#include "pipeline.h"
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+
+// ---- helpers ----
+
+class LeaveThreadOnExit {
+public:
+    LeaveThreadOnExit(AudioEndpoint &endpoint) : m_endpoint(endpoint) {}
+    ~LeaveThreadOnExit() { m_endpoint.LeaveThread(); }
+
+private:
+    AudioEndpoint &m_endpoint;
+};
+
+// a latency from capture to playback is spent on the capture packet
+// first; the rest, at least a render period, is held in the ring and the
+// device together
+static uint32_t QueuedFramesFor(uint32_t nLatencyFrames, uint32_t nCaptureFrames, uint32_t nPeriodFrames) {
+    return (std::max)(nLatencyFrames > nCaptureFrames ? nLatencyFrames - nCaptureFrames : 0, nPeriodFrames);
+}
+
+// the device gets half of what's queued and half a period, so once a
+// wakeup has taken its period from the ring, each has the same margin
+// left before it runs dry
+static uint32_t DeviceFillFrames(uint32_t nQueuedFrames, uint32_t nPeriodFrames, uint32_t nBufferFrames) {
+    return (std::min)((nQueuedFrames + nPeriodFrames) / 2, nBufferFrames);
+}
+
+// ---- setup and teardown ----
+
+StreamPipeline::StreamPipeline(StatsClock &clock, StatsSink &statsSink, MessageSink &messages)
+    : m_clock(clock)
+    , m_statsSink(statsSink)
+    , m_messages(messages)
+    , m_pSource(NULL)
+    , m_bSourceStarted(false)
+    , m_nOutputs(0)
+    , m_pRepack(NULL)
+    , m_bDetectPhase(false)
+    , m_hnsStatsInterval(0)
+    , m_pLiveStatsSink(NULL)
+    , m_hnsLiveStatsInterval(0)
+    , m_pRecording(NULL)
+    , m_pStreaming(NULL)
+    , m_nRingRate(0)
+    , m_nCaptureFrames(0)
+    , m_bStopOnOutputLoss(false)
+    , m_nErrorCode(0)
+{
+    m_bStop.store(false, std::memory_order_relaxed);
+    m_nRunningOutputs.store(0, std::memory_order_relaxed);
+    m_nCapturedFrames.store(0, std::memory_order_relaxed);
+    m_hnsFirstCapture.store(0, std::memory_order_relaxed);
+    m_hnsLastCapture.store(0, std::memory_order_relaxed);
+    m_nLostOutput.store(-1, std::memory_order_relaxed);
+}
+
+StreamPipeline::~StreamPipeline() {
+    Shutdown();
+}
+
+void StreamPipeline::SetLiveStats(StatsSink &sink, uint32_t nIntervalMs) {
+    m_pLiveStatsSink = &sink;
+    m_hnsLiveStatsInterval = static_cast<int64_t>(nIntervalMs) * (HNS_PER_SECOND / 1000);
+}
+
+void StreamPipeline::SetRecording(RecordingTap &tap) {
+    m_pRecording = &tap;
+}
+
+void StreamPipeline::SetStreaming(RtpSender &sender) {
+    m_pStreaming = &sender;
+}
+
+void StreamPipeline::Stop() {
+    m_bStop.store(true, std::memory_order_release);
+
+    if (NULL != m_pSource) {
+        m_pSource->Interrupt();
+    }
+    for (uint32_t i = 0; i < m_nOutputs; i++) {
+        m_outputs[i].pSink->Interrupt();
+    }
+}
+
+// render threads first, since they use the ring and the sinks
+void StreamPipeline::Shutdown() {
+    Stop();
+
+    for (uint32_t i = 0; i < m_nOutputs; i++) {
+        Output &output = m_outputs[i];
+        if (output.thread.joinable()) {
+            output.thread.join();
+        }
+        if (output.bStarted) {
+            output.pSink->Stop();
+            output.bStarted = false;
+        }
+    }
+
+    if (m_bSourceStarted) {
+        m_pSource->Stop();
+        m_bSourceStarted = false;
+    }
+}
+
+DeviceStatus StreamPipeline::Fail(DeviceStatus status, int32_t nErrorCode, const char *szFormat, ...) {
+    char szMessage[512];
+    va_list args;
+    va_start(args, szFormat);
+    vsnprintf(szMessage, sizeof(szMessage), szFormat, args);
+    va_end(args);
+
+    m_error = szMessage;
+    m_nErrorCode = nErrorCode;
+    m_messages.Error("%s", szMessage);
+    return status;
+}
+
+DeviceStatus StreamPipeline::Start(CaptureSource &source, RenderSink *const *ppSinks, uint32_t nSinks, const PipelineOptions &options) {
+    if (0 == nSinks) {
+        return Fail(DEVICE_FAILED, 0, "no outputs to render to");
+    }
+
+    // without resampling, a level that shrinks would only move the audio
+    // from the device into the ring, not get rid of it
+    if (options.bAutoBuffer && !options.bDriftCompensation) {
+        return Fail(DEVICE_FAILED, 0, "tuning the buffer size needs drift compensation");
+    }
+
+    m_pSource = &source;
+    DeviceStatus status = source.Open();
+    if (DEVICE_OK != status) {
+        return Fail(status, source.ErrorCode(), "couldn't open the input: %s", source.Error().c_str());
+    }
+
+    // shared with the file converter so both accept exactly the same input
+    const AudioFormat &inputFormat = source.Format();
+    std::string formatError;
+    if (!CheckMultiplexedInputFormat(inputFormat, options.nMultiplex, formatError)) {
+        return Fail(DEVICE_FAILED, 0, "device format rejected: %s", formatError.c_str());
+    }
+
+    if (!RepackInit(m_repack, inputFormat.nBlockAlign, options.nMultiplex, options.nSampleOffset)) {
+        return Fail(DEVICE_FAILED, 0, "can't start %u samples into a frame of %u", options.nSampleOffset, options.nMultiplex);
+    }
+    m_pRepack = RepackKernelFor(inputFormat.nBlockAlign, options.nMultiplex);
+
+    // nSampleOffset is only the starting guess when detecting; the detector
+    // only knows about pairs of mono samples
+    m_bDetectPhase = options.bDetectPhase && 2 == options.nMultiplex && 1 == inputFormat.nChannels;
+    if (options.bDetectPhase && !m_bDetectPhase) {
+        m_messages.Log("Not detecting channel phase, which needs a mono input carrying stereo; starting %u samples into a frame", options.nSampleOffset);
+    }
+    if (m_bDetectPhase) {
+        if (!m_phase.Init(inputFormat)) {
+            return Fail(DEVICE_FAILED, 0, "couldn't set up channel phase detection");
+        }
+        m_messages.Log("Detecting channel phase (%s)", SimdLevelName(m_phase.Level()));
+    }
+
+    // what the repacker produces; the devices may want a different sample type
+    AudioFormat ringFormat = DemultiplexedFormat(inputFormat, options.nMultiplex);
+    if (2 != options.nMultiplex || 1 != inputFormat.nChannels) {
+        m_messages.Log("Demultiplexing %u channels at %u Hz into %u at %u Hz", inputFormat.nChannels, inputFormat.nSamplesPerSec, ringFormat.nChannels, ringFormat.nSamplesPerSec);
+    }
+
+    if (!m_concealer.Init(ringFormat, ringFormat.nSamplesPerSec * CONCEAL_FADE_MS / 1000)) {
+        return Fail(DEVICE_FAILED, 0, "couldn't set up glitch concealment");
+    }
+
+    if (options.dsp.Any() && 2 != ringFormat.nChannels) {
+        return Fail(DEVICE_FAILED, 0, "processing needs a stereo stream, this one has %u channels", ringFormat.nChannels);
+    }
+    if (!m_dsp.Init(options.dsp, ringFormat)) {
+        return Fail(DEVICE_FAILED, 0, "couldn't set up processing: %s", m_dsp.Describe().c_str());
+    }
+    if (m_dsp.IsActive()) {
+        m_messages.Log("Processing: %s", m_dsp.Describe().c_str());
+    }
+
+    // a recording that can't be kept going isn't worth stopping the stream for
+    if (NULL != m_pRecording) {
+        std::string recordError;
+        if (m_pRecording->Begin(ringFormat, recordError)) {
+            m_messages.Log("Recording to %s", m_pRecording->Path().c_str());
+        }
+        else {
+            m_messages.Error("Not recording: %s", recordError.c_str());
+            m_pRecording = NULL;
+        }
+    }
+    if (NULL != m_pStreaming) {
+        std::string streamError;
+        if (m_pStreaming->Begin(ringFormat, streamError)) {
+            m_messages.Log(
+                "Streaming %s to %s, %u frames a packet",
+                RtpEncodingName(m_pStreaming->Options().encoding), m_pStreaming->Destination().c_str(), m_pStreaming->PacketFrames()
+            );
+        }
+        else {
+            m_messages.Error("Not streaming: %s", streamError.c_str());
+            m_pStreaming = NULL;
+        }
+    }
+    m_nRingRate = ringFormat.nSamplesPerSec;
+    m_nCaptureFrames = static_cast<uint32_t>(source.PeriodHns() * ringFormat.nSamplesPerSec / HNS_PER_SECOND);
+
+    // each output gets its own buffer, format and drift compensation so
+    // they can't get in each other's way
+    m_outputs.reset(new Output[nSinks]);
+    m_nOutputs = nSinks;
+    uint32_t nRingFrames = 0;
+    for (uint32_t i = 0; i < nSinks; i++) {
+        m_outputs[i].pSink = ppSinks[i];
+        status = OpenOutput(i, ringFormat, options);
+        if (DEVICE_OK != status) {
+            return status;
+        }
+
+        nRingFrames = (std::max)(nRingFrames, ppSinks[i]->BufferFrames() * 2);
+    }
+
+    // one ring for all of them, written once per packet; give it room for
+    // two of the largest render buffers to soak up render hiccups
+    if (!m_ring.Init(ringFormat.nBlockAlign, nRingFrames, nSinks)) {
+        return Fail(DEVICE_FAILED, 0, "couldn't allocate a %u frame ring buffer", nRingFrames);
+    }
+
+    if (!m_stats.Init(ringFormat.nSamplesPerSec, source.PeriodHns(), nSinks)) {
+        return Fail(DEVICE_FAILED, 0, "couldn't set up latency measurement");
+    }
+    m_hnsStatsInterval = static_cast<int64_t>(options.nStatsIntervalSec) * HNS_PER_SECOND;
+    m_bStopOnOutputLoss = options.bStopOnOutputLoss;
+
+    for (uint32_t i = 0; i < nSinks; i++) {
+        Output &output = m_outputs[i];
+        m_stats.Render(i).Init(output.pSink->PeriodHns());
+
+        status = output.pSink->Start();
+        if (DEVICE_OK != status) {
+            return Fail(status, output.pSink->ErrorCode(), "couldn't start output %u: %s", i + 1, output.pSink->Error().c_str());
+        }
+        output.bStarted = true;
+
+        m_nRunningOutputs.fetch_add(1, std::memory_order_relaxed);
+        output.thread = std::thread(&StreamPipeline::RenderThread, this, i);
+    }
+
+    status = source.Start();
+    if (DEVICE_OK != status) {
+        return Fail(status, source.ErrorCode(), "couldn't start the input: %s", source.Error().c_str());
+    }
+    m_bSourceStarted = true;
+
+    return DEVICE_OK;
+}
+
+DeviceStatus StreamPipeline::OpenOutput(uint32_t nOutput, const AudioFormat &ringFormat, const PipelineOptions &options) {
+    Output &output = m_outputs[nOutput];
+    RenderSink &sink = *output.pSink;
+
+    // a tuned output only fills as much of a big buffer as it needs
+    DeviceStatus status = sink.Open(ringFormat, options.bAutoBuffer ? BUFFERTUNE_MAX_MS : options.nBufferMs);
+    if (DEVICE_OK != status) {
+        return Fail(status, sink.ErrorCode(), "couldn't open output %u: %s", nOutput + 1, sink.Error().c_str());
+    }
+
+    const AudioFormat &deviceFormat = sink.Format();
+    if (deviceFormat.nChannels != ringFormat.nChannels || deviceFormat.nSamplesPerSec != ringFormat.nSamplesPerSec) {
+        return Fail(DEVICE_FAILED, 0, "output %u opened with %u channels at %u Hz", nOutput + 1, deviceFormat.nChannels, deviceFormat.nSamplesPerSec);
+    }
+
+    output.bConvert = SampleTypeOf(deviceFormat) != SampleTypeOf(ringFormat);
+    if (output.bConvert) {
+        if (!output.converter.Init(SampleTypeOf(ringFormat), SampleTypeOf(deviceFormat), true)) {
+            return Fail(DEVICE_FAILED, 0, "can't convert to the format of output %u", nOutput + 1);
+        }
+        m_messages.Log(
+            "Converting %s to %s for output %u (%s)",
+            SampleTypeName(output.converter.InputType()), SampleTypeName(output.converter.OutputType()),
+            nOutput + 1, SimdLevelName(output.converter.Level())
+        );
+    }
+
+    // the latency to keep from capture to playback is half a buffer, or
+    // the level a tuned output's BufferTuner has found the machine needs;
+    // neither can be less than a capture packet and a render period
+    uint32_t nBufferFrames = sink.BufferFrames();
+    uint32_t nLatencyFrames = nBufferFrames / 2;
+    output.nPeriodFrames = static_cast<uint32_t>(sink.PeriodHns() * deviceFormat.nSamplesPerSec / HNS_PER_SECOND);
+    output.bTuneBuffer = options.bAutoBuffer;
+    if (output.bTuneBuffer) {
+        if (!output.tuner.Init(deviceFormat.nSamplesPerSec, m_nCaptureFrames + output.nPeriodFrames, nBufferFrames)) {
+            return Fail(DEVICE_FAILED, 0, "couldn't set up buffer tuning for output %u", nOutput + 1);
+        }
+        nLatencyFrames = output.tuner.LevelFrames();
+    }
+
+    // the capture and render clocks drift apart; keep the ring and the
+    // device together at that latency by resampling slightly faster or
+    // slower, with the device only filled to its share. without drift
+    // compensation the device starts with half a buffer and takes
+    // whatever arrives on top
+    output.bDriftCompensation = options.bDriftCompensation;
+    output.nFillFrames = nBufferFrames;
+    uint32_t nStartFrames = nLatencyFrames;
+    if (output.bDriftCompensation) {
+        uint32_t nQueuedFrames = QueuedFramesFor(nLatencyFrames, m_nCaptureFrames, output.nPeriodFrames);
+        if (!output.driftReader.Init(ringFormat, deviceFormat, nBufferFrames, nQueuedFrames)) {
+            return Fail(DEVICE_FAILED, 0, "couldn't set up drift compensation");
+        }
+        output.nFillFrames = DeviceFillFrames(nQueuedFrames, output.nPeriodFrames, nBufferFrames);
+        nStartFrames = output.nFillFrames;
+    }
+
+    uint8_t *pData;
+    status = sink.GetBuffer(nStartFrames, &pData);
+    if (DEVICE_OK == status) {
+        status = sink.ReleaseBuffer(nStartFrames, true);
+    }
+    if (DEVICE_OK != status) {
+        return Fail(status, sink.ErrorCode(), "couldn't prefill output %u: %s", nOutput + 1, sink.Error().c_str());
+    }
+
+    return DEVICE_OK;
+}
+
+// ---- capture ----
+
+DeviceStatus StreamPipeline::Run() {
+    CaptureSource &source = *m_pSource;
+
+    DeviceStatus status = source.EnterThread();
+    if (DEVICE_OK != status) {
+        return Fail(status, source.ErrorCode(), "couldn't set up the capture thread: %s", source.Error().c_str());
+    }
+    LeaveThreadOnExit leaveThread(source);
+
+    // statistics are published from this thread between packets
+    int64_t hnsNextStats = m_clock.NowHns() + m_hnsStatsInterval;
+    int64_t hnsNextLiveStats = m_clock.NowHns() + m_hnsLiveStatsInterval;
+
+    while (!m_bStop.load(std::memory_order_acquire)) {
+        status = source.Wait(PIPELINE_WAIT_MS);
+
+        if (m_hnsStatsInterval > 0 && m_clock.NowHns() >= hnsNextStats) {
+            PublishStats(m_statsSink);
+            hnsNextStats += m_hnsStatsInterval;
+        }
+
+        // no catching up after a long wait; the next one is just as current
+        if (NULL != m_pLiveStatsSink && m_clock.NowHns() >= hnsNextLiveStats) {
+            PublishStats(*m_pLiveStatsSink);
+            hnsNextLiveStats = m_clock.NowHns() + m_hnsLiveStatsInterval;
+        }
+
+        if (DEVICE_STOPPED == status) {
+            break;
+        }
+
+        if (0 == m_nRunningOutputs.load(std::memory_order_acquire)) {
+            status = Fail(DEVICE_FAILED, m_nErrorCode, "every output has stopped after %llu frames", static_cast<unsigned long long>(CapturedFrames()));
+            break;
+        }
+
+        if (DEVICE_TIMEOUT == status) {
+            continue;
+        }
+
+        if (DEVICE_OK != status) {
+            status = Fail(status, source.ErrorCode(), "waiting for the input failed after %llu frames: %s", static_cast<unsigned long long>(CapturedFrames()), source.Error().c_str());
+            break;
+        }
+
+        int64_t hnsWake = m_clock.NowHns();
+        m_stats.Capture().Wake(hnsWake);
+        WakeupTimerDoneOnExit captureDone(m_stats.Capture(), m_clock);
+
+        uint64_t nBefore = CapturedFrames();
+        status = CapturePackets();
+        if (CapturedFrames() != nBefore) {
+            if (0 == nBefore) {
+                m_hnsFirstCapture.store(hnsWake, std::memory_order_relaxed);
+            }
+            m_hnsLastCapture.store(hnsWake, std::memory_order_relaxed);
+        }
+        if (DEVICE_OK != status) {
+            break;
+        }
+    }
+
+    int32_t nLostOutput = m_nLostOutput.load(std::memory_order_acquire);
+    if (nLostOutput >= 0 && (DEVICE_STOPPED == status || DEVICE_OK == status)) {
+        status = Fail(DEVICE_LOST, m_outputs[nLostOutput].pSink->ErrorCode(), "output %d lost its device after %llu frames", nLostOutput + 1, static_cast<unsigned long long>(CapturedFrames()));
+    }
+    else if (DEVICE_STOPPED == status || DEVICE_OK == status) {
+        m_messages.Log("Stopped after %llu frames", static_cast<unsigned long long>(CapturedFrames()));
+        status = DEVICE_OK;
+    }
+    if (m_dsp.LimitedFrames() != 0) {
+        m_messages.Log("The limiter turned down %llu frames", static_cast<unsigned long long>(m_dsp.LimitedFrames()));
+    }
+
+    // the render threads go down with us
+    Stop();
+    PublishStats(m_statsSink);
+    if (NULL != m_pLiveStatsSink) {
+        PublishStats(*m_pLiveStatsSink);
+    }
+    return status;
+}
+
+DeviceStatus StreamPipeline::CapturePackets() {
+    CaptureSource &source = *m_pSource;
+
+    for (;;) {
+        uint64_t nCaptured = CapturedFrames();
+
+        CapturePacket packet;
+        DeviceStatus status = source.GetPacket(packet);
+        if (DEVICE_OK != status) {
+            return Fail(status, source.ErrorCode(), "reading the input failed after %llu frames: %s", static_cast<unsigned long long>(nCaptured), source.Error().c_str());
+        }
+
+        if (packet.nFrames == 0) {
+            return DEVICE_OK;
+        }
+
+        // the audio is fine, only the time it was captured is unknown
+        bool bTimestampValid = 0 == (packet.nFlags & DEVICE_FLAG_TIMESTAMP_ERROR);
+
+        // glitches are papered over and counted; none of them stops capture
+        uint32_t nGlitches = m_concealer.NotePacket(
+            packet.nFlags, bTimestampValid ? packet.nDevicePosition : UINT64_MAX,
+            packet.pData, packet.nFrames, m_repack
+        );
+
+        if (nGlitches & GLITCH_DISCONTINUITY) {
+            m_messages.Log(
+                "Glitch reported after %llu frames%s", static_cast<unsigned long long>(nCaptured),
+                (nGlitches & GLITCH_REALIGNED) ? ", part of a frame was lost so the channels were realigned" : ""
+            );
+
+            // the device may have come back with the other phase
+            m_phase.Reset();
+            if (nGlitches & GLITCH_REALIGNED) {
+                m_phase.Flip();
+            }
+        }
+
+        if ((nGlitches & GLITCH_UNKNOWN_FLAGS) && 1 == m_concealer.Stats().nUnknownFlagPackets) {
+            m_messages.Log("Ignoring capture packet flags 0x%08x after %llu frames; later ones are only counted", packet.nFlags, static_cast<unsigned long long>(nCaptured));
+        }
+
+        // a silent packet's buffer is meaningless
+        if (m_bDetectPhase && !(nGlitches & GLITCH_SILENT)) {
+            ChannelPhase detected = m_phase.Analyze(packet.pData, packet.nFrames);
+            uint32_t nOffset = PHASE_SKIP_FIRST == detected ? 1 : 0;
+            if (PHASE_UNKNOWN != detected && nOffset != m_repack.nOffset) {
+                m_messages.Log("Channel phase is now %s after %llu frames", ChannelPhaseName(detected), static_cast<unsigned long long>(nCaptured));
+                m_repack.nOffset = nOffset;
+            }
+        }
+
+        if (bTimestampValid) {
+            m_stats.NoteCapturePosition(packet.nDevicePosition, packet.nFrames);
+            m_stats.NoteCapture(m_ring.WritePosition(), packet.hnsCapture);
+        }
+        else {
+            m_stats.NoteTimestampError();
+        }
+
+        // never blocks; an output that has fallen a whole ring behind is
+        // lapped and the frames count as its overrun
+        RepackIntoRing(packet.pData, packet.nFrames, bTimestampValid ? packet.hnsCapture : 0);
+
+        status = source.ReleasePacket(packet.nFrames);
+        if (DEVICE_OK != status) {
+            return Fail(status, source.ErrorCode(), "releasing an input packet failed after %llu frames: %s", static_cast<unsigned long long>(nCaptured), source.Error().c_str());
+        }
+
+        m_nCapturedFrames.store(nCaptured + packet.nFrames, std::memory_order_relaxed);
+    }
+}
+
+void StreamPipeline::RepackIntoRing(const uint8_t *pData, uint32_t nFrames, int64_t hnsCapture) {
+    uint32_t nOutFrames = RepackOutputFrames(m_repack, nFrames);
+    uint32_t nWritten = 0;
+    uint32_t nRead = 0;
+
+    // at most two passes, one on each side of the wrap point. every pass but
+    // the last takes whole output frames' worth of samples, so whatever is
+    // carried stays carried and the last one takes the rest of the packet
+    while (nWritten < nOutFrames) {
+        uint8_t *pOutData;
+        uint32_t n = m_ring.BeginWrite(&pOutData, nOutFrames - nWritten);
+        uint32_t nSamples = nWritten + n < nOutFrames ? n * m_repack.nFactor : nFrames - nRead;
+
+        m_pRepack(m_repack, pData + static_cast<size_t>(nRead) * m_repack.nBlockAlign, nSamples, pOutData);
+        m_concealer.Process(pOutData, n);
+        if (m_dsp.IsActive()) {
+            m_dsp.Process(pOutData, n);
+        }
+        if (NULL != m_pRecording) {
+            m_pRecording->Write(pOutData, n);
+        }
+        if (NULL != m_pStreaming) {
+            int64_t hnsFirst = 0 == hnsCapture ? 0 : hnsCapture + static_cast<int64_t>(nWritten) * HNS_PER_SECOND / m_nRingRate;
+            m_pStreaming->Write(pOutData, n, hnsFirst);
+        }
+        m_ring.CommitWrite(n);
+        nWritten += n;
+        nRead += nSamples;
+    }
+
+    // a single sample can complete nothing, but it is still carried
+    if (nRead < nFrames) {
+        RepackAdvance(m_repack, pData + static_cast<size_t>(nRead) * m_repack.nBlockAlign, nFrames - nRead);
+    }
+}
+
+void StreamPipeline::PublishStats(StatsSink &sink) {
+    for (uint32_t i = 0; i < m_nOutputs; i++) {
+        StreamStatsSnapshot snapshot = m_stats.Snapshot(i, m_ring.Reader(i).GetStats());
+        snapshot.nCapturedFrames = CapturedFrames();
+        snapshot.glitches = m_concealer.Stats();
+        if (m_outputs[i].bTuneBuffer) {
+            snapshot.buffer = m_outputs[i].tuner.Stats();
+        }
+        sink.Publish(snapshot);
+    }
+}
+
+// ---- render ----
+
+void StreamPipeline::RenderThread(uint32_t nOutput) {
+    RenderSink &sink = *m_outputs[nOutput].pSink;
+
+    DeviceStatus status = sink.EnterThread();
+    if (DEVICE_OK == status) {
+        status = RenderLoop(nOutput);
+        sink.LeaveThread();
+    }
+
+    if (DEVICE_STOPPED != status) {
+        m_messages.Error(
+            "Output %u stopped after %llu frames (%s): %s",
+            nOutput + 1, static_cast<unsigned long long>(CapturedFrames()), DeviceStatusName(status), sink.Error().c_str()
+        );
+    }
+
+    // the capture thread turns this into Run's result
+    int32_t nNoOutput = -1;
+    if (DEVICE_LOST == status && m_bStopOnOutputLoss &&
+        m_nLostOutput.compare_exchange_strong(nNoOutput, static_cast<int32_t>(nOutput), std::memory_order_release)) {
+        Stop();
+    }
+
+    m_nRunningOutputs.fetch_sub(1, std::memory_order_release);
+}
+
+DeviceStatus StreamPipeline::RenderLoop(uint32_t nOutput) {
+    Output &output = m_outputs[nOutput];
+    RenderSink &sink = *output.pSink;
+    FanoutReader &ring = m_ring.Reader(nOutput);
+    WakeupTimer &timer = m_stats.Render(nOutput);
+    DriftCompensatedReader *pDriftReader = output.bDriftCompensation ? &output.driftReader : NULL;
+    SampleConverter *pConverter = output.bConvert ? &output.converter : NULL;
+    const bool bTuneBuffer = output.bTuneBuffer;
+
+    for (;;) {
+        DeviceStatus status = sink.Wait(PIPELINE_WAIT_MS);
+        if (DEVICE_TIMEOUT == status) {
+            continue;
+        }
+        if (DEVICE_OK != status) {
+            return status;
+        }
+
+        int64_t hnsWake = m_clock.NowHns();
+        timer.Wake(hnsWake);
+        WakeupTimerDoneOnExit renderDone(timer, m_clock);
+
+        uint32_t nPadding;
+        status = sink.GetPadding(nPadding);
+        if (DEVICE_OK != status) {
+            return status;
+        }
+
+        // whatever is written next will be heard once the padding has played
+        m_stats.Latency(nOutput).NoteRender(
+            ring.ReadPosition(),
+            NULL != pDriftReader ? pDriftReader->HeldFrames() : 0.0,
+            nPadding, hnsWake
+        );
+
+        uint32_t nFill = bTuneBuffer ? TuneBuffer(nOutput, nPadding, hnsWake) : output.nFillFrames;
+        uint32_t nWanted = nFill > nPadding ? nFill - nPadding : 0;
+        if (nWanted == 0) {
+            continue;
+        }
+
+        if (NULL != pDriftReader) {
+            // always fills the whole request, resampled to follow the
+            // capture clock; shortfalls are padded and counted as underruns
+            uint8_t *pOutData;
+            status = sink.GetBuffer(nWanted, &pOutData);
+            if (DEVICE_OK != status) {
+                return status;
+            }
+
+            ring.NoteReadFill(ring.ReadAvailable());
+            uint64_t nDropped = pDriftReader->DroppedFrames();
+            pDriftReader->Read(ring, pOutData, nWanted, nPadding);
+            if (pDriftReader->DroppedFrames() != nDropped) {
+                m_messages.Log(
+                    "Output %u skipped %.1f ms to get back to its latency after %llu frames",
+                    nOutput + 1, (pDriftReader->DroppedFrames() - nDropped) * 1000.0 / m_nRingRate,
+                    static_cast<unsigned long long>(CapturedFrames())
+                );
+            }
+
+            status = sink.ReleaseBuffer(nWanted, false);
+            if (DEVICE_OK != status) {
+                return status;
+            }
+            continue;
+        }
+
+        uint32_t nQueued = ring.ReadAvailable();
+        ring.NoteReadFill(nQueued);
+
+        // the device has played everything it had
+        if (nPadding == 0 && nQueued < nWanted) {
+            ring.NoteUnderrun(nWanted - nQueued);
+        }
+
+        uint32_t nFrames = (std::min)(nWanted, nQueued);
+        if (nFrames == 0) {
+            continue;
+        }
+
+        uint8_t *pOutData;
+        status = sink.GetBuffer(nFrames, &pOutData);
+        if (DEVICE_OK != status) {
+            return status;
+        }
+
+        if (NULL == pConverter) {
+            ring.Read(pOutData, nFrames);
+        }
+        else {
+            // convert straight out of the ring, one contiguous region at a time
+            uint32_t nOutBlockAlign = sink.Format().nBlockAlign;
+            for (uint32_t nDone = 0; nDone < nFrames; ) {
+                const uint8_t *pData;
+                uint32_t n = (std::min)(ring.BeginRead(&pData), nFrames - nDone);
+                uint8_t *pOut = pOutData + static_cast<size_t>(nDone) * nOutBlockAlign;
+                pConverter->Convert(pData, pOut, static_cast<size_t>(n) * sink.Format().nChannels);
+                if (!ring.CommitRead(n)) {
+                    memset(pOut, 0, static_cast<size_t>(n) * nOutBlockAlign);
+                }
+                nDone += n;
+            }
+        }
+
+        status = sink.ReleaseBuffer(nFrames, false);
+        if (DEVICE_OK != status) {
+            return status;
+        }
+    }
+}
+
+// tells the output's tuner how close this wakeup came to running dry, in
+// the device or in the ring, and returns the level to fill the device to
+uint32_t StreamPipeline::TuneBuffer(uint32_t nOutput, uint32_t nPadding, int64_t hnsWake) {
+    Output &output = m_outputs[nOutput];
+    BufferTuner &tuner = output.tuner;
+    DriftCompensatedReader &reader = output.driftReader;
+    const DriftController &controller = reader.Controller();
+    uint32_t nFill = output.nFillFrames;
+
+    // what the ring has beyond what's about to be taken from it, as if it
+    // had already drained to where drift compensation is taking it after a
+    // shrink; nothing while it refills. the level is split evenly between
+    // the two, so it has twice the least either has left to spare
+    double fSlack = nPadding;
+    if (controller.IsPrimed()) {
+        double fWanted = nFill > nPadding ? nFill - nPadding : 0;
+        double fAboveTarget = (std::max)(controller.FilteredFrames() - controller.TargetFrames(), 0.0);
+        fSlack = (std::min)(fSlack, reader.QueuedFrames(m_ring.Reader(nOutput)) - fWanted - fAboveTarget);
+    }
+    fSlack *= 2;
+
+    int iMoved = tuner.Update(fSlack, hnsWake);
+    if (0 == iMoved) {
+        return nFill;
+    }
+
+    // growing can't wait for the resampler to fill the ring a ms a second,
+    // so it's refilled at once and the difference played as silence; a
+    // shrink is drained without anyone hearing it
+    uint32_t nLevel = tuner.LevelFrames();
+    uint32_t nQueuedFrames = QueuedFramesFor(nLevel, m_nCaptureFrames, output.nPeriodFrames);
+    reader.Retarget(nQueuedFrames, iMoved > 0);
+    output.nFillFrames = DeviceFillFrames(nQueuedFrames, output.nPeriodFrames, output.pSink->BufferFrames());
+    m_messages.Log(
+        "Output %u buffering %s to %.1f ms after %llu frames",
+        nOutput + 1, iMoved > 0 ? "grew" : "shrank", nLevel * 1000.0 / m_nRingRate,
+        static_cast<unsigned long long>(CapturedFrames())
+    );
+    return output.nFillFrames;
+}
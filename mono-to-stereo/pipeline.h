@@ -0,0 +1,179 @@
+// pipeline.h
+
+// the capture to render pipeline, on top of the endpoint interface
+//
+// the thread that calls Run services the capture source: each packet is
+// checked, its channel phase worked out, and it is repacked once into a
+// fanout ring, with any glitch the device reports concealed and any
+// processing asked for (dsp.h) done on the way.
+// every render sink gets its own thread, which pulls from its cursor in
+// the ring through drift compensation and sample conversion straight into
+// the device's buffer. the latency kept from capture to playback is half
+// the buffer or, with bAutoBuffer, the level the output's BufferTuner
+// has found the machine needs (buffertune.h), split between the ring and
+// the device. messages and statistics are handed to sinks from those
+// threads, so they should be ones that don't block (messages.h)
+//
+// no Windows dependencies; runs the same against WASAPI or a simulated device
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "buffertune.h"
+#include "conceal.h"
+#include "device.h"
+#include "drift.h"
+#include "dsp.h"
+#include "fanout.h"
+#include "latency.h"
+#include "messages.h"
+#include "phasedetect.h"
+#include "recorder.h"
+#include "repack.h"
+#include "rtp.h"
+#include "sampleconvert.h"
+
+struct PipelineOptions {
+    uint32_t nBufferMs;
+    bool bAutoBuffer;          // ignore nBufferMs and tune each output's buffering as it runs; needs bDriftCompensation
+    uint32_t nMultiplex;       // input samples per output frame; 2 for mono into stereo
+    uint32_t nSampleOffset;    // samples the first output frame is missing; starting guess if bDetectPhase is set
+    bool bDetectPhase;         // only for a mono input carrying stereo
+    bool bDriftCompensation;
+    uint32_t nStatsIntervalSec; // 0 to only publish statistics when stopping
+    bool bStopOnOutputLoss;     // an output losing its device stops the pipeline with DEVICE_LOST instead of being left behind
+    DspOptions dsp;             // run on the stereo stream after glitch concealment; stereo only
+
+    PipelineOptions()
+        : nBufferMs(64)
+        , bAutoBuffer(false)
+        , nMultiplex(2)
+        , nSampleOffset(1)
+        , bDetectPhase(true)
+        , bDriftCompensation(true)
+        , nStatsIntervalSec(0)
+        , bStopOnOutputLoss(false)
+    {}
+};
+
+// the loops wake up at least this often even if a device stops signalling,
+// to notice the rest of the pipeline stopping
+#define PIPELINE_WAIT_MS 2000
+
+class StreamPipeline {
+public:
+    StreamPipeline(StatsClock &clock, StatsSink &statsSink, MessageSink &messages);
+
+    // stops everything still running
+    ~StreamPipeline();
+
+    // opens the source and every sink, then starts the render threads and
+    // the capture stream; the endpoints must outlive the pipeline
+    DeviceStatus Start(CaptureSource &source, RenderSink *const *ppSinks, uint32_t nSinks, const PipelineOptions &options);
+
+    // also publishes statistics to sink every nIntervalMs, from the capture
+    // thread, for watching them as they change; call before Start
+    void SetLiveStats(StatsSink &sink, uint32_t nIntervalMs);
+
+    // also copies the repaired stereo stream to tap, from the capture
+    // thread; the tap must already be open and outlive the pipeline. if it
+    // can't take this stream the pipeline runs without it. call before Start
+    void SetRecording(RecordingTap &tap);
+
+    // also sends the repaired stream over the network, from the capture
+    // thread, the same way; the sender must already be open
+    void SetStreaming(RtpSender &sender);
+
+    // services the capture source on the calling thread until Stop is
+    // called, the source is interrupted or fails, or every output has failed
+    // an output that fails on its own is logged and left behind; the ring
+    // just laps its cursor from then on, unless bStopOnOutputLoss is set
+    // and it lost its device
+    DeviceStatus Run();
+
+    // any thread
+    void Stop();
+
+    // mono frames captured so far
+    uint64_t CapturedFrames() const { return m_nCapturedFrames.load(std::memory_order_relaxed); }
+
+    // when the capture thread first and last woke up to frames, on the
+    // StatsClock; 0 if it hasn't yet
+    int64_t FirstCaptureHns() const { return m_hnsFirstCapture.load(std::memory_order_relaxed); }
+    int64_t LastCaptureHns() const { return m_hnsLastCapture.load(std::memory_order_relaxed); }
+
+    // why Start or Run failed, and the endpoint's own error code
+    const std::string &Error() const { return m_error; }
+    int32_t ErrorCode() const { return m_nErrorCode; }
+
+private:
+    StreamPipeline(const StreamPipeline &) = delete;
+    StreamPipeline &operator=(const StreamPipeline &) = delete;
+
+    struct Output {
+        Output() : pSink(NULL), bConvert(false), bDriftCompensation(false), bTuneBuffer(false), nPeriodFrames(0), nFillFrames(0), bStarted(false) {}
+
+        RenderSink *pSink;
+        bool bConvert;
+        SampleConverter converter;
+        bool bDriftCompensation;
+        DriftCompensatedReader driftReader;
+        bool bTuneBuffer;
+        BufferTuner tuner;
+        uint32_t nPeriodFrames;
+        uint32_t nFillFrames; // what the device is topped up to
+        bool bStarted;
+        std::thread thread;
+    };
+
+    DeviceStatus OpenOutput(uint32_t nOutput, const AudioFormat &ringFormat, const PipelineOptions &options);
+    DeviceStatus CapturePackets();
+    void RepackIntoRing(const uint8_t *pData, uint32_t nFrames, int64_t hnsCapture);
+    void RenderThread(uint32_t nOutput);
+    DeviceStatus RenderLoop(uint32_t nOutput);
+    uint32_t TuneBuffer(uint32_t nOutput, uint32_t nPadding, int64_t hnsWake);
+    void PublishStats(StatsSink &sink);
+    void Shutdown();
+    DeviceStatus Fail(DeviceStatus status, int32_t nErrorCode, const char *szFormat, ...);
+
+    StatsClock &m_clock;
+    StatsSink &m_statsSink;
+    MessageSink &m_messages;
+
+    CaptureSource *m_pSource;
+    bool m_bSourceStarted;
+    std::unique_ptr<Output[]> m_outputs;
+    uint32_t m_nOutputs;
+
+    FanoutRing m_ring;
+    StreamStats m_stats;
+    RepackState m_repack;
+    RepackKernel m_pRepack;   // picked for the input's frame size and multiplex factor
+    GlitchConcealer m_concealer;
+    DspChain m_dsp;
+    bool m_bDetectPhase;
+    PhaseDetector m_phase;
+    int64_t m_hnsStatsInterval;
+    StatsSink *m_pLiveStatsSink;
+    int64_t m_hnsLiveStatsInterval;
+    RecordingTap *m_pRecording;
+    RtpSender *m_pStreaming;
+    uint32_t m_nRingRate;
+    uint32_t m_nCaptureFrames; // a capture packet, in ring frames
+    bool m_bStopOnOutputLoss;
+
+    std::atomic<bool> m_bStop;
+    std::atomic<uint32_t> m_nRunningOutputs;
+    std::atomic<uint64_t> m_nCapturedFrames;
+    std::atomic<int64_t> m_hnsFirstCapture;
+    std::atomic<int64_t> m_hnsLastCapture;
+    std::atomic<int32_t> m_nLostOutput; // -1, or the first output to lose its device
+
+    std::string m_error;
+    int32_t m_nErrorCode;
+};
@@ -5,10 +5,9 @@
 #define DEFAULT_BUFFER_MS 64
 
 void usage(LPCWSTR exe);
-HRESULT get_default_device(IMMDevice **ppMMDevice);
-HRESULT list_devices();
-HRESULT list_devices_with_direction(EDataFlow direction, const wchar_t *direction_label);
-HRESULT get_specific_device(LPCWSTR szLongName, EDataFlow direction, IMMDevice **ppMMDevice);
+HRESULT list_devices(DeviceRegistry &registry);
+HRESULT list_devices_with_direction(DeviceRegistry &registry, EDataFlow direction, const wchar_t *direction_label);
+HRESULT expand_config_files(int argc, LPCWSTR argv[], std::vector<std::wstring> &args);
 
 void usage(LPCWSTR exe) {
     LOG(
@@ -16,24 +15,89 @@ void usage(LPCWSTR exe) {
         L"\n"
         L"%ls -?\n"
         L"%ls --list-devices\n"
-        L"%ls [--in-device \"Device long name\"] [--out-device \"Device long name\"] [--buffer-size 128] [--no-skip-first-sample]\n"
+        L"%ls [--in-device \"Device long name\"] [--out-device \"Device long name\" ...] [--buffer-size 128 | auto] [--multiplex 2] [--skip-first-sample | --no-skip-first-sample | --sample-offset 1] [--no-drift-compensation] [--remove-dc] [--swap-channels | --mono] [--gain 6] [--limit -1] [--stats-interval 10] [--shared-stats name] [--record out.wav] [--rtp-send host:5004 [--rtp-format l16] [--rtp-ptime 5] [--rtp-batch 64]] [--daemon [--stop-event name]]\n"
+        L"%ls --rtp-receive [host:]5004 [--out-device \"Device long name\"] [--buffer-size 128] [--rtp-format l16] [--rtp-rate 48000] [--rtp-channels 2] [--rtp-jitter 20]\n"
+        L"%ls --config switches.conf ...\n"
+        L"%ls --input-file capture.wav --output-file fixed.wav [--raw-format s16] [--raw-rate 96000] [--raw-channels 1] [--multiplex 2] [--skip-first-sample | --no-skip-first-sample | --sample-offset 1]\n"
+        L"%ls --batch captures [--batch list.txt ...] --output-dir fixed [--threads 0] [--chunk-size %d] [--raw-format s16] ...\n"
         L"\n"
         L"    -? prints this message.\n"
         L"    --list-devices displays the long names of all active capture and render devices.\n"
         L"    --in-device captures from the specified device to capture (\"Digital Audio Interface (USB Digital Audio)\" if omitted)\n"
-        L"    --out-device device to stream stereo audio to (default if omitted)\n"
-        L"    --buffer-size set the size of the audio buffer, in milliseconds (default to %dms)\n"
-        L"    --no-skip-first-sample do not skip the first channel sample",
-        VERSION, exe, exe, exe, DEFAULT_BUFFER_MS
+        L"    --out-device device to stream stereo audio to (default if omitted); repeat for up to %d devices\n"
+        L"        either can be given by long name or by endpoint ID\n"
+        L"    --buffer-size set the size of the audio buffer, in milliseconds (default to %dms), or auto to keep each output's\n"
+        L"        as small as this machine's wakeups allow, up to %dms; auto needs drift compensation and doesn't apply to --rtp-receive\n"
+        L"    --skip-first-sample always skip the first channel sample instead of working it out from the audio\n"
+        L"    --no-skip-first-sample never skip the first channel sample\n"
+        L"    --multiplex how many channels are time multiplexed onto each input channel (default 2, at most %d in all)\n"
+        L"    --sample-offset how many samples the input's first frame is missing, for a multiplex other than 2 (default 1)\n"
+        L"    --no-drift-compensation do not resample to follow clock drift between the input and output devices\n"
+        L"    --remove-dc takes out any DC offset with a %d Hz high pass\n"
+        L"    --swap-channels plays the left channel on the right and the other way round\n"
+        L"    --mono plays the average of both channels on each\n"
+        L"    --gain amplifies (or with a negative value attenuates) by this many dB, up to 40\n"
+        L"    --limit keeps peaks at or below this many dBFS, without clipping\n"
+        L"    --stats-interval print latency, jitter and processing time statistics every this many seconds (default only when stopping)\n"
+        L"    --shared-stats keep live statistics in shared memory under this name, for stats-monitor to read\n"
+        L"    --record also writes the stereo stream to this WAV file as it plays\n"
+        L"    --rtp-send also sends the stereo stream as RTP to this host:port, straight from the capture thread\n"
+        L"    --rtp-format l16 or l24, big-endian 16 or 24 bit PCM on the wire (default l16)\n"
+        L"    --rtp-ptime how many ms of audio go in each packet (default %g)\n"
+        L"    --rtp-batch most packets sent at once, 1 to %d (default %d)\n"
+        L"    --rtp-receive plays an RTP stream arriving on this port (and address) to the output device instead of capturing\n"
+        L"    --rtp-rate, --rtp-channels what the stream being received is (default 48000 Hz, 2 channels)\n"
+        L"    --rtp-jitter how many ms of the received stream are buffered before it plays (default %g)\n"
+        L"    --daemon runs without a console until stopped, waiting for devices that aren't there yet and restarting when one goes away\n"
+        L"    --stop-event with --daemon, also stops when the named event (Global\\ or Local\\) is set\n"
+        L"    --config reads more switches from this file, one per line without the dashes\n"
+        L"    --input-file converts a recorded mono capture (WAV or headerless PCM) instead of capturing from a device; - reads headerless PCM from standard input\n"
+        L"    --output-file where to write the converted stereo (or wider) stream (WAV if it ends in .wav, headerless PCM otherwise); - for standard output\n"
+        L"    --raw-format sample format of headerless input: s16, s24, s32, f32 or f64 (default s16)\n"
+        L"    --raw-rate sample rate of headerless input (default 96000)\n"
+        L"    --raw-channels channels of headerless input (default 1)\n"
+        L"    --batch converts every file in this directory, or every file listed in this file, one path per line; can be repeated\n"
+        L"    --output-dir where --batch writes each file, under the same name\n"
+        L"    --threads how many files or parts of files --batch converts at once (default 0, one per core)\n"
+        L"    --chunk-size megabytes of output each part of a file --batch converts is (default %d)",
+        VERSION, exe, exe, exe, exe, exe, exe, exe, BATCH_DEFAULT_CHUNK_MB, MAX_OUTPUT_DEVICES, DEFAULT_BUFFER_MS, BUFFERTUNE_MAX_MS, AUDIOFORMAT_MAX_CHANNELS, DSP_DC_CUTOFF_HZ,
+        RTP_DEFAULT_PACKET_MS, UDP_MAX_BATCH, UDP_MAX_BATCH, RTP_DEFAULT_JITTER_MS, BATCH_DEFAULT_CHUNK_MB
     );
 }
 
 CPrefs::CPrefs(int argc, LPCWSTR argv[], HRESULT &hr)
     : m_pMMInDevice(NULL)
-    , m_pMMOutDevice(NULL)
+    , m_nOutDevices(0)
     , m_iBufferMs(DEFAULT_BUFFER_MS)
-    , m_bSkipFirstSample(true)
+    , m_bAutoBuffer(false)
+    , m_nMultiplex(2)
+    , m_nSampleOffset(1)
+    , m_bDetectPhase(true)
+    , m_bDriftCompensation(true)
+    , m_iStatsIntervalSec(0)
+    , m_bDaemon(false)
+    , m_bConvert(false)
+    , m_bBatch(false)
 {
+    for (UINT32 i = 0; i < MAX_OUTPUT_DEVICES; i++) {
+        m_pMMOutDevices[i] = NULL;
+    }
+
+    // the switches from a --config file go where it was
+    std::vector<std::wstring> args;
+    hr = expand_config_files(argc, argv, args);
+    if (FAILED(hr)) {
+        return;
+    }
+    std::vector<LPCWSTR> expanded;
+    for (const std::wstring &arg : args) {
+        expanded.push_back(arg.c_str());
+    }
+    argc = static_cast<int>(expanded.size());
+    argv = expanded.data();
+
+    DeviceRegistry registry;
+
     switch (argc) {
     case 2:
         if (0 == _wcsicmp(argv[1], L"-?") || 0 == _wcsicmp(argv[1], L"/?")) {
@@ -44,7 +108,7 @@ CPrefs::CPrefs(int argc, LPCWSTR argv[], HRESULT &hr)
         }
         else if (0 == _wcsicmp(argv[1], L"--list-devices")) {
             // list the devices but don't actually capture
-            hr = list_devices();
+            hr = list_devices(registry);
 
             // don't actually play
             if (S_OK == hr) {
@@ -60,57 +124,57 @@ CPrefs::CPrefs(int argc, LPCWSTR argv[], HRESULT &hr)
 
             // --in-device
             if (0 == _wcsicmp(argv[i], L"--in-device")) {
-                if (NULL != m_pMMInDevice) {
+                if (!m_inDeviceName.empty()) {
                     ERR(L"%s", L"Only one --device switch is allowed");
                     hr = E_INVALIDARG;
                     return;
                 }
 
-                if (i++ == argc) {
+                if (++i == argc) {
                     ERR(L"%s", L"--device switch requires an argument");
                     hr = E_INVALIDARG;
                     return;
                 }
 
-                hr = get_specific_device(argv[i], eCapture, &m_pMMInDevice);
-                if (FAILED(hr)) {
-                    return;
-                }
-
+                m_inDeviceName = argv[i];
                 continue;
             }
 
             // --out-device
             if (0 == _wcsicmp(argv[i], L"--out-device")) {
-                if (NULL != m_pMMOutDevice) {
-                    ERR(L"%s", L"Only one --device switch is allowed");
+                if (MAX_OUTPUT_DEVICES == m_nOutDevices) {
+                    ERR(L"At most %d --out-device switches are allowed", MAX_OUTPUT_DEVICES);
                     hr = E_INVALIDARG;
                     return;
                 }
 
-                if (i++ == argc) {
+                if (++i == argc) {
                     ERR(L"%s", L"--device switch requires an argument");
                     hr = E_INVALIDARG;
                     return;
                 }
 
-                hr = get_specific_device(argv[i], eRender, &m_pMMOutDevice);
-                if (FAILED(hr)) {
-                    return;
-                }
+                m_outDeviceNames[m_nOutDevices] = argv[i];
+                m_nOutDevices++;
 
                 continue;
             }
 
             // --buffer-size
             if (0 == _wcsicmp(argv[i], L"--buffer-size")) {
-                if (i++ == argc) {
+                if (++i == argc) {
                     ERR(L"%s", L"--buffer-size switch requires an argument");
                     hr = E_INVALIDARG;
                     return;
                 }
 
+                if (0 == _wcsicmp(argv[i], L"auto")) {
+                    m_bAutoBuffer = true;
+                    continue;
+                }
+
                 m_iBufferMs = _wtoi(argv[i]);
+                m_bAutoBuffer = false;
                 if (m_iBufferMs <= 0) {
                     ERR(L"%s", L"invalid buffer size given");
                     hr = E_INVALIDARG;
@@ -120,9 +184,472 @@ CPrefs::CPrefs(int argc, LPCWSTR argv[], HRESULT &hr)
                 continue;
             }
 
+            // --skip-first-sample
+            if (0 == _wcsicmp(argv[i], L"--skip-first-sample")) {
+                m_nSampleOffset = 1;
+                m_bDetectPhase = false;
+                m_convert.nSampleOffset = 1;
+                m_convert.bDetectPhase = false;
+                continue;
+            }
+
             // --no-skip-first-sample
             if (0 == _wcsicmp(argv[i], L"--no-skip-first-sample")) {
-                m_bSkipFirstSample = false;
+                m_nSampleOffset = 0;
+                m_bDetectPhase = false;
+                m_convert.nSampleOffset = 0;
+                m_convert.bDetectPhase = false;
+                continue;
+            }
+
+            // --multiplex
+            if (0 == _wcsicmp(argv[i], L"--multiplex")) {
+                if (++i == argc) {
+                    ERR(L"%s", L"--multiplex switch requires an argument");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                int iMultiplex = _wtoi(argv[i]);
+                if (iMultiplex < 2 || iMultiplex > AUDIOFORMAT_MAX_CHANNELS) {
+                    ERR(L"multiplex must be between 2 and %d", AUDIOFORMAT_MAX_CHANNELS);
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                m_nMultiplex = static_cast<UINT32>(iMultiplex);
+                m_convert.nMultiplex = m_nMultiplex;
+                continue;
+            }
+
+            // --sample-offset
+            if (0 == _wcsicmp(argv[i], L"--sample-offset")) {
+                if (++i == argc) {
+                    ERR(L"%s", L"--sample-offset switch requires an argument");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                int iOffset = _wtoi(argv[i]);
+                if (iOffset < 0 || iOffset >= AUDIOFORMAT_MAX_CHANNELS) {
+                    ERR(L"%s", L"invalid sample offset given");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                m_nSampleOffset = static_cast<UINT32>(iOffset);
+                m_bDetectPhase = false;
+                m_convert.nSampleOffset = m_nSampleOffset;
+                m_convert.bDetectPhase = false;
+                continue;
+            }
+
+            // --no-drift-compensation
+            if (0 == _wcsicmp(argv[i], L"--no-drift-compensation")) {
+                m_bDriftCompensation = false;
+                continue;
+            }
+
+            // --remove-dc
+            if (0 == _wcsicmp(argv[i], L"--remove-dc")) {
+                m_dsp.bRemoveDc = true;
+                continue;
+            }
+
+            // --swap-channels
+            if (0 == _wcsicmp(argv[i], L"--swap-channels")) {
+                m_dsp.channels = DSP_CHANNELS_SWAP;
+                continue;
+            }
+
+            // --mono
+            if (0 == _wcsicmp(argv[i], L"--mono")) {
+                m_dsp.channels = DSP_CHANNELS_MONO;
+                continue;
+            }
+
+            // --gain
+            if (0 == _wcsicmp(argv[i], L"--gain")) {
+                if (++i == argc) {
+                    ERR(L"%s", L"--gain switch requires an argument");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                m_dsp.fGainDb = _wtof(argv[i]);
+                if (m_dsp.fGainDb < -60 || m_dsp.fGainDb > 40) {
+                    ERR(L"%s", L"gain must be between -60 and 40 dB");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                continue;
+            }
+
+            // --limit
+            if (0 == _wcsicmp(argv[i], L"--limit")) {
+                if (++i == argc) {
+                    ERR(L"%s", L"--limit switch requires an argument");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                m_dsp.bLimit = true;
+                m_dsp.fLimitDb = _wtof(argv[i]);
+                if (m_dsp.fLimitDb < -60 || m_dsp.fLimitDb > 0) {
+                    ERR(L"%s", L"the limiter ceiling must be between -60 and 0 dBFS");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                continue;
+            }
+
+            // --stats-interval
+            if (0 == _wcsicmp(argv[i], L"--stats-interval")) {
+                if (++i == argc) {
+                    ERR(L"%s", L"--stats-interval switch requires an argument");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                m_iStatsIntervalSec = _wtoi(argv[i]);
+                if (m_iStatsIntervalSec <= 0) {
+                    ERR(L"%s", L"invalid stats interval given");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                continue;
+            }
+
+            // --shared-stats
+            if (0 == _wcsicmp(argv[i], L"--shared-stats")) {
+                if (++i == argc) {
+                    ERR(L"%s", L"--shared-stats switch requires an argument");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                m_sharedStatsName = utf8_from_wide(argv[i]);
+                if (!IsValidSharedStatsName(m_sharedStatsName)) {
+                    ERR(L"%s", L"shared statistics names can only have letters, digits, '-', '_' and '.'");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                continue;
+            }
+
+            // --record
+            if (0 == _wcsicmp(argv[i], L"--record")) {
+                if (++i == argc) {
+                    ERR(L"%s", L"--record switch requires an argument");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                m_recordPath = utf8_from_wide(argv[i]);
+                continue;
+            }
+
+            // --rtp-send
+            if (0 == _wcsicmp(argv[i], L"--rtp-send")) {
+                if (++i == argc) {
+                    ERR(L"%s", L"--rtp-send switch requires an argument");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                m_rtpSendAddress = utf8_from_wide(argv[i]);
+                continue;
+            }
+
+            // --rtp-receive
+            if (0 == _wcsicmp(argv[i], L"--rtp-receive")) {
+                if (++i == argc) {
+                    ERR(L"%s", L"--rtp-receive switch requires an argument");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                m_rtpReceiveAddress = utf8_from_wide(argv[i]);
+                continue;
+            }
+
+            // --rtp-format
+            if (0 == _wcsicmp(argv[i], L"--rtp-format")) {
+                if (++i == argc) {
+                    ERR(L"%s", L"--rtp-format switch requires an argument");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                if (!ParseRtpEncodingName(utf8_from_wide(argv[i]).c_str(), m_rtpSend.encoding)) {
+                    ERR(L"unknown RTP format %ls", argv[i]);
+                    hr = E_INVALIDARG;
+                    return;
+                }
+                m_rtpReceive.encoding = m_rtpSend.encoding;
+
+                continue;
+            }
+
+            // --rtp-ptime
+            if (0 == _wcsicmp(argv[i], L"--rtp-ptime")) {
+                if (++i == argc) {
+                    ERR(L"%s", L"--rtp-ptime switch requires an argument");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                m_rtpSend.fPacketMs = _wtof(argv[i]);
+                if (m_rtpSend.fPacketMs <= 0) {
+                    ERR(L"%s", L"invalid packet time given");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                continue;
+            }
+
+            // --rtp-batch
+            if (0 == _wcsicmp(argv[i], L"--rtp-batch")) {
+                if (++i == argc) {
+                    ERR(L"%s", L"--rtp-batch switch requires an argument");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                int iBatch = _wtoi(argv[i]);
+                if (iBatch < 1 || iBatch > UDP_MAX_BATCH) {
+                    ERR(L"batch size must be between 1 and %d", UDP_MAX_BATCH);
+                    hr = E_INVALIDARG;
+                    return;
+                }
+                m_rtpSend.nMaxBatch = static_cast<uint32_t>(iBatch);
+
+                continue;
+            }
+
+            // --rtp-rate
+            if (0 == _wcsicmp(argv[i], L"--rtp-rate")) {
+                if (++i == argc) {
+                    ERR(L"%s", L"--rtp-rate switch requires an argument");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                int iRate = _wtoi(argv[i]);
+                if (iRate <= 0) {
+                    ERR(L"%s", L"invalid stream rate given");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+                m_rtpReceive.nRate = static_cast<uint32_t>(iRate);
+
+                continue;
+            }
+
+            // --rtp-channels
+            if (0 == _wcsicmp(argv[i], L"--rtp-channels")) {
+                if (++i == argc) {
+                    ERR(L"%s", L"--rtp-channels switch requires an argument");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                int iChannels = _wtoi(argv[i]);
+                if (iChannels < 1 || iChannels > AUDIOFORMAT_MAX_CHANNELS) {
+                    ERR(L"a stream can have between 1 and %d channels", AUDIOFORMAT_MAX_CHANNELS);
+                    hr = E_INVALIDARG;
+                    return;
+                }
+                m_rtpReceive.nChannels = static_cast<uint16_t>(iChannels);
+
+                continue;
+            }
+
+            // --rtp-jitter
+            if (0 == _wcsicmp(argv[i], L"--rtp-jitter")) {
+                if (++i == argc) {
+                    ERR(L"%s", L"--rtp-jitter switch requires an argument");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                m_rtpReceive.fJitterMs = _wtof(argv[i]);
+                if (m_rtpReceive.fJitterMs < 0) {
+                    ERR(L"%s", L"invalid jitter buffer delay given");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                continue;
+            }
+
+            // --daemon
+            if (0 == _wcsicmp(argv[i], L"--daemon")) {
+                m_bDaemon = true;
+                continue;
+            }
+
+            // --stop-event
+            if (0 == _wcsicmp(argv[i], L"--stop-event")) {
+                if (++i == argc) {
+                    ERR(L"%s", L"--stop-event switch requires an argument");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                m_stopEventName = argv[i];
+                continue;
+            }
+
+            // --input-file
+            if (0 == _wcsicmp(argv[i], L"--input-file")) {
+                if (++i == argc) {
+                    ERR(L"%s", L"--input-file switch requires an argument");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                m_convert.inputPath = utf8_from_wide(argv[i]);
+                m_bConvert = true;
+                continue;
+            }
+
+            // --output-file
+            if (0 == _wcsicmp(argv[i], L"--output-file")) {
+                if (++i == argc) {
+                    ERR(L"%s", L"--output-file switch requires an argument");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                m_convert.outputPath = utf8_from_wide(argv[i]);
+                m_bConvert = true;
+                continue;
+            }
+
+            // --batch
+            if (0 == _wcsicmp(argv[i], L"--batch")) {
+                if (++i == argc) {
+                    ERR(L"%s", L"--batch switch requires an argument");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                std::string error;
+                if (!ListBatchInputs(utf8_from_wide(argv[i]), m_batch.inputs, error)) {
+                    ERR(L"%hs", error.c_str());
+                    hr = E_INVALIDARG;
+                    return;
+                }
+                m_bBatch = true;
+                continue;
+            }
+
+            // --output-dir
+            if (0 == _wcsicmp(argv[i], L"--output-dir")) {
+                if (++i == argc) {
+                    ERR(L"%s", L"--output-dir switch requires an argument");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                m_batch.outputDir = utf8_from_wide(argv[i]);
+                continue;
+            }
+
+            // --threads
+            if (0 == _wcsicmp(argv[i], L"--threads")) {
+                if (++i == argc) {
+                    ERR(L"%s", L"--threads switch requires an argument");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                int iThreads = _wtoi(argv[i]);
+                if (iThreads < 0 || iThreads > BATCH_MAX_THREADS) {
+                    ERR(L"--threads takes 0 to %d", BATCH_MAX_THREADS);
+                    hr = E_INVALIDARG;
+                    return;
+                }
+                m_batch.nThreads = static_cast<UINT32>(iThreads);
+                continue;
+            }
+
+            // --chunk-size
+            if (0 == _wcsicmp(argv[i], L"--chunk-size")) {
+                if (++i == argc) {
+                    ERR(L"%s", L"--chunk-size switch requires an argument");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                int iChunkMB = _wtoi(argv[i]);
+                if (iChunkMB <= 0 || iChunkMB > 1024) {
+                    ERR(L"%s", L"invalid chunk size given");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+                m_batch.nChunkMB = static_cast<UINT32>(iChunkMB);
+                continue;
+            }
+
+            // --raw-format
+            if (0 == _wcsicmp(argv[i], L"--raw-format")) {
+                if (++i == argc) {
+                    ERR(L"%s", L"--raw-format switch requires an argument");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                if (!ParseSampleFormatName(utf8_from_wide(argv[i]).c_str(), m_convert.rawFormat.wFormatTag, m_convert.rawFormat.wBitsPerSample)) {
+                    ERR(L"unknown raw format %ls", argv[i]);
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                continue;
+            }
+
+            // --raw-rate
+            if (0 == _wcsicmp(argv[i], L"--raw-rate")) {
+                if (++i == argc) {
+                    ERR(L"%s", L"--raw-rate switch requires an argument");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                int iRate = _wtoi(argv[i]);
+                if (iRate <= 0) {
+                    ERR(L"%s", L"invalid raw sample rate given");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+                m_convert.rawFormat.nSamplesPerSec = static_cast<UINT32>(iRate);
+
+                continue;
+            }
+
+            // --raw-channels
+            if (0 == _wcsicmp(argv[i], L"--raw-channels")) {
+                if (++i == argc) {
+                    ERR(L"%s", L"--raw-channels switch requires an argument");
+                    hr = E_INVALIDARG;
+                    return;
+                }
+
+                int iChannels = _wtoi(argv[i]);
+                if (iChannels < 1 || iChannels > AUDIOFORMAT_MAX_CHANNELS / 2) {
+                    ERR(L"headerless input can have between 1 and %d channels", AUDIOFORMAT_MAX_CHANNELS / 2);
+                    hr = E_INVALIDARG;
+                    return;
+                }
+                m_convert.rawFormat.nChannels = static_cast<UINT16>(iChannels);
+
                 continue;
             }
 
@@ -131,21 +658,95 @@ CPrefs::CPrefs(int argc, LPCWSTR argv[], HRESULT &hr)
             return;
         }
 
-        // open default device if not specified
-        if (NULL == m_pMMInDevice) {
-            hr = get_specific_device(L"Digital Audio Interface (USB Digital Audio)", eCapture, &m_pMMInDevice);
-            if (FAILED(hr)) {
+        // a batch of files to convert doesn't need any devices
+        if (m_bBatch) {
+            if (m_bConvert || m_batch.outputDir.empty()) {
+                ERR(L"%s", L"--batch goes with --output-dir, not --input-file or --output-file");
+                hr = E_INVALIDARG;
                 return;
             }
+            m_convert.rawFormat = MakeAudioFormat(m_convert.rawFormat.wFormatTag, m_convert.rawFormat.nChannels, m_convert.rawFormat.nSamplesPerSec, m_convert.rawFormat.wBitsPerSample);
+            m_batch.convert = m_convert;
+            return;
         }
 
-        // open default device if not specified
-        if (NULL == m_pMMOutDevice) {
-            hr = get_default_device(&m_pMMOutDevice);
+        // converting a file doesn't need any devices
+        if (m_bConvert) {
+            m_convert.rawFormat = MakeAudioFormat(m_convert.rawFormat.wFormatTag, m_convert.rawFormat.nChannels, m_convert.rawFormat.nSamplesPerSec, m_convert.rawFormat.wBitsPerSample);
+            if (m_convert.inputPath.empty() || m_convert.outputPath.empty()) {
+                ERR(L"%s", L"--input-file and --output-file must be used together");
+                hr = E_INVALIDARG;
+            }
+            return;
+        }
+
+        if (m_bAutoBuffer && !m_bDriftCompensation) {
+            ERR(L"%s", L"--buffer-size auto needs drift compensation");
+            hr = E_INVALIDARG;
+            return;
+        }
+
+        if (!m_stopEventName.empty() && !m_bDaemon) {
+            ERR(L"%s", L"--stop-event only goes with --daemon");
+            hr = E_INVALIDARG;
+            return;
+        }
+
+        // playing a stream from the network only needs the one output
+        if (!m_rtpReceiveAddress.empty()) {
+            if (m_bDaemon || !m_rtpSendAddress.empty() || m_nOutDevices > 1) {
+                ERR(L"%s", L"--rtp-receive plays to a single --out-device, without --daemon or --rtp-send");
+                hr = E_INVALIDARG;
+                return;
+            }
+
+            m_nOutDevices = 1;
+            if (m_outDeviceNames[0].empty()) {
+                hr = registry.FindDefault(eRender, &m_pMMOutDevices[0]);
+            }
+            else {
+                hr = registry.Find(m_outDeviceNames[0].c_str(), eRender, &m_pMMOutDevices[0]);
+            }
+            return;
+        }
+
+        // default devices if not specified
+        if (m_inDeviceName.empty()) {
+            m_inDeviceName = DEFAULT_IN_DEVICE_NAME;
+        }
+        if (0 == m_nOutDevices) {
+            m_nOutDevices = 1;
+        }
+
+        // a daemon looks them up every time it starts the stream, since
+        // they may not be there yet
+        if (m_bDaemon) {
+            return;
+        }
+
+        hr = registry.Find(m_inDeviceName.c_str(), eCapture, &m_pMMInDevice);
+        if (FAILED(hr)) {
+            return;
+        }
+
+        for (UINT32 i = 0; i < m_nOutDevices; i++) {
+            if (m_outDeviceNames[i].empty()) {
+                hr = registry.FindDefault(eRender, &m_pMMOutDevices[i]);
+            }
+            else {
+                hr = registry.Find(m_outDeviceNames[i].c_str(), eRender, &m_pMMOutDevices[i]);
+            }
             if (FAILED(hr)) {
                 return;
             }
         }
+
+        const DeviceRegistryStats &stats = registry.Stats();
+        LOG(
+            L"Found %u devices in %.1f ms (%u remembered, %u endpoint walks, %u endpoints opened)",
+            stats.nLookups, static_cast<double>(stats.hnsSpent) / 10000.0,
+            stats.nFromFile, stats.nWalks, stats.nEndpointsOpened
+        );
     }
 }
 
@@ -154,48 +755,24 @@ CPrefs::~CPrefs() {
         m_pMMInDevice->Release();
     }
 
-    if (NULL != m_pMMOutDevice) {
-        m_pMMOutDevice->Release();
-    }
-}
-
-HRESULT get_default_device(IMMDevice **ppMMDevice) {
-    HRESULT hr = S_OK;
-    IMMDeviceEnumerator *pMMDeviceEnumerator;
-
-    // activate a device enumerator
-    hr = CoCreateInstance(
-        __uuidof(MMDeviceEnumerator), NULL, CLSCTX_ALL,
-        __uuidof(IMMDeviceEnumerator),
-        (void**)&pMMDeviceEnumerator
-    );
-    if (FAILED(hr)) {
-        ERR(L"CoCreateInstance(IMMDeviceEnumerator) failed: hr = 0x%08x", hr);
-        return hr;
-    }
-    ReleaseOnExit releaseMMDeviceEnumerator(pMMDeviceEnumerator);
-
-    // get the default render endpoint
-    hr = pMMDeviceEnumerator->GetDefaultAudioEndpoint(eRender, eConsole, ppMMDevice);
-    if (FAILED(hr)) {
-        ERR(L"IMMDeviceEnumerator::GetDefaultAudioEndpoint failed: hr = 0x%08x", hr);
-        return hr;
+    for (UINT32 i = 0; i < m_nOutDevices; i++) {
+        if (NULL != m_pMMOutDevices[i]) {
+            m_pMMOutDevices[i]->Release();
+        }
     }
-
-    return S_OK;
 }
 
-HRESULT list_devices() {
+HRESULT list_devices(DeviceRegistry &registry) {
     HRESULT hr;
 
-    hr = list_devices_with_direction(eRender, L"render");
+    hr = list_devices_with_direction(registry, eRender, L"render");
     if (FAILED(hr)) {
         return hr;
     }
 
     LOG(L"");
 
-    hr = list_devices_with_direction(eCapture, L"capture");
+    hr = list_devices_with_direction(registry, eCapture, L"capture");
     if (FAILED(hr)) {
         return hr;
     }
@@ -203,173 +780,69 @@ HRESULT list_devices() {
     return hr;
 }
 
-HRESULT list_devices_with_direction(EDataFlow direction, const wchar_t *direction_label) {
-    HRESULT hr = S_OK;
-
-    // get an enumerator
-    IMMDeviceEnumerator *pMMDeviceEnumerator;
-
-    hr = CoCreateInstance(
-        __uuidof(MMDeviceEnumerator), NULL, CLSCTX_ALL,
-        __uuidof(IMMDeviceEnumerator),
-        (void**)&pMMDeviceEnumerator
-    );
-    if (FAILED(hr)) {
-        ERR(L"CoCreateInstance(IMMDeviceEnumerator) failed: hr = 0x%08x", hr);
-        return hr;
-    }
-    ReleaseOnExit releaseMMDeviceEnumerator(pMMDeviceEnumerator);
-
-    IMMDeviceCollection *pMMDeviceCollection;
-
-    // get all the active render endpoints
-    hr = pMMDeviceEnumerator->EnumAudioEndpoints(
-        direction, DEVICE_STATE_ACTIVE, &pMMDeviceCollection
-    );
-    if (FAILED(hr)) {
-        ERR(L"IMMDeviceEnumerator::EnumAudioEndpoints failed: hr = 0x%08x", hr);
-        return hr;
-    }
-    ReleaseOnExit releaseMMDeviceCollection(pMMDeviceCollection);
-
-    UINT count;
-    hr = pMMDeviceCollection->GetCount(&count);
+// the same walk a lookup falls back on, so listing also refreshes what the
+// registry remembers
+HRESULT list_devices_with_direction(DeviceRegistry &registry, EDataFlow direction, const wchar_t *direction_label) {
+    std::vector<std::wstring> names;
+    HRESULT hr = registry.List(direction, names);
     if (FAILED(hr)) {
-        ERR(L"IMMDeviceCollection::GetCount failed: hr = 0x%08x", hr);
         return hr;
     }
-    LOG(L"Active %s endpoints found: %u", direction_label, count);
-
-    for (UINT i = 0; i < count; i++) {
-        IMMDevice *pMMDevice;
-
-        // get the "n"th device
-        hr = pMMDeviceCollection->Item(i, &pMMDevice);
-        if (FAILED(hr)) {
-            ERR(L"IMMDeviceCollection::Item failed: hr = 0x%08x", hr);
-            return hr;
-        }
-        ReleaseOnExit releaseMMDevice(pMMDevice);
-
-        // open the property store on that device
-        IPropertyStore *pPropertyStore;
-        hr = pMMDevice->OpenPropertyStore(STGM_READ, &pPropertyStore);
-        if (FAILED(hr)) {
-            ERR(L"IMMDevice::OpenPropertyStore failed: hr = 0x%08x", hr);
-            return hr;
-        }
-        ReleaseOnExit releasePropertyStore(pPropertyStore);
-
-        // get the long name property
-        PROPVARIANT pv; PropVariantInit(&pv);
-        hr = pPropertyStore->GetValue(PKEY_Device_FriendlyName, &pv);
-        if (FAILED(hr)) {
-            ERR(L"IPropertyStore::GetValue failed: hr = 0x%08x", hr);
-            return hr;
-        }
-        PropVariantClearOnExit clearPv(&pv);
-
-        if (VT_LPWSTR != pv.vt) {
-            ERR(L"PKEY_Device_FriendlyName variant type is %u - expected VT_LPWSTR", pv.vt);
-            return E_UNEXPECTED;
-        }
 
-        LOG(L"    %ls", pv.pwszVal);
+    LOG(L"Active %s endpoints found: %u", direction_label, static_cast<UINT>(names.size()));
+    for (const std::wstring &name : names) {
+        LOG(L"    %ls", name.c_str());
     }
 
     return S_OK;
 }
 
-HRESULT get_specific_device(LPCWSTR szLongName, EDataFlow direction, IMMDevice **ppMMDevice) {
-    HRESULT hr = S_OK;
-
-    *ppMMDevice = NULL;
-
-    // get an enumerator
-    IMMDeviceEnumerator *pMMDeviceEnumerator;
-
-    hr = CoCreateInstance(
-        __uuidof(MMDeviceEnumerator), NULL, CLSCTX_ALL,
-        __uuidof(IMMDeviceEnumerator),
-        (void**)&pMMDeviceEnumerator
-    );
-    if (FAILED(hr)) {
-        ERR(L"CoCreateInstance(IMMDeviceEnumerator) failed: hr = 0x%08x", hr);
-        return hr;
+std::string utf8_from_wide(LPCWSTR sz) {
+    int n = WideCharToMultiByte(CP_UTF8, 0, sz, -1, NULL, 0, NULL, NULL);
+    if (n <= 0) {
+        return std::string();
     }
-    ReleaseOnExit releaseMMDeviceEnumerator(pMMDeviceEnumerator);
 
-    IMMDeviceCollection *pMMDeviceCollection;
-
-    // get all the active render endpoints
-    hr = pMMDeviceEnumerator->EnumAudioEndpoints(
-        direction, DEVICE_STATE_ACTIVE, &pMMDeviceCollection
-    );
-    if (FAILED(hr)) {
-        ERR(L"IMMDeviceEnumerator::EnumAudioEndpoints failed: hr = 0x%08x", hr);
-        return hr;
-    }
-    ReleaseOnExit releaseMMDeviceCollection(pMMDeviceCollection);
+    std::string s(static_cast<size_t>(n), '\0');
+    WideCharToMultiByte(CP_UTF8, 0, sz, -1, &s[0], n, NULL, NULL);
+    s.resize(static_cast<size_t>(n) - 1);
+    return s;
+}
 
-    UINT count;
-    hr = pMMDeviceCollection->GetCount(&count);
-    if (FAILED(hr)) {
-        ERR(L"IMMDeviceCollection::GetCount failed: hr = 0x%08x", hr);
-        return hr;
+std::wstring wide_from_utf8(const std::string &s) {
+    int n = MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, NULL, 0);
+    if (n <= 0) {
+        return std::wstring();
     }
 
-    for (UINT i = 0; i < count; i++) {
-        IMMDevice *pMMDevice;
-
-        // get the "n"th device
-        hr = pMMDeviceCollection->Item(i, &pMMDevice);
-        if (FAILED(hr)) {
-            ERR(L"IMMDeviceCollection::Item failed: hr = 0x%08x", hr);
-            return hr;
-        }
-        ReleaseOnExit releaseMMDevice(pMMDevice);
+    std::wstring w(static_cast<size_t>(n), L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, &w[0], n);
+    w.resize(static_cast<size_t>(n) - 1);
+    return w;
+}
 
-        // open the property store on that device
-        IPropertyStore *pPropertyStore;
-        hr = pMMDevice->OpenPropertyStore(STGM_READ, &pPropertyStore);
-        if (FAILED(hr)) {
-            ERR(L"IMMDevice::OpenPropertyStore failed: hr = 0x%08x", hr);
-            return hr;
+HRESULT expand_config_files(int argc, LPCWSTR argv[], std::vector<std::wstring> &args) {
+    for (int i = 0; i < argc; i++) {
+        if (0 != _wcsicmp(argv[i], L"--config")) {
+            args.push_back(argv[i]);
+            continue;
         }
-        ReleaseOnExit releasePropertyStore(pPropertyStore);
 
-        // get the long name property
-        PROPVARIANT pv; PropVariantInit(&pv);
-        hr = pPropertyStore->GetValue(PKEY_Device_FriendlyName, &pv);
-        if (FAILED(hr)) {
-            ERR(L"IPropertyStore::GetValue failed: hr = 0x%08x", hr);
-            return hr;
+        if (++i == argc) {
+            ERR(L"%s", L"--config switch requires an argument");
+            return E_INVALIDARG;
         }
-        PropVariantClearOnExit clearPv(&pv);
 
-        if (VT_LPWSTR != pv.vt) {
-            ERR(L"PKEY_Device_FriendlyName variant type is %u - expected VT_LPWSTR", pv.vt);
-            return E_UNEXPECTED;
+        std::vector<std::string> configArgs;
+        std::string error;
+        if (!ReadConfigFile(utf8_from_wide(argv[i]), configArgs, error)) {
+            ERR(L"%hs", error.c_str());
+            return E_INVALIDARG;
         }
-
-        // is it a match?
-        if (0 == _wcsicmp(pv.pwszVal, szLongName)) {
-            // did we already find it?
-            if (NULL == *ppMMDevice) {
-                *ppMMDevice = pMMDevice;
-                pMMDevice->AddRef();
-            }
-            else {
-                ERR(L"Found (at least) two devices named %ls", szLongName);
-                return E_UNEXPECTED;
-            }
+        for (const std::string &arg : configArgs) {
+            args.push_back(wide_from_utf8(arg));
         }
     }
 
-    if (NULL == *ppMMDevice) {
-        ERR(L"Could not find a device named %ls", szLongName);
-        return HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
-    }
-
     return S_OK;
 }
@@ -1,14 +1,60 @@
 // prefs.h
 
+// the same stereo stream can be rendered to this many endpoints at once
+#define MAX_OUTPUT_DEVICES 8
+
+// the input device if --in-device isn't given
+#define DEFAULT_IN_DEVICE_NAME L"Digital Audio Interface (USB Digital Audio)"
+
 class CPrefs {
 public:
-    IMMDevice *m_pMMInDevice;
-    IMMDevice *m_pMMOutDevice;
+    IMMDevice *m_pMMInDevice;                       // NULL with --daemon
+    IMMDevice *m_pMMOutDevices[MAX_OUTPUT_DEVICES]; // NULL with --daemon
+    UINT32 m_nOutDevices;
+
+    // what the devices were asked for by, so they can be found again;
+    // an empty output name is the default render device
+    std::wstring m_inDeviceName;
+    std::wstring m_outDeviceNames[MAX_OUTPUT_DEVICES];
+
     int m_iBufferMs;
-    bool m_bSkipFirstSample;
+    bool m_bAutoBuffer;  // --buffer-size auto (buffertune.h)
+    UINT32 m_nMultiplex;
+    UINT32 m_nSampleOffset;
+    bool m_bDetectPhase;
+    bool m_bDriftCompensation;
+    int m_iStatsIntervalSec;
+    std::string m_sharedStatsName; // empty for none
+    std::string m_recordPath;      // UTF-8, empty for none
+    DspOptions m_dsp;
+
+    // also send the stream over the network as RTP (rtp.h)
+    std::string m_rtpSendAddress;  // "host:port", empty for none
+    RtpSendOptions m_rtpSend;
+
+    // play a stream from the network on the first output instead of
+    // capturing; no input device is needed
+    std::string m_rtpReceiveAddress; // "[host:]port", empty for none
+    RtpReceiveOptions m_rtpReceive;
+
+    // keep running without a console, finding the devices again whenever
+    // they go away, until the stop event is set
+    bool m_bDaemon;
+    std::wstring m_stopEventName; // empty for an unnamed one
+
+    // offline conversion instead of capture, see fileconvert.h
+    bool m_bConvert;
+    ConvertOptions m_convert;
+
+    // the same for a whole archive of captures at once, see batchconvert.h
+    bool m_bBatch;
+    BatchOptions m_batch;
 
     // set hr to S_FALSE to abort but return success
     CPrefs(int argc, LPCWSTR argv[], HRESULT &hr);
     ~CPrefs();
 
 };
+
+std::string utf8_from_wide(LPCWSTR sz);
+std::wstring wide_from_utf8(const std::string &s);
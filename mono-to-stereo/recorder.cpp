@@ -0,0 +1,298 @@
+// recorder.cpp
+
+#include "recorder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <new>
+
+#include "wavfile.h"
+
+// blocks start on a page boundary
+#define RECORD_ALIGN_BYTES 4096
+
+RecordingTap::RecordingTap(StatsClock &clock, MessageSink &messages)
+    : m_clock(clock)
+    , m_messages(messages)
+    , m_bOpen(false)
+    , m_bBegun(false)
+    , m_format()
+    , m_pSilence(NULL)
+    , m_nFill(0)
+    , m_nPendingSilence(0)
+    , m_nDrain(0)
+    , m_nDataBytes(0)
+    , m_nHeaderDataBytes(0)
+    , m_hnsNextHeader(0)
+{
+    for (uint32_t i = 0; i < RECORD_BLOCKS; i++) {
+        m_blocks[i].bFull.store(false, std::memory_order_relaxed);
+        m_blocks[i].nFrames = 0;
+        m_blocks[i].nSilenceBefore = 0;
+        m_blocks[i].pData = NULL;
+    }
+    m_bFailed.store(false, std::memory_order_relaxed);
+    m_nFrames.store(0, std::memory_order_relaxed);
+    m_nDroppedFrames.store(0, std::memory_order_relaxed);
+    m_nBlocks.store(0, std::memory_order_relaxed);
+    m_nHeaderUpdates.store(0, std::memory_order_relaxed);
+    m_bStop.store(false, std::memory_order_relaxed);
+}
+
+RecordingTap::~RecordingTap() {
+    std::string error;
+    Stop(error);
+}
+
+bool RecordingTap::Open(const std::string &path, std::string &error) {
+    if (m_bOpen) {
+        error = "already recording to " + m_path;
+        return false;
+    }
+
+    if (!m_file.Open(path, error)) {
+        error = path + ": " + error;
+        return false;
+    }
+
+    m_path = path;
+    m_bOpen = true;
+    return true;
+}
+
+bool RecordingTap::Begin(const AudioFormat &format, std::string &error) {
+    if (!m_bOpen) {
+        error = "no recording file open";
+        return false;
+    }
+
+    if (m_bBegun) {
+        if (format.wFormatTag != m_format.wFormatTag || format.nChannels != m_format.nChannels ||
+            format.nSamplesPerSec != m_format.nSamplesPerSec || format.wBitsPerSample != m_format.wBitsPerSample) {
+            error = "the stream's format changed since " + m_path + " was started";
+            return false;
+        }
+        return true;
+    }
+
+    // one more block than is handed round, kept silent for the dropped frames
+    const size_t nBlockBytes = static_cast<size_t>(RECORD_BLOCK_FRAMES) * format.nBlockAlign;
+    m_memory.reset(new (std::nothrow) uint8_t[nBlockBytes * (RECORD_BLOCKS + 1) + RECORD_ALIGN_BYTES]);
+    if (!m_memory) {
+        error = "couldn't allocate the recording buffers";
+        return false;
+    }
+
+    uintptr_t nBase = reinterpret_cast<uintptr_t>(m_memory.get());
+    uint8_t *pBase = m_memory.get() + (RECORD_ALIGN_BYTES - nBase % RECORD_ALIGN_BYTES) % RECORD_ALIGN_BYTES;
+    for (uint32_t i = 0; i < RECORD_BLOCKS; i++) {
+        m_blocks[i].pData = pBase + nBlockBytes * i;
+    }
+    m_pSilence = pBase + nBlockBytes * RECORD_BLOCKS;
+    memset(m_pSilence, 0, nBlockBytes);
+
+    // placeholder until the first update
+    m_format = format;
+    uint8_t header[WAV_HEADER_BYTES];
+    BuildWavHeader(m_format, 0, header);
+    if (!m_file.Write(header, sizeof(header), error)) {
+        error = m_path + ": " + error;
+        return false;
+    }
+
+    m_bBegun = true;
+    m_hnsNextHeader = m_clock.NowHns() + static_cast<int64_t>(RECORD_HEADER_MS) * (HNS_PER_SECOND / 1000);
+    m_thread = std::thread(&RecordingTap::WriterThread, this);
+    return true;
+}
+
+// ---- capture thread ----
+
+void RecordingTap::Write(const uint8_t *pData, uint32_t nFrames) {
+    if (!m_bBegun || m_bFailed.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    const uint32_t nBlockAlign = m_format.nBlockAlign;
+    while (nFrames > 0) {
+        Block &block = m_blocks[m_nFill];
+
+        // the writer hasn't got round to it yet
+        if (block.bFull.load(std::memory_order_acquire)) {
+            m_nPendingSilence += nFrames;
+            m_nDroppedFrames.fetch_add(nFrames, std::memory_order_relaxed);
+            return;
+        }
+
+        if (0 == block.nFrames) {
+            block.nSilenceBefore = m_nPendingSilence;
+            m_nPendingSilence = 0;
+        }
+
+        uint32_t n = (std::min)(nFrames, RECORD_BLOCK_FRAMES - block.nFrames);
+        memcpy(block.pData + static_cast<size_t>(block.nFrames) * nBlockAlign, pData, static_cast<size_t>(n) * nBlockAlign);
+        block.nFrames += n;
+        pData += static_cast<size_t>(n) * nBlockAlign;
+        nFrames -= n;
+
+        if (RECORD_BLOCK_FRAMES == block.nFrames) {
+            block.bFull.store(true, std::memory_order_release);
+            m_nFill = (m_nFill + 1) % RECORD_BLOCKS;
+        }
+    }
+}
+
+// ---- writer ----
+
+bool RecordingTap::Drain() {
+    bool bAny = false;
+
+    while (!m_bFailed.load(std::memory_order_relaxed)) {
+        Block &block = m_blocks[m_nDrain];
+        if (!block.bFull.load(std::memory_order_acquire)) {
+            break;
+        }
+
+        if (!WriteBlock(block)) {
+            break;
+        }
+
+        // back to the capture thread
+        block.nFrames = 0;
+        block.nSilenceBefore = 0;
+        block.bFull.store(false, std::memory_order_release);
+        m_nDrain = (m_nDrain + 1) % RECORD_BLOCKS;
+        bAny = true;
+    }
+
+    if (!m_bFailed.load(std::memory_order_relaxed) && m_clock.NowHns() >= m_hnsNextHeader) {
+        UpdateHeader();
+        m_hnsNextHeader = m_clock.NowHns() + static_cast<int64_t>(RECORD_HEADER_MS) * (HNS_PER_SECOND / 1000);
+    }
+
+    return bAny;
+}
+
+void RecordingTap::WriterThread() {
+    while (!m_bStop.load(std::memory_order_acquire)) {
+        if (!Drain()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(RECORD_DRAIN_MS));
+        }
+    }
+}
+
+bool RecordingTap::WriteBlock(Block &block) {
+    if (!WriteSilence(block.nSilenceBefore)) {
+        return false;
+    }
+
+    size_t nBytes = static_cast<size_t>(block.nFrames) * m_format.nBlockAlign;
+    std::string error;
+    if (!m_file.Write(block.pData, nBytes, error)) {
+        WriteFailed(error);
+        return false;
+    }
+
+    m_nDataBytes += nBytes;
+    m_nFrames.fetch_add(block.nFrames, std::memory_order_relaxed);
+    m_nBlocks.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool RecordingTap::WriteSilence(uint64_t nFrames) {
+    while (nFrames > 0) {
+        uint32_t n = static_cast<uint32_t>((std::min)(nFrames, static_cast<uint64_t>(RECORD_BLOCK_FRAMES)));
+        size_t nBytes = static_cast<size_t>(n) * m_format.nBlockAlign;
+        std::string error;
+        if (!m_file.Write(m_pSilence, nBytes, error)) {
+            WriteFailed(error);
+            return false;
+        }
+
+        m_nDataBytes += nBytes;
+        m_nFrames.fetch_add(n, std::memory_order_relaxed);
+        nFrames -= n;
+    }
+
+    return true;
+}
+
+bool RecordingTap::UpdateHeader() {
+    if (m_nDataBytes == m_nHeaderDataBytes) {
+        return true;
+    }
+
+    uint8_t header[WAV_HEADER_BYTES];
+    BuildWavHeader(m_format, m_nDataBytes, header);
+    std::string error;
+    if (!m_file.WriteAt(0, header, sizeof(header), error)) {
+        WriteFailed(error);
+        return false;
+    }
+
+    m_nHeaderDataBytes = m_nDataBytes;
+    m_nHeaderUpdates.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+// the capture thread stops handing blocks over once it sees this
+void RecordingTap::WriteFailed(const std::string &error) {
+    m_error = m_path + ": " + error;
+    m_bFailed.store(true, std::memory_order_relaxed);
+    m_messages.Error("Recording stopped: %s", m_error.c_str());
+}
+
+bool RecordingTap::Stop(std::string &error) {
+    if (!m_bOpen) {
+        if (!m_error.empty()) {
+            error = m_error;
+            return false;
+        }
+        return true;
+    }
+
+    if (m_thread.joinable()) {
+        m_bStop.store(true, std::memory_order_release);
+        m_thread.join();
+    }
+
+    // every full block, then the one still being filled and anything
+    // dropped after it
+    if (m_bBegun) {
+        Drain();
+
+        Block &block = m_blocks[m_nFill];
+        if (!m_bFailed.load(std::memory_order_relaxed) && !block.bFull.load(std::memory_order_acquire) && block.nFrames > 0) {
+            WriteBlock(block);
+            block.nFrames = 0;
+        }
+        if (!m_bFailed.load(std::memory_order_relaxed) && WriteSilence(m_nPendingSilence)) {
+            m_nPendingSilence = 0;
+        }
+        if (!m_bFailed.load(std::memory_order_relaxed)) {
+            UpdateHeader();
+        }
+    }
+
+    std::string closeError;
+    if (!m_file.Close(closeError) && m_error.empty()) {
+        m_error = m_path + ": " + closeError;
+    }
+    m_bOpen = false;
+
+    if (!m_error.empty()) {
+        error = m_error;
+        return false;
+    }
+    return true;
+}
+
+RecordingStats RecordingTap::Stats() const {
+    RecordingStats stats;
+    stats.nFrames = m_nFrames.load(std::memory_order_relaxed);
+    stats.nDroppedFrames = m_nDroppedFrames.load(std::memory_order_relaxed);
+    stats.nBlocks = m_nBlocks.load(std::memory_order_relaxed);
+    stats.nHeaderUpdates = m_nHeaderUpdates.load(std::memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,131 @@
+// recorder.h
+
+// records the repaired stereo stream to a WAV file while it plays
+//
+// the capture thread copies what goes into the fanout ring into fixed size
+// blocks and hands each full one to a writer thread of the tap's own; it
+// never allocates, never touches the file and never waits. blocks are used
+// round robin and each one belongs either to the capture thread or to the
+// writer, so passing one over is a single atomic store. if the writer falls
+// so far behind that the next block isn't free yet, the frames are dropped
+// and counted, and the writer puts the same number of silent frames in the
+// file so what comes after stays in time
+//
+// the writer does one large write per block and rewrites the header every
+// RECORD_HEADER_MS, so a file left behind by a crash still plays up to the
+// last update; it becomes RF64 once it outgrows RIFF
+//
+// no Windows dependencies
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "audioformat.h"
+#include "fileio.h"
+#include "latency.h"
+#include "messages.h"
+
+// frames per block; a multiple of 4 KiB for every stereo frame size
+#define RECORD_BLOCK_FRAMES 16384
+
+// blocks in flight, which is how far the writer can fall behind before
+// frames are dropped; about 2.7 seconds at 48 kHz
+#define RECORD_BLOCKS 8
+
+// how often the writer looks for full blocks
+#define RECORD_DRAIN_MS 20
+
+// how often the header is brought up to date with what has been written
+#define RECORD_HEADER_MS 1000
+
+struct RecordingStats {
+    uint64_t nFrames;        // written to the file, silence included
+    uint64_t nDroppedFrames; // no free block; written as silence
+    uint64_t nBlocks;        // large writes
+    uint64_t nHeaderUpdates;
+};
+
+class RecordingTap {
+public:
+    RecordingTap(StatsClock &clock, MessageSink &messages);
+
+    // Stop if it hasn't been
+    ~RecordingTap();
+
+    // creates the file, so a bad path is found before anything starts;
+    // nothing is written until Begin. path is UTF-8
+    bool Open(const std::string &path, std::string &error);
+
+    // called by the pipeline as it starts, before any Write; the first call
+    // writes the header and starts the writer, later ones (a restarted
+    // stream) only check the format hasn't changed
+    bool Begin(const AudioFormat &format, std::string &error);
+
+    // capture thread; never blocks or allocates
+    void Write(const uint8_t *pData, uint32_t nFrames);
+
+    // writes out whatever is left and closes the file; call once nothing
+    // can call Write any more. false if anything couldn't be written
+    bool Stop(std::string &error);
+
+    bool IsOpen() const { return m_bOpen; }
+    const std::string &Path() const { return m_path; }
+    RecordingStats Stats() const;
+
+private:
+    RecordingTap(const RecordingTap &) = delete;
+    RecordingTap &operator=(const RecordingTap &) = delete;
+
+    struct Block {
+        std::atomic<bool> bFull;  // the writer's until it clears this
+        uint32_t nFrames;
+        uint64_t nSilenceBefore;  // frames dropped just before this block
+        uint8_t *pData;
+    };
+
+    // writer side
+    bool Drain();
+    void WriterThread();
+    bool WriteBlock(Block &block);
+    bool WriteSilence(uint64_t nFrames);
+    bool UpdateHeader();
+    void WriteFailed(const std::string &error);
+
+    StatsClock &m_clock;
+    MessageSink &m_messages;
+
+    std::string m_path;
+    OutputFile m_file;
+    bool m_bOpen;
+    bool m_bBegun;
+    AudioFormat m_format;
+
+    std::unique_ptr<uint8_t[]> m_memory;
+    Block m_blocks[RECORD_BLOCKS];
+    uint8_t *m_pSilence;      // a block's worth of zeros
+
+    // capture thread
+    uint32_t m_nFill;         // the block being filled
+    uint64_t m_nPendingSilence;
+
+    // writer thread, then Stop
+    uint32_t m_nDrain;        // the next block to write
+    uint64_t m_nDataBytes;
+    uint64_t m_nHeaderDataBytes; // what the header in the file says
+    int64_t m_hnsNextHeader;
+    std::string m_error;
+
+    std::atomic<bool> m_bFailed;
+    std::atomic<uint64_t> m_nFrames;
+    std::atomic<uint64_t> m_nDroppedFrames;
+    std::atomic<uint64_t> m_nBlocks;
+    std::atomic<uint64_t> m_nHeaderUpdates;
+
+    std::atomic<bool> m_bStop;
+    std::thread m_thread;
+};
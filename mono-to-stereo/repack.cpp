@@ -0,0 +1,206 @@
+// repack.cpp
+
+// the kernels are all in repack.h; this is the offline check
+
+#include "repack.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "audioformat.h"
+#include "phasedetect.h"
+#include "sampleconvert.h"
+
+// sample sizes of the formats we take
+static const uint32_t g_sampleBytes[] = { 2, 3, 4, 8 };
+
+// multiplex factors, the common ones and an odd one
+static const uint32_t g_factors[] = { 2, 3, 4, 8 };
+
+// uniform in [0, n)
+static uint32_t RepackRandom(uint64_t &x, uint32_t n) {
+    x += 0x9E3779B97F4A7C15ull;
+    uint64_t z = x;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    z ^= z >> 31;
+    return static_cast<uint32_t>((z >> 32) % n);
+}
+
+// mostly capture sized packets, with plenty of the awkward ones
+static uint32_t RandomPacketSize(uint64_t &x) {
+    switch (RepackRandom(x, 8)) {
+    case 0: return 0;
+    case 1: return 1;
+    case 2: return 2 + RepackRandom(x, 4);
+    case 3: return 2 * (1 + RepackRandom(x, 480));
+    default: return 1 + RepackRandom(x, 1100);
+    }
+}
+
+// one trial: returns false if the repacked frames differ from the model's
+static bool RepackTrial(uint64_t &x, RepackSimulationResult &result) {
+    const uint32_t nFactor = g_factors[RepackRandom(x, sizeof(g_factors) / sizeof(g_factors[0]))];
+    const uint32_t nChannels = 1 + RepackRandom(x, AUDIOFORMAT_MAX_CHANNELS / nFactor);
+    const uint32_t nBlockAlign = nChannels * g_sampleBytes[RepackRandom(x, sizeof(g_sampleBytes) / sizeof(g_sampleBytes[0]))];
+    const uint32_t nSamples = RepackRandom(x, 20000);
+    uint32_t nOffset = RepackRandom(x, nFactor);
+
+    std::vector<uint8_t> in(static_cast<size_t>(nSamples) * nBlockAlign + 1);
+    for (uint8_t &b : in) {
+        b = static_cast<uint8_t>(RepackRandom(x, 256));
+    }
+
+    RepackState state;
+    RepackInit(state, nBlockAlign, nFactor, nOffset);
+
+    // the generic copy or the one specialized on the format
+    RepackKernel pRepack = RepackFrames;
+    if (RepackRandom(x, 2)) {
+        pRepack = RepackKernelFor(nBlockAlign, nFactor);
+        result.nKernelTrials++;
+    }
+
+    // the model takes one frame at a time and writes out the last nFactor
+    // of them whenever one completes an output frame; missing ones are silence
+    std::vector<uint8_t> expected;
+    std::vector<uint8_t> recent(static_cast<size_t>(nFactor - 1) * nBlockAlign, 0);
+    uint32_t nPosition = 0;
+
+    std::vector<uint8_t> out;
+    std::vector<uint8_t> packet;
+
+    for (uint32_t nDone = 0; nDone < nSamples; ) {
+        uint32_t n = (std::min)(RandomPacketSize(x), nSamples - nDone);
+        const uint8_t *pIn = in.data() + static_cast<size_t>(nDone) * nBlockAlign;
+
+        // a phase change between packets writes the last frames again, or
+        // drops them
+        if (RepackRandom(x, 20) == 0) {
+            nOffset = RepackRandom(x, nFactor);
+            state.nOffset = nOffset;
+        }
+
+        // frames lost in front of the packet
+        if (RepackRandom(x, 40) == 0 && n > 0) {
+            uint32_t nLost = 1 + RepackRandom(x, 3 * nFactor);
+            RepackSkip(state, nLost, pIn);
+            nOffset = (nOffset + nLost) % nFactor;
+            for (uint32_t i = 0; i + 1 < nFactor; i++) {
+                memcpy(recent.data() + static_cast<size_t>(i) * nBlockAlign, pIn, nBlockAlign);
+            }
+        }
+
+        for (uint32_t i = 0; i < n; i++) {
+            const uint8_t *pSample = pIn + static_cast<size_t>(i) * nBlockAlign;
+            if ((nPosition + nOffset) % nFactor == nFactor - 1) {
+                expected.insert(expected.end(), recent.begin(), recent.end());
+                expected.insert(expected.end(), pSample, pSample + nBlockAlign);
+            }
+            nPosition = (nPosition + 1) % nFactor;
+            if (!recent.empty()) {
+                recent.erase(recent.begin(), recent.begin() + nBlockAlign);
+                recent.insert(recent.end(), pSample, pSample + nBlockAlign);
+            }
+        }
+
+        result.nPackets++;
+        if (n % nFactor != 0) {
+            result.nOddPackets++;
+        }
+
+        // each packet in a buffer of its own, the way a device hands them over
+        packet.assign(pIn, pIn + static_cast<size_t>(n) * nBlockAlign);
+        uint32_t nOut = RepackOutputFrames(state, n);
+        const size_t nOutFrameBytes = static_cast<size_t>(nFactor) * nBlockAlign;
+        size_t nOutBytes = nOut * nOutFrameBytes;
+        size_t nAt = out.size();
+
+        const uint8_t *pInPlace = RepackRandom(x, 2) ? RepackInPlace(state, packet.data(), n) : NULL;
+        if (NULL != pInPlace) {
+            result.nInPlacePackets++;
+            out.insert(out.end(), pInPlace, pInPlace + nOutBytes);
+        }
+        else if (nOut > 1 && RepackRandom(x, 2)) {
+            // split the way the capture loop does at the ring's wrap point
+            out.resize(nAt + nOutBytes);
+            uint32_t nFirst = 1 + RepackRandom(x, nOut - 1);
+            uint32_t nWritten = pRepack(state, packet.data(), nFirst * nFactor, out.data() + nAt);
+            nWritten += pRepack(state, packet.data() + static_cast<size_t>(nFirst) * nFactor * nBlockAlign, n - nFirst * nFactor, out.data() + nAt + nFirst * nOutFrameBytes);
+            if (nWritten != nOut) {
+                return false;
+            }
+        }
+        else {
+            out.resize(nAt + nOutBytes);
+            if (pRepack(state, packet.data(), n, out.data() + nAt) != nOut) {
+                return false;
+            }
+        }
+
+        nDone += n;
+    }
+
+    if (nFactor * nChannels > 2) {
+        result.nWideTrials++;
+    }
+    return out == expected && RepackCarried(state) == (nPosition + nOffset) % nFactor;
+}
+
+// a tone in both channels at different levels, interleaved into a 96 kHz
+// s16 stream with or without its first sample, fed to the detector in
+// packets of 10 ms or of random sizes; returns the decision
+static ChannelPhase PhaseTrial(bool bMissingFirst, bool bRandomPackets, uint64_t &x) {
+    const uint32_t nRate = 96000;
+    const uint32_t nSamples = nRate * 2;
+    AudioFormat format = MakeAudioFormat(AUDIOFORMAT_TAG_PCM, 1, nRate, 16);
+
+    std::vector<float> signal(nSamples);
+    for (uint32_t i = 0; i < nSamples; i++) {
+        uint32_t nReal = i + (bMissingFirst ? 1 : 0);
+        double fPhase = 6.283185307179586 * 440.0 * (nReal / 2) / (nRate / 2);
+        signal[i] = static_cast<float>(nReal & 1 ? 0.3 * std::sin(fPhase) : 0.6 * std::sin(fPhase));
+    }
+
+    std::vector<uint8_t> in(static_cast<size_t>(nSamples) * format.nBlockAlign);
+    SampleConverter converter;
+    converter.Init(SAMPLE_FLOAT32, SAMPLE_INT16, false);
+    converter.FromFloat(signal.data(), in.data(), nSamples);
+
+    PhaseDetector detector;
+    detector.Init(format);
+    for (uint32_t nDone = 0; nDone < nSamples; ) {
+        uint32_t n = (std::min)(bRandomPackets ? RandomPacketSize(x) : nRate / 100, nSamples - nDone);
+        detector.Analyze(in.data() + static_cast<size_t>(nDone) * format.nBlockAlign, n);
+        nDone += n;
+    }
+
+    return detector.Phase();
+}
+
+RepackSimulationResult SimulateRepacking(uint32_t nTrials, uint32_t nSeed) {
+    RepackSimulationResult result = {};
+    uint64_t x = nSeed;
+
+    for (uint32_t i = 0; i < nTrials; i++) {
+        result.nTrials++;
+        if (!RepackTrial(x, result)) {
+            result.nFailedTrials++;
+        }
+    }
+
+    for (int bMissingFirst = 0; bMissingFirst < 2; bMissingFirst++) {
+        for (int bRandomPackets = 0; bRandomPackets < 2; bRandomPackets++) {
+            ChannelPhase expected = bMissingFirst ? PHASE_SKIP_FIRST : PHASE_ALIGNED;
+            result.nPhaseCases++;
+            if (PhaseTrial(bMissingFirst != 0, bRandomPackets != 0, x) != expected) {
+                result.nPhaseFailures++;
+            }
+        }
+    }
+
+    result.bPass = result.nFailedTrials == 0 && result.nPhaseFailures == 0 && result.nOddPackets != 0 && result.nInPlacePackets != 0 && result.nKernelTrials != 0 && result.nWideTrials != 0;
+    return result;
+}
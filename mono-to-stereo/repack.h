@@ -0,0 +1,240 @@
+// repack.h
+
+// portable demultiplexing of a time multiplexed capture stream
+//
+// the capture device hands us a mono stream at twice the real sample rate;
+// every pair of mono samples is actually one stereo frame. when the device
+// drops the very first left channel sample every pair is shifted by one,
+// so we delay the stream by a single sample (carried between packets)
+//
+// other capture chips do the same with more channels: N channels
+// multiplexed onto a mono or stereo stream at N times the rate, so every N
+// input frames are one output frame of N times as many channels. the
+// factor is nFactor, and nOffset is how many input frames of the first
+// output frame the device left out, 0 to nFactor - 1 (the MS2109's
+// missing first sample is factor 2, offset 1)
+//
+// packets can be any size. output frames are counted from the start of
+// the stream, so a packet that doesn't end on a frame boundary leaves part
+// of a frame behind, carried until the next packet completes it. how much
+// is carried follows from the stream position and the offset: a packet of
+// whole frames with nothing carried already is a run of output frames.
+// the output is interleaved like the input, so demultiplexing never
+// reorders samples, it only delays the stream by the carried frames
+//
+// this file has no Windows dependencies so the kernel can be built,
+// profiled and unit tested on its own
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "audioformat.h"
+
+// largest sample we know how to carry (64-bit float)
+#define REPACK_MAX_SAMPLE_BYTES 8
+
+// most input frames that make up one output frame
+#define REPACK_MAX_FACTOR AUDIOFORMAT_MAX_CHANNELS
+
+// the most that can be carried: all but one sample of the widest frame
+#define REPACK_MAX_CARRY_BYTES ((AUDIOFORMAT_MAX_CHANNELS - 1) * REPACK_MAX_SAMPLE_BYTES)
+
+struct RepackState {
+    uint32_t nBlockAlign; // bytes per input frame
+    uint32_t nFactor;     // input frames per output frame
+    uint32_t nOffset;     // input frames missing in front of the first output frame
+    uint32_t nPosition;   // input frames gone by, modulo nFactor
+    uint8_t history[REPACK_MAX_CARRY_BYTES]; // the last nFactor - 1 input frames, oldest first
+};
+
+// returns false if the factor, offset or frame size can't be handled
+static inline bool RepackInit(RepackState &state, uint32_t nBlockAlign, uint32_t nFactor, uint32_t nOffset) {
+    if (nBlockAlign == 0 || nFactor < 2 || nFactor > REPACK_MAX_FACTOR || nOffset >= nFactor ||
+        static_cast<size_t>(nFactor - 1) * nBlockAlign > REPACK_MAX_CARRY_BYTES) {
+        return false;
+    }
+
+    state.nBlockAlign = nBlockAlign;
+    state.nFactor = nFactor;
+    state.nOffset = nOffset;
+    state.nPosition = 0;
+
+    // the missing first frames are rendered as silence
+    memset(state.history, 0, sizeof(state.history));
+    return true;
+}
+
+// input frames of the next output frame already seen, carried until it's
+// complete. changing nOffset between packets changes this too, so the
+// last frames are either written again or not at all
+static inline uint32_t RepackCarried(const RepackState &state) {
+    return (state.nPosition + state.nOffset) % state.nFactor;
+}
+
+// the carried frames, oldest first
+static inline const uint8_t *RepackCarriedFrames(const RepackState &state) {
+    return state.history + static_cast<size_t>(state.nFactor - 1 - RepackCarried(state)) * state.nBlockAlign;
+}
+
+// number of output frames the next nInFrames input frames complete
+static inline uint32_t RepackOutputFrames(const RepackState &state, uint32_t nInFrames) {
+    return static_cast<uint32_t>((static_cast<uint64_t>(nInFrames) + RepackCarried(state)) / state.nFactor);
+}
+
+// keeps the last frames of a packet and moves the stream position past it
+static inline void RepackAdvance(RepackState &state, const uint8_t *pIn, uint32_t nInFrames) {
+    if (nInFrames == 0) {
+        return;
+    }
+
+    // kept whatever the offset so nOffset can be changed between packets
+    const size_t nBlockAlign = state.nBlockAlign;
+    const uint32_t nKeep = state.nFactor - 1;
+    if (nInFrames >= nKeep) {
+        memcpy(state.history, pIn + (nInFrames - nKeep) * nBlockAlign, nKeep * nBlockAlign);
+    }
+    else {
+        memmove(state.history, state.history + nInFrames * nBlockAlign, (nKeep - nInFrames) * nBlockAlign);
+        memcpy(state.history + (nKeep - nInFrames) * nBlockAlign, pIn, nInFrames * nBlockAlign);
+    }
+    state.nPosition = static_cast<uint32_t>((state.nPosition + static_cast<uint64_t>(nInFrames)) % state.nFactor);
+}
+
+// frames lost in front of the next packet: the frames after the gap belong
+// that much further on, and the carried ones are replaced with the first
+// frame after it (pFirst, NULL to leave them) since what they belonged to
+// isn't there any more. returns true if the gap moved the frame boundary
+static inline bool RepackSkip(RepackState &state, uint64_t nLostFrames, const uint8_t *pFirst) {
+    uint32_t nShift = static_cast<uint32_t>(nLostFrames % state.nFactor);
+    state.nOffset = (state.nOffset + nShift) % state.nFactor;
+
+    if (NULL != pFirst) {
+        for (uint32_t i = 0; i + 1 < state.nFactor; i++) {
+            memcpy(state.history + static_cast<size_t>(i) * state.nBlockAlign, pFirst, state.nBlockAlign);
+        }
+    }
+    return nShift != 0;
+}
+
+// the fast path: when nothing is carried and the packet is whole frames,
+// the packet already is RepackOutputFrames(nInFrames) output frames.
+// returns pIn and moves past the packet, or NULL (and does nothing) if it
+// has to be copied
+static inline const uint8_t *RepackInPlace(RepackState &state, const uint8_t *pIn, uint32_t nInFrames) {
+    if (RepackCarried(state) != 0 || nInFrames % state.nFactor != 0) {
+        return NULL;
+    }
+
+    RepackAdvance(state, pIn, nInFrames);
+    return pIn;
+}
+
+// repacks nInFrames input frames from pIn into pOut, which must have room
+// for RepackOutputFrames(state, nInFrames) output frames (nFactor *
+// nBlockAlign bytes each). a trailing part frame is carried into the next
+// call. returns the number of output frames written
+static inline uint32_t RepackFrames(RepackState &state, const uint8_t *pIn, uint32_t nInFrames, uint8_t *pOut) {
+    const uint32_t nOutFrames = RepackOutputFrames(state, nInFrames);
+    const size_t nBlockAlign = state.nBlockAlign;
+    const size_t nBytes = static_cast<size_t>(nOutFrames) * state.nFactor * nBlockAlign;
+
+    if (nOutFrames != 0) {
+        const size_t nCarriedBytes = RepackCarried(state) * nBlockAlign;
+        memcpy(pOut, RepackCarriedFrames(state), nCarriedBytes);
+        memcpy(pOut + nCarriedBytes, pIn, nBytes - nCarriedBytes);
+    }
+
+    RepackAdvance(state, pIn, nInFrames);
+    return nOutFrames;
+}
+
+// RepackFrames with the frame size and factor fixed at compile time: the
+// carried frames are a constant size copy per case, the position wraps
+// without a division and every byte count is a constant multiple, so
+// nothing is sized at run time but the packet. one of these is picked by
+// RepackKernelFor once the input format is known, and called through the
+// pointer for every packet after that. how much is carried still changes
+// from packet to packet (part frames, phase flips), so that stays a branch
+// per packet rather than a kernel of its own
+typedef uint32_t (*RepackKernel)(RepackState &state, const uint8_t *pIn, uint32_t nInFrames, uint8_t *pOut);
+
+template <size_t BYTES, uint32_t FACTOR>
+static uint32_t RepackFramesFixed(RepackState &state, const uint8_t *pIn, uint32_t nInFrames, uint8_t *pOut) {
+    const uint32_t nCarried = (state.nPosition + state.nOffset) % FACTOR;
+    const uint32_t nOutFrames = static_cast<uint32_t>((static_cast<uint64_t>(nInFrames) + nCarried) / FACTOR);
+    const size_t nBytes = static_cast<size_t>(nOutFrames) * (FACTOR * BYTES);
+
+    if (nOutFrames != 0) {
+        if (0 == nCarried) {
+            memcpy(pOut, pIn, nBytes);
+        }
+        else {
+            memcpy(pOut, state.history + (FACTOR - 1 - nCarried) * BYTES, nCarried * BYTES);
+            memcpy(pOut + nCarried * BYTES, pIn, nBytes - nCarried * BYTES);
+        }
+    }
+
+    if (nInFrames >= FACTOR - 1) {
+        memcpy(state.history, pIn + static_cast<size_t>(nInFrames - (FACTOR - 1)) * BYTES, (FACTOR - 1) * BYTES);
+        state.nPosition = static_cast<uint32_t>((state.nPosition + static_cast<uint64_t>(nInFrames)) % FACTOR);
+    }
+    else {
+        RepackAdvance(state, pIn, nInFrames);
+    }
+    return nOutFrames;
+}
+
+template <uint32_t FACTOR>
+static inline RepackKernel RepackKernelForFactor(uint32_t nBlockAlign) {
+    switch (nBlockAlign) {
+    case 1: return RepackFramesFixed<1, FACTOR>;
+    case 2: return RepackFramesFixed<2, FACTOR>;
+    case 3: return RepackFramesFixed<3, FACTOR>;
+    case 4: return RepackFramesFixed<4, FACTOR>;
+    case 5: return RepackFramesFixed<5, FACTOR>;
+    case 6: return RepackFramesFixed<6, FACTOR>;
+    case 7: return RepackFramesFixed<7, FACTOR>;
+    case 8: return RepackFramesFixed<8, FACTOR>;
+    default: return RepackFrames;
+    }
+}
+
+// the kernel for input frames of nBlockAlign bytes multiplexed nFactor to
+// one: specialized for the common factors (2, 4 and 8) and frames of up to
+// one 64-bit sample, RepackFrames itself for the rest
+static inline RepackKernel RepackKernelFor(uint32_t nBlockAlign, uint32_t nFactor) {
+    switch (nFactor) {
+    case 2: return RepackKernelForFactor<2>(nBlockAlign);
+    case 4: return RepackKernelForFactor<4>(nBlockAlign);
+    case 8: return RepackKernelForFactor<8>(nBlockAlign);
+    default: return RepackFrames;
+    }
+}
+
+// ---- offline check ----
+
+struct RepackSimulationResult {
+    uint64_t nTrials;
+    uint64_t nKernelTrials;    // through RepackKernelFor's kernel
+    uint64_t nWideTrials;      // demultiplexed into more than two channels
+    uint64_t nPackets;
+    uint64_t nOddPackets;      // not whole output frames
+    uint64_t nInPlacePackets;  // taken by the fast path
+    uint64_t nFailedTrials;    // output not what a sample at a time model gives
+    uint32_t nPhaseCases;
+    uint32_t nPhaseFailures;   // odd packets changed the phase decision
+    bool bPass;
+};
+
+// repacks random streams in every sample size, mono and wider, multiplexed
+// by factors of 2, 3, 4 and 8 from a random offset, split into packets of
+// random size (empty, single frames, whole output frames or not, both fast
+// and slow path) with the offset changed and frames lost now and then, and
+// checks the output frames against a model that takes one frame at a time.
+// also checks that the phase detector reaches the same decision whatever
+// the packet sizes. half the copies go through RepackFrames and half
+// through RepackKernelFor's kernel
+RepackSimulationResult SimulateRepacking(uint32_t nTrials, uint32_t nSeed);
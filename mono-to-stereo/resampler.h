@@ -0,0 +1,306 @@
+// resampler.h
+
+// asynchronous resampling to absorb clock drift between the capture and
+// render devices
+//
+// AdaptiveResampler is a windowed-sinc interpolator whose ratio can be
+// changed on every call without clicks. DriftController watches how much
+// audio is queued between the two clocks and nudges that ratio so the
+// queue, and so the latency, stays at a fixed target
+//
+// no Windows dependencies; everything works on interleaved float frames
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// ---- interpolator ----
+
+// filter length in input frames and number of precomputed sub-sample phases
+#define RESAMPLER_TAPS 32
+#define RESAMPLER_PHASES 256
+
+class AdaptiveResampler {
+public:
+    AdaptiveResampler() : m_nChannels(0), m_nCapacity(0), m_nBuffered(0), m_fPos(0), m_fRatio(1.0) {}
+
+    // nCapacityFrames bounds how much input can be queued inside the resampler
+    bool Init(uint32_t nChannels, uint32_t nCapacityFrames) {
+        if (nChannels == 0 || nCapacityFrames < 2 * RESAMPLER_TAPS) {
+            return false;
+        }
+
+        m_nChannels = nChannels;
+        m_nCapacity = nCapacityFrames;
+        m_input.assign(static_cast<size_t>(nCapacityFrames) * nChannels, 0.0f);
+        BuildFilter();
+        Reset();
+        return true;
+    }
+
+    // starts over with half a filter of silence as history
+    void Reset() {
+        std::fill(m_input.begin(), m_input.end(), 0.0f);
+        m_nBuffered = RESAMPLER_TAPS / 2;
+        m_fPos = RESAMPLER_TAPS / 2 - 1;
+    }
+
+    // input frames consumed per output frame; > 1 drains the input faster
+    void SetRatio(double fRatio) { m_fRatio = fRatio; }
+    double Ratio() const { return m_fRatio; }
+
+    uint32_t Channels() const { return m_nChannels; }
+
+    // input frames queued but not yet fully consumed
+    uint32_t BufferedFrames() const { return m_nBuffered; }
+
+    // room for more input
+    uint32_t FreeFrames() const { return m_nCapacity - m_nBuffered; }
+
+    // how much more input is needed to produce nOutFrames at the current ratio
+    uint32_t InputFramesNeeded(uint32_t nOutFrames) const {
+        double fLast = m_fPos + m_fRatio * nOutFrames + RESAMPLER_TAPS / 2 + 1;
+        double fNeeded = std::ceil(fLast) - m_nBuffered;
+        return fNeeded > 0 ? static_cast<uint32_t>(fNeeded) : 0;
+    }
+
+    // queues up to nFrames interleaved frames; returns how many fit
+    uint32_t Push(const float *pIn, uint32_t nFrames) {
+        nFrames = (std::min)(nFrames, FreeFrames());
+        memcpy(
+            m_input.data() + static_cast<size_t>(m_nBuffered) * m_nChannels,
+            pIn, static_cast<size_t>(nFrames) * m_nChannels * sizeof(float)
+        );
+        m_nBuffered += nFrames;
+        return nFrames;
+    }
+
+    // produces up to nOutFrames interleaved frames from queued input
+    // returns the number produced; fewer means the input ran out
+    uint32_t Pull(float *pOut, uint32_t nOutFrames) {
+        const uint32_t nHalf = RESAMPLER_TAPS / 2;
+        uint32_t nProduced = 0;
+
+        while (nProduced < nOutFrames) {
+            double fIndex = std::floor(m_fPos);
+            uint32_t nIndex = static_cast<uint32_t>(fIndex);
+            if (nIndex + nHalf >= m_nBuffered) {
+                break;
+            }
+
+            // pick the two nearest phases and blend between them
+            double fPhase = (m_fPos - fIndex) * RESAMPLER_PHASES;
+            uint32_t nPhase = static_cast<uint32_t>(fPhase);
+            float fBlend = static_cast<float>(fPhase - nPhase);
+            const float *pH0 = m_filter.data() + static_cast<size_t>(nPhase) * RESAMPLER_TAPS;
+            const float *pH1 = pH0 + RESAMPLER_TAPS;
+
+            const float *pX = m_input.data() + static_cast<size_t>(nIndex + 1 - nHalf) * m_nChannels;
+            float *pY = pOut + static_cast<size_t>(nProduced) * m_nChannels;
+
+            for (uint32_t c = 0; c < m_nChannels; c++) {
+                float fAcc0 = 0.0f;
+                float fAcc1 = 0.0f;
+                for (uint32_t k = 0; k < RESAMPLER_TAPS; k++) {
+                    float x = pX[static_cast<size_t>(k) * m_nChannels + c];
+                    fAcc0 += pH0[k] * x;
+                    fAcc1 += pH1[k] * x;
+                }
+                pY[c] = fAcc0 + (fAcc1 - fAcc0) * fBlend;
+            }
+
+            m_fPos += m_fRatio;
+            nProduced++;
+        }
+
+        Discard();
+        return nProduced;
+    }
+
+private:
+    // drops input that no future output can reach
+    void Discard() {
+        const uint32_t nHalf = RESAMPLER_TAPS / 2;
+        double fIndex = std::floor(m_fPos);
+        if (fIndex < nHalf) {
+            return;
+        }
+
+        uint32_t nDrop = (std::min)(static_cast<uint32_t>(fIndex) + 1 - nHalf, m_nBuffered);
+        if (nDrop == 0) {
+            return;
+        }
+
+        memmove(
+            m_input.data(),
+            m_input.data() + static_cast<size_t>(nDrop) * m_nChannels,
+            static_cast<size_t>(m_nBuffered - nDrop) * m_nChannels * sizeof(float)
+        );
+        m_nBuffered -= nDrop;
+        m_fPos -= nDrop;
+    }
+
+    // Kaiser-windowed sinc, one row per phase plus a guard row so phase
+    // RESAMPLER_PHASES - 1 can blend into the next whole sample
+    void BuildFilter() {
+        const double fCutoff = 0.45; // of the input rate; leaves headroom for the ratio swing
+        const double fBeta = 8.0;
+        const double fPi = 3.14159265358979323846;
+
+        m_filter.assign(static_cast<size_t>(RESAMPLER_PHASES + 1) * RESAMPLER_TAPS, 0.0f);
+
+        for (uint32_t p = 0; p <= RESAMPLER_PHASES; p++) {
+            double fFrac = static_cast<double>(p) / RESAMPLER_PHASES;
+            double fSum = 0.0;
+            std::vector<double> row(RESAMPLER_TAPS);
+
+            for (uint32_t k = 0; k < RESAMPLER_TAPS; k++) {
+                // distance from the output point to tap k
+                double t = static_cast<double>(k) - (RESAMPLER_TAPS / 2 - 1) - fFrac;
+                double x = 2.0 * fCutoff * t;
+                double fSinc = std::fabs(x) < 1e-12 ? 1.0 : std::sin(fPi * x) / (fPi * x);
+                double r = t / (RESAMPLER_TAPS / 2);
+                double fWindow = std::fabs(r) >= 1.0 ? 0.0 : BesselI0(fBeta * std::sqrt(1.0 - r * r)) / BesselI0(fBeta);
+                row[k] = fSinc * fWindow;
+                fSum += row[k];
+            }
+
+            // unity gain at DC for every phase
+            for (uint32_t k = 0; k < RESAMPLER_TAPS; k++) {
+                m_filter[static_cast<size_t>(p) * RESAMPLER_TAPS + k] = static_cast<float>(row[k] / fSum);
+            }
+        }
+    }
+
+    static double BesselI0(double x) {
+        double fSum = 1.0;
+        double fTerm = 1.0;
+        for (int k = 1; k < 32; k++) {
+            fTerm *= (x / (2.0 * k)) * (x / (2.0 * k));
+            fSum += fTerm;
+        }
+        return fSum;
+    }
+
+    uint32_t m_nChannels;
+    uint32_t m_nCapacity;
+    uint32_t m_nBuffered;
+    double m_fPos;   // position of the next output in m_input, in frames
+    double m_fRatio;
+    std::vector<float> m_input;
+    std::vector<float> m_filter;
+};
+
+// ---- controller ----
+
+// default limit on how far the ratio may move from 1: twice the largest
+// clock skew it is meant to follow, so there is still room to pull the
+// latency back to the target at that skew
+#define DRIFT_MAX_PPM 2000.0
+#define DRIFT_MAX_SKEW_PPM 1000.0
+
+class DriftController {
+public:
+    DriftController()
+        : m_fTarget(0), m_fRate(0), m_fMaxDeviation(DRIFT_MAX_PPM * 1e-6)
+        , m_fFiltered(0), m_fIntegral(0), m_fRatio(1.0), m_bPrimed(false) {}
+
+    // fTargetFrames is the queue depth to hold; fSampleRate is frames per second
+    void Init(double fTargetFrames, double fSampleRate, double fMaxPpm = DRIFT_MAX_PPM) {
+        m_fTarget = fTargetFrames;
+        m_fRate = fSampleRate;
+        m_fMaxDeviation = fMaxPpm * 1e-6;
+        m_fFiltered = fTargetFrames;
+        m_fIntegral = 0;
+        m_fRatio = 1.0;
+        m_bPrimed = false;
+    }
+
+    // call once per render period with the current queue depth and the
+    // number of frames rendered since the last call; returns the new ratio
+    double Update(double fQueuedFrames, uint32_t nElapsedFrames) {
+        if (nElapsedFrames == 0 || m_fRate <= 0) {
+            return m_fRatio;
+        }
+
+        double dt = nElapsedFrames / m_fRate;
+
+        // the queue level jumps by a whole packet at a time, so smooth it
+        // over about a second before reacting
+        const double fSmoothing = 1.0;
+        double fAlpha = dt / (fSmoothing + dt);
+        m_fFiltered += (fQueuedFrames - m_fFiltered) * fAlpha;
+
+        // PI control on the latency error in seconds
+        //  - 10 ms of error asks for 500 ppm straight away
+        //  - the integral term learns the real clock offset; its gain gives
+        //    a damping ratio of about 0.7 so the latency settles without
+        //    ringing in a couple of minutes
+        const double fKp = 0.05;
+        const double fKi = (fKp / 1.4) * (fKp / 1.4);
+        double fError = (m_fFiltered - m_fTarget) / m_fRate;
+
+        m_fIntegral += fError * dt;
+        double fIntegralLimit = m_fMaxDeviation / fKi;
+        m_fIntegral = (std::min)((std::max)(m_fIntegral, -fIntegralLimit), fIntegralLimit);
+
+        double fDeviation = fKp * fError + fKi * m_fIntegral;
+        fDeviation = (std::min)((std::max)(fDeviation, -m_fMaxDeviation), m_fMaxDeviation);
+
+        m_fRatio = 1.0 + fDeviation;
+        return m_fRatio;
+    }
+
+    double Ratio() const { return m_fRatio; }
+    double TargetFrames() const { return m_fTarget; }
+    double FilteredFrames() const { return m_fFiltered; }
+
+    // the consumer shouldn't start pulling until the queue first reaches
+    // the target, otherwise the controller spends its range filling it
+    bool Primed(double fQueuedFrames) {
+        if (!m_bPrimed && fQueuedFrames >= m_fTarget) {
+            m_bPrimed = true;
+        }
+        return m_bPrimed;
+    }
+
+    bool IsPrimed() const { return m_bPrimed; }
+
+    // how much of the queue to drop rather than drain a ms a second: it
+    // first fills up to a packet over the target, and a stall leaves it a
+    // whole stall deeper, which past twice the target is cut back to it.
+    // bPriming is whether this is the call that primed it; the controller
+    // is then told the new depth through Resync
+    double Excess(double fQueuedFrames, bool bPriming) const {
+        if (!m_bPrimed || (!bPriming && fQueuedFrames <= 2 * m_fTarget)) {
+            return 0;
+        }
+        return (std::max)(fQueuedFrames - m_fTarget, 0.0);
+    }
+
+    void Resync(double fQueuedFrames) { m_fFiltered = fQueuedFrames; }
+
+    // moves the queue depth to hold; the controller gets there at its own
+    // pace, unless bRefill is set, in which case the consumer stops pulling
+    // until the queue reaches it, the way it does at the start
+    void Retarget(double fTargetFrames, bool bRefill) {
+        m_fTarget = fTargetFrames;
+        if (bRefill) {
+            m_fFiltered = fTargetFrames;
+            m_bPrimed = false;
+        }
+    }
+
+private:
+    double m_fTarget;
+    double m_fRate;
+    double m_fMaxDeviation;
+    double m_fFiltered;
+    double m_fIntegral;
+    double m_fRatio;
+    bool m_bPrimed;
+};
@@ -0,0 +1,242 @@
+// ring.h
+
+// lock-free single-producer/single-consumer ring of fixed-size frames
+//
+// the producer (capture thread) and the consumer (render thread) only ever
+// touch their own index, so neither side can block the other. both sides
+// can borrow contiguous regions of the ring directly so data can be written
+// in place instead of being staged somewhere else first
+//
+// no Windows dependencies; usable without any audio device
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+struct RingStats {
+    uint32_t nCapacityFrames;
+    uint32_t nFillFrames;       // frames queued right now
+    uint32_t nMaxFillFrames;    // high water mark
+    uint32_t nMinFillFrames;    // low water mark seen by the consumer
+    uint64_t nOverrunFrames;    // frames the producer had to drop
+    uint64_t nUnderrunFrames;   // frames the consumer wanted but didn't get
+    uint64_t nTornFrames;       // frames the producer overwrote while the consumer
+                                // was reading them, played as silence instead
+    uint32_t nOverruns;
+    uint32_t nUnderruns;
+    uint32_t nTornReads;
+};
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable: 4324) // structure was padded due to alignment specifier
+#endif
+
+class SpscRing {
+public:
+    SpscRing() : m_nFrameBytes(0), m_nCapacity(0), m_nMask(0) {
+        m_nHead.store(0, std::memory_order_relaxed);
+        m_nTail.store(0, std::memory_order_relaxed);
+        ResetCounters();
+    }
+
+    // capacity is rounded up to a power of two
+    // not thread safe; call before handing the ring to the threads
+    bool Init(uint32_t nFrameBytes, uint32_t nMinCapacityFrames) {
+        if (nFrameBytes == 0 || nMinCapacityFrames == 0 || nMinCapacityFrames > (1u << 30)) {
+            return false;
+        }
+
+        uint32_t nCapacity = 1;
+        while (nCapacity < nMinCapacityFrames) {
+            nCapacity <<= 1;
+        }
+
+        m_buffer.assign(static_cast<size_t>(nCapacity) * nFrameBytes, 0);
+        m_nFrameBytes = nFrameBytes;
+        m_nCapacity = nCapacity;
+        m_nMask = nCapacity - 1;
+        m_nHead.store(0, std::memory_order_relaxed);
+        m_nTail.store(0, std::memory_order_relaxed);
+        ResetCounters();
+        return true;
+    }
+
+    uint32_t FrameBytes() const { return m_nFrameBytes; }
+    uint32_t CapacityFrames() const { return m_nCapacity; }
+
+    // may be called from either side; the answer is a lower bound for the
+    // consumer and an upper bound for the producer
+    uint32_t FillFrames() const {
+        return m_nHead.load(std::memory_order_acquire) - m_nTail.load(std::memory_order_acquire);
+    }
+
+    // ---- producer side ----
+
+    uint32_t WriteAvailable() const {
+        return m_nCapacity - (m_nHead.load(std::memory_order_relaxed) - m_nTail.load(std::memory_order_acquire));
+    }
+
+    // borrows the next contiguous writable region, which may be shorter than
+    // WriteAvailable() if it wraps; returns the number of frames in the region
+    uint32_t BeginWrite(uint8_t **ppData) {
+        uint32_t nHead = m_nHead.load(std::memory_order_relaxed);
+        uint32_t nFree = m_nCapacity - (nHead - m_nTail.load(std::memory_order_acquire));
+        uint32_t nOffset = nHead & m_nMask;
+        *ppData = m_buffer.data() + static_cast<size_t>(nOffset) * m_nFrameBytes;
+        return (std::min)(nFree, m_nCapacity - nOffset);
+    }
+
+    void CommitWrite(uint32_t nFrames) {
+        uint32_t nHead = m_nHead.load(std::memory_order_relaxed) + nFrames;
+        m_nHead.store(nHead, std::memory_order_release);
+
+        uint32_t nFill = nHead - m_nTail.load(std::memory_order_relaxed);
+        if (nFill > m_nMaxFill.load(std::memory_order_relaxed)) {
+            m_nMaxFill.store(nFill, std::memory_order_relaxed);
+        }
+    }
+
+    // running count of frames ever committed, wrapping at 2^32; the next
+    // frame written will have this position
+    uint32_t WritePosition() const {
+        return m_nHead.load(std::memory_order_relaxed);
+    }
+
+    // the producer couldn't fit nFrames and threw them away
+    void NoteOverrun(uint32_t nFrames) {
+        m_nOverrunFrames.fetch_add(nFrames, std::memory_order_relaxed);
+        m_nOverruns.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // copies as many frames as fit; returns the number written
+    uint32_t Write(const uint8_t *pData, uint32_t nFrames) {
+        uint32_t nWritten = 0;
+        while (nWritten < nFrames) {
+            uint8_t *pDest;
+            uint32_t n = (std::min)(BeginWrite(&pDest), nFrames - nWritten);
+            if (n == 0) {
+                break;
+            }
+            memcpy(pDest, pData + static_cast<size_t>(nWritten) * m_nFrameBytes, static_cast<size_t>(n) * m_nFrameBytes);
+            CommitWrite(n);
+            nWritten += n;
+        }
+        if (nWritten < nFrames) {
+            NoteOverrun(nFrames - nWritten);
+        }
+        return nWritten;
+    }
+
+    // ---- consumer side ----
+
+    uint32_t ReadAvailable() const {
+        return m_nHead.load(std::memory_order_acquire) - m_nTail.load(std::memory_order_relaxed);
+    }
+
+    // borrows the next contiguous readable region
+    uint32_t BeginRead(const uint8_t **ppData) {
+        uint32_t nTail = m_nTail.load(std::memory_order_relaxed);
+        uint32_t nFill = m_nHead.load(std::memory_order_acquire) - nTail;
+        uint32_t nOffset = nTail & m_nMask;
+        *ppData = m_buffer.data() + static_cast<size_t>(nOffset) * m_nFrameBytes;
+        return (std::min)(nFill, m_nCapacity - nOffset);
+    }
+
+    // always true; the producer never writes over what the consumer has
+    // borrowed here, unlike in a FanoutRing
+    bool CommitRead(uint32_t nFrames) {
+        m_nTail.store(m_nTail.load(std::memory_order_relaxed) + nFrames, std::memory_order_release);
+        return true;
+    }
+
+    // position of the next frame to be read, see WritePosition
+    uint32_t ReadPosition() const {
+        return m_nTail.load(std::memory_order_relaxed);
+    }
+
+    // the consumer wanted nFrames more than were queued
+    void NoteUnderrun(uint32_t nFrames) {
+        m_nUnderrunFrames.fetch_add(nFrames, std::memory_order_relaxed);
+        m_nUnderruns.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // records the fill level the consumer saw before draining
+    void NoteReadFill(uint32_t nFill) {
+        if (nFill < m_nMinFill.load(std::memory_order_relaxed)) {
+            m_nMinFill.store(nFill, std::memory_order_relaxed);
+        }
+    }
+
+    // copies up to nFrames out of the ring; returns the number read
+    uint32_t Read(uint8_t *pData, uint32_t nFrames) {
+        uint32_t nRead = 0;
+        while (nRead < nFrames) {
+            const uint8_t *pSrc;
+            uint32_t n = (std::min)(BeginRead(&pSrc), nFrames - nRead);
+            if (n == 0) {
+                break;
+            }
+            memcpy(pData + static_cast<size_t>(nRead) * m_nFrameBytes, pSrc, static_cast<size_t>(n) * m_nFrameBytes);
+            CommitRead(n);
+            nRead += n;
+        }
+        return nRead;
+    }
+
+    // ---- either side ----
+
+    RingStats GetStats() const {
+        RingStats stats;
+        stats.nCapacityFrames = m_nCapacity;
+        stats.nFillFrames = FillFrames();
+        stats.nMaxFillFrames = m_nMaxFill.load(std::memory_order_relaxed);
+        stats.nMinFillFrames = m_nMinFill.load(std::memory_order_relaxed);
+        stats.nOverrunFrames = m_nOverrunFrames.load(std::memory_order_relaxed);
+        stats.nUnderrunFrames = m_nUnderrunFrames.load(std::memory_order_relaxed);
+        stats.nOverruns = m_nOverruns.load(std::memory_order_relaxed);
+        stats.nUnderruns = m_nUnderruns.load(std::memory_order_relaxed);
+        stats.nTornFrames = 0;
+        stats.nTornReads = 0;
+        return stats;
+    }
+
+private:
+    SpscRing(const SpscRing &) = delete;
+    SpscRing &operator=(const SpscRing &) = delete;
+
+    void ResetCounters() {
+        m_nMaxFill.store(0, std::memory_order_relaxed);
+        m_nMinFill.store(UINT32_MAX, std::memory_order_relaxed);
+        m_nOverrunFrames.store(0, std::memory_order_relaxed);
+        m_nUnderrunFrames.store(0, std::memory_order_relaxed);
+        m_nOverruns.store(0, std::memory_order_relaxed);
+        m_nUnderruns.store(0, std::memory_order_relaxed);
+    }
+
+    std::vector<uint8_t> m_buffer;
+    uint32_t m_nFrameBytes;
+    uint32_t m_nCapacity;
+    uint32_t m_nMask;
+
+    // indices run freely and wrap at 2^32; keep them on separate cache lines
+    alignas(64) std::atomic<uint32_t> m_nHead; // written by producer
+    alignas(64) std::atomic<uint32_t> m_nTail; // written by consumer
+
+    // counters; each is only written by one side
+    alignas(64) std::atomic<uint32_t> m_nMaxFill;
+    std::atomic<uint64_t> m_nOverrunFrames;
+    std::atomic<uint32_t> m_nOverruns;
+    alignas(64) std::atomic<uint32_t> m_nMinFill;
+    std::atomic<uint64_t> m_nUnderrunFrames;
+    std::atomic<uint32_t> m_nUnderruns;
+};
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
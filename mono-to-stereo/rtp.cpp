@@ -0,0 +1,1145 @@
+// rtp.cpp
+
+#include "rtp.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+// how long a stretch of playback the jitter buffer watches for a sender
+// running ahead, by the shallowest it got over that time
+#define RTP_DRIFT_WINDOW_MS 1000
+
+// the player wakes up at least this often even if the sink stops signalling
+#define RTP_PLAY_WAIT_MS 2000
+
+static const struct {
+    const char *szName;
+    RtpEncoding encoding;
+} g_encodings[] = {
+    { "L16", RTP_L16 },
+    { "l16", RTP_L16 },
+    { "L24", RTP_L24 },
+    { "l24", RTP_L24 },
+};
+
+bool ParseRtpEncodingName(const char *szName, RtpEncoding &encoding) {
+    for (const auto &known : g_encodings) {
+        if (0 == strcmp(known.szName, szName)) {
+            encoding = known.encoding;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *RtpEncodingName(RtpEncoding encoding) {
+    return RTP_L24 == encoding ? "L24" : "L16";
+}
+
+AudioFormat RtpStreamFormat(RtpEncoding encoding, uint32_t nRate, uint16_t nChannels) {
+    return MakeAudioFormat(AUDIOFORMAT_TAG_PCM, nChannels, nRate, RTP_L24 == encoding ? 24 : 16);
+}
+
+static uint8_t PayloadTypeOf(RtpEncoding encoding) {
+    return RTP_L24 == encoding ? RTP_PAYLOAD_TYPE_L24 : RTP_PAYLOAD_TYPE_L16;
+}
+
+// the wire is big-endian and memory little-endian, so each sample is
+// reversed in place on the way in and on the way out
+static void SwapSampleBytes(uint8_t *pData, size_t nSamples, uint32_t nBytes) {
+    if (2 == nBytes) {
+        for (size_t i = 0; i < nSamples; i++, pData += 2) {
+            std::swap(pData[0], pData[1]);
+        }
+    }
+    else {
+        for (size_t i = 0; i < nSamples; i++, pData += 3) {
+            std::swap(pData[0], pData[2]);
+        }
+    }
+}
+
+static void PutBigEndian(uint8_t *pOut, uint64_t nValue, uint32_t nBytes) {
+    for (uint32_t i = 0; i < nBytes; i++) {
+        pOut[i] = static_cast<uint8_t>(nValue >> (8 * (nBytes - 1 - i)));
+    }
+}
+
+static uint64_t GetBigEndian(const uint8_t *pIn, uint32_t nBytes) {
+    uint64_t nValue = 0;
+    for (uint32_t i = 0; i < nBytes; i++) {
+        nValue = (nValue << 8) | pIn[i];
+    }
+    return nValue;
+}
+
+uint32_t RtpWriteHeader(const RtpHeader &header, uint8_t *pOut) {
+    pOut[0] = static_cast<uint8_t>((RTP_VERSION << 6) | (header.bHasCaptureTime ? 0x10 : 0));
+    pOut[1] = static_cast<uint8_t>((header.bMarker ? 0x80 : 0) | (header.nPayloadType & 0x7F));
+    PutBigEndian(pOut + 2, header.nSequence, 2);
+    PutBigEndian(pOut + 4, header.nTimestamp, 4);
+    PutBigEndian(pOut + 8, header.nSsrc, 4);
+    if (!header.bHasCaptureTime) {
+        return RTP_HEADER_BYTES;
+    }
+
+    // one element: the ID and length - 1 in a byte, then the time
+    uint8_t *pExtension = pOut + RTP_HEADER_BYTES;
+    PutBigEndian(pExtension, RTP_EXTENSION_PROFILE, 2);
+    PutBigEndian(pExtension + 2, (RTP_EXTENSION_BYTES - 4) / 4, 2);
+    pExtension[4] = static_cast<uint8_t>((RTP_CAPTURE_TIME_ID << 4) | (8 - 1));
+    PutBigEndian(pExtension + 5, static_cast<uint64_t>(header.hnsCapture), 8);
+    memset(pExtension + 13, 0, RTP_EXTENSION_BYTES - 13);
+    return RTP_HEADER_BYTES + RTP_EXTENSION_BYTES;
+}
+
+bool RtpParsePacket(const uint8_t *pData, uint32_t nBytes, RtpHeader &header, uint32_t &nPayloadOffset, uint32_t &nPayloadBytes) {
+    if (nBytes < RTP_HEADER_BYTES || RTP_VERSION != (pData[0] >> 6)) {
+        return false;
+    }
+
+    const bool bPadding = 0 != (pData[0] & 0x20);
+    const bool bExtension = 0 != (pData[0] & 0x10);
+    const uint32_t nCsrcs = pData[0] & 0x0F;
+
+    header.bMarker = 0 != (pData[1] & 0x80);
+    header.nPayloadType = pData[1] & 0x7F;
+    header.nSequence = static_cast<uint16_t>(GetBigEndian(pData + 2, 2));
+    header.nTimestamp = static_cast<uint32_t>(GetBigEndian(pData + 4, 4));
+    header.nSsrc = static_cast<uint32_t>(GetBigEndian(pData + 8, 4));
+    header.bHasCaptureTime = false;
+    header.hnsCapture = 0;
+
+    uint32_t nOffset = RTP_HEADER_BYTES + 4 * nCsrcs;
+    if (bExtension) {
+        if (nOffset + 4 > nBytes) {
+            return false;
+        }
+        uint32_t nProfile = static_cast<uint32_t>(GetBigEndian(pData + nOffset, 2));
+        uint32_t nLength = 4 * static_cast<uint32_t>(GetBigEndian(pData + nOffset + 2, 2));
+        if (nOffset + 4 + nLength > nBytes) {
+            return false;
+        }
+
+        // one-byte elements; zero bytes are padding and ID 15 ends the list.
+        // anyone else's extensions are skipped
+        if (RTP_EXTENSION_PROFILE == nProfile) {
+            const uint8_t *p = pData + nOffset + 4;
+            const uint8_t *pEnd = p + nLength;
+            while (p < pEnd) {
+                if (0 == *p) {
+                    p++;
+                    continue;
+                }
+                uint32_t nId = *p >> 4;
+                uint32_t nElementBytes = (*p & 0x0F) + 1u;
+                if (15 == nId || p + 1 + nElementBytes > pEnd) {
+                    break;
+                }
+                if (RTP_CAPTURE_TIME_ID == nId && 8 == nElementBytes) {
+                    header.bHasCaptureTime = true;
+                    header.hnsCapture = static_cast<int64_t>(GetBigEndian(p + 1, 8));
+                }
+                p += 1 + nElementBytes;
+            }
+        }
+        nOffset += 4 + nLength;
+    }
+
+    uint32_t nEnd = nBytes;
+    if (bPadding) {
+        uint32_t nPadding = pData[nBytes - 1];
+        if (0 == nPadding || nOffset + nPadding > nBytes) {
+            return false;
+        }
+        nEnd -= nPadding;
+    }
+    if (nOffset > nEnd) {
+        return false;
+    }
+
+    nPayloadOffset = nOffset;
+    nPayloadBytes = nEnd - nOffset;
+    return true;
+}
+
+// ---- sending ----
+
+RtpSender::RtpSender(StatsClock &clock, MessageSink &messages)
+    : m_clock(clock)
+    , m_messages(messages)
+    , m_bBegun(false)
+    , m_format()
+    , m_wireFormat()
+    , m_nPacketFrames(0)
+    , m_nPacketBytes(0)
+    , m_nQueued(0)
+    , m_nFilled(0)
+    , m_nSequence(0)
+    , m_nTimestamp(0)
+    , m_nSsrc(0)
+    , m_bMarkNext(false)
+{
+    memset(m_datagrams, 0, sizeof(m_datagrams));
+    m_nPackets.store(0, std::memory_order_relaxed);
+    m_nBytes.store(0, std::memory_order_relaxed);
+    m_nSendCalls.store(0, std::memory_order_relaxed);
+    m_nDroppedPackets.store(0, std::memory_order_relaxed);
+    m_nRefusedPackets.store(0, std::memory_order_relaxed);
+    m_nFailedPackets.store(0, std::memory_order_relaxed);
+}
+
+RtpSender::~RtpSender() {
+    Close();
+}
+
+bool RtpSender::Open(const std::string &destination, const RtpSendOptions &options, std::string &error) {
+    if (!(options.fPacketMs > 0) || options.nMaxBatch < 1 || options.nMaxBatch > UDP_MAX_BATCH) {
+        error = "packet time must be above 0 and batches 1 to " + std::to_string(UDP_MAX_BATCH) + " packets";
+        return false;
+    }
+
+    UdpAddress address;
+    if (!ParseUdpAddress(destination, true, address, error)) {
+        return false;
+    }
+    if (!m_socket.Connect(address, error)) {
+        error = destination + ": " + error;
+        return false;
+    }
+
+    m_destination = destination;
+    m_options = options;
+
+    // where the numbering starts only has to differ from run to run
+    uint64_t nSeed = static_cast<uint64_t>(m_clock.NowHns()) * 6364136223846793005ull + 1442695040888963407ull;
+    m_nSsrc = static_cast<uint32_t>(nSeed >> 32);
+    m_nSequence = static_cast<uint16_t>(nSeed >> 16);
+    m_nTimestamp = static_cast<uint32_t>(nSeed);
+    return true;
+}
+
+bool RtpSender::Begin(const AudioFormat &format, std::string &error) {
+    if (!m_socket.IsOpen()) {
+        error = "the network stream isn't open";
+        return false;
+    }
+
+    if (m_bBegun) {
+        if (format.wFormatTag != m_format.wFormatTag || format.nChannels != m_format.nChannels ||
+            format.nSamplesPerSec != m_format.nSamplesPerSec || format.wBitsPerSample != m_format.wBitsPerSample) {
+            error = "the stream changed format, which the network stream can't follow";
+            return false;
+        }
+        m_bMarkNext = true;
+        return true;
+    }
+
+    SampleType type = SampleTypeOf(format);
+    SampleType wireType = RTP_L24 == m_options.encoding ? SAMPLE_INT24 : SAMPLE_INT16;
+    if (SAMPLE_UNKNOWN == type || !m_converter.Init(type, wireType, true)) {
+        error = std::string("can't send ") + SampleTypeName(type) + " as " + RtpEncodingName(m_options.encoding);
+        return false;
+    }
+    m_wireFormat = RtpStreamFormat(m_options.encoding, format.nSamplesPerSec, format.nChannels);
+
+    // as many frames as the packet time asks for, as long as they fit
+    uint32_t nMaxFrames = RTP_MAX_PAYLOAD_BYTES / m_wireFormat.nBlockAlign;
+    uint32_t nFrames = static_cast<uint32_t>((std::max)(1L, std::lround(format.nSamplesPerSec * m_options.fPacketMs / 1000.0)));
+    if (nFrames > nMaxFrames) {
+        m_messages.Log(
+            "Sending %.2f ms packets instead of %.2f ms, so each fits an Ethernet frame",
+            nMaxFrames * 1000.0 / format.nSamplesPerSec, m_options.fPacketMs
+        );
+        nFrames = nMaxFrames;
+    }
+    m_nPacketFrames = nFrames;
+    m_nPacketBytes = RTP_HEADER_BYTES + RTP_EXTENSION_BYTES + nFrames * m_wireFormat.nBlockAlign;
+
+    // a batch, and the packet being filled behind it
+    m_memory.reset(new uint8_t[static_cast<size_t>(m_nPacketBytes) * (UDP_MAX_BATCH + 1)]);
+    for (uint32_t i = 0; i < UDP_MAX_BATCH; i++) {
+        m_datagrams[i].pData = m_memory.get() + static_cast<size_t>(i) * m_nPacketBytes;
+        m_datagrams[i].nBytes = m_nPacketBytes;
+    }
+
+    m_format = format;
+    m_bBegun = true;
+    m_bMarkNext = true;
+    return true;
+}
+
+void RtpSender::Write(const uint8_t *pData, uint32_t nFrames, int64_t hnsCapture) {
+    const uint32_t nHeaderBytes = RTP_HEADER_BYTES + RTP_EXTENSION_BYTES;
+    const uint32_t nChannels = m_format.nChannels;
+    const uint32_t nWireBlockAlign = m_wireFormat.nBlockAlign;
+    const double fHnsPerFrame = static_cast<double>(HNS_PER_SECOND) / m_format.nSamplesPerSec;
+
+    uint32_t nDone = 0;
+    while (nDone < nFrames) {
+        uint8_t *pPacket = m_memory.get() + static_cast<size_t>(m_nQueued) * m_nPacketBytes;
+
+        // the header goes in with the first frame, which is when it was captured
+        if (0 == m_nFilled) {
+            RtpHeader header;
+            header.nPayloadType = PayloadTypeOf(m_options.encoding);
+            header.bMarker = m_bMarkNext;
+            header.nSequence = m_nSequence++;
+            header.nTimestamp = m_nTimestamp;
+            header.nSsrc = m_nSsrc;
+            header.bHasCaptureTime = true;
+            header.hnsCapture = 0 == hnsCapture ? 0 : hnsCapture + std::llround(nDone * fHnsPerFrame);
+            RtpWriteHeader(header, pPacket);
+            m_nTimestamp += m_nPacketFrames;
+            m_bMarkNext = false;
+        }
+
+        uint32_t n = (std::min)(nFrames - nDone, m_nPacketFrames - m_nFilled);
+        uint8_t *pPayload = pPacket + nHeaderBytes + static_cast<size_t>(m_nFilled) * nWireBlockAlign;
+        m_converter.Convert(pData + static_cast<size_t>(nDone) * m_format.nBlockAlign, pPayload, static_cast<size_t>(n) * nChannels);
+        SwapSampleBytes(pPayload, static_cast<size_t>(n) * nChannels, m_wireFormat.wBitsPerSample / 8);
+        m_nFilled += n;
+        nDone += n;
+
+        if (m_nFilled == m_nPacketFrames) {
+            m_nFilled = 0;
+            m_nQueued++;
+            if (m_nQueued == m_options.nMaxBatch) {
+                SendQueued();
+            }
+        }
+    }
+
+    if (0 != m_nQueued) {
+        SendQueued();
+    }
+}
+
+void RtpSender::SendQueued() {
+    int64_t hnsStart = m_clock.NowHns();
+    std::string error;
+    UdpSendResult result = m_socket.Send(m_datagrams, m_nQueued, error);
+    m_sendTime.Record(m_clock.NowHns() - hnsStart);
+
+    m_nPackets.store(m_nPackets.load(std::memory_order_relaxed) + result.nSent, std::memory_order_relaxed);
+    m_nBytes.store(m_nBytes.load(std::memory_order_relaxed) + static_cast<uint64_t>(result.nSent) * m_nPacketBytes, std::memory_order_relaxed);
+    m_nSendCalls.store(m_nSendCalls.load(std::memory_order_relaxed) + result.nCalls, std::memory_order_relaxed);
+    m_nRefusedPackets.store(m_nRefusedPackets.load(std::memory_order_relaxed) + result.nRefused, std::memory_order_relaxed);
+    if (result.bFailed) {
+        m_messages.Error("Network stream to %s: %s", m_destination.c_str(), error.c_str());
+        m_nFailedPackets.store(m_nFailedPackets.load(std::memory_order_relaxed) + result.nDropped, std::memory_order_relaxed);
+    }
+    else {
+        m_nDroppedPackets.store(m_nDroppedPackets.load(std::memory_order_relaxed) + result.nDropped, std::memory_order_relaxed);
+    }
+
+    // the packet being filled moves up to the front, header and all
+    if (0 != m_nFilled) {
+        memmove(m_memory.get(), m_memory.get() + static_cast<size_t>(m_nQueued) * m_nPacketBytes, m_nPacketBytes);
+    }
+    m_nQueued = 0;
+}
+
+void RtpSender::Close() {
+    m_socket.Close();
+}
+
+RtpSendStats RtpSender::Stats() const {
+    RtpSendStats stats;
+    stats.nPackets = m_nPackets.load(std::memory_order_relaxed);
+    stats.nBytes = m_nBytes.load(std::memory_order_relaxed);
+    stats.nSendCalls = m_nSendCalls.load(std::memory_order_relaxed);
+    stats.nDroppedPackets = m_nDroppedPackets.load(std::memory_order_relaxed);
+    stats.nRefusedPackets = m_nRefusedPackets.load(std::memory_order_relaxed);
+    stats.nFailedPackets = m_nFailedPackets.load(std::memory_order_relaxed);
+    stats.sendTime = m_sendTime.Summary();
+    return stats;
+}
+
+// ---- receiving ----
+
+// the first stream's sequence numbers are extended from here, so late
+// packets never wrap below zero
+#define RTP_FIRST_EXTENDED_SEQUENCE 0x10000ull
+
+static void AddRelaxed(std::atomic<uint64_t> &counter, uint64_t n) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+RtpReceiver::RtpReceiver(StatsClock &clock, MessageSink &messages)
+    : m_clock(clock)
+    , m_messages(messages)
+    , m_format()
+    , m_nPayloadType(0)
+    , m_bHaveStream(false)
+    , m_nSsrc(0)
+    , m_nHighest(0)
+    , m_nStreamStart(0)
+    , m_nPacketBytes(0)
+    , m_nStreamsSeen(0)
+    , m_bPlaying(false)
+    , m_nNext(0)
+    , m_nOffset(0)
+    , m_nPacketFramesSeen(0)
+    , m_nJitterPackets(1)
+    , m_nWindowFrames(0)
+    , m_nShallowest(0)
+{
+    m_nPacketFrames.store(0, std::memory_order_relaxed);
+    m_nPublishedHighest.store(0, std::memory_order_relaxed);
+    m_nPublishedStart.store(0, std::memory_order_relaxed);
+    m_nStreams.store(0, std::memory_order_relaxed);
+    m_nPlaying.store(0, std::memory_order_relaxed);
+    m_nPackets.store(0, std::memory_order_relaxed);
+    m_nReceiveCalls.store(0, std::memory_order_relaxed);
+    m_nBatches.store(0, std::memory_order_relaxed);
+    m_nReorderedPackets.store(0, std::memory_order_relaxed);
+    m_nDuplicatePackets.store(0, std::memory_order_relaxed);
+    m_nLatePackets.store(0, std::memory_order_relaxed);
+    m_nOverflowPackets.store(0, std::memory_order_relaxed);
+    m_nInvalidPackets.store(0, std::memory_order_relaxed);
+    m_nLostPackets.store(0, std::memory_order_relaxed);
+    m_nSkippedPackets.store(0, std::memory_order_relaxed);
+    m_nUnderruns.store(0, std::memory_order_relaxed);
+    m_nFrames.store(0, std::memory_order_relaxed);
+    m_nSilentFrames.store(0, std::memory_order_relaxed);
+    m_bStop.store(false, std::memory_order_relaxed);
+}
+
+RtpReceiver::~RtpReceiver() {
+    Stop();
+}
+
+bool RtpReceiver::Open(const std::string &address, const RtpReceiveOptions &options, std::string &error) {
+    if (0 == options.nRate || 0 == options.nChannels || options.nChannels > AUDIOFORMAT_MAX_CHANNELS || !(options.fJitterMs >= 0)) {
+        error = "the stream needs a rate, 1 to " + std::to_string(AUDIOFORMAT_MAX_CHANNELS) + " channels and a delay of 0 ms or more";
+        return false;
+    }
+
+    UdpAddress bindAddress;
+    if (!ParseUdpAddress(address, false, bindAddress, error)) {
+        return false;
+    }
+    if (!m_socket.Bind(bindAddress, RTP_RECEIVE_BUFFER_BYTES, error)) {
+        error = address + ": " + error;
+        return false;
+    }
+
+    m_options = options;
+    m_format = RtpStreamFormat(options.encoding, options.nRate, options.nChannels);
+    m_nPayloadType = PayloadTypeOf(options.encoding);
+    m_slots.reset(new Slot[RTP_JITTER_PACKETS]);
+    for (uint32_t i = 0; i < RTP_JITTER_PACKETS; i++) {
+        m_slots[i].nSequence.store(0, std::memory_order_relaxed);
+        m_slots[i].hnsCapture = 0;
+    }
+    return true;
+}
+
+void RtpReceiver::Start() {
+    m_bStop.store(false, std::memory_order_relaxed);
+    m_thread = std::thread(&RtpReceiver::ReceiveThread, this);
+}
+
+void RtpReceiver::Stop() {
+    m_bStop.store(true, std::memory_order_release);
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void RtpReceiver::ReceiveThread() {
+    std::unique_ptr<uint8_t[]> memory(new uint8_t[static_cast<size_t>(UDP_MAX_BATCH) * RTP_MAX_PACKET_BYTES]);
+    UdpBuffer buffers[UDP_MAX_BATCH];
+    for (uint32_t i = 0; i < UDP_MAX_BATCH; i++) {
+        buffers[i].pData = memory.get() + static_cast<size_t>(i) * RTP_MAX_PACKET_BYTES;
+        buffers[i].nCapacity = RTP_MAX_PACKET_BYTES;
+        buffers[i].nBytes = 0;
+        buffers[i].bTruncated = false;
+    }
+
+    while (!m_bStop.load(std::memory_order_acquire)) {
+        uint32_t nCalls;
+        std::string error;
+        int nReceived = m_socket.Receive(buffers, UDP_MAX_BATCH, RTP_RECEIVE_WAIT_MS, &nCalls, error);
+        AddRelaxed(m_nReceiveCalls, nCalls);
+        if (nReceived < 0) {
+            m_messages.Error("Stopped receiving the network stream: %s", error.c_str());
+            return;
+        }
+        if (0 == nReceived) {
+            continue;
+        }
+
+        AddRelaxed(m_nBatches, 1);
+        int64_t hnsNow = m_clock.NowHns();
+        for (int i = 0; i < nReceived; i++) {
+            if (buffers[i].bTruncated) {
+                AddRelaxed(m_nInvalidPackets, 1);
+                continue;
+            }
+            File(buffers[i].pData, buffers[i].nBytes, hnsNow);
+        }
+    }
+}
+
+void RtpReceiver::File(const uint8_t *pData, uint32_t nBytes, int64_t hnsNow) {
+    RtpHeader header;
+    uint32_t nPayloadOffset;
+    uint32_t nPayloadBytes;
+    if (!RtpParsePacket(pData, nBytes, header, nPayloadOffset, nPayloadBytes) || m_nPayloadType != header.nPayloadType ||
+        0 == nPayloadBytes || nPayloadBytes > RTP_MAX_PAYLOAD_BYTES || 0 != nPayloadBytes % m_format.nBlockAlign) {
+        AddRelaxed(m_nInvalidPackets, 1);
+        return;
+    }
+
+    uint64_t nSequence;
+    if (!m_bHaveStream || header.nSsrc != m_nSsrc) {
+        // a new sender, or the same one started again: numbered well past
+        // anything of the last one, so nothing of it can be taken for the new
+        uint64_t nBase = m_bHaveStream ? m_nHighest + 2 * RTP_JITTER_PACKETS : RTP_FIRST_EXTENDED_SEQUENCE;
+        nSequence = (((nBase >> 16) + 1) << 16) | header.nSequence;
+
+        m_bHaveStream = true;
+        m_nSsrc = header.nSsrc;
+        m_nHighest = nSequence;
+        m_nStreamStart = nSequence;
+        m_nPacketBytes = nPayloadBytes;
+
+        // the reader starts the stream from here on seeing the count change
+        m_nPacketFrames.store(nPayloadBytes / m_format.nBlockAlign, std::memory_order_relaxed);
+        m_nPublishedStart.store(nSequence, std::memory_order_relaxed);
+        m_nStreams.fetch_add(1, std::memory_order_release);
+        m_messages.Log(
+            "Receiving %s from %08x, %u frames a packet",
+            RtpEncodingName(m_options.encoding), header.nSsrc, nPayloadBytes / m_format.nBlockAlign
+        );
+    }
+    else {
+        if (nPayloadBytes != m_nPacketBytes) {
+            AddRelaxed(m_nInvalidPackets, 1);
+            return;
+        }
+
+        // whichever extension of the 16 bit number is nearest the highest
+        int16_t nDelta = static_cast<int16_t>(static_cast<uint16_t>(header.nSequence - static_cast<uint16_t>(m_nHighest)));
+        nSequence = static_cast<uint64_t>(static_cast<int64_t>(m_nHighest) + nDelta);
+    }
+
+    // a slot only takes a packet the reader can't be in the middle of
+    uint64_t nPlaying = (std::max)(m_nPlaying.load(std::memory_order_acquire), m_nStreamStart);
+    if (nSequence < nPlaying) {
+        AddRelaxed(m_nLatePackets, 1);
+        return;
+    }
+    if (nSequence >= nPlaying + RTP_JITTER_PACKETS - 1) {
+        AddRelaxed(m_nOverflowPackets, 1);
+        return;
+    }
+
+    Slot &slot = m_slots[nSequence & (RTP_JITTER_PACKETS - 1)];
+    if (slot.nSequence.load(std::memory_order_relaxed) == nSequence) {
+        AddRelaxed(m_nDuplicatePackets, 1);
+        return;
+    }
+    if (nSequence < m_nHighest) {
+        AddRelaxed(m_nReorderedPackets, 1);
+    }
+
+    memcpy(slot.payload, pData + nPayloadOffset, nPayloadBytes);
+    slot.hnsCapture = header.bHasCaptureTime ? header.hnsCapture : 0;
+    slot.nSequence.store(nSequence, std::memory_order_release);
+    if (0 != slot.hnsCapture) {
+        m_transit.Record(hnsNow - header.hnsCapture);
+    }
+    AddRelaxed(m_nPackets, 1);
+
+    if (nSequence >= m_nHighest) {
+        m_nHighest = nSequence;
+        m_nPublishedHighest.store(nSequence, std::memory_order_release);
+    }
+}
+
+void RtpReceiver::Decode(const Slot &slot, uint32_t nOffset, uint8_t *pOut, uint32_t nFrames) {
+    const size_t nBlockAlign = m_format.nBlockAlign;
+    memcpy(pOut, slot.payload + nOffset * nBlockAlign, nFrames * nBlockAlign);
+    SwapSampleBytes(pOut, static_cast<size_t>(nFrames) * m_format.nChannels, m_format.wBitsPerSample / 8);
+}
+
+void RtpReceiver::Read(uint8_t *pOut, uint32_t nFrames, int64_t hnsHeard) {
+    const size_t nBlockAlign = m_format.nBlockAlign;
+    const double fHnsPerFrame = static_cast<double>(HNS_PER_SECOND) / m_format.nSamplesPerSec;
+    const uint64_t nWindowFrames = static_cast<uint64_t>(m_format.nSamplesPerSec) * RTP_DRIFT_WINDOW_MS / 1000;
+
+    uint32_t nDone = 0;
+    uint64_t nSilent = 0;
+    bool bMeasured = 0 == hnsHeard;
+
+    while (nDone < nFrames) {
+        // a new stream starts over from its first packet
+        uint64_t nStreams = m_nStreams.load(std::memory_order_acquire);
+        if (nStreams != m_nStreamsSeen) {
+            m_nStreamsSeen = nStreams;
+            m_nNext = m_nPublishedStart.load(std::memory_order_relaxed);
+            m_nOffset = 0;
+            m_bPlaying = false;
+            m_nPacketFramesSeen = m_nPacketFrames.load(std::memory_order_relaxed);
+            m_nJitterPackets = (std::max)(1u, static_cast<uint32_t>(std::ceil(m_options.fJitterMs * m_format.nSamplesPerSec / 1000.0 / m_nPacketFramesSeen)));
+            m_nWindowFrames = 0;
+            m_nShallowest = UINT64_MAX;
+            m_nPlaying.store(m_nNext, std::memory_order_release);
+        }
+        if (0 == nStreams) {
+            break;
+        }
+
+        uint64_t nHighest = m_nPublishedHighest.load(std::memory_order_acquire);
+        uint64_t nBuffered = nHighest < m_nNext ? 0 : nHighest - m_nNext + 1;
+
+        if (!m_bPlaying) {
+            if (nBuffered < m_nJitterPackets) {
+                break;
+            }
+            m_bPlaying = true;
+        }
+        else if (0 == nBuffered) {
+            // ran dry; wait for the delay to build up again
+            AddRelaxed(m_nUnderruns, 1);
+            m_bPlaying = false;
+            break;
+        }
+
+        if (0 == m_nOffset) {
+            // a sender running ahead of us keeps the buffer from ever getting
+            // down to the delay; skip what it has gained over the window
+            m_nShallowest = (std::min)(m_nShallowest, nBuffered);
+            if (m_nWindowFrames >= nWindowFrames) {
+                if (m_nShallowest > 2 * static_cast<uint64_t>(m_nJitterPackets)) {
+                    uint64_t nSkip = m_nShallowest - m_nJitterPackets;
+                    m_nNext += nSkip;
+                    AddRelaxed(m_nSkippedPackets, nSkip);
+                    m_nPlaying.store(m_nNext, std::memory_order_release);
+                }
+                m_nWindowFrames = 0;
+                m_nShallowest = UINT64_MAX;
+            }
+        }
+
+        const Slot &slot = m_slots[m_nNext & (RTP_JITTER_PACKETS - 1)];
+        uint32_t n = (std::min)(nFrames - nDone, m_nPacketFramesSeen - m_nOffset);
+        uint8_t *pFrames = pOut + nDone * nBlockAlign;
+        if (slot.nSequence.load(std::memory_order_acquire) == m_nNext) {
+            Decode(slot, m_nOffset, pFrames, n);
+            if (!bMeasured && 0 != slot.hnsCapture) {
+                int64_t hnsCaptured = slot.hnsCapture + std::llround(m_nOffset * fHnsPerFrame);
+                m_latency.Record(hnsHeard + std::llround(nDone * fHnsPerFrame) - hnsCaptured);
+                bMeasured = true;
+            }
+        }
+        else {
+            memset(pFrames, 0, n * nBlockAlign);
+            nSilent += n;
+            if (0 == m_nOffset) {
+                AddRelaxed(m_nLostPackets, 1);
+            }
+        }
+
+        m_nOffset += n;
+        m_nWindowFrames += n;
+        nDone += n;
+        if (m_nOffset == m_nPacketFramesSeen) {
+            m_nOffset = 0;
+            m_nNext++;
+            m_nPlaying.store(m_nNext, std::memory_order_release);
+        }
+    }
+
+    if (nDone < nFrames) {
+        memset(pOut + nDone * nBlockAlign, 0, (nFrames - nDone) * nBlockAlign);
+        nSilent += nFrames - nDone;
+    }
+    AddRelaxed(m_nFrames, nFrames);
+    AddRelaxed(m_nSilentFrames, nSilent);
+}
+
+RtpReceiveStats RtpReceiver::Stats() const {
+    RtpReceiveStats stats;
+    stats.nPackets = m_nPackets.load(std::memory_order_relaxed);
+    stats.nReceiveCalls = m_nReceiveCalls.load(std::memory_order_relaxed);
+    stats.nBatches = m_nBatches.load(std::memory_order_relaxed);
+    stats.nReorderedPackets = m_nReorderedPackets.load(std::memory_order_relaxed);
+    stats.nDuplicatePackets = m_nDuplicatePackets.load(std::memory_order_relaxed);
+    stats.nLatePackets = m_nLatePackets.load(std::memory_order_relaxed);
+    stats.nOverflowPackets = m_nOverflowPackets.load(std::memory_order_relaxed);
+    stats.nInvalidPackets = m_nInvalidPackets.load(std::memory_order_relaxed);
+    stats.nStreams = m_nStreams.load(std::memory_order_relaxed);
+    stats.nLostPackets = m_nLostPackets.load(std::memory_order_relaxed);
+    stats.nSkippedPackets = m_nSkippedPackets.load(std::memory_order_relaxed);
+    stats.nUnderruns = m_nUnderruns.load(std::memory_order_relaxed);
+    stats.nFrames = m_nFrames.load(std::memory_order_relaxed);
+    stats.nSilentFrames = m_nSilentFrames.load(std::memory_order_relaxed);
+    stats.nPacketFrames = m_nPacketFrames.load(std::memory_order_relaxed);
+    stats.transit = m_transit.Summary();
+    stats.latency = m_latency.Summary();
+    return stats;
+}
+
+// ---- playing ----
+
+RtpPlayer::RtpPlayer(StatsClock &clock, MessageSink &messages)
+    : m_clock(clock)
+    , m_messages(messages)
+    , m_pReceiver(NULL)
+    , m_pSink(NULL)
+    , m_bConvert(false)
+{
+    m_bStop.store(false, std::memory_order_relaxed);
+}
+
+DeviceStatus RtpPlayer::Fail(DeviceStatus status, const char *szWhat) {
+    m_error = std::string(szWhat) + ": " + (NULL != m_pSink ? m_pSink->Error() : std::string());
+    return status;
+}
+
+DeviceStatus RtpPlayer::Start(RtpReceiver &receiver, RenderSink &sink, uint32_t nBufferMs) {
+    m_pReceiver = &receiver;
+    m_pSink = &sink;
+
+    const AudioFormat &streamFormat = receiver.Format();
+    DeviceStatus status = sink.Open(streamFormat, nBufferMs);
+    if (DEVICE_OK != status) {
+        return Fail(status, "couldn't open the output");
+    }
+
+    const AudioFormat &deviceFormat = sink.Format();
+    m_bConvert = SampleTypeOf(deviceFormat) != SampleTypeOf(streamFormat);
+    if (m_bConvert) {
+        if (!m_converter.Init(SampleTypeOf(streamFormat), SampleTypeOf(deviceFormat), true)) {
+            m_error = std::string("can't convert to the output's ") + SampleTypeName(SampleTypeOf(deviceFormat));
+            return DEVICE_FAILED;
+        }
+        m_scratch.reset(new uint8_t[static_cast<size_t>(sink.BufferFrames()) * streamFormat.nBlockAlign]);
+        m_messages.Log(
+            "Converting %s to %s for the output (%s)",
+            SampleTypeName(m_converter.InputType()), SampleTypeName(m_converter.OutputType()), SimdLevelName(m_converter.Level())
+        );
+    }
+
+    status = sink.Start();
+    if (DEVICE_OK != status) {
+        return Fail(status, "couldn't start the output");
+    }
+    return DEVICE_OK;
+}
+
+DeviceStatus RtpPlayer::Run() {
+    RenderSink &sink = *m_pSink;
+    DeviceStatus status = sink.EnterThread();
+    if (DEVICE_OK != status) {
+        return Fail(status, "couldn't set up the playing thread");
+    }
+
+    const uint32_t nBufferFrames = sink.BufferFrames();
+    const uint32_t nChannels = sink.Format().nChannels;
+    const double fHnsPerFrame = static_cast<double>(HNS_PER_SECOND) / sink.Format().nSamplesPerSec;
+
+    while (!m_bStop.load(std::memory_order_acquire)) {
+        status = sink.Wait(RTP_PLAY_WAIT_MS);
+        if (DEVICE_TIMEOUT == status) {
+            continue;
+        }
+        if (DEVICE_OK != status) {
+            break;
+        }
+
+        uint32_t nPadding;
+        status = sink.GetPadding(nPadding);
+        if (DEVICE_OK != status) {
+            break;
+        }
+
+        uint32_t nWanted = nBufferFrames - nPadding;
+        if (0 == nWanted) {
+            continue;
+        }
+
+        // whatever is written next will be heard once the padding has played
+        int64_t hnsHeard = m_clock.NowHns() + std::llround(nPadding * fHnsPerFrame);
+
+        uint8_t *pData;
+        status = sink.GetBuffer(nWanted, &pData);
+        if (DEVICE_OK != status) {
+            break;
+        }
+
+        if (m_bConvert) {
+            m_pReceiver->Read(m_scratch.get(), nWanted, hnsHeard);
+            m_converter.Convert(m_scratch.get(), pData, static_cast<size_t>(nWanted) * nChannels);
+        }
+        else {
+            m_pReceiver->Read(pData, nWanted, hnsHeard);
+        }
+
+        status = sink.ReleaseBuffer(nWanted, false);
+        if (DEVICE_OK != status) {
+            break;
+        }
+    }
+
+    sink.LeaveThread();
+    if (DEVICE_OK == status) {
+        return DEVICE_STOPPED;
+    }
+    if (DEVICE_STOPPED != status) {
+        return Fail(status, "playing stopped");
+    }
+    return status;
+}
+
+void RtpPlayer::Stop() {
+    m_bStop.store(true, std::memory_order_release);
+    if (NULL != m_pSink) {
+        m_pSink->Interrupt();
+    }
+}
+
+// ---- offline check ----
+
+// the simulation's own messages aren't worth showing
+class DiscardedMessages : public MessageSink {
+public:
+    void Write(bool, const char *) override {}
+};
+
+// waits for the receiver to have taken nTotal packets one way or another;
+// loopback delivers in well under this
+static bool WaitForPackets(const RtpReceiver &receiver, uint64_t nTotal) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    for (;;) {
+        RtpReceiveStats stats = receiver.Stats();
+        if (stats.nPackets + stats.nDuplicatePackets + stats.nLatePackets + stats.nOverflowPackets + stats.nInvalidPackets >= nTotal) {
+            return true;
+        }
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        std::this_thread::yield();
+    }
+}
+
+// sends a synthetic stream through a sender and a receiver in 10 ms capture
+// packets of 1 ms RTP packets, reading it back a packet at a time as a
+// player would, and compares what comes out with what went in
+static bool SimulateStream(const AudioFormat &format, RtpEncoding encoding, uint32_t nMaxBatch, uint32_t nSeed, RtpSimulationResult &result, bool bBatched) {
+    SteadyClock clock;
+    DiscardedMessages messages;
+    std::string error;
+
+    RtpReceiveOptions receiveOptions;
+    receiveOptions.encoding = encoding;
+    receiveOptions.nRate = format.nSamplesPerSec;
+    receiveOptions.nChannels = format.nChannels;
+    receiveOptions.fJitterMs = 0;
+    RtpReceiver receiver(clock, messages);
+    if (!receiver.Open("127.0.0.1:0", receiveOptions, error)) {
+        return false;
+    }
+    receiver.Start();
+
+    RtpSendOptions sendOptions;
+    sendOptions.encoding = encoding;
+    sendOptions.fPacketMs = 1;
+    sendOptions.nMaxBatch = nMaxBatch;
+    RtpSender sender(clock, messages);
+    if (!sender.Open("127.0.0.1:" + std::to_string(receiver.Port()), sendOptions, error) || !sender.Begin(format, error)) {
+        return false;
+    }
+    const uint32_t nPacketFrames = sender.PacketFrames();
+    result.nPacketFrames = nPacketFrames;
+
+    // 5 seconds of noise in the capture format
+    const uint32_t nChannels = format.nChannels;
+    const uint32_t nTotalFrames = format.nSamplesPerSec * 5;
+    const uint32_t nChunkFrames = format.nSamplesPerSec / 100;
+    std::vector<float> signal(static_cast<size_t>(nTotalFrames) * nChannels);
+    uint32_t nRandom = nSeed;
+    for (float &f : signal) {
+        nRandom = nRandom * 1664525u + 1013904223u;
+        f = 0.9f * static_cast<float>(static_cast<int32_t>(nRandom)) / 2147483648.0f;
+    }
+    std::vector<uint8_t> input(static_cast<size_t>(nTotalFrames) * format.nBlockAlign);
+    SampleConverter fromFloat;
+    fromFloat.Init(SAMPLE_FLOAT32, SampleTypeOf(format), false);
+    fromFloat.FromFloat(signal.data(), input.data(), signal.size());
+    SampleConverter inputToFloat;
+    inputToFloat.Init(SampleTypeOf(format), SAMPLE_FLOAT32, false);
+    inputToFloat.ToFloat(input.data(), signal.data(), signal.size());
+
+    const AudioFormat &streamFormat = receiver.Format();
+    std::vector<uint8_t> output(static_cast<size_t>(nTotalFrames) * streamFormat.nBlockAlign);
+    SampleConverter outputToFloat;
+    outputToFloat.Init(SampleTypeOf(streamFormat), SAMPLE_FLOAT32, false);
+
+    double fSendSeconds = 0;
+    uint32_t nRead = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t nWritten = 0; nWritten + nChunkFrames <= nTotalFrames; nWritten += nChunkFrames) {
+        auto before = std::chrono::steady_clock::now();
+        sender.Write(input.data() + static_cast<size_t>(nWritten) * format.nBlockAlign, nChunkFrames, clock.NowHns());
+        fSendSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - before).count();
+
+        uint32_t nComplete = (nWritten + nChunkFrames) / nPacketFrames;
+        if (!WaitForPackets(receiver, nComplete)) {
+            break;
+        }
+        for (; nRead + nPacketFrames <= nComplete * nPacketFrames; nRead += nPacketFrames) {
+            receiver.Read(output.data() + static_cast<size_t>(nRead) * streamFormat.nBlockAlign, nPacketFrames, 0);
+        }
+    }
+    double fSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    receiver.Stop();
+
+    // everything read has to match within the requantization to the wire
+    std::vector<float> received(static_cast<size_t>(nRead) * nChannels);
+    outputToFloat.ToFloat(output.data(), received.data(), received.size());
+    const float fTolerance = 2.0f / (RTP_L24 == encoding ? 8388608.0f : 32768.0f);
+    uint64_t nWrong = static_cast<uint64_t>(nTotalFrames / nPacketFrames * nPacketFrames - nRead);
+    for (uint32_t i = 0; i < nRead; i++) {
+        for (uint32_t c = 0; c < nChannels; c++) {
+            size_t n = static_cast<size_t>(i) * nChannels + c;
+            if (std::fabs(received[n] - signal[n]) > fTolerance) {
+                nWrong++;
+                break;
+            }
+        }
+    }
+    result.nWrongFrames += nWrong;
+
+    RtpSendStats sent = sender.Stats();
+    double fPackets = static_cast<double>(sent.nPackets);
+    if (bBatched) {
+        result.nBatchedPackets = sent.nPackets;
+        result.nBatchedCalls = sent.nSendCalls;
+        result.fBatchedUsPerPacket = fPackets > 0 ? fSendSeconds * 1e6 / fPackets : 0;
+        result.fBatchedPacketsPerSec = fSeconds > 0 ? fPackets / fSeconds : 0;
+        result.transit = receiver.Stats().transit;
+    }
+    else {
+        result.nSinglePackets = sent.nPackets;
+        result.nSingleCalls = sent.nSendCalls;
+        result.fSingleUsPerPacket = fPackets > 0 ? fSendSeconds * 1e6 / fPackets : 0;
+        result.fSinglePacketsPerSec = fSeconds > 0 ? fPackets / fSeconds : 0;
+    }
+    return 0 == nWrong && 0 == sent.nDroppedPackets + sent.nFailedPackets;
+}
+
+// one packet of the hand made stream: every sample says which stream and
+// packet it came from
+static void SendNumbered(UdpSocket &socket, const AudioFormat &format, uint32_t nPacketFrames, uint32_t nStream, uint16_t nFirstSequence, uint32_t nPacket) {
+    uint8_t packet[RTP_MAX_PACKET_BYTES];
+    RtpHeader header;
+    header.nPayloadType = 24 == format.wBitsPerSample ? RTP_PAYLOAD_TYPE_L24 : RTP_PAYLOAD_TYPE_L16;
+    header.bMarker = 0 == nPacket;
+    header.nSequence = static_cast<uint16_t>(nFirstSequence + nPacket);
+    header.nTimestamp = nPacket * nPacketFrames;
+    header.nSsrc = 0x5100 + nStream;
+    header.bHasCaptureTime = false;
+    header.hnsCapture = 0;
+    uint32_t nBytes = RtpWriteHeader(header, packet);
+
+    const uint32_t nSampleBytes = format.wBitsPerSample / 8;
+    const uint32_t nValue = nStream * 10000 + nPacket + 1;
+    for (uint32_t i = 0; i < nPacketFrames * format.nChannels; i++) {
+        PutBigEndian(packet + nBytes, nValue, nSampleBytes);
+        nBytes += nSampleBytes;
+    }
+
+    UdpDatagram datagram = { packet, nBytes };
+    std::string error;
+    socket.Send(&datagram, 1, error);
+}
+
+// what a packet's worth of Read output says it was: 0 for silence
+static uint32_t PlayedNumber(const uint8_t *pFrames, const AudioFormat &format) {
+    return 24 == format.wBitsPerSample
+        ? static_cast<uint32_t>(pFrames[0] | (pFrames[1] << 8) | (pFrames[2] << 16))
+        : static_cast<uint32_t>(pFrames[0] | (pFrames[1] << 8));
+}
+
+enum RtpFault {
+    RTP_FAULT_NONE,
+    RTP_FAULT_LOST,       // packet 6 never sent
+    RTP_FAULT_REORDERED,  // 6 and 7 swapped
+    RTP_FAULT_DUPLICATED, // 6 sent twice
+    RTP_FAULT_LATE,       // 6 sent after its turn
+    RTP_FAULT_STALLED,    // nothing for 4 steps, then all of it
+    RTP_FAULT_FAST,       // an extra packet every 50 steps
+    RTP_FAULT_RESTARTED,  // a new SSRC and sequence half way
+    RTP_FAULT_CASES,
+};
+
+// steps a stream through a receiver with a 4 packet delay: each step sends
+// the packets the fault calls for and plays one packet's worth, so the
+// buffer stays at the delay unless the fault moves it
+static bool SimulateFault(RtpFault fault, const AudioFormat &streamFormat, RtpEncoding encoding) {
+    SteadyClock clock;
+    DiscardedMessages messages;
+    std::string error;
+
+    const uint32_t nPacketFrames = streamFormat.nSamplesPerSec / 1000;
+    const uint32_t nJitterPackets = 4;
+    const uint32_t nSteps = RTP_FAULT_FAST == fault ? 2400 : 24;
+
+    RtpReceiveOptions options;
+    options.encoding = encoding;
+    options.nRate = streamFormat.nSamplesPerSec;
+    options.nChannels = streamFormat.nChannels;
+    options.fJitterMs = nJitterPackets;
+    RtpReceiver receiver(clock, messages);
+    UdpSocket socket;
+    UdpAddress address;
+    address.host = "127.0.0.1";
+    if (!receiver.Open("127.0.0.1:0", options, error)) {
+        return false;
+    }
+    address.nPort = receiver.Port();
+    if (!socket.Connect(address, error)) {
+        return false;
+    }
+    receiver.Start();
+
+    uint32_t nStream = 1;
+    uint16_t nFirstSequence = 65530; // wraps early on
+    uint32_t nNextPacket = 0;
+    uint64_t nSent = 0;
+    std::vector<uint32_t> played;
+    std::vector<uint8_t> frames(static_cast<size_t>(nPacketFrames) * streamFormat.nBlockAlign);
+
+    for (uint32_t nStep = 0; nStep < nSteps; nStep++) {
+        std::vector<uint32_t> packets;
+        if (RTP_FAULT_STALLED == fault && nStep >= 8 && nStep < 12) {
+            // nothing this step
+        }
+        else {
+            uint32_t nLast = RTP_FAULT_FAST == fault ? nStep + nStep / 50 : nStep;
+            for (; nNextPacket <= nLast; nNextPacket++) {
+                packets.push_back(nNextPacket);
+            }
+        }
+
+        for (uint32_t &nPacket : packets) {
+            if (6 == nPacket) {
+                if (RTP_FAULT_LOST == fault || RTP_FAULT_LATE == fault) {
+                    continue;
+                }
+                if (RTP_FAULT_REORDERED == fault) {
+                    nPacket = 7;
+                }
+            }
+            else if (7 == nPacket && RTP_FAULT_REORDERED == fault) {
+                nPacket = 6;
+            }
+            if (RTP_FAULT_RESTARTED == fault && 12 == nStep && packets.front() == nPacket) {
+                nStream = 2;
+                nFirstSequence = 1000;
+            }
+            SendNumbered(socket, streamFormat, nPacketFrames, nStream, nFirstSequence, nPacket);
+            nSent++;
+            if (6 == nPacket && RTP_FAULT_DUPLICATED == fault) {
+                SendNumbered(socket, streamFormat, nPacketFrames, nStream, nFirstSequence, nPacket);
+                nSent++;
+            }
+        }
+        if (RTP_FAULT_LATE == fault && 16 == nStep) {
+            SendNumbered(socket, streamFormat, nPacketFrames, nStream, nFirstSequence, 6);
+            nSent++;
+        }
+
+        if (!WaitForPackets(receiver, nSent)) {
+            return false;
+        }
+        receiver.Read(frames.data(), nPacketFrames, 0);
+        played.push_back(PlayedNumber(frames.data(), streamFormat));
+    }
+    receiver.Stop();
+    RtpReceiveStats stats = receiver.Stats();
+
+    // what a stream with nothing wrong plays: silence while the delay
+    // builds up, then every packet in turn
+    std::vector<uint32_t> expected(nSteps, 0);
+    for (uint32_t i = nJitterPackets - 1; i < nSteps; i++) {
+        expected[i] = 10000 + (i - (nJitterPackets - 1)) + 1;
+    }
+    const uint32_t nSixth = nJitterPackets - 1 + 6;
+
+    bool bPass = true;
+    switch (fault) {
+    case RTP_FAULT_NONE:
+        bPass = played == expected && 0 == stats.nLostPackets + stats.nLatePackets + stats.nUnderruns;
+        break;
+    case RTP_FAULT_REORDERED:
+        bPass = played == expected && 1 == stats.nReorderedPackets && 0 == stats.nLostPackets;
+        break;
+    case RTP_FAULT_DUPLICATED:
+        bPass = played == expected && 1 == stats.nDuplicatePackets;
+        break;
+    case RTP_FAULT_LOST:
+    case RTP_FAULT_LATE:
+        expected[nSixth] = 0;
+        bPass = played == expected && 1 == stats.nLostPackets && (RTP_FAULT_LATE == fault ? 1u : 0u) == stats.nLatePackets;
+        break;
+    case RTP_FAULT_STALLED:
+    case RTP_FAULT_FAST: {
+        // in order, nothing twice, nothing lost; only the gaps differ
+        uint32_t nLast = 0;
+        for (uint32_t nPlayed : played) {
+            if (0 != nPlayed) {
+                bPass = bPass && nPlayed > nLast && (RTP_FAULT_FAST == fault || nPlayed == nLast + 1 || 0 == nLast);
+                nLast = nPlayed;
+            }
+        }
+        bPass = bPass && 0 == stats.nLostPackets && (RTP_FAULT_STALLED == fault
+            ? 1 == stats.nUnderruns && 0 == stats.nSkippedPackets
+            : 0 != stats.nSkippedPackets && 0 == stats.nUnderruns);
+        break;
+    }
+    case RTP_FAULT_RESTARTED: {
+        // the second stream takes over from its own first packet
+        bool bSecond = false;
+        uint32_t nLast = 0;
+        for (uint32_t nPlayed : played) {
+            if (nPlayed > 20000) {
+                bPass = bPass && (bSecond ? nPlayed == nLast + 1 : nPlayed == 20000 + 12 + 1);
+                bSecond = true;
+                nLast = nPlayed;
+            }
+        }
+        bPass = bPass && bSecond && 2 == stats.nStreams;
+        break;
+    }
+    default:
+        break;
+    }
+    return bPass;
+}
+
+RtpSimulationResult SimulateRtp(const AudioFormat &format, RtpEncoding encoding, uint32_t nSeed) {
+    RtpSimulationResult result = {};
+
+    bool bPass = SimulateStream(format, encoding, UDP_MAX_BATCH, nSeed, result, true);
+    bPass = SimulateStream(format, encoding, 1, nSeed + 1, result, false) && bPass;
+
+    AudioFormat streamFormat = RtpStreamFormat(encoding, format.nSamplesPerSec, format.nChannels);
+    for (int fault = RTP_FAULT_NONE; fault < RTP_FAULT_CASES; fault++) {
+        result.nFaultCases++;
+        if (!SimulateFault(static_cast<RtpFault>(fault), streamFormat, encoding)) {
+            result.nFaultFailures++;
+        }
+    }
+
+    result.bPass = bPass && 0 == result.nFaultFailures;
+    return result;
+}
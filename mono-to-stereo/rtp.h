@@ -0,0 +1,399 @@
+// rtp.h
+
+// streams the repaired audio over the network as RTP, and plays such a
+// stream back
+//
+// RtpSender is a tap on the pipeline, the same as RecordingTap: the capture
+// thread hands it every frame that goes into the fanout ring. it cuts them
+// into L16 or L24 packets (big-endian PCM, RFC 3551 and RFC 3190) of a fixed
+// packet time and sends every packet one capture packet completes in a
+// single batch. the socket is non-blocking, so a send queues the datagram
+// or drops it and never waits. unlike the recording, the sender needs no
+// thread of its own and no buffer in between: the frames are on the wire
+// as soon as the capture thread has them. each packet carries the time its
+// first frame was captured in a header extension, so a receiver on the
+// same machine can measure the latency from capture
+//
+// RtpReceiver takes packets off the socket on a thread of its own, a batch
+// at a time, and files them in a jitter buffer by sequence number, so late
+// and out of order packets still play in order. playback starts once the
+// buffer holds the configured delay. a packet that never arrives plays as
+// silence. if the buffer runs dry, playback waits for it to fill up to the
+// delay again. a sender whose clock runs faster than the player's keeps
+// the buffer from ever getting back down to the delay; once it has stayed
+// above twice the delay for a second, packets are skipped to bring it back
+// down. the shallowest it got is what counts, not how full it is when a
+// burst has just come in
+//
+// RtpPlayer services a render sink from a receiver, the way the pipeline's
+// render threads do from the ring
+//
+// nothing is negotiated: the receiver has to be told the encoding, rate
+// and channel count the sender uses. it works out the packet time from
+// the first packet
+//
+// no Windows dependencies
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "audioformat.h"
+#include "device.h"
+#include "latency.h"
+#include "messages.h"
+#include "sampleconvert.h"
+#include "udpsocket.h"
+
+#define RTP_VERSION 2
+#define RTP_HEADER_BYTES 12
+
+// the capture time goes in a one-byte header extension (RFC 8285): the
+// 4 byte extension header, then one element of 8 bytes padded to a word
+#define RTP_EXTENSION_PROFILE 0xBEDE
+#define RTP_EXTENSION_BYTES 16
+#define RTP_CAPTURE_TIME_ID 1
+
+// dynamic payload types, one for each encoding
+#define RTP_PAYLOAD_TYPE_L16 96
+#define RTP_PAYLOAD_TYPE_L24 97
+
+// the largest payload whose packet fits in a 1500 byte Ethernet frame
+// behind the IPv4 and UDP headers
+#define RTP_MAX_PAYLOAD_BYTES (1500 - 20 - 8 - RTP_HEADER_BYTES - RTP_EXTENSION_BYTES)
+#define RTP_MAX_PACKET_BYTES (RTP_HEADER_BYTES + RTP_EXTENSION_BYTES + RTP_MAX_PAYLOAD_BYTES)
+
+#define RTP_DEFAULT_PACKET_MS 5.0
+#define RTP_DEFAULT_JITTER_MS 20.0
+
+// packets the jitter buffer holds, a power of two
+#define RTP_JITTER_PACKETS 1024
+
+// how often the receiving thread wakes up without packets, to notice Stop
+#define RTP_RECEIVE_WAIT_MS 20
+
+// socket buffer asked for on the receiving side, so a burst isn't dropped
+// by the kernel before the thread gets to it
+#define RTP_RECEIVE_BUFFER_BYTES (4 << 20)
+
+enum RtpEncoding {
+    RTP_L16,
+    RTP_L24,
+};
+
+// "L16" or "L24", either case
+bool ParseRtpEncodingName(const char *szName, RtpEncoding &encoding);
+const char *RtpEncodingName(RtpEncoding encoding);
+
+// what a stream of this encoding, rate and channel count plays as
+AudioFormat RtpStreamFormat(RtpEncoding encoding, uint32_t nRate, uint16_t nChannels);
+
+// ---- packets ----
+
+struct RtpHeader {
+    uint8_t nPayloadType;
+    bool bMarker;
+    uint16_t nSequence;
+    uint32_t nTimestamp;
+    uint32_t nSsrc;
+    bool bHasCaptureTime;
+    int64_t hnsCapture;  // on the sender's StatsClock
+};
+
+// writes the fixed header and the capture time extension in front of the
+// payload; returns how many bytes that took
+uint32_t RtpWriteHeader(const RtpHeader &header, uint8_t *pOut);
+
+// false if it isn't an RTP packet; the payload is what's left once the
+// header, any extension and any padding are taken off
+bool RtpParsePacket(const uint8_t *pData, uint32_t nBytes, RtpHeader &header, uint32_t &nPayloadOffset, uint32_t &nPayloadBytes);
+
+// ---- sending ----
+
+struct RtpSendOptions {
+    RtpEncoding encoding;
+    double fPacketMs;    // packet time; shortened if a packet wouldn't fit a single Ethernet frame
+    uint32_t nMaxBatch;  // most packets to a send call; 1 sends each one on its own
+
+    RtpSendOptions()
+        : encoding(RTP_L16)
+        , fPacketMs(RTP_DEFAULT_PACKET_MS)
+        , nMaxBatch(UDP_MAX_BATCH)
+    {}
+};
+
+struct RtpSendStats {
+    uint64_t nPackets;         // handed to the kernel
+    uint64_t nBytes;           // of those, headers included
+    uint64_t nSendCalls;       // system calls
+    uint64_t nDroppedPackets;  // the socket buffer was full
+    uint64_t nRefusedPackets;  // nobody was listening
+    uint64_t nFailedPackets;   // any other error
+    HistogramSummary sendTime; // per batch
+};
+
+class RtpSender {
+public:
+    RtpSender(StatsClock &clock, MessageSink &messages);
+    ~RtpSender();
+
+    // connects the socket, so a bad address is found before anything
+    // starts; destination is "host:port"
+    bool Open(const std::string &destination, const RtpSendOptions &options, std::string &error);
+
+    // called by the pipeline as it starts, before any Write; the first call
+    // sets up the packets, later ones (a restarted stream) only check the
+    // format hasn't changed. the sequence numbers and timestamps run on
+    // across restarts, so the receiver sees one stream with a gap in it
+    bool Begin(const AudioFormat &format, std::string &error);
+
+    // capture thread: hnsCapture is when the first frame was captured, 0
+    // if the device didn't say.
+    // sends every packet completed, keeps the rest for the next call; never
+    // blocks or allocates
+    void Write(const uint8_t *pData, uint32_t nFrames, int64_t hnsCapture);
+
+    void Close();
+
+    bool IsOpen() const { return m_socket.IsOpen(); }
+    const std::string &Destination() const { return m_destination; }
+    const RtpSendOptions &Options() const { return m_options; }
+    uint32_t PacketFrames() const { return m_nPacketFrames; }
+    RtpSendStats Stats() const;
+
+private:
+    RtpSender(const RtpSender &) = delete;
+    RtpSender &operator=(const RtpSender &) = delete;
+
+    void SendQueued();
+
+    StatsClock &m_clock;
+    MessageSink &m_messages;
+
+    std::string m_destination;
+    RtpSendOptions m_options;
+    UdpSocket m_socket;
+    bool m_bBegun;
+    AudioFormat m_format;
+    AudioFormat m_wireFormat;  // what the payload is, before byte swapping
+    SampleConverter m_converter;
+
+    uint32_t m_nPacketFrames;
+    uint32_t m_nPacketBytes;   // header and payload
+    std::unique_ptr<uint8_t[]> m_memory;
+    UdpDatagram m_datagrams[UDP_MAX_BATCH];
+
+    // capture thread
+    uint32_t m_nQueued;        // complete packets waiting for the batch to go
+    uint32_t m_nFilled;        // frames in the packet after them
+    uint16_t m_nSequence;
+    uint32_t m_nTimestamp;
+    uint32_t m_nSsrc;
+    bool m_bMarkNext;          // the next packet starts a stream
+    Histogram m_sendTime;
+
+    std::atomic<uint64_t> m_nPackets;
+    std::atomic<uint64_t> m_nBytes;
+    std::atomic<uint64_t> m_nSendCalls;
+    std::atomic<uint64_t> m_nDroppedPackets;
+    std::atomic<uint64_t> m_nRefusedPackets;
+    std::atomic<uint64_t> m_nFailedPackets;
+};
+
+// ---- receiving ----
+
+struct RtpReceiveOptions {
+    RtpEncoding encoding;
+    uint32_t nRate;
+    uint16_t nChannels;
+    double fJitterMs;  // how much is buffered before playing
+
+    RtpReceiveOptions()
+        : encoding(RTP_L16)
+        , nRate(48000)
+        , nChannels(2)
+        , fJitterMs(RTP_DEFAULT_JITTER_MS)
+    {}
+};
+
+struct RtpReceiveStats {
+    uint64_t nPackets;           // filed in the jitter buffer
+    uint64_t nReceiveCalls;      // system calls
+    uint64_t nBatches;           // of those, ones that returned packets
+    uint64_t nReorderedPackets;  // arrived after a later one, still in time
+    uint64_t nDuplicatePackets;
+    uint64_t nLatePackets;       // arrived after their turn to play
+    uint64_t nOverflowPackets;   // arrived too far ahead of playback
+    uint64_t nInvalidPackets;    // not RTP, or not the payload we were told
+    uint64_t nStreams;           // senders seen, by SSRC
+    uint64_t nLostPackets;       // their turn came and they weren't there
+    uint64_t nSkippedPackets;    // to bring the buffer back down to the delay
+    uint64_t nUnderruns;         // ran dry and waited for the delay again
+    uint64_t nFrames;            // played, silence included
+    uint64_t nSilentFrames;      // played while waiting, or for lost packets
+    uint32_t nPacketFrames;      // worked out from the first packet
+    HistogramSummary transit;    // capture to arrival
+    HistogramSummary latency;    // capture to being heard
+};
+
+class RtpReceiver {
+public:
+    RtpReceiver(StatsClock &clock, MessageSink &messages);
+
+    // Stop if it hasn't been
+    ~RtpReceiver();
+
+    // binds the socket; address is "port", ":port" or "host:port"
+    bool Open(const std::string &address, const RtpReceiveOptions &options, std::string &error);
+
+    // starts taking packets off the socket
+    void Start();
+    void Stop();
+
+    // what Read produces: 16 or 24 bit PCM at the stream's rate and channels
+    const AudioFormat &Format() const { return m_format; }
+
+    uint16_t Port() const { return m_socket.LocalPort(); }
+
+    // one thread only: fills pOut with nFrames frames, silence wherever
+    // there is nothing to play. hnsHeard is when the first of them will be
+    // heard, on the same clock as the sender's if the latency is wanted;
+    // 0 not to measure it
+    void Read(uint8_t *pOut, uint32_t nFrames, int64_t hnsHeard);
+
+    RtpReceiveStats Stats() const;
+
+private:
+    RtpReceiver(const RtpReceiver &) = delete;
+    RtpReceiver &operator=(const RtpReceiver &) = delete;
+
+    struct Slot {
+        std::atomic<uint64_t> nSequence; // extended; 0 while empty
+        int64_t hnsCapture;              // 0 if the packet didn't say
+        uint8_t payload[RTP_MAX_PAYLOAD_BYTES];
+    };
+
+    // receiving thread
+    void ReceiveThread();
+    void File(const uint8_t *pData, uint32_t nBytes, int64_t hnsNow);
+
+    // reading thread
+    void Decode(const Slot &slot, uint32_t nOffset, uint8_t *pOut, uint32_t nFrames);
+
+    StatsClock &m_clock;
+    MessageSink &m_messages;
+
+    RtpReceiveOptions m_options;
+    AudioFormat m_format;
+    uint32_t m_nPayloadType;
+    UdpSocket m_socket;
+    std::unique_ptr<Slot[]> m_slots;
+
+    // receiving thread
+    bool m_bHaveStream;
+    uint32_t m_nSsrc;
+    uint64_t m_nHighest;         // extended sequence number
+    uint64_t m_nStreamStart;
+    uint32_t m_nPacketBytes;     // payload
+    Histogram m_transit;
+
+    // shared
+    std::atomic<uint32_t> m_nPacketFrames;
+    std::atomic<uint64_t> m_nPublishedHighest;  // 0 until the first packet
+    std::atomic<uint64_t> m_nPublishedStart;
+    std::atomic<uint64_t> m_nStreams;
+    std::atomic<uint64_t> m_nPlaying;           // the reader's next packet
+
+    // reading thread
+    uint64_t m_nStreamsSeen;
+    bool m_bPlaying;
+    uint64_t m_nNext;            // extended sequence number to play
+    uint32_t m_nOffset;          // frames of it already played
+    uint32_t m_nPacketFramesSeen;
+    uint32_t m_nJitterPackets;
+    uint64_t m_nWindowFrames;    // played since the drift was last looked at
+    uint64_t m_nShallowest;      // fewest packets buffered in that time
+    Histogram m_latency;
+
+    std::atomic<uint64_t> m_nPackets;
+    std::atomic<uint64_t> m_nReceiveCalls;
+    std::atomic<uint64_t> m_nBatches;
+    std::atomic<uint64_t> m_nReorderedPackets;
+    std::atomic<uint64_t> m_nDuplicatePackets;
+    std::atomic<uint64_t> m_nLatePackets;
+    std::atomic<uint64_t> m_nOverflowPackets;
+    std::atomic<uint64_t> m_nInvalidPackets;
+    std::atomic<uint64_t> m_nLostPackets;
+    std::atomic<uint64_t> m_nSkippedPackets;
+    std::atomic<uint64_t> m_nUnderruns;
+    std::atomic<uint64_t> m_nFrames;
+    std::atomic<uint64_t> m_nSilentFrames;
+
+    std::atomic<bool> m_bStop;
+    std::thread m_thread;
+};
+
+// plays a receiver's stream on a render sink, on the thread that calls Run
+class RtpPlayer {
+public:
+    RtpPlayer(StatsClock &clock, MessageSink &messages);
+
+    // opens the sink in the receiver's format, or as close as it allows,
+    // with about nBufferMs of buffer, and starts it. the receiver and sink
+    // must outlive the player
+    DeviceStatus Start(RtpReceiver &receiver, RenderSink &sink, uint32_t nBufferMs);
+
+    // services the sink until Stop is called or the sink fails
+    DeviceStatus Run();
+
+    // any thread
+    void Stop();
+
+    const std::string &Error() const { return m_error; }
+
+private:
+    RtpPlayer(const RtpPlayer &) = delete;
+    RtpPlayer &operator=(const RtpPlayer &) = delete;
+
+    DeviceStatus Fail(DeviceStatus status, const char *szWhat);
+
+    StatsClock &m_clock;
+    MessageSink &m_messages;
+    RtpReceiver *m_pReceiver;
+    RenderSink *m_pSink;
+    bool m_bConvert;
+    SampleConverter m_converter;
+    std::unique_ptr<uint8_t[]> m_scratch;
+    std::atomic<bool> m_bStop;
+    std::string m_error;
+};
+
+// ---- offline check ----
+
+struct RtpSimulationResult {
+    uint32_t nPacketFrames;
+    uint64_t nBatchedPackets;      // sent batched, as fast as they are taken
+    uint64_t nBatchedCalls;        // send calls that took
+    double fBatchedUsPerPacket;    // sender's time per packet
+    double fBatchedPacketsPerSec;  // end to end
+    uint64_t nSinglePackets;       // the same one packet to a call
+    uint64_t nSingleCalls;
+    double fSingleUsPerPacket;
+    double fSinglePacketsPerSec;
+    uint64_t nWrongFrames;         // came out different from what went in
+    uint32_t nFaultCases;
+    uint32_t nFaultFailures;       // lost, late, reordered or duplicated packets played wrong
+    HistogramSummary transit;
+    bool bPass;
+};
+
+// sends a synthetic stream in format to a receiver over 127.0.0.1 as fast
+// as it can take it, once batched and once a packet at a time, and checks
+// that what plays is what was sent. then sends packets by hand, with some
+// lost, duplicated, reordered or late, and checks the jitter buffer plays
+// each case the way it should
+RtpSimulationResult SimulateRtp(const AudioFormat &format, RtpEncoding encoding, uint32_t nSeed);
@@ -0,0 +1,491 @@
+// sampleconvert.cpp
+
+#include "sampleconvert.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "simd.h"
+
+// ---- format helpers ----
+
+SampleType SampleTypeOf(const AudioFormat &format) {
+    if (format.wFormatTag == AUDIOFORMAT_TAG_IEEE_FLOAT) {
+        switch (format.wBitsPerSample) {
+        case 32: return SAMPLE_FLOAT32;
+        case 64: return SAMPLE_FLOAT64;
+        default: return SAMPLE_UNKNOWN;
+        }
+    }
+
+    if (format.wFormatTag == AUDIOFORMAT_TAG_PCM) {
+        switch (format.wBitsPerSample) {
+        case 16: return SAMPLE_INT16;
+        case 24: return SAMPLE_INT24;
+        case 32: return SAMPLE_INT32;
+        default: return SAMPLE_UNKNOWN;
+        }
+    }
+
+    return SAMPLE_UNKNOWN;
+}
+
+const char *SampleTypeName(SampleType type) {
+    switch (type) {
+    case SAMPLE_INT16: return "int16";
+    case SAMPLE_INT24: return "int24";
+    case SAMPLE_INT32: return "int32";
+    case SAMPLE_FLOAT32: return "float32";
+    case SAMPLE_FLOAT64: return "float64";
+    default: return "unknown";
+    }
+}
+
+size_t SampleTypeBytes(SampleType type) {
+    switch (type) {
+    case SAMPLE_INT16: return 2;
+    case SAMPLE_INT24: return 3;
+    case SAMPLE_INT32: return 4;
+    case SAMPLE_FLOAT32: return 4;
+    case SAMPLE_FLOAT64: return 8;
+    default: return 0;
+    }
+}
+
+static int SampleTypePrecision(SampleType type) {
+    switch (type) {
+    case SAMPLE_INT16: return 16;
+    case SAMPLE_INT24: return 24;
+    case SAMPLE_INT32: return 32;
+    case SAMPLE_FLOAT32: return 25; // 24-bit mantissa plus sign
+    case SAMPLE_FLOAT64: return 54;
+    default: return 0;
+    }
+}
+
+SimdLevel DetectSimdLevel() {
+#if defined(SIMD_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int nIds = info[0];
+
+    __cpuid(info, 1);
+    bool bSse2 = (info[3] & (1 << 26)) != 0;
+    bool bOsxsave = (info[2] & (1 << 27)) != 0;
+    bool bAvx = (info[2] & (1 << 28)) != 0;
+
+    bool bAvx2 = false;
+    if (nIds >= 7 && bOsxsave && bAvx && (_xgetbv(0) & 6) == 6) {
+        __cpuidex(info, 7, 0);
+        bAvx2 = (info[1] & (1 << 5)) != 0;
+    }
+
+    return bAvx2 ? SIMD_AVX2 : bSse2 ? SIMD_SSE2 : SIMD_SCALAR;
+#elif defined(SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return SIMD_AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return SIMD_SSE2;
+    }
+    return SIMD_SCALAR;
+#else
+    return SIMD_SCALAR;
+#endif
+}
+
+const char *SimdLevelName(SimdLevel level) {
+    switch (level) {
+    case SIMD_SSE2: return "sse2";
+    case SIMD_AVX2: return "avx2";
+    default: return "scalar";
+    }
+}
+
+// ---- scalar kernels ----
+// these are also the reference the vector versions are checked against
+
+static inline uint32_t XorShift(uint32_t &x) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+// triangular noise spanning +/- 1 LSB
+static inline float Tpdf(uint32_t &x) {
+    uint32_t r = XorShift(x);
+    return static_cast<float>(static_cast<int32_t>(r & 0xFFFF) - static_cast<int32_t>(r >> 16)) * (1.0f / 65536.0f);
+}
+
+static void Int16ToFloatScalar(const uint8_t *pIn, float *pOut, size_t nSamples) {
+    for (size_t i = 0; i < nSamples; i++) {
+        int16_t s;
+        memcpy(&s, pIn + i * 2, sizeof(s));
+        pOut[i] = static_cast<float>(s) * (1.0f / 32768.0f);
+    }
+}
+
+static void Int24ToFloatScalar(const uint8_t *pIn, float *pOut, size_t nSamples) {
+    for (size_t i = 0; i < nSamples; i++) {
+        const uint8_t *p = pIn + i * 3;
+        int32_t s = static_cast<int32_t>((static_cast<uint32_t>(p[0]) << 8) | (static_cast<uint32_t>(p[1]) << 16) | (static_cast<uint32_t>(p[2]) << 24)) >> 8;
+        pOut[i] = static_cast<float>(s) * (1.0f / 8388608.0f);
+    }
+}
+
+static void Int32ToFloatScalar(const uint8_t *pIn, float *pOut, size_t nSamples) {
+    for (size_t i = 0; i < nSamples; i++) {
+        int32_t s;
+        memcpy(&s, pIn + i * 4, sizeof(s));
+        pOut[i] = static_cast<float>(s) * (1.0f / 2147483648.0f);
+    }
+}
+
+static void Float32ToFloat(const uint8_t *pIn, float *pOut, size_t nSamples) {
+    memcpy(pOut, pIn, nSamples * sizeof(float));
+}
+
+static void Float64ToFloat(const uint8_t *pIn, float *pOut, size_t nSamples) {
+    for (size_t i = 0; i < nSamples; i++) {
+        double d;
+        memcpy(&d, pIn + i * 8, sizeof(d));
+        pOut[i] = static_cast<float>(d);
+    }
+}
+
+static void FloatToInt16Scalar(const float *pIn, uint8_t *pOut, size_t nSamples, DitherState *pDither) {
+    for (size_t i = 0; i < nSamples; i++) {
+        float f = pIn[i] * 32768.0f;
+        if (pDither) {
+            f += Tpdf(pDither->lanes[0]);
+        }
+        f = (std::min)((std::max)(f, -32768.0f), 32767.0f);
+        int16_t s = static_cast<int16_t>(lrintf(f));
+        memcpy(pOut + i * 2, &s, sizeof(s));
+    }
+}
+
+static void FloatToInt24Scalar(const float *pIn, uint8_t *pOut, size_t nSamples, DitherState *pDither) {
+    for (size_t i = 0; i < nSamples; i++) {
+        float f = pIn[i] * 8388608.0f;
+        if (pDither) {
+            f += Tpdf(pDither->lanes[0]);
+        }
+        f = (std::min)((std::max)(f, -8388608.0f), 8388607.0f);
+        int32_t s = static_cast<int32_t>(lrintf(f));
+        uint8_t *p = pOut + i * 3;
+        p[0] = static_cast<uint8_t>(s);
+        p[1] = static_cast<uint8_t>(s >> 8);
+        p[2] = static_cast<uint8_t>(s >> 16);
+    }
+}
+
+static void FloatToInt32Scalar(const float *pIn, uint8_t *pOut, size_t nSamples, DitherState *) {
+    for (size_t i = 0; i < nSamples; i++) {
+        // 2^31 itself isn't representable as an int32
+        float f = (std::min)((std::max)(pIn[i] * 2147483648.0f, -2147483648.0f), 2147483520.0f);
+        int32_t s = static_cast<int32_t>(lrintf(f));
+        memcpy(pOut + i * 4, &s, sizeof(s));
+    }
+}
+
+static void FloatToFloat32(const float *pIn, uint8_t *pOut, size_t nSamples, DitherState *) {
+    memcpy(pOut, pIn, nSamples * sizeof(float));
+}
+
+static void FloatToFloat64(const float *pIn, uint8_t *pOut, size_t nSamples, DitherState *) {
+    for (size_t i = 0; i < nSamples; i++) {
+        double d = pIn[i];
+        memcpy(pOut + i * 8, &d, sizeof(d));
+    }
+}
+
+#ifdef SIMD_X86
+
+// ---- SSE2 kernels ----
+
+TARGET_SSE2 static inline __m128i XorShiftSse2(__m128i &x) {
+    x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+    x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+    return x;
+}
+
+TARGET_SSE2 static inline __m128 TpdfSse2(__m128i &x) {
+    __m128i r = XorShiftSse2(x);
+    __m128i lo = _mm_and_si128(r, _mm_set1_epi32(0xFFFF));
+    __m128i hi = _mm_srli_epi32(r, 16);
+    return _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(lo, hi)), _mm_set1_ps(1.0f / 65536.0f));
+}
+
+TARGET_SSE2 static void Int16ToFloatSse2(const uint8_t *pIn, float *pOut, size_t nSamples) {
+    const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+    size_t i = 0;
+    for (; i + 8 <= nSamples; i += 8) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pIn + i * 2));
+        // sign extend by putting each sample in the top half and shifting down
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+        _mm_storeu_ps(pOut + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(pOut + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+    Int16ToFloatScalar(pIn + i * 2, pOut + i, nSamples - i);
+}
+
+TARGET_SSE2 static void Int32ToFloatSse2(const uint8_t *pIn, float *pOut, size_t nSamples) {
+    const __m128 scale = _mm_set1_ps(1.0f / 2147483648.0f);
+    size_t i = 0;
+    for (; i + 4 <= nSamples; i += 4) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pIn + i * 4));
+        _mm_storeu_ps(pOut + i, _mm_mul_ps(_mm_cvtepi32_ps(x), scale));
+    }
+    Int32ToFloatScalar(pIn + i * 4, pOut + i, nSamples - i);
+}
+
+TARGET_SSE2 static void FloatToInt16Sse2(const float *pIn, uint8_t *pOut, size_t nSamples, DitherState *pDither) {
+    const __m128 scale = _mm_set1_ps(32768.0f);
+    const __m128 lo = _mm_set1_ps(-32768.0f);
+    const __m128 hi = _mm_set1_ps(32767.0f);
+    __m128i state = _mm_setzero_si128();
+    if (pDither) {
+        state = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pDither->lanes));
+    }
+    size_t i = 0;
+    for (; i + 8 <= nSamples; i += 8) {
+        __m128 a = _mm_mul_ps(_mm_loadu_ps(pIn + i), scale);
+        __m128 b = _mm_mul_ps(_mm_loadu_ps(pIn + i + 4), scale);
+        if (pDither) {
+            a = _mm_add_ps(a, TpdfSse2(state));
+            b = _mm_add_ps(b, TpdfSse2(state));
+        }
+        __m128i ia = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(a, lo), hi));
+        __m128i ib = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(b, lo), hi));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(pOut + i * 2), _mm_packs_epi32(ia, ib));
+    }
+    if (pDither) {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(pDither->lanes), state);
+    }
+    FloatToInt16Scalar(pIn + i, pOut + i * 2, nSamples - i, pDither);
+}
+
+TARGET_SSE2 static void FloatToInt32Sse2(const float *pIn, uint8_t *pOut, size_t nSamples, DitherState *pDither) {
+    const __m128 scale = _mm_set1_ps(2147483648.0f);
+    const __m128 lo = _mm_set1_ps(-2147483648.0f);
+    const __m128 hi = _mm_set1_ps(2147483520.0f);
+    size_t i = 0;
+    for (; i + 4 <= nSamples; i += 4) {
+        __m128 a = _mm_mul_ps(_mm_loadu_ps(pIn + i), scale);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(pOut + i * 4), _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(a, lo), hi)));
+    }
+    FloatToInt32Scalar(pIn + i, pOut + i * 4, nSamples - i, pDither);
+}
+
+// ---- AVX2 kernels ----
+
+TARGET_AVX2 static inline __m256 TpdfAvx2(__m256i &x) {
+    x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+    x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+    __m256i lo = _mm256_and_si256(x, _mm256_set1_epi32(0xFFFF));
+    __m256i hi = _mm256_srli_epi32(x, 16);
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(lo, hi)), _mm256_set1_ps(1.0f / 65536.0f));
+}
+
+TARGET_AVX2 static void Int16ToFloatAvx2(const uint8_t *pIn, float *pOut, size_t nSamples) {
+    const __m256 scale = _mm256_set1_ps(1.0f / 32768.0f);
+    size_t i = 0;
+    for (; i + 16 <= nSamples; i += 16) {
+        __m256i a = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pIn + i * 2)));
+        __m256i b = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pIn + i * 2 + 16)));
+        _mm256_storeu_ps(pOut + i, _mm256_mul_ps(_mm256_cvtepi32_ps(a), scale));
+        _mm256_storeu_ps(pOut + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(b), scale));
+    }
+    Int16ToFloatScalar(pIn + i * 2, pOut + i, nSamples - i);
+}
+
+TARGET_AVX2 static void Int24ToFloatAvx2(const uint8_t *pIn, float *pOut, size_t nSamples) {
+    const __m256 scale = _mm256_set1_ps(1.0f / 2147483648.0f);
+    // move bytes 12..27 into the upper lane so each lane holds four samples
+    const __m256i spread = _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6);
+    // put each 3-byte sample in the top of a dword, low byte zero
+    const __m256i place = _mm256_setr_epi8(
+        -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+        -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11
+    );
+    size_t i = 0;
+    // each step reads 32 bytes but only uses 24, so stop short of the end
+    for (; i + 11 <= nSamples; i += 8) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pIn + i * 3));
+        x = _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(x, spread), place);
+        // the sample now sits in the top 24 bits, so scale as a 32-bit value
+        _mm256_storeu_ps(pOut + i, _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+    }
+    Int24ToFloatScalar(pIn + i * 3, pOut + i, nSamples - i);
+}
+
+TARGET_AVX2 static void Int32ToFloatAvx2(const uint8_t *pIn, float *pOut, size_t nSamples) {
+    const __m256 scale = _mm256_set1_ps(1.0f / 2147483648.0f);
+    size_t i = 0;
+    for (; i + 8 <= nSamples; i += 8) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pIn + i * 4));
+        _mm256_storeu_ps(pOut + i, _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+    }
+    Int32ToFloatScalar(pIn + i * 4, pOut + i, nSamples - i);
+}
+
+TARGET_AVX2 static void FloatToInt16Avx2(const float *pIn, uint8_t *pOut, size_t nSamples, DitherState *pDither) {
+    const __m256 scale = _mm256_set1_ps(32768.0f);
+    const __m256 lo = _mm256_set1_ps(-32768.0f);
+    const __m256 hi = _mm256_set1_ps(32767.0f);
+    __m256i state = _mm256_setzero_si256();
+    if (pDither) {
+        state = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pDither->lanes));
+    }
+    size_t i = 0;
+    for (; i + 16 <= nSamples; i += 16) {
+        __m256 a = _mm256_mul_ps(_mm256_loadu_ps(pIn + i), scale);
+        __m256 b = _mm256_mul_ps(_mm256_loadu_ps(pIn + i + 8), scale);
+        if (pDither) {
+            a = _mm256_add_ps(a, TpdfAvx2(state));
+            b = _mm256_add_ps(b, TpdfAvx2(state));
+        }
+        __m256i ia = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(a, lo), hi));
+        __m256i ib = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(b, lo), hi));
+        // packs works per lane, so put the quadwords back in order afterwards
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(ia, ib), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(pOut + i * 2), packed);
+    }
+    if (pDither) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(pDither->lanes), state);
+    }
+    FloatToInt16Scalar(pIn + i, pOut + i * 2, nSamples - i, pDither);
+}
+
+TARGET_AVX2 static void FloatToInt32Avx2(const float *pIn, uint8_t *pOut, size_t nSamples, DitherState *pDither) {
+    const __m256 scale = _mm256_set1_ps(2147483648.0f);
+    const __m256 lo = _mm256_set1_ps(-2147483648.0f);
+    const __m256 hi = _mm256_set1_ps(2147483520.0f);
+    size_t i = 0;
+    for (; i + 8 <= nSamples; i += 8) {
+        __m256 a = _mm256_mul_ps(_mm256_loadu_ps(pIn + i), scale);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(pOut + i * 4), _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(a, lo), hi)));
+    }
+    FloatToInt32Scalar(pIn + i, pOut + i * 4, nSamples - i, pDither);
+}
+
+#endif // SIMD_X86
+
+// ---- dispatch ----
+
+static ToFloatKernel PickToFloat(SampleType type, SimdLevel level) {
+    switch (type) {
+    case SAMPLE_INT16:
+#ifdef SIMD_X86
+        if (level >= SIMD_AVX2) return Int16ToFloatAvx2;
+        if (level >= SIMD_SSE2) return Int16ToFloatSse2;
+#endif
+        return Int16ToFloatScalar;
+    case SAMPLE_INT24:
+#ifdef SIMD_X86
+        if (level >= SIMD_AVX2) return Int24ToFloatAvx2;
+#endif
+        return Int24ToFloatScalar;
+    case SAMPLE_INT32:
+#ifdef SIMD_X86
+        if (level >= SIMD_AVX2) return Int32ToFloatAvx2;
+        if (level >= SIMD_SSE2) return Int32ToFloatSse2;
+#endif
+        return Int32ToFloatScalar;
+    case SAMPLE_FLOAT32:
+        return Float32ToFloat;
+    case SAMPLE_FLOAT64:
+        return Float64ToFloat;
+    default:
+        return nullptr;
+    }
+}
+
+static FromFloatKernel PickFromFloat(SampleType type, SimdLevel level) {
+    switch (type) {
+    case SAMPLE_INT16:
+#ifdef SIMD_X86
+        if (level >= SIMD_AVX2) return FloatToInt16Avx2;
+        if (level >= SIMD_SSE2) return FloatToInt16Sse2;
+#endif
+        return FloatToInt16Scalar;
+    case SAMPLE_INT24:
+        return FloatToInt24Scalar;
+    case SAMPLE_INT32:
+#ifdef SIMD_X86
+        if (level >= SIMD_AVX2) return FloatToInt32Avx2;
+        if (level >= SIMD_SSE2) return FloatToInt32Sse2;
+#endif
+        return FloatToInt32Scalar;
+    case SAMPLE_FLOAT32:
+        return FloatToFloat32;
+    case SAMPLE_FLOAT64:
+        return FloatToFloat64;
+    default:
+        return nullptr;
+    }
+}
+
+SampleConverter::SampleConverter()
+    : m_in(SAMPLE_UNKNOWN)
+    , m_out(SAMPLE_UNKNOWN)
+    , m_level(SIMD_SCALAR)
+    , m_bDither(false)
+    , m_pToFloat(nullptr)
+    , m_pFromFloat(nullptr)
+{
+    memset(&m_dither, 0, sizeof(m_dither));
+}
+
+bool SampleConverter::Init(SampleType in, SampleType out, bool bDither, SimdLevel level) {
+    m_pToFloat = PickToFloat(in, level);
+    m_pFromFloat = PickFromFloat(out, level);
+    if (nullptr == m_pToFloat || nullptr == m_pFromFloat) {
+        return false;
+    }
+
+    m_in = in;
+    m_out = out;
+    m_level = level;
+
+    // only worth it when precision is actually being thrown away
+    m_bDither = bDither && (out == SAMPLE_INT16 || out == SAMPLE_INT24) && SampleTypePrecision(in) > SampleTypePrecision(out);
+
+    // any non-zero seeds will do; different lanes must differ
+    for (uint32_t i = 0; i < 8; i++) {
+        m_dither.lanes[i] = 0x9E3779B9u * (i + 1);
+    }
+    return true;
+}
+
+void SampleConverter::Convert(const uint8_t *pIn, uint8_t *pOut, size_t nSamples) {
+    if (m_in == m_out) {
+        memcpy(pOut, pIn, nSamples * SampleTypeBytes(m_in));
+        return;
+    }
+
+    const size_t nInBytes = SampleTypeBytes(m_in);
+    const size_t nOutBytes = SampleTypeBytes(m_out);
+    DitherState *pDither = m_bDither ? &m_dither : nullptr;
+
+    if (m_in == SAMPLE_FLOAT32) {
+        m_pFromFloat(reinterpret_cast<const float *>(pIn), pOut, nSamples, pDither);
+        return;
+    }
+
+    while (nSamples > 0) {
+        size_t n = (std::min)(nSamples, static_cast<size_t>(SAMPLECONVERT_BLOCK));
+        m_pToFloat(pIn, m_block, n);
+        m_pFromFloat(m_block, pOut, n, pDither);
+        pIn += n * nInBytes;
+        pOut += n * nOutBytes;
+        nSamples -= n;
+    }
+}
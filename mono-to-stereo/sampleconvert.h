@@ -0,0 +1,84 @@
+// sampleconvert.h
+
+// sample format conversion between the formats a shared mode endpoint can
+// ask for: 16-bit, packed 24-bit and 32-bit integer PCM, and 32/64-bit float
+//
+// every conversion goes through 32-bit float a block at a time so there are
+// only two kernels per format; the hot ones have SSE2 and AVX2 versions
+// that are picked at run time. reducing to 16 or 24 bits can add TPDF dither
+//
+// no Windows dependencies
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "audioformat.h"
+
+enum SampleType {
+    SAMPLE_UNKNOWN,
+    SAMPLE_INT16,
+    SAMPLE_INT24,   // packed, 3 bytes
+    SAMPLE_INT32,   // also 24-in-32 containers
+    SAMPLE_FLOAT32,
+    SAMPLE_FLOAT64,
+};
+
+enum SimdLevel {
+    SIMD_SCALAR,
+    SIMD_SSE2,
+    SIMD_AVX2,
+};
+
+SampleType SampleTypeOf(const AudioFormat &format);
+const char *SampleTypeName(SampleType type);
+size_t SampleTypeBytes(SampleType type);
+
+// best level the CPU supports
+SimdLevel DetectSimdLevel();
+const char *SimdLevelName(SimdLevel level);
+
+// xorshift state for the dither noise, one per vector lane
+struct DitherState {
+    uint32_t lanes[8];
+};
+
+typedef void (*ToFloatKernel)(const uint8_t *pIn, float *pOut, size_t nSamples);
+typedef void (*FromFloatKernel)(const float *pIn, uint8_t *pOut, size_t nSamples, DitherState *pDither);
+
+// samples per internal float block; small enough to stay in L1
+#define SAMPLECONVERT_BLOCK 1024
+
+class SampleConverter {
+public:
+    SampleConverter();
+
+    // level defaults to the best the CPU supports; a lower one can be forced
+    // for testing and benchmarking
+    // dither is only applied when the output has less precision than the input
+    bool Init(SampleType in, SampleType out, bool bDither, SimdLevel level);
+    bool Init(SampleType in, SampleType out, bool bDither) { return Init(in, out, bDither, DetectSimdLevel()); }
+
+    // nSamples counts individual samples, not frames
+    void Convert(const uint8_t *pIn, uint8_t *pOut, size_t nSamples);
+
+    // the two halves on their own, for callers that work in float
+    void ToFloat(const uint8_t *pIn, float *pOut, size_t nSamples) { m_pToFloat(pIn, pOut, nSamples); }
+    void FromFloat(const float *pIn, uint8_t *pOut, size_t nSamples) { m_pFromFloat(pIn, pOut, nSamples, m_bDither ? &m_dither : nullptr); }
+
+    bool IsPassthrough() const { return m_in == m_out; }
+    SampleType InputType() const { return m_in; }
+    SampleType OutputType() const { return m_out; }
+    SimdLevel Level() const { return m_level; }
+
+private:
+    SampleType m_in;
+    SampleType m_out;
+    SimdLevel m_level;
+    bool m_bDither;
+    DitherState m_dither;
+    ToFloatKernel m_pToFloat;
+    FromFloatKernel m_pFromFloat;
+    float m_block[SAMPLECONVERT_BLOCK];
+};
@@ -0,0 +1,278 @@
+// sharedstats.cpp
+
+#include "sharedstats.h"
+
+#include <cstring>
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+static std::string LastErrorString(const char *szWhat) {
+    return std::string(szWhat) + " failed: last error = " + std::to_string(GetLastError());
+}
+
+static uint32_t CurrentProcessId() {
+    return static_cast<uint32_t>(GetCurrentProcessId());
+}
+
+SharedStatsMapping::SharedStatsMapping() : m_pBlock(NULL), m_bOwner(false), m_hMapping(NULL) {}
+
+bool SharedStatsMapping::Map(const std::string &name, bool bCreate, std::string &error) {
+    Unmap();
+
+    std::string mappingName = "Local\\" SHAREDSTATS_PREFIX + name;
+    if (bCreate) {
+        // a mapping lasts as long as anybody has it open, so one that
+        // already exists is reused; Create sets it up from scratch
+        m_hMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(SharedStatsBlock), mappingName.c_str());
+    }
+    else {
+        m_hMapping = OpenFileMappingA(FILE_MAP_READ, FALSE, mappingName.c_str());
+    }
+    if (NULL == m_hMapping) {
+        error = LastErrorString(bCreate ? "CreateFileMapping" : "OpenFileMapping");
+        return false;
+    }
+
+    void *pView = MapViewOfFile(m_hMapping, bCreate ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, sizeof(SharedStatsBlock));
+    if (NULL == pView) {
+        error = LastErrorString("MapViewOfFile");
+        CloseHandle(m_hMapping);
+        m_hMapping = NULL;
+        return false;
+    }
+
+    m_pBlock = static_cast<SharedStatsBlock *>(pView);
+    m_name = name;
+    m_bOwner = bCreate;
+    return true;
+}
+
+void SharedStatsMapping::Unmap() {
+    if (NULL != m_pBlock) {
+        UnmapViewOfFile(m_pBlock);
+        m_pBlock = NULL;
+    }
+
+    if (NULL != m_hMapping) {
+        CloseHandle(m_hMapping);
+        m_hMapping = NULL;
+    }
+
+    m_bOwner = false;
+}
+
+#else // POSIX
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static std::string ErrnoString(const char *szWhat) {
+    return std::string(szWhat) + " failed: " + strerror(errno);
+}
+
+static uint32_t CurrentProcessId() {
+    return static_cast<uint32_t>(getpid());
+}
+
+SharedStatsMapping::SharedStatsMapping() : m_pBlock(NULL), m_bOwner(false) {}
+
+bool SharedStatsMapping::Map(const std::string &name, bool bCreate, std::string &error) {
+    Unmap();
+
+    std::string objectName = "/" SHAREDSTATS_PREFIX + name;
+    int fd;
+    if (bCreate) {
+        // whatever is left under the name belongs to an instance that
+        // didn't get to remove it, or is about to be orphaned by this one
+        shm_unlink(objectName.c_str());
+        fd = shm_open(objectName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (fd >= 0 && ftruncate(fd, sizeof(SharedStatsBlock)) != 0) {
+            error = ErrnoString("ftruncate");
+            close(fd);
+            shm_unlink(objectName.c_str());
+            return false;
+        }
+    }
+    else {
+        fd = shm_open(objectName.c_str(), O_RDONLY, 0);
+    }
+    if (fd < 0) {
+        error = ErrnoString("shm_open");
+        return false;
+    }
+
+    // a writer may not have sized it yet
+    struct stat st;
+    if (!bCreate && (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(SharedStatsBlock))) {
+        error = "not a statistics block, or not set up yet";
+        close(fd);
+        return false;
+    }
+
+    void *pView = mmap(NULL, sizeof(SharedStatsBlock), bCreate ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == pView) {
+        error = ErrnoString("mmap");
+        if (bCreate) {
+            shm_unlink(objectName.c_str());
+        }
+        return false;
+    }
+
+    m_pBlock = static_cast<SharedStatsBlock *>(pView);
+    m_name = name;
+    m_bOwner = bCreate;
+    return true;
+}
+
+void SharedStatsMapping::Unmap() {
+    if (NULL != m_pBlock) {
+        munmap(m_pBlock, sizeof(SharedStatsBlock));
+        m_pBlock = NULL;
+    }
+
+    if (m_bOwner) {
+        shm_unlink(("/" SHAREDSTATS_PREFIX + m_name).c_str());
+        m_bOwner = false;
+    }
+}
+
+#endif
+
+SharedStatsMapping::~SharedStatsMapping() {
+    Unmap();
+}
+
+bool IsValidSharedStatsName(const std::string &name) {
+    if (name.empty() || name.size() > 200) {
+        return false;
+    }
+
+    for (char c : name) {
+        bool bOk = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_' || c == '.';
+        if (!bOk) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// ---- writer ----
+
+SharedStatsWriter::SharedStatsWriter(StatsClock &clock) : m_clock(clock) {}
+
+SharedStatsWriter::~SharedStatsWriter() {
+    Close();
+}
+
+bool SharedStatsWriter::Create(const std::string &name, std::string &error) {
+    if (!IsValidSharedStatsName(name)) {
+        error = "statistics names can only have letters, digits, '-', '_' and '.'";
+        return false;
+    }
+
+    if (!Map(name, true, error)) {
+        return false;
+    }
+
+    // the magic number goes in last to say it's ready
+    SharedStatsBlock *pBlock = m_pBlock;
+    pBlock->nMagic.store(0, std::memory_order_relaxed);
+    memset(&pBlock->stats, 0, sizeof(pBlock->stats));
+    pBlock->nVersion = SHAREDSTATS_VERSION;
+    pBlock->nSize = sizeof(SharedStatsBlock);
+    pBlock->nProcessId = CurrentProcessId();
+    pBlock->nSequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    pBlock->nMagic.store(SHAREDSTATS_MAGIC, std::memory_order_release);
+    return true;
+}
+
+void SharedStatsWriter::Close() {
+    Unmap();
+}
+
+void SharedStatsWriter::Publish(const StreamStatsSnapshot &snapshot) {
+    SharedStatsBlock *pBlock = m_pBlock;
+    if (NULL == pBlock) {
+        return;
+    }
+
+    SharedStats &stats = pBlock->stats;
+
+    // odd while the copy is going on
+    uint32_t nSequence = pBlock->nSequence.load(std::memory_order_relaxed);
+    pBlock->nSequence.store(nSequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    stats.hnsUpdated = m_clock.NowHns();
+    stats.nUpdates++;
+    stats.nCapturedFrames = snapshot.nCapturedFrames;
+    stats.captureJitter = snapshot.captureJitter;
+    stats.captureProcessing = snapshot.captureProcessing;
+    stats.nCaptureGapFrames = snapshot.nCaptureGapFrames;
+    stats.nTimestampErrors = snapshot.nTimestampErrors;
+    stats.glitches = snapshot.glitches;
+
+    if (snapshot.nOutput < SHAREDSTATS_MAX_OUTPUTS) {
+        SharedStatsOutput &output = stats.outputs[snapshot.nOutput];
+        output.latency = snapshot.latency;
+        output.renderJitter = snapshot.renderJitter;
+        output.renderProcessing = snapshot.renderProcessing;
+        output.ring = snapshot.ring;
+        output.nDroppedAnchors = snapshot.nDroppedAnchors;
+
+        if (snapshot.nOutput >= stats.nOutputs) {
+            stats.nOutputs = snapshot.nOutput + 1;
+        }
+    }
+
+    pBlock->nSequence.store(nSequence + 2, std::memory_order_release);
+}
+
+// ---- reader ----
+
+bool SharedStatsReader::Open(const std::string &name, std::string &error) {
+    if (!IsValidSharedStatsName(name)) {
+        error = "not a statistics name";
+        return false;
+    }
+
+    if (!Map(name, false, error)) {
+        return false;
+    }
+
+    if (m_pBlock->nMagic.load(std::memory_order_acquire) != SHAREDSTATS_MAGIC ||
+        m_pBlock->nVersion != SHAREDSTATS_VERSION || m_pBlock->nSize != sizeof(SharedStatsBlock)) {
+        error = "not set up yet, or from another version";
+        Unmap();
+        return false;
+    }
+
+    return true;
+}
+
+bool SharedStatsReader::Read(SharedStats &stats) const {
+    const SharedStatsBlock *pBlock = m_pBlock;
+
+    for (uint32_t nTry = 0; nTry < SHAREDSTATS_READ_TRIES; nTry++) {
+        uint32_t nBefore = pBlock->nSequence.load(std::memory_order_acquire);
+        if (nBefore & 1) {
+            continue;
+        }
+
+        memcpy(&stats, &pBlock->stats, sizeof(stats));
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (pBlock->nSequence.load(std::memory_order_relaxed) == nBefore) {
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,125 @@
+// sharedstats.h
+
+// live statistics in a named block of shared memory, for watching many
+// instances from outside without talking to them
+//
+// SharedStatsWriter is a StatsSink: each snapshot the pipeline publishes is
+// copied into the block under a sequence lock. the writer bumps the
+// sequence number to odd, copies, and bumps it back to even; a reader
+// copies the block out and keeps the copy only if the number was even and
+// unchanged around it, so the writer never waits for anybody and a reader
+// never sees half an update. nothing in the block is a pointer, so any
+// process that maps it reads it the same
+//
+// the block is a POSIX shared memory object named /mono-to-stereo.<name>,
+// or a Windows file mapping named Local\mono-to-stereo.<name>; the writer
+// removes it again when it closes
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "conceal.h"
+#include "latency.h"
+#include "ring.h"
+
+#define SHAREDSTATS_PREFIX "mono-to-stereo."
+#define SHAREDSTATS_MAGIC 0x5453324du // "M2ST"
+#define SHAREDSTATS_VERSION 2
+
+// how often the pipeline updates the block
+#define SHAREDSTATS_INTERVAL_MS 250
+
+// outputs past this many aren't in the block
+#define SHAREDSTATS_MAX_OUTPUTS 8
+
+// how many times a reader tries for a copy the writer didn't get in the way of
+#define SHAREDSTATS_READ_TRIES 100
+
+struct SharedStatsOutput {
+    HistogramSummary latency;
+    HistogramSummary renderJitter;
+    HistogramSummary renderProcessing;
+    RingStats ring;
+    uint64_t nDroppedAnchors;
+};
+
+struct SharedStats {
+    int64_t hnsUpdated;           // on the writer's StatsClock
+    uint64_t nUpdates;            // snapshots published so far
+    uint64_t nCapturedFrames;
+    HistogramSummary captureJitter;
+    HistogramSummary captureProcessing;
+    uint64_t nCaptureGapFrames;
+    uint64_t nTimestampErrors;
+    GlitchStats glitches;
+    uint32_t nOutputs;            // of the outputs array that have been published
+    uint32_t nReserved;
+    SharedStatsOutput outputs[SHAREDSTATS_MAX_OUTPUTS];
+};
+
+struct SharedStatsBlock {
+    std::atomic<uint32_t> nMagic; // written last, once the rest is set up
+    uint32_t nVersion;
+    uint32_t nSize;               // sizeof(SharedStatsBlock)
+    uint32_t nProcessId;
+    std::atomic<uint32_t> nSequence;
+    uint32_t nReserved;
+    SharedStats stats;
+};
+
+// what both ends of the block share; not for use on its own
+class SharedStatsMapping {
+protected:
+    SharedStatsMapping();
+    ~SharedStatsMapping();
+
+    // bCreate makes a new block, replacing any left behind by a writer that
+    // didn't get to remove it
+    bool Map(const std::string &name, bool bCreate, std::string &error);
+    void Unmap();
+
+    SharedStatsBlock *m_pBlock;
+    std::string m_name;
+    bool m_bOwner;
+
+#ifdef _WIN32
+    void *m_hMapping;
+#endif
+
+private:
+    SharedStatsMapping(const SharedStatsMapping &) = delete;
+    SharedStatsMapping &operator=(const SharedStatsMapping &) = delete;
+};
+
+class SharedStatsWriter : public StatsSink, private SharedStatsMapping {
+public:
+    explicit SharedStatsWriter(StatsClock &clock);
+    ~SharedStatsWriter();
+
+    // names are letters, digits, '-', '_' and '.'
+    bool Create(const std::string &name, std::string &error);
+    void Close();
+
+    // one thread at a time; never blocks or allocates
+    void Publish(const StreamStatsSnapshot &snapshot) override;
+
+private:
+    StatsClock &m_clock;
+};
+
+class SharedStatsReader : private SharedStatsMapping {
+public:
+    bool Open(const std::string &name, std::string &error);
+    void Close() { Unmap(); }
+
+    bool IsOpen() const { return NULL != m_pBlock; }
+    uint32_t ProcessId() const { return m_pBlock->nProcessId; }
+
+    // false if the writer kept getting in the way
+    bool Read(SharedStats &stats) const;
+};
+
+bool IsValidSharedStatsName(const std::string &name);
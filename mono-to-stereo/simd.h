@@ -0,0 +1,22 @@
+// simd.h
+
+// what the x86 vector kernels need to build with both compilers
+//
+// MSVC lets any function use any instruction set, GCC and clang only allow
+// it in functions marked with a target attribute. kernels are always picked
+// at run time from DetectSimdLevel, never at compile time
+
+#pragma once
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_SSE2
+#define TARGET_AVX2
+#else
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
@@ -0,0 +1,461 @@
+// simdevice.cpp
+
+#include "simdevice.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include "fileio.h"
+
+// random streams, see SimulatedEvents::Random
+#define SIM_STREAM_JITTER 0
+#define SIM_STREAM_PACKET_SIZE 1
+#define SIM_STREAM_DISCONTINUITY 2
+#define SIM_STREAM_LOST_FRAMES 3
+#define SIM_STREAM_FAULT 4
+#define SIM_STREAM_FAULT_KIND 5
+#define SIM_STREAM_NOISE 6
+
+// a packet flag no real device sets
+#define SIM_FLAG_UNKNOWN 0x100
+
+// a profile is a wakeup per line, so this is several hours of them
+#define SIM_PROFILE_MAX_BYTES (64 * 1024 * 1024)
+
+// ---- jitter profiles ----
+
+bool LoadJitterProfile(const std::string &path, std::vector<float> &profileMs, std::string &error) {
+    MappedInputFile file;
+    if (!file.Open(path, error)) {
+        error = path + ": " + error;
+        return false;
+    }
+    if (file.Size() > SIM_PROFILE_MAX_BYTES) {
+        error = path + ": too big for a jitter profile";
+        return false;
+    }
+
+    std::string text;
+    if (file.Size() > 0) {
+        const uint8_t *pData = file.Map(0, static_cast<size_t>(file.Size()), error);
+        if (NULL == pData) {
+            error = path + ": " + error;
+            return false;
+        }
+        text.assign(reinterpret_cast<const char *>(pData), static_cast<size_t>(file.Size()));
+    }
+
+    profileMs.clear();
+    size_t nLine = 0;
+    size_t nPos = 0;
+    while (nPos < text.size()) {
+        size_t nNewline = text.find('\n', nPos);
+        if (std::string::npos == nNewline) {
+            nNewline = text.size();
+        }
+        std::string line = text.substr(nPos, nNewline - nPos);
+        nPos = nNewline + 1;
+        nLine++;
+
+        size_t nFirst = line.find_first_not_of(" \t\r");
+        if (std::string::npos == nFirst || '#' == line[nFirst]) {
+            continue;
+        }
+
+        char *pEnd;
+        double fMs = strtod(line.c_str() + nFirst, &pEnd);
+        if (pEnd == line.c_str() + nFirst || fMs < 0 || fMs > 1000 || std::string::npos != line.find_first_not_of(" \t\r", pEnd - line.c_str())) {
+            error = path + ":" + std::to_string(nLine) + ": expected a lateness in ms, from 0 to 1000";
+            return false;
+        }
+        profileMs.push_back(static_cast<float>(fMs));
+    }
+
+    if (profileMs.empty()) {
+        error = path + ": no wakeups in the profile";
+        return false;
+    }
+    return true;
+}
+
+// ---- events ----
+
+void SimulatedEvents::Init(StatsClock &clock, int64_t hnsPeriod, double fJitterMs, const std::vector<float> &profileMs, uint32_t nSeed) {
+    m_pClock = &clock;
+    m_hnsPeriod = hnsPeriod;
+    m_nJitterHns = static_cast<int64_t>(fJitterMs * 10000.0);
+    m_pProfileMs = profileMs.empty() ? NULL : &profileMs;
+    m_nSeed = nSeed;
+    m_nEvent = 0;
+    m_bStarted = false;
+    m_bInterrupted = false;
+}
+
+void SimulatedEvents::Start(int64_t hnsStart) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_hnsStart = hnsStart;
+    m_nEvent = 0;
+    m_bStarted = true;
+}
+
+void SimulatedEvents::Interrupt() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_bInterrupted = true;
+    m_wake.notify_all();
+}
+
+double SimulatedEvents::Random(uint32_t nStream, uint64_t n) const {
+    // splitmix64 of everything that picks the value
+    uint64_t x = (static_cast<uint64_t>(m_nSeed) << 32 | nStream) * 0x9E3779B97F4A7C15ull + n;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    return static_cast<double>(x >> 11) / 9007199254740992.0;
+}
+
+// event n is due n periods after the start, plus its own lateness
+int64_t SimulatedEvents::DueHns(uint64_t n) const {
+    int64_t hnsLate;
+    if (NULL != m_pProfileMs) {
+        hnsLate = static_cast<int64_t>((*m_pProfileMs)[static_cast<size_t>(n % m_pProfileMs->size())] * 10000.0);
+    }
+    else {
+        hnsLate = static_cast<int64_t>(Random(SIM_STREAM_JITTER, n) * static_cast<double>(m_nJitterHns));
+    }
+    return m_hnsStart + static_cast<int64_t>(n) * m_hnsPeriod + hnsLate;
+}
+
+int64_t SimulatedEvents::NextEventHns() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return DueHns(m_nEvent + 1);
+}
+
+DeviceStatus SimulatedEvents::Wait(uint32_t nTimeoutMs, SimulatedDeviceStats &stats) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    const int64_t hnsDeadline = m_pClock->NowHns() + static_cast<int64_t>(nTimeoutMs) * 10000;
+    for (;;) {
+        if (m_bInterrupted) {
+            return DEVICE_STOPPED;
+        }
+
+        int64_t hnsNow = m_pClock->NowHns();
+        int64_t hnsWake = hnsDeadline;
+        if (m_bStarted) {
+            int64_t hnsDue = DueHns(m_nEvent + 1);
+            if (hnsNow >= hnsDue) {
+                // like an auto-reset event, events that fire while nobody is
+                // waiting are lost rather than queued
+                m_nEvent++;
+                while (hnsNow >= DueHns(m_nEvent + 1)) {
+                    m_nEvent++;
+                    stats.nLateEvents++;
+                }
+                stats.nEvents++;
+                return DEVICE_OK;
+            }
+            hnsWake = (std::min)(hnsWake, hnsDue);
+        }
+
+        if (hnsNow >= hnsDeadline) {
+            return DEVICE_TIMEOUT;
+        }
+
+        m_wake.wait_for(lock, std::chrono::microseconds((hnsWake - hnsNow + 9) / 10));
+    }
+}
+
+// ---- capture ----
+
+// the tone in the simulated stream; the right channel is a little quieter
+// and a little behind, so the channels are correlated but not identical
+#define SIM_TONE_HZ 997
+
+SimulatedCaptureSource::SimulatedCaptureSource(StatsClock &clock, const SimulatedDeviceOptions &options)
+    : m_clock(clock)
+    , m_options(options)
+    , m_stats()
+    , m_fFramesPerHns(0)
+    , m_nPeriodFrames(0)
+    , m_nPosition(0)
+    , m_nHeld(0)
+{
+    m_options.fPacketVariation = (std::min)((std::max)(m_options.fPacketVariation, 0.0), 1.0);
+}
+
+DeviceStatus SimulatedCaptureSource::Open() {
+    const AudioFormat &format = m_options.format;
+    if (!m_converter.Init(SAMPLE_FLOAT32, SampleTypeOf(format), false)) {
+        return Fail(DEVICE_FAILED, 0, "simulated capture device can't produce %u-bit format %u", format.wBitsPerSample, format.wFormatTag);
+    }
+
+    if (m_options.hnsPeriod <= 0) {
+        return Fail(DEVICE_FAILED, 0, "simulated capture device needs a period");
+    }
+
+    m_nPeriodFrames = static_cast<uint32_t>((std::max)(static_cast<int64_t>(1), static_cast<int64_t>(format.nSamplesPerSec) * m_options.hnsPeriod / HNS_PER_SECOND));
+    m_fFramesPerHns = format.nSamplesPerSec * (1.0 + m_options.fPpm / 1e6) / HNS_PER_SECOND;
+
+    // the largest packet is twice the period
+    size_t nMaxFrames = static_cast<size_t>(m_nPeriodFrames) * 2 + 1;
+    m_signal.assign(nMaxFrames * format.nChannels, 0.0f);
+    m_packet.assign(nMaxFrames * format.nBlockAlign, 0);
+
+    m_events.Init(m_clock, m_options.hnsPeriod, m_options.fJitterMs, m_options.jitterProfileMs, m_options.nSeed);
+    m_stats = SimulatedDeviceStats();
+    return DEVICE_OK;
+}
+
+DeviceStatus SimulatedCaptureSource::Start() {
+    m_nPosition = 0;
+    m_nHeld = 0;
+    m_events.Start(m_clock.NowHns());
+    return DEVICE_OK;
+}
+
+DeviceStatus SimulatedCaptureSource::Wait(uint32_t nTimeoutMs) {
+    DeviceStatus status = m_events.Wait(nTimeoutMs, m_stats);
+
+    // like WASAPI, a device that has gone away is only noticed the next
+    // time it's asked for something
+    if (DEVICE_OK == status && m_clock.NowHns() >= m_options.hnsLoseAt) {
+        return Fail(DEVICE_LOST, 0, "simulated capture device went away");
+    }
+    return status;
+}
+
+uint64_t SimulatedCaptureSource::DeviceFrames(int64_t hnsNow) const {
+    int64_t hnsElapsed = hnsNow - m_events.StartHns();
+    return hnsElapsed > 0 ? static_cast<uint64_t>(static_cast<double>(hnsElapsed) * m_fFramesPerHns) : 0;
+}
+
+uint32_t SimulatedCaptureSource::PacketFrames(uint64_t nPacket) const {
+    double fSpread = 2.0 * m_events.Random(SIM_STREAM_PACKET_SIZE, nPacket) - 1.0;
+    double fFrames = m_nPeriodFrames * (1.0 + m_options.fPacketVariation * fSpread);
+    return (std::max)(static_cast<uint32_t>(std::lround(fFrames)), 1u);
+}
+
+double SimulatedChannelLevel(uint32_t nChannel) {
+    return 0.5 / (1.0 + 0.25 * nChannel);
+}
+
+void SimulatedCaptureSource::Synthesize(uint64_t nPosition, uint32_t nFrames) {
+    const double fTwoPi = 6.283185307179586;
+    const uint32_t nChannels = m_options.format.nChannels;
+    const uint32_t nMultiplex = m_options.nMultiplex;
+    const uint64_t nRealRate = m_options.format.nSamplesPerSec / nMultiplex;
+    const uint64_t nFirst = m_options.bMissingFirstSample ? 1 : 0;
+
+    for (uint32_t i = 0; i < nFrames; i++) {
+        // which frame of the real stream this is part of, and which part
+        uint64_t nSample = nPosition + i + nFirst;
+        uint64_t nFrame = nSample / nMultiplex;
+        uint32_t nSlot = static_cast<uint32_t>(nSample % nMultiplex);
+
+        // in whole cycles and a fraction, so the phase stays exact however
+        // long the stream runs
+        double fPhase = fTwoPi * static_cast<double>(nFrame * SIM_TONE_HZ % nRealRate) / static_cast<double>(nRealRate);
+        for (uint32_t c = 0; c < nChannels; c++) {
+            uint32_t nChannel = nSlot * nChannels + c;
+            m_signal[static_cast<size_t>(i) * nChannels + c] = static_cast<float>(SimulatedChannelLevel(nChannel) * std::sin(fPhase - 0.3 * nChannel));
+        }
+    }
+
+    m_converter.FromFloat(m_signal.data(), m_packet.data(), static_cast<size_t>(nFrames) * nChannels);
+}
+
+DeviceStatus SimulatedCaptureSource::GetPacket(CapturePacket &packet) {
+    memset(&packet, 0, sizeof(packet));
+    if (m_nHeld != 0) {
+        return Fail(DEVICE_FAILED, 0, "simulated capture packet taken twice");
+    }
+
+    // the packet's size, and whether frames are lost in front of it, only
+    // depend on its number
+    uint64_t nPacket = m_stats.nPackets;
+    uint32_t nFrames = PacketFrames(nPacket);
+
+    uint64_t nLost = 0;
+    double fPerPacket = m_options.fDiscontinuitiesPerMinute / 60.0 * static_cast<double>(m_options.hnsPeriod) / HNS_PER_SECOND;
+    if (nPacket > 0 && m_events.Random(SIM_STREAM_DISCONTINUITY, nPacket) < fPerPacket) {
+        nLost = static_cast<uint64_t>(m_nPeriodFrames * (1.0 + 3.0 * m_events.Random(SIM_STREAM_LOST_FRAMES, nPacket)));
+    }
+
+    if (DeviceFrames(m_clock.NowHns()) < m_nPosition + nLost + nFrames) {
+        return DEVICE_OK;
+    }
+
+    if (nLost > 0) {
+        m_nPosition += nLost;
+        m_stats.nDiscontinuities++;
+        m_stats.nLostFrames += nLost;
+        packet.nFlags |= DEVICE_FLAG_DISCONTINUITY;
+    }
+
+    Synthesize(m_nPosition, nFrames);
+
+    // the other things a device can say about a packet
+    double fFaultsPerPacket = m_options.fFaultsPerMinute / 60.0 * static_cast<double>(m_options.hnsPeriod) / HNS_PER_SECOND;
+    if (nPacket > 0 && m_events.Random(SIM_STREAM_FAULT, nPacket) < fFaultsPerPacket) {
+        m_stats.nFaults++;
+        switch (static_cast<int>(m_events.Random(SIM_STREAM_FAULT_KIND, nPacket) * 3)) {
+        case 0:
+            // nothing says what a silent packet's buffer holds
+            packet.nFlags |= DEVICE_FLAG_SILENT;
+            for (uint32_t i = 0; i < nFrames * m_options.format.nChannels; i++) {
+                m_signal[i] = static_cast<float>(1.8 * m_events.Random(SIM_STREAM_NOISE, m_nPosition * m_options.format.nChannels + i) - 0.9);
+            }
+            m_converter.FromFloat(m_signal.data(), m_packet.data(), static_cast<size_t>(nFrames) * m_options.format.nChannels);
+            break;
+        case 1:
+            packet.nFlags |= DEVICE_FLAG_TIMESTAMP_ERROR;
+            break;
+        default:
+            packet.nFlags |= SIM_FLAG_UNKNOWN;
+            break;
+        }
+    }
+
+    packet.pData = m_packet.data();
+    packet.nFrames = nFrames;
+    packet.nDevicePosition = m_nPosition;
+    packet.hnsCapture = m_events.StartHns() + static_cast<int64_t>(static_cast<double>(m_nPosition) / m_fFramesPerHns);
+    m_nHeld = nFrames;
+    return DEVICE_OK;
+}
+
+DeviceStatus SimulatedCaptureSource::ReleasePacket(uint32_t nFrames) {
+    if (nFrames != m_nHeld) {
+        return Fail(DEVICE_FAILED, 0, "released %u frames of a %u frame simulated packet", nFrames, m_nHeld);
+    }
+
+    if (nFrames % 2 != 0) {
+        m_stats.nOddPackets++;
+    }
+
+    m_nPosition += nFrames;
+    m_nHeld = 0;
+    m_stats.nPackets++;
+    m_stats.nFrames += nFrames;
+    return DEVICE_OK;
+}
+
+// ---- render ----
+
+SimulatedRenderSink::SimulatedRenderSink(StatsClock &clock, const SimulatedDeviceOptions &options)
+    : m_clock(clock)
+    , m_options(options)
+    , m_stats()
+    , m_format()
+    , m_nBufferFrames(0)
+    , m_fFramesPerHns(0)
+    , m_bStarted(false)
+    , m_bDry(false)
+    , m_nWritten(0)
+    , m_nPlayed(0)
+    , m_nBorrowed(0)
+{
+}
+
+DeviceStatus SimulatedRenderSink::Open(const AudioFormat &desired, uint32_t nBufferMs) {
+    if (m_options.hnsPeriod <= 0 || desired.nSamplesPerSec == 0) {
+        return Fail(DEVICE_FAILED, 0, "simulated render device needs a period and a rate");
+    }
+
+    // takes what it is offered unless it was told to want something else
+    m_format = desired;
+    SampleType preferred = SampleTypeOf(m_options.format);
+    if (SAMPLE_UNKNOWN != preferred && preferred != SampleTypeOf(desired)) {
+        m_format = MakeAudioFormat(m_options.format.wFormatTag, desired.nChannels, desired.nSamplesPerSec, m_options.format.wBitsPerSample);
+    }
+
+    uint32_t nPeriodFrames = static_cast<uint32_t>(static_cast<int64_t>(desired.nSamplesPerSec) * m_options.hnsPeriod / HNS_PER_SECOND);
+    m_nBufferFrames = (std::max)(static_cast<uint32_t>(static_cast<uint64_t>(nBufferMs) * desired.nSamplesPerSec / 1000), nPeriodFrames);
+    m_fFramesPerHns = desired.nSamplesPerSec * (1.0 + m_options.fPpm / 1e6) / HNS_PER_SECOND;
+    m_buffer.assign(static_cast<size_t>(m_nBufferFrames) * m_format.nBlockAlign, 0);
+
+    m_events.Init(m_clock, m_options.hnsPeriod, m_options.fJitterMs, m_options.jitterProfileMs, m_options.nSeed);
+    m_stats = SimulatedDeviceStats();
+    m_bStarted = false;
+    m_bDry = false;
+    m_nWritten = 0;
+    m_nPlayed = 0;
+    m_nBorrowed = 0;
+    return DEVICE_OK;
+}
+
+DeviceStatus SimulatedRenderSink::Start() {
+    m_events.Start(m_clock.NowHns());
+    m_bStarted = true;
+    return DEVICE_OK;
+}
+
+DeviceStatus SimulatedRenderSink::Wait(uint32_t nTimeoutMs) {
+    DeviceStatus status = m_events.Wait(nTimeoutMs, m_stats);
+    if (DEVICE_OK == status && m_clock.NowHns() >= m_options.hnsLoseAt) {
+        return Fail(DEVICE_LOST, 0, "simulated render device went away");
+    }
+    return status;
+}
+
+void SimulatedRenderSink::Play() {
+    if (!m_bStarted) {
+        return;
+    }
+
+    int64_t hnsElapsed = m_clock.NowHns() - m_events.StartHns();
+    uint64_t nPlayable = hnsElapsed > 0 ? static_cast<uint64_t>(static_cast<double>(hnsElapsed) * m_fFramesPerHns) : 0;
+    if (nPlayable <= m_nPlayed) {
+        return;
+    }
+
+    // whatever it needed beyond what it was given came out as silence
+    if (nPlayable > m_nWritten) {
+        if (!m_bDry) {
+            m_stats.nUnderruns++;
+            m_bDry = true;
+        }
+        m_stats.nUnderrunFrames += nPlayable - m_nWritten;
+        m_nWritten = nPlayable;
+    }
+    m_nPlayed = nPlayable;
+}
+
+DeviceStatus SimulatedRenderSink::GetPadding(uint32_t &nPadding) {
+    Play();
+    nPadding = static_cast<uint32_t>(m_nWritten - m_nPlayed);
+    return DEVICE_OK;
+}
+
+DeviceStatus SimulatedRenderSink::GetBuffer(uint32_t nFrames, uint8_t **ppData) {
+    Play();
+    uint32_t nFree = m_nBufferFrames - static_cast<uint32_t>(m_nWritten - m_nPlayed);
+    if (m_nBorrowed != 0 || nFrames > nFree) {
+        return Fail(DEVICE_FAILED, 0, "asked the simulated render device for %u frames with %u free", nFrames, nFree);
+    }
+
+    m_nBorrowed = nFrames;
+    *ppData = m_buffer.data();
+    return DEVICE_OK;
+}
+
+DeviceStatus SimulatedRenderSink::ReleaseBuffer(uint32_t nFrames, bool bSilent) {
+    if (nFrames > m_nBorrowed) {
+        return Fail(DEVICE_FAILED, 0, "released %u frames of %u borrowed from the simulated render device", nFrames, m_nBorrowed);
+    }
+
+    m_nBorrowed = 0;
+    m_nWritten += nFrames;
+    m_stats.nPackets++;
+    m_stats.nFrames += nFrames;
+    if (bSilent) {
+        m_stats.nSilentFrames += nFrames;
+    }
+    if (nFrames > 0) {
+        m_bDry = false;
+    }
+    return DEVICE_OK;
+}
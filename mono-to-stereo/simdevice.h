@@ -0,0 +1,207 @@
+// simdevice.h
+
+// simulated capture and render devices, for running the whole pipeline
+// without audio hardware
+//
+// each one keeps a device clock that runs off the pipeline's StatsClock,
+// optionally some ppm fast or slow, and signals its event once per period
+// with random lateness, like a shared mode stream woken by a busy
+// scheduler, or as late as a recorded profile says. the capture side splits what its clock has produced into
+// packets of varying size, now and then loses a run of frames and flags the
+// next packet as a discontinuity, and fills the packets with a tone on
+// each of its nMultiplex times as many real channels, time multiplexed
+// the way the real device does, and can flag packets as silent
+// or as having a bad timestamp; the render side plays out of
+// its buffer in real time and counts what it ran out of
+//
+// every random choice is drawn from the seed and the event or packet
+// number, so a given seed always produces the same schedule even though
+// the threads run in real time
+//
+// no Windows dependencies
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "audioformat.h"
+#include "device.h"
+#include "latency.h"
+#include "sampleconvert.h"
+
+struct SimulatedDeviceOptions {
+    AudioFormat format;       // capture: what it hands out, usually mono
+                              // render: the sample type it asks for instead of the one offered
+    int64_t hnsPeriod;
+    double fJitterMs;         // each event up to this late
+    std::vector<float> jitterProfileMs; // if not empty, how late each event is instead, in turn, over and over
+    double fPpm;              // device clock against the StatsClock
+    uint32_t nSeed;
+    int64_t hnsLoseAt;        // on the StatsClock: from then on the device is gone and everything fails with DEVICE_LOST
+
+    // capture only
+    double fPacketVariation;   // packet sizes vary by up to this fraction of a period, 0 to 1
+    double fDiscontinuitiesPerMinute;
+    double fFaultsPerMinute;   // packets flagged silent (and full of noise), with a bad timestamp, or with an unknown flag
+    uint32_t nMultiplex;       // real channels carried on each of format's
+    bool bMissingFirstSample;  // the real stream starts on its second frame's worth of channels, e.g. on the right for stereo
+
+    SimulatedDeviceOptions()
+        : format(MakeAudioFormat(AUDIOFORMAT_TAG_PCM, 1, 96000, 16))
+        , hnsPeriod(HNS_PER_SECOND / 100)
+        , fJitterMs(0)
+        , fPpm(0)
+        , nSeed(1)
+        , hnsLoseAt(INT64_MAX)
+        , fPacketVariation(0)
+        , fDiscontinuitiesPerMinute(0)
+        , fFaultsPerMinute(0)
+        , nMultiplex(2)
+        , bMissingFirstSample(false)
+    {}
+};
+
+struct SimulatedDeviceStats {
+    uint64_t nEvents;
+    uint64_t nLateEvents;       // fired more than a period late, so one was skipped
+    uint64_t nPackets;          // capture packets, or render buffers released
+    uint64_t nFrames;           // captured, or written by the pipeline
+    uint64_t nDiscontinuities;  // capture
+    uint64_t nLostFrames;       // capture: frames the discontinuities threw away
+    uint64_t nOddPackets;       // capture: packets with an odd number of samples
+    uint64_t nFaults;           // capture: packets given one of the other flags
+    uint64_t nUnderruns;        // render: times the buffer ran dry
+    uint64_t nUnderrunFrames;   // render: frames played as silence because of it
+    uint64_t nSilentFrames;     // render: frames released as silent
+};
+
+// peak level of the simulated capture tone on real channel nChannel; each
+// one is quieter than the one before, so a channel in the wrong place shows
+double SimulatedChannelLevel(uint32_t nChannel);
+
+// reads a recorded lateness profile for jitterProfileMs: one event's
+// lateness a line, in ms, with blank lines and lines starting with '#'
+// skipped (see --record-jitter)
+bool LoadJitterProfile(const std::string &path, std::vector<float> &profileMs, std::string &error);
+
+// the event side both devices share
+class SimulatedEvents {
+public:
+    SimulatedEvents() : m_pClock(NULL), m_hnsPeriod(0), m_nJitterHns(0), m_pProfileMs(NULL), m_nSeed(0), m_hnsStart(0), m_nEvent(0), m_bStarted(false), m_bInterrupted(false) {}
+
+    // profileMs must outlive the events; empty for random lateness
+    void Init(StatsClock &clock, int64_t hnsPeriod, double fJitterMs, const std::vector<float> &profileMs, uint32_t nSeed);
+    void Start(int64_t hnsStart);
+    DeviceStatus Wait(uint32_t nTimeoutMs, SimulatedDeviceStats &stats);
+    void Interrupt();
+
+    int64_t StartHns() const { return m_hnsStart; }
+
+    // when the next event is due, for stepping a SimulatedClock to it
+    int64_t NextEventHns();
+
+    // a uniform value in [0, 1) that only depends on the seed, the stream
+    // it is for and n
+    double Random(uint32_t nStream, uint64_t n) const;
+
+private:
+    int64_t DueHns(uint64_t n) const;
+
+    StatsClock *m_pClock;
+    int64_t m_hnsPeriod;
+    int64_t m_nJitterHns;
+    const std::vector<float> *m_pProfileMs;
+    uint32_t m_nSeed;
+    int64_t m_hnsStart;
+    uint64_t m_nEvent; // the last one fired
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_bStarted;
+    bool m_bInterrupted;
+};
+
+class SimulatedCaptureSource : public CaptureSource {
+public:
+    SimulatedCaptureSource(StatsClock &clock, const SimulatedDeviceOptions &options);
+
+    const AudioFormat &Format() const override { return m_options.format; }
+    int64_t PeriodHns() const override { return m_options.hnsPeriod; }
+
+    DeviceStatus Open() override;
+    DeviceStatus Start() override;
+    void Stop() override {}
+    DeviceStatus Wait(uint32_t nTimeoutMs) override;
+    void Interrupt() override { m_events.Interrupt(); }
+
+    DeviceStatus GetPacket(CapturePacket &packet) override;
+    DeviceStatus ReleasePacket(uint32_t nFrames) override;
+
+    // only stable once the pipeline has stopped
+    const SimulatedDeviceStats &Stats() const { return m_stats; }
+
+private:
+    uint64_t DeviceFrames(int64_t hnsNow) const;
+    uint32_t PacketFrames(uint64_t nPacket) const;
+    void Synthesize(uint64_t nPosition, uint32_t nFrames);
+
+    StatsClock &m_clock;
+    SimulatedDeviceOptions m_options;
+    SimulatedEvents m_events;
+    SimulatedDeviceStats m_stats;
+    SampleConverter m_converter;
+    double m_fFramesPerHns;
+    uint32_t m_nPeriodFrames;
+
+    uint64_t m_nPosition;        // device position of the next packet
+    uint32_t m_nHeld;            // frames in the packet handed out, 0 if none
+    std::vector<float> m_signal;
+    std::vector<uint8_t> m_packet;
+};
+
+class SimulatedRenderSink : public RenderSink {
+public:
+    SimulatedRenderSink(StatsClock &clock, const SimulatedDeviceOptions &options);
+
+    const AudioFormat &Format() const override { return m_format; }
+    int64_t PeriodHns() const override { return m_options.hnsPeriod; }
+
+    DeviceStatus Open(const AudioFormat &desired, uint32_t nBufferMs) override;
+    uint32_t BufferFrames() const override { return m_nBufferFrames; }
+    DeviceStatus Start() override;
+    void Stop() override {}
+    DeviceStatus Wait(uint32_t nTimeoutMs) override;
+    void Interrupt() override { m_events.Interrupt(); }
+
+    DeviceStatus GetPadding(uint32_t &nPadding) override;
+    DeviceStatus GetBuffer(uint32_t nFrames, uint8_t **ppData) override;
+    DeviceStatus ReleaseBuffer(uint32_t nFrames, bool bSilent) override;
+
+    int64_t NextEventHns() { return m_events.NextEventHns(); }
+
+    // only stable once the pipeline has stopped
+    const SimulatedDeviceStats &Stats() const { return m_stats; }
+
+private:
+    // catches the played position up with the device clock
+    void Play();
+
+    StatsClock &m_clock;
+    SimulatedDeviceOptions m_options;
+    SimulatedEvents m_events;
+    SimulatedDeviceStats m_stats;
+    AudioFormat m_format;
+    uint32_t m_nBufferFrames;
+    double m_fFramesPerHns;
+    bool m_bStarted;
+    bool m_bDry;                 // ran out and hasn't been refilled yet
+
+    uint64_t m_nWritten;         // frames released
+    uint64_t m_nPlayed;          // frames the device clock has consumed
+    uint32_t m_nBorrowed;        // frames handed out by GetBuffer
+    std::vector<uint8_t> m_buffer;
+};
@@ -0,0 +1,205 @@
+// supervisor.cpp
+
+#include "supervisor.h"
+
+#include <algorithm>
+#include <chrono>
+
+static double Ms(int64_t hns) {
+    return static_cast<double>(hns) / 10000.0;
+}
+
+StreamSupervisor::StreamSupervisor(StatsClock &clock, StatsSink &statsSink, MessageSink &messages, EndpointProvider &provider)
+    : m_clock(clock)
+    , m_statsSink(statsSink)
+    , m_messages(messages)
+    , m_provider(provider)
+    , m_pLiveStatsSink(NULL)
+    , m_nLiveStatsIntervalMs(0)
+    , m_pRecording(NULL)
+    , m_pStreaming(NULL)
+    , m_pPipeline(NULL)
+    , m_bStop(false)
+    , m_nErrorCode(0)
+{
+    m_state.store(SUPERVISOR_STARTING, std::memory_order_relaxed);
+    m_nPreviousFrames.store(0, std::memory_order_relaxed);
+    m_nRestarts.store(0, std::memory_order_relaxed);
+    m_nFailedAttempts.store(0, std::memory_order_relaxed);
+}
+
+void StreamSupervisor::SetLiveStats(StatsSink &sink, uint32_t nIntervalMs) {
+    m_pLiveStatsSink = &sink;
+    m_nLiveStatsIntervalMs = nIntervalMs;
+}
+
+void StreamSupervisor::SetRecording(RecordingTap &tap) {
+    m_pRecording = &tap;
+}
+
+void StreamSupervisor::SetStreaming(RtpSender &sender) {
+    m_pStreaming = &sender;
+}
+
+void StreamSupervisor::SetState(SupervisorState state) {
+    m_state.store(state, std::memory_order_release);
+}
+
+void StreamSupervisor::Stop() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_bStop = true;
+    if (NULL != m_pPipeline) {
+        m_pPipeline->Stop();
+    }
+    m_wake.notify_all();
+}
+
+// false if Stop was called instead
+bool StreamSupervisor::WaitToRetry(int64_t hnsWait) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_wake.wait_for(lock, std::chrono::microseconds(hnsWait / 10), [this]() { return m_bStop; });
+    return !m_bStop;
+}
+
+uint64_t StreamSupervisor::CapturedFrames() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    uint64_t nFrames = m_nPreviousFrames.load(std::memory_order_relaxed);
+    if (NULL != m_pPipeline) {
+        nFrames += m_pPipeline->CapturedFrames();
+    }
+    return nFrames;
+}
+
+SupervisorStats StreamSupervisor::Stats() const {
+    SupervisorStats stats;
+    stats.nRestarts = m_nRestarts.load(std::memory_order_relaxed);
+    stats.nFailedAttempts = m_nFailedAttempts.load(std::memory_order_relaxed);
+    stats.restart = m_restart.Summary();
+    stats.gap = m_gap.Summary();
+    return stats;
+}
+
+DeviceStatus StreamSupervisor::Run(const PipelineOptions &options) {
+    PipelineOptions pipelineOptions = options;
+    pipelineOptions.bStopOnOutputLoss = true;
+
+    bool bRan = false;          // a pipeline has run at all
+    int64_t hnsStopped = 0;     // when the last one did, or the first try if none has
+    int64_t hnsLastCapture = 0; // its last captured frame
+    uint32_t nAttempts = 0;     // since then
+    int64_t hnsBackoff = static_cast<int64_t>(SUPERVISOR_RETRY_MS) * 10000;
+
+    SetState(SUPERVISOR_STARTING);
+    hnsStopped = m_clock.NowHns();
+
+    for (;;) {
+        // the endpoints are declared first so they outlive the pipeline
+        std::unique_ptr<CaptureSource> source;
+        std::vector<std::unique_ptr<RenderSink>> sinks;
+        std::unique_ptr<StreamPipeline> pipeline;
+        std::string error;
+        int32_t nErrorCode = 0;
+
+        DeviceStatus status = m_provider.Create(source, sinks, error);
+        if (DEVICE_OK == status) {
+            std::vector<RenderSink *> pSinks;
+            for (const std::unique_ptr<RenderSink> &sink : sinks) {
+                pSinks.push_back(sink.get());
+            }
+
+            pipeline.reset(new StreamPipeline(m_clock, m_statsSink, m_messages));
+            if (NULL != m_pLiveStatsSink) {
+                pipeline->SetLiveStats(*m_pLiveStatsSink, m_nLiveStatsIntervalMs);
+            }
+            if (NULL != m_pRecording) {
+                pipeline->SetRecording(*m_pRecording);
+            }
+            if (NULL != m_pStreaming) {
+                pipeline->SetStreaming(*m_pStreaming);
+            }
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_bStop) {
+                break;
+            }
+            status = pipeline->Start(*source, pSinks.data(), static_cast<uint32_t>(pSinks.size()), pipelineOptions);
+            if (DEVICE_OK == status) {
+                m_pPipeline = pipeline.get();
+            }
+            else {
+                error = pipeline->Error();
+                nErrorCode = pipeline->ErrorCode();
+            }
+        }
+
+        if (DEVICE_OK == status) {
+            nAttempts++;
+            if (bRan) {
+                int64_t hnsRestart = m_clock.NowHns() - hnsStopped;
+                m_restart.Record(hnsRestart);
+                m_nRestarts.fetch_add(1, std::memory_order_relaxed);
+                m_messages.Log("Restarted in %.1f ms, after %u attempts", Ms(hnsRestart), nAttempts);
+            }
+            SetState(SUPERVISOR_RUNNING);
+
+            status = pipeline->Run();
+            hnsStopped = m_clock.NowHns();
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_pPipeline = NULL;
+                m_nPreviousFrames.fetch_add(pipeline->CapturedFrames(), std::memory_order_relaxed);
+            }
+
+            if (bRan && 0 != hnsLastCapture && 0 != pipeline->FirstCaptureHns()) {
+                m_gap.Record(pipeline->FirstCaptureHns() - hnsLastCapture);
+            }
+            if (0 != pipeline->LastCaptureHns()) {
+                hnsLastCapture = pipeline->LastCaptureHns();
+            }
+            bRan = true;
+            nAttempts = 0;
+            hnsBackoff = static_cast<int64_t>(SUPERVISOR_RETRY_MS) * 10000;
+
+            // only Stop, or the input being interrupted, stops it cleanly
+            if (DEVICE_OK == status) {
+                break;
+            }
+
+            m_error = pipeline->Error();
+            m_nErrorCode = pipeline->ErrorCode();
+            m_messages.Log("Restarting the stream (%s)", DeviceStatusName(status));
+            SetState(SUPERVISOR_RESTARTING);
+            continue;
+        }
+
+        nAttempts++;
+        m_nFailedAttempts.fetch_add(1, std::memory_order_relaxed);
+        m_error = error;
+        m_nErrorCode = nErrorCode;
+
+        if (!bRan && DEVICE_LOST != status) {
+            m_messages.Error("Can't start the stream: %s", error.c_str());
+            SetState(SUPERVISOR_STOPPED);
+            return status;
+        }
+
+        // a reconfigured device is usually back within a few tries; one
+        // that was unplugged may be away for good
+        int64_t hnsWait = static_cast<int64_t>(SUPERVISOR_RETRY_MS) * 10000;
+        if (m_clock.NowHns() - hnsStopped >= static_cast<int64_t>(SUPERVISOR_FAST_RETRY_MS) * 10000) {
+            hnsBackoff = (std::min)(hnsBackoff * 2, static_cast<int64_t>(SUPERVISOR_MAX_RETRY_MS) * 10000);
+            hnsWait = hnsBackoff;
+        }
+        if (1 == nAttempts) {
+            m_messages.Log("Waiting for the devices: %s", error.c_str());
+        }
+
+        if (!WaitToRetry(hnsWait)) {
+            break;
+        }
+    }
+
+    SetState(SUPERVISOR_STOPPED);
+    return DEVICE_OK;
+}
@@ -0,0 +1,147 @@
+// supervisor.h
+
+// keeps a stream running through device loss, for running headless
+//
+// StreamSupervisor runs a StreamPipeline on the calling thread, and when
+// the pipeline stops because the input or an output lost its device
+// (unplugged, disabled, its format changed under it) it throws the
+// endpoints away, asks its EndpointProvider for new ones, which looks the
+// devices up again, and starts a new pipeline on them straight away. while
+// a device stays away it keeps trying, every SUPERVISOR_RETRY_MS at first
+// and backing off to SUPERVISOR_MAX_RETRY_MS once it has been gone for
+// SUPERVISOR_FAST_RETRY_MS
+//
+// a pipeline that was running and fails any other way is restarted the
+// same way; but if the very first one can't start for any reason other
+// than a missing device, that's a mistake in the setup and Run returns it
+//
+//     STARTING -> RUNNING <-> RESTARTING
+//         \          |           /
+//          `----> STOPPED <-----'
+//
+// every restart records how long it took, from the old pipeline stopping
+// to the new one running, and how much audio went missing, from the last
+// frame the old pipeline captured to the first the new one did
+//
+// no Windows dependencies
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "device.h"
+#include "latency.h"
+#include "messages.h"
+#include "pipeline.h"
+
+// how often to look for a device that has gone, at first and at most
+#define SUPERVISOR_RETRY_MS 10
+#define SUPERVISOR_FAST_RETRY_MS 1000
+#define SUPERVISOR_MAX_RETRY_MS 1000
+
+class EndpointProvider {
+public:
+    virtual ~EndpointProvider() {}
+
+    // new endpoints for the input and each output, not opened yet;
+    // DEVICE_LOST, with error set, while one of the devices isn't there
+    virtual DeviceStatus Create(std::unique_ptr<CaptureSource> &source, std::vector<std::unique_ptr<RenderSink>> &sinks, std::string &error) = 0;
+};
+
+enum SupervisorState {
+    SUPERVISOR_STARTING,
+    SUPERVISOR_RUNNING,
+    SUPERVISOR_RESTARTING,
+    SUPERVISOR_STOPPED,
+};
+
+static inline const char *SupervisorStateName(SupervisorState state) {
+    switch (state) {
+    case SUPERVISOR_STARTING: return "starting";
+    case SUPERVISOR_RUNNING: return "running";
+    case SUPERVISOR_RESTARTING: return "restarting";
+    case SUPERVISOR_STOPPED: return "stopped";
+    }
+    return "?";
+}
+
+struct SupervisorStats {
+    uint32_t nRestarts;
+    uint32_t nFailedAttempts;  // to start a pipeline, the first one included
+    HistogramSummary restart;  // from the old pipeline stopping to the new one running
+    HistogramSummary gap;      // from the last frame captured before a restart to the first after
+};
+
+class StreamSupervisor {
+public:
+    StreamSupervisor(StatsClock &clock, StatsSink &statsSink, MessageSink &messages, EndpointProvider &provider);
+
+    // handed on to every pipeline; call before Run
+    void SetLiveStats(StatsSink &sink, uint32_t nIntervalMs);
+
+    // likewise; one recording runs on across restarts, with the time the
+    // devices were away left out
+    void SetRecording(RecordingTap &tap);
+
+    // likewise; the stream's sequence numbers run on across restarts, so a
+    // receiver hears a gap rather than a new sender
+    void SetStreaming(RtpSender &sender);
+
+    // keeps a pipeline running on the calling thread until Stop is called,
+    // or one of them stops by itself with DEVICE_OK (the input was
+    // interrupted); bStopOnOutputLoss is always set
+    DeviceStatus Run(const PipelineOptions &options);
+
+    // any thread, at any point
+    void Stop();
+
+    SupervisorState State() const { return m_state.load(std::memory_order_acquire); }
+
+    // mono frames captured so far, by every pipeline
+    uint64_t CapturedFrames() const;
+
+    SupervisorStats Stats() const;
+
+    // why the last pipeline failed, and the endpoint's own error code
+    const std::string &Error() const { return m_error; }
+    int32_t ErrorCode() const { return m_nErrorCode; }
+
+private:
+    StreamSupervisor(const StreamSupervisor &) = delete;
+    StreamSupervisor &operator=(const StreamSupervisor &) = delete;
+
+    void SetState(SupervisorState state);
+    bool WaitToRetry(int64_t hnsWait);
+
+    StatsClock &m_clock;
+    StatsSink &m_statsSink;
+    MessageSink &m_messages;
+    EndpointProvider &m_provider;
+    StatsSink *m_pLiveStatsSink;
+    uint32_t m_nLiveStatsIntervalMs;
+    RecordingTap *m_pRecording;
+    RtpSender *m_pStreaming;
+
+    // guards m_pPipeline and m_bStop, so Stop never misses a pipeline
+    // that is being started
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wake;
+    StreamPipeline *m_pPipeline;
+    bool m_bStop;
+
+    std::atomic<SupervisorState> m_state;
+    std::atomic<uint64_t> m_nPreviousFrames; // by the pipelines that have stopped
+    std::atomic<uint32_t> m_nRestarts;
+    std::atomic<uint32_t> m_nFailedAttempts;
+    Histogram m_restart;
+    Histogram m_gap;
+
+    std::string m_error;
+    int32_t m_nErrorCode;
+};
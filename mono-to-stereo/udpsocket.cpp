@@ -0,0 +1,512 @@
+// udpsocket.cpp
+
+#include "udpsocket.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+bool ParseUdpAddress(const std::string &text, bool bHostRequired, UdpAddress &address, std::string &error) {
+    std::string host;
+    std::string port = text;
+
+    size_t nColon = text.rfind(':');
+    if (std::string::npos != nColon) {
+        host = text.substr(0, nColon);
+        port = text.substr(nColon + 1);
+
+        // a v6 address is bracketed so its own colons aren't taken for the port's
+        if (host.size() >= 2 && '[' == host.front() && ']' == host.back()) {
+            host = host.substr(1, host.size() - 2);
+        }
+    }
+
+    if (bHostRequired && host.empty()) {
+        error = "\"" + text + "\" needs a host, as in 127.0.0.1:5004";
+        return false;
+    }
+
+    char *pEnd = NULL;
+    long nPort = port.empty() ? -1 : strtol(port.c_str(), &pEnd, 10);
+    if (port.empty() || '\0' != *pEnd || nPort < 0 || nPort > 65535 || (bHostRequired && 0 == nPort)) {
+        error = "\"" + text + "\" doesn't end in a valid port";
+        return false;
+    }
+
+    address.host = host;
+    address.nPort = static_cast<uint16_t>(nPort);
+    return true;
+}
+
+#ifdef _WIN32
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+static std::string WsaErrorString(const char *szWhat) {
+    return std::string(szWhat) + " failed: WSA error " + std::to_string(WSAGetLastError());
+}
+
+// once per process, before any other Winsock call
+static bool StartWinsock(std::string &error) {
+    static const int nResult = []() {
+        WSADATA data;
+        return WSAStartup(MAKEWORD(2, 2), &data);
+    }();
+
+    if (0 != nResult) {
+        error = "WSAStartup failed: " + std::to_string(nResult);
+        return false;
+    }
+    return true;
+}
+
+// resolves address and opens a non-blocking socket of its family
+static SOCKET OpenSocket(const UdpAddress &address, bool bPassive, sockaddr_storage &resolved, int &nResolved, std::string &error) {
+    if (!StartWinsock(error)) {
+        return INVALID_SOCKET;
+    }
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = bPassive ? AI_PASSIVE : 0;
+
+    std::string port = std::to_string(address.nPort);
+    addrinfo *pResult = NULL;
+    int nError = getaddrinfo(address.host.empty() ? NULL : address.host.c_str(), port.c_str(), &hints, &pResult);
+    if (0 != nError || NULL == pResult) {
+        error = "can't resolve \"" + address.host + "\": WSA error " + std::to_string(nError);
+        return INVALID_SOCKET;
+    }
+
+    memcpy(&resolved, pResult->ai_addr, pResult->ai_addrlen);
+    nResolved = static_cast<int>(pResult->ai_addrlen);
+    SOCKET s = socket(pResult->ai_family, SOCK_DGRAM, IPPROTO_UDP);
+    freeaddrinfo(pResult);
+    if (INVALID_SOCKET == s) {
+        error = WsaErrorString("socket");
+        return INVALID_SOCKET;
+    }
+
+    u_long nNonBlocking = 1;
+    if (0 != ioctlsocket(s, FIONBIO, &nNonBlocking)) {
+        error = WsaErrorString("ioctlsocket");
+        closesocket(s);
+        return INVALID_SOCKET;
+    }
+    return s;
+}
+
+UdpSocket::UdpSocket() : m_socket(INVALID_SOCKET) {}
+
+UdpSocket::~UdpSocket() {
+    Close();
+}
+
+bool UdpSocket::Connect(const UdpAddress &address, std::string &error) {
+    Close();
+
+    sockaddr_storage resolved;
+    int nResolved;
+    SOCKET s = OpenSocket(address, false, resolved, nResolved, error);
+    if (INVALID_SOCKET == s) {
+        return false;
+    }
+
+    if (0 != connect(s, reinterpret_cast<const sockaddr *>(&resolved), nResolved)) {
+        error = WsaErrorString("connect");
+        closesocket(s);
+        return false;
+    }
+
+    m_socket = static_cast<uintptr_t>(s);
+    return true;
+}
+
+bool UdpSocket::Bind(const UdpAddress &address, uint32_t nBufferBytes, std::string &error) {
+    Close();
+
+    sockaddr_storage resolved;
+    int nResolved;
+    SOCKET s = OpenSocket(address, true, resolved, nResolved, error);
+    if (INVALID_SOCKET == s) {
+        return false;
+    }
+
+    // only a hint; the stream still works with the default
+    int nBuffer = static_cast<int>(nBufferBytes);
+    setsockopt(s, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char *>(&nBuffer), sizeof(nBuffer));
+
+    if (0 != bind(s, reinterpret_cast<const sockaddr *>(&resolved), nResolved)) {
+        error = WsaErrorString("bind");
+        closesocket(s);
+        return false;
+    }
+
+    m_socket = static_cast<uintptr_t>(s);
+    return true;
+}
+
+void UdpSocket::Close() {
+    if (INVALID_SOCKET != static_cast<SOCKET>(m_socket)) {
+        closesocket(static_cast<SOCKET>(m_socket));
+        m_socket = INVALID_SOCKET;
+    }
+}
+
+bool UdpSocket::IsOpen() const {
+    return INVALID_SOCKET != static_cast<SOCKET>(m_socket);
+}
+
+uint16_t UdpSocket::LocalPort() const {
+    sockaddr_storage local;
+    int nLocal = sizeof(local);
+    if (0 != getsockname(static_cast<SOCKET>(m_socket), reinterpret_cast<sockaddr *>(&local), &nLocal)) {
+        return 0;
+    }
+    return ntohs(AF_INET6 == local.ss_family ? reinterpret_cast<sockaddr_in6 *>(&local)->sin6_port : reinterpret_cast<sockaddr_in *>(&local)->sin_port);
+}
+
+// Winsock has no call for more than one datagram at a time
+UdpSendResult UdpSocket::Send(const UdpDatagram *pDatagrams, uint32_t nCount, std::string &error) {
+    UdpSendResult result = {};
+    SOCKET s = static_cast<SOCKET>(m_socket);
+
+    uint32_t i = 0;
+    while (i < nCount) {
+        int nSent = send(s, reinterpret_cast<const char *>(pDatagrams[i].pData), static_cast<int>(pDatagrams[i].nBytes), 0);
+        result.nCalls++;
+        if (SOCKET_ERROR != nSent) {
+            result.nSent++;
+            i++;
+            continue;
+        }
+
+        int nError = WSAGetLastError();
+        if (WSAECONNRESET == nError || WSAECONNREFUSED == nError) {
+            // an earlier datagram found nobody listening; this one is lost
+            result.nRefused++;
+            i++;
+            continue;
+        }
+
+        if (WSAEWOULDBLOCK != nError && WSAENOBUFS != nError) {
+            result.bFailed = true;
+            error = "send failed: WSA error " + std::to_string(nError);
+        }
+        result.nDropped += nCount - i;
+        break;
+    }
+    return result;
+}
+
+int UdpSocket::Receive(UdpBuffer *pBuffers, uint32_t nCount, uint32_t nTimeoutMs, uint32_t *pnCalls, std::string &error) {
+    SOCKET s = static_cast<SOCKET>(m_socket);
+    *pnCalls = 0;
+
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(s, &readable);
+    timeval timeout;
+    timeout.tv_sec = static_cast<long>(nTimeoutMs / 1000);
+    timeout.tv_usec = static_cast<long>(nTimeoutMs % 1000) * 1000;
+    int nReady = select(0, &readable, NULL, NULL, &timeout);
+    (*pnCalls)++;
+    if (SOCKET_ERROR == nReady) {
+        error = WsaErrorString("select");
+        return -1;
+    }
+    if (0 == nReady) {
+        return 0;
+    }
+
+    nCount = (std::min)(nCount, static_cast<uint32_t>(UDP_MAX_BATCH));
+    uint32_t nReceived = 0;
+    while (nReceived < nCount) {
+        UdpBuffer &buffer = pBuffers[nReceived];
+        int nBytes = recv(s, reinterpret_cast<char *>(buffer.pData), static_cast<int>(buffer.nCapacity), 0);
+        (*pnCalls)++;
+        if (SOCKET_ERROR != nBytes) {
+            buffer.nBytes = static_cast<uint32_t>(nBytes);
+            buffer.bTruncated = false;
+            nReceived++;
+            continue;
+        }
+
+        int nError = WSAGetLastError();
+        if (WSAEMSGSIZE == nError) {
+            buffer.nBytes = buffer.nCapacity;
+            buffer.bTruncated = true;
+            nReceived++;
+            continue;
+        }
+        if (WSAECONNRESET == nError) {
+            continue;
+        }
+        if (WSAEWOULDBLOCK != nError) {
+            error = "recv failed: WSA error " + std::to_string(nError);
+            return nReceived > 0 ? static_cast<int>(nReceived) : -1;
+        }
+        break;
+    }
+    return static_cast<int>(nReceived);
+}
+
+#else // POSIX
+
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+static std::string ErrnoString(const char *szWhat) {
+    return std::string(szWhat) + " failed: " + strerror(errno);
+}
+
+// resolves address and opens a non-blocking socket of its family
+static int OpenSocket(const UdpAddress &address, bool bPassive, sockaddr_storage &resolved, socklen_t &nResolved, std::string &error) {
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = bPassive ? AI_PASSIVE : 0;
+
+    std::string port = std::to_string(address.nPort);
+    addrinfo *pResult = NULL;
+    int nError = getaddrinfo(address.host.empty() ? NULL : address.host.c_str(), port.c_str(), &hints, &pResult);
+    if (0 != nError || NULL == pResult) {
+        error = "can't resolve \"" + address.host + "\": " + gai_strerror(nError);
+        return -1;
+    }
+
+    memcpy(&resolved, pResult->ai_addr, pResult->ai_addrlen);
+    nResolved = pResult->ai_addrlen;
+    int fd = socket(pResult->ai_family, SOCK_DGRAM, IPPROTO_UDP);
+    freeaddrinfo(pResult);
+    if (fd < 0) {
+        error = ErrnoString("socket");
+        return -1;
+    }
+
+    int nFlags = fcntl(fd, F_GETFL, 0);
+    if (nFlags < 0 || fcntl(fd, F_SETFL, nFlags | O_NONBLOCK) < 0) {
+        error = ErrnoString("fcntl");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+UdpSocket::UdpSocket() : m_fd(-1) {}
+
+UdpSocket::~UdpSocket() {
+    Close();
+}
+
+bool UdpSocket::Connect(const UdpAddress &address, std::string &error) {
+    Close();
+
+    sockaddr_storage resolved;
+    socklen_t nResolved;
+    int fd = OpenSocket(address, false, resolved, nResolved, error);
+    if (fd < 0) {
+        return false;
+    }
+
+    if (0 != connect(fd, reinterpret_cast<const sockaddr *>(&resolved), nResolved)) {
+        error = ErrnoString("connect");
+        close(fd);
+        return false;
+    }
+
+    m_fd = fd;
+    return true;
+}
+
+bool UdpSocket::Bind(const UdpAddress &address, uint32_t nBufferBytes, std::string &error) {
+    Close();
+
+    sockaddr_storage resolved;
+    socklen_t nResolved;
+    int fd = OpenSocket(address, true, resolved, nResolved, error);
+    if (fd < 0) {
+        return false;
+    }
+
+    // only a hint; the stream still works with the default
+    int nBuffer = static_cast<int>(nBufferBytes);
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &nBuffer, sizeof(nBuffer));
+
+    if (0 != bind(fd, reinterpret_cast<const sockaddr *>(&resolved), nResolved)) {
+        error = ErrnoString("bind");
+        close(fd);
+        return false;
+    }
+
+    m_fd = fd;
+    return true;
+}
+
+void UdpSocket::Close() {
+    if (m_fd >= 0) {
+        close(m_fd);
+        m_fd = -1;
+    }
+}
+
+bool UdpSocket::IsOpen() const {
+    return m_fd >= 0;
+}
+
+uint16_t UdpSocket::LocalPort() const {
+    sockaddr_storage local;
+    socklen_t nLocal = sizeof(local);
+    if (0 != getsockname(m_fd, reinterpret_cast<sockaddr *>(&local), &nLocal)) {
+        return 0;
+    }
+    return ntohs(AF_INET6 == local.ss_family ? reinterpret_cast<sockaddr_in6 *>(&local)->sin6_port : reinterpret_cast<sockaddr_in *>(&local)->sin_port);
+}
+
+// what to do about a datagram that couldn't be sent; false to give up on
+// the rest of the batch
+static bool SendFailed(uint32_t &i, uint32_t nCount, UdpSendResult &result, std::string &error) {
+    if (EINTR == errno) {
+        return true;
+    }
+
+    if (ECONNREFUSED == errno) {
+        // an earlier datagram found nobody listening; this one is lost
+        result.nRefused++;
+        i++;
+        return true;
+    }
+
+    if (EAGAIN != errno && EWOULDBLOCK != errno && ENOBUFS != errno) {
+        result.bFailed = true;
+        error = ErrnoString("send");
+    }
+    result.nDropped += nCount - i;
+    return false;
+}
+
+UdpSendResult UdpSocket::Send(const UdpDatagram *pDatagrams, uint32_t nCount, std::string &error) {
+    UdpSendResult result = {};
+
+    uint32_t i = 0;
+    while (i < nCount) {
+#ifdef __linux__
+        mmsghdr messages[UDP_MAX_BATCH];
+        iovec vectors[UDP_MAX_BATCH];
+        uint32_t nBatch = (std::min)(nCount - i, static_cast<uint32_t>(UDP_MAX_BATCH));
+        for (uint32_t j = 0; j < nBatch; j++) {
+            vectors[j].iov_base = const_cast<uint8_t *>(pDatagrams[i + j].pData);
+            vectors[j].iov_len = pDatagrams[i + j].nBytes;
+            memset(&messages[j], 0, sizeof(messages[j]));
+            messages[j].msg_hdr.msg_iov = &vectors[j];
+            messages[j].msg_hdr.msg_iovlen = 1;
+        }
+
+        int nSent = sendmmsg(m_fd, messages, nBatch, 0);
+        result.nCalls++;
+        if (nSent > 0) {
+            result.nSent += static_cast<uint32_t>(nSent);
+            i += static_cast<uint32_t>(nSent);
+            continue;
+        }
+#else
+        ssize_t nSent = send(m_fd, pDatagrams[i].pData, pDatagrams[i].nBytes, 0);
+        result.nCalls++;
+        if (nSent >= 0) {
+            result.nSent++;
+            i++;
+            continue;
+        }
+#endif
+        if (!SendFailed(i, nCount, result, error)) {
+            break;
+        }
+    }
+    return result;
+}
+
+int UdpSocket::Receive(UdpBuffer *pBuffers, uint32_t nCount, uint32_t nTimeoutMs, uint32_t *pnCalls, std::string &error) {
+    *pnCalls = 0;
+
+    pollfd readable = {};
+    readable.fd = m_fd;
+    readable.events = POLLIN;
+    int nReady = poll(&readable, 1, static_cast<int>(nTimeoutMs));
+    (*pnCalls)++;
+    if (nReady < 0) {
+        if (EINTR == errno) {
+            return 0;
+        }
+        error = ErrnoString("poll");
+        return -1;
+    }
+    if (0 == nReady) {
+        return 0;
+    }
+
+    nCount = (std::min)(nCount, static_cast<uint32_t>(UDP_MAX_BATCH));
+    iovec vectors[UDP_MAX_BATCH];
+#ifdef __linux__
+    mmsghdr messages[UDP_MAX_BATCH];
+    for (uint32_t j = 0; j < nCount; j++) {
+        vectors[j].iov_base = pBuffers[j].pData;
+        vectors[j].iov_len = pBuffers[j].nCapacity;
+        memset(&messages[j], 0, sizeof(messages[j]));
+        messages[j].msg_hdr.msg_iov = &vectors[j];
+        messages[j].msg_hdr.msg_iovlen = 1;
+    }
+
+    int nReceived = recvmmsg(m_fd, messages, nCount, MSG_DONTWAIT, NULL);
+    (*pnCalls)++;
+    if (nReceived < 0) {
+        if (EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno || ECONNREFUSED == errno) {
+            return 0;
+        }
+        error = ErrnoString("recvmmsg");
+        return -1;
+    }
+
+    for (int j = 0; j < nReceived; j++) {
+        pBuffers[j].nBytes = (std::min)(static_cast<uint32_t>(messages[j].msg_len), pBuffers[j].nCapacity);
+        pBuffers[j].bTruncated = 0 != (messages[j].msg_hdr.msg_flags & MSG_TRUNC);
+    }
+    return nReceived;
+#else
+    uint32_t nReceived = 0;
+    while (nReceived < nCount) {
+        msghdr message = {};
+        vectors[nReceived].iov_base = pBuffers[nReceived].pData;
+        vectors[nReceived].iov_len = pBuffers[nReceived].nCapacity;
+        message.msg_iov = &vectors[nReceived];
+        message.msg_iovlen = 1;
+
+        ssize_t nBytes = recvmsg(m_fd, &message, MSG_DONTWAIT);
+        (*pnCalls)++;
+        if (nBytes < 0) {
+            if (EINTR == errno || ECONNREFUSED == errno) {
+                continue;
+            }
+            if (EAGAIN != errno && EWOULDBLOCK != errno) {
+                error = ErrnoString("recvmsg");
+                return nReceived > 0 ? static_cast<int>(nReceived) : -1;
+            }
+            break;
+        }
+
+        pBuffers[nReceived].nBytes = static_cast<uint32_t>(nBytes);
+        pBuffers[nReceived].bTruncated = 0 != (message.msg_flags & MSG_TRUNC);
+        nReceived++;
+    }
+    return static_cast<int>(nReceived);
+#endif
+}
+
+#endif
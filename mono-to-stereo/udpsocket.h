@@ -0,0 +1,91 @@
+// udpsocket.h
+
+// thin portable wrapper for the UDP sockets the network stream goes over
+//
+// a sending socket is connected to one destination and non-blocking, so a
+// send either goes to the kernel straight away or is dropped and counted,
+// and never waits; that is what lets the capture thread send for itself.
+// datagrams go out and come in in batches, one system call per batch
+// where the platform has one for it (sendmmsg and recvmmsg on Linux) and
+// one call per datagram where it doesn't
+//
+// addresses are numeric IPv4 or IPv6, or a name the resolver knows
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// most datagrams one system call sends or receives
+#define UDP_MAX_BATCH 64
+
+// where to send to or receive on
+struct UdpAddress {
+    std::string host; // empty to receive on every interface
+    uint16_t nPort;   // 0 to receive on any free port
+
+    UdpAddress() : nPort(0) {}
+};
+
+// "host:port", "[v6 host]:port", or for receiving just "port" or ":port"
+bool ParseUdpAddress(const std::string &text, bool bHostRequired, UdpAddress &address, std::string &error);
+
+struct UdpDatagram {
+    const uint8_t *pData;
+    uint32_t nBytes;
+};
+
+struct UdpBuffer {
+    uint8_t *pData;
+    uint32_t nCapacity;
+    uint32_t nBytes;   // filled in by Receive
+    bool bTruncated;   // the datagram didn't fit; nBytes is what did
+};
+
+struct UdpSendResult {
+    uint32_t nSent;
+    uint32_t nDropped;  // the socket buffer was full
+    uint32_t nRefused;  // nobody was listening the last time one arrived
+    uint32_t nCalls;    // system calls it took
+    bool bFailed;       // anything else; the rest of the batch is dropped
+};
+
+class UdpSocket {
+public:
+    UdpSocket();
+    ~UdpSocket();
+
+    // a socket that sends to address
+    bool Connect(const UdpAddress &address, std::string &error);
+
+    // a socket that receives on address, with a socket buffer of at least
+    // nBufferBytes if the system allows it
+    bool Bind(const UdpAddress &address, uint32_t nBufferBytes, std::string &error);
+
+    void Close();
+    bool IsOpen() const;
+
+    // the port it is bound to, once connected or bound
+    uint16_t LocalPort() const;
+
+    // sends them in order, at most UDP_MAX_BATCH to a system call; never
+    // blocks. error is only set if result.bFailed
+    UdpSendResult Send(const UdpDatagram *pDatagrams, uint32_t nCount, std::string &error);
+
+    // waits up to nTimeoutMs for the first datagram, then takes whatever
+    // else has arrived without waiting, up to nCount and UDP_MAX_BATCH in
+    // all. returns how many, or -1 if the socket failed. *pnCalls counts
+    // the system calls
+    int Receive(UdpBuffer *pBuffers, uint32_t nCount, uint32_t nTimeoutMs, uint32_t *pnCalls, std::string &error);
+
+private:
+    UdpSocket(const UdpSocket &) = delete;
+    UdpSocket &operator=(const UdpSocket &) = delete;
+
+#ifdef _WIN32
+    uintptr_t m_socket;
+#else
+    int m_fd;
+#endif
+};
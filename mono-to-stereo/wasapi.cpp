@@ -0,0 +1,566 @@
+// wasapi.cpp
+
+#include "common.h"
+
+DeviceStatus DeviceStatusFromHresult(HRESULT hr) {
+    switch (hr) {
+    case AUDCLNT_E_DEVICE_INVALIDATED:
+    case AUDCLNT_E_SERVICE_NOT_RUNNING:
+    case AUDCLNT_E_RESOURCES_INVALIDATED:
+        return DEVICE_LOST;
+    default:
+        return DEVICE_FAILED;
+    }
+}
+
+// ---- streams ----
+
+WasapiStream::WasapiStream(IMMDevice* pMMDevice, HANDLE hStopEvent)
+    : m_pMMDevice(pMMDevice)
+    , m_pAudioClient(NULL)
+    , m_hEvent(NULL)
+    , m_hStopEvent(hStopEvent)
+    , m_bOwnStopEvent(false)
+    , m_bStopped(FALSE)
+    , m_bStarted(false)
+    , m_hTask(NULL)
+    , m_bCoInitialized(false)
+{
+}
+
+WasapiStream::~WasapiStream() {
+    Stop();
+
+    if (m_bOwnStopEvent) {
+        CloseHandle(m_hStopEvent);
+    }
+
+    if (NULL != m_hEvent) {
+        CloseHandle(m_hEvent);
+    }
+
+    if (NULL != m_pAudioClient) {
+        m_pAudioClient->Release();
+    }
+}
+
+HRESULT WasapiStream::Activate() {
+    HRESULT hr = m_pMMDevice->Activate(
+        __uuidof(IAudioClient),
+        CLSCTX_ALL, NULL,
+        (void**)&m_pAudioClient
+    );
+    if (FAILED(hr)) {
+        m_pAudioClient = NULL;
+        return hr;
+    }
+
+    m_hEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (NULL == m_hEvent) {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    // manual reset, so every later wait sees it too
+    if (NULL == m_hStopEvent) {
+        m_hStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        if (NULL == m_hStopEvent) {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+        m_bOwnStopEvent = true;
+    }
+
+    return S_OK;
+}
+
+// only once the client is initialized
+HRESULT WasapiStream::SetEventHandle() {
+    return m_pAudioClient->SetEventHandle(m_hEvent);
+}
+
+HRESULT WasapiStream::Start() {
+    HRESULT hr = m_pAudioClient->Start();
+    if (SUCCEEDED(hr)) {
+        m_bStarted = true;
+    }
+    return hr;
+}
+
+void WasapiStream::Stop() {
+    if (!m_bStarted) {
+        return;
+    }
+    m_bStarted = false;
+
+    HRESULT hr = m_pAudioClient->Stop();
+    if (FAILED(hr)) {
+        ERR(L"IAudioClient::Stop failed: hr = 0x%08x", hr);
+    }
+}
+
+HRESULT WasapiStream::EnterThread() {
+    HRESULT hr = CoInitialize(NULL);
+    if (FAILED(hr)) {
+        return hr;
+    }
+    m_bCoInitialized = true;
+
+    // register with MMCSS
+    DWORD nTaskIndex = 0;
+    m_hTask = AvSetMmThreadCharacteristics(L"Audio", &nTaskIndex);
+    if (NULL == m_hTask) {
+        // LeaveThread won't be called
+        HRESULT hrTask = HRESULT_FROM_WIN32(GetLastError());
+        CoUninitialize();
+        m_bCoInitialized = false;
+        return hrTask;
+    }
+
+    return S_OK;
+}
+
+void WasapiStream::LeaveThread() {
+    if (NULL != m_hTask) {
+        if (!AvRevertMmThreadCharacteristics(m_hTask)) {
+            ERR(L"AvRevertMmThreadCharacteristics failed: last error is %d", GetLastError());
+        }
+        m_hTask = NULL;
+    }
+
+    if (m_bCoInitialized) {
+        CoUninitialize();
+        m_bCoInitialized = false;
+    }
+}
+
+DeviceStatus WasapiStream::Wait(uint32_t nTimeoutMs, DWORD* pdwError) {
+    *pdwError = 0;
+    if (InterlockedCompareExchange(&m_bStopped, FALSE, FALSE)) {
+        return DEVICE_STOPPED;
+    }
+
+    HANDLE waitArray[2] = { m_hStopEvent, m_hEvent };
+    DWORD dwWaitResult = WaitForMultipleObjects(ARRAYSIZE(waitArray), waitArray, FALSE, nTimeoutMs);
+
+    switch (dwWaitResult) {
+    case WAIT_OBJECT_0:
+        InterlockedExchange(&m_bStopped, TRUE);
+        return DEVICE_STOPPED;
+    case WAIT_OBJECT_0 + 1:
+        return DEVICE_OK;
+    case WAIT_TIMEOUT:
+        return DEVICE_TIMEOUT;
+    default:
+        *pdwError = WAIT_FAILED == dwWaitResult ? GetLastError() : dwWaitResult;
+        return DEVICE_FAILED;
+    }
+}
+
+void WasapiStream::Interrupt() {
+    InterlockedExchange(&m_bStopped, TRUE);
+    if (NULL != m_hStopEvent && !SetEvent(m_hStopEvent)) {
+        ERR(L"SetEvent failed: last error is %d", GetLastError());
+    }
+}
+
+// ---- capture ----
+
+WasapiCaptureSource::WasapiCaptureSource(IMMDevice* pMMDevice, HANDLE hStopEvent)
+    : m_stream(pMMDevice, hStopEvent)
+    , m_pCaptureClient(NULL)
+    , m_hnsPeriod(0)
+{
+}
+
+WasapiCaptureSource::~WasapiCaptureSource() {
+    m_stream.Stop();
+
+    if (NULL != m_pCaptureClient) {
+        m_pCaptureClient->Release();
+    }
+}
+
+DeviceStatus WasapiCaptureSource::Open() {
+    HRESULT hr = m_stream.Activate();
+    if (FAILED(hr)) {
+        return Fail(DeviceStatusFromHresult(hr), hr, "IMMDevice::Activate(IAudioClient) failed: hr = 0x%08x", hr);
+    }
+    IAudioClient* pAudioClient = m_stream.Client();
+
+    // get the default device periodicity
+    REFERENCE_TIME hnsDefaultDevicePeriod;
+    hr = pAudioClient->GetDevicePeriod(&hnsDefaultDevicePeriod, NULL);
+    if (FAILED(hr)) {
+        return Fail(DeviceStatusFromHresult(hr), hr, "IAudioClient::GetDevicePeriod failed: hr = 0x%08x", hr);
+    }
+    m_hnsPeriod = hnsDefaultDevicePeriod;
+
+    // get the default device format
+    WAVEFORMATEX* pwfx;
+    hr = pAudioClient->GetMixFormat(&pwfx);
+    if (FAILED(hr)) {
+        return Fail(DeviceStatusFromHresult(hr), hr, "IAudioClient::GetMixFormat failed: hr = 0x%08x", hr);
+    }
+    CoTaskMemFreeOnExit freeMixFormat(pwfx);
+
+    pwfx->nBlockAlign = pwfx->nChannels * pwfx->wBitsPerSample / 8;
+
+    hr = AudioFormatFromWaveFormat(pwfx, &m_format);
+    if (FAILED(hr)) {
+        return Fail(DEVICE_FAILED, hr, "unsupported mix format");
+    }
+
+    hr = pAudioClient->Initialize(
+        AUDCLNT_SHAREMODE_SHARED,
+        AUDCLNT_STREAMFLAGS_EVENTCALLBACK,
+        0, 0, pwfx, 0
+    );
+    if (FAILED(hr)) {
+        return Fail(DeviceStatusFromHresult(hr), hr, "IAudioClient::Initialize failed: hr = 0x%08x", hr);
+    }
+
+    hr = pAudioClient->GetService(
+        __uuidof(IAudioCaptureClient),
+        (void**)&m_pCaptureClient
+    );
+    if (FAILED(hr)) {
+        m_pCaptureClient = NULL;
+        return Fail(DeviceStatusFromHresult(hr), hr, "IAudioClient::GetService(IAudioCaptureClient) failed: hr = 0x%08x", hr);
+    }
+
+    hr = m_stream.SetEventHandle();
+    if (FAILED(hr)) {
+        return Fail(DeviceStatusFromHresult(hr), hr, "IAudioClient::SetEventHandle failed: hr = 0x%08x", hr);
+    }
+
+    return DEVICE_OK;
+}
+
+DeviceStatus WasapiCaptureSource::Start() {
+    HRESULT hr = m_stream.Start();
+    if (FAILED(hr)) {
+        return Fail(DeviceStatusFromHresult(hr), hr, "IAudioClient::Start failed: hr = 0x%08x", hr);
+    }
+    return DEVICE_OK;
+}
+
+DeviceStatus WasapiCaptureSource::EnterThread() {
+    HRESULT hr = m_stream.EnterThread();
+    if (FAILED(hr)) {
+        return Fail(DEVICE_FAILED, hr, "couldn't set up the capture thread for audio: hr = 0x%08x", hr);
+    }
+    return DEVICE_OK;
+}
+
+DeviceStatus WasapiCaptureSource::Wait(uint32_t nTimeoutMs) {
+    DWORD dwError;
+    DeviceStatus status = m_stream.Wait(nTimeoutMs, &dwError);
+    if (DEVICE_FAILED == status) {
+        return Fail(status, HRESULT_FROM_WIN32(dwError), "WaitForMultipleObjects failed: last error = %u", dwError);
+    }
+    return status;
+}
+
+DeviceStatus WasapiCaptureSource::GetPacket(CapturePacket& packet) {
+    ZeroMemory(&packet, sizeof(packet));
+
+    UINT32 nNextPacketSize;
+    HRESULT hr = m_pCaptureClient->GetNextPacketSize(&nNextPacketSize);
+    if (FAILED(hr)) {
+        return Fail(DeviceStatusFromHresult(hr), hr, "IAudioCaptureClient::GetNextPacketSize failed: hr = 0x%08x", hr);
+    }
+
+    if (nNextPacketSize == 0) {
+        return DEVICE_OK;
+    }
+
+    BYTE* pData;
+    UINT32 nNumFramesToRead;
+    DWORD dwFlags;
+    UINT64 u64DevicePosition;
+    UINT64 u64QPCPosition;
+    hr = m_pCaptureClient->GetBuffer(
+        &pData,
+        &nNumFramesToRead,
+        &dwFlags,
+        &u64DevicePosition,
+        &u64QPCPosition
+    );
+    if (FAILED(hr)) {
+        return Fail(DeviceStatusFromHresult(hr), hr, "IAudioCaptureClient::GetBuffer failed: hr = 0x%08x", hr);
+    }
+
+    if (nNextPacketSize != nNumFramesToRead) {
+        m_pCaptureClient->ReleaseBuffer(nNumFramesToRead);
+        return Fail(DEVICE_FAILED, E_UNEXPECTED, "GetNextPacketSize and GetBuffer values don't match (%u and %u)", nNextPacketSize, nNumFramesToRead);
+    }
+
+    // the QPC position is already in 100 ns units on the QpcClock
+    packet.pData = pData;
+    packet.nFrames = nNumFramesToRead;
+    packet.nFlags = dwFlags;
+    packet.nDevicePosition = u64DevicePosition;
+    packet.hnsCapture = static_cast<int64_t>(u64QPCPosition);
+    return DEVICE_OK;
+}
+
+DeviceStatus WasapiCaptureSource::ReleasePacket(uint32_t nFrames) {
+    HRESULT hr = m_pCaptureClient->ReleaseBuffer(nFrames);
+    if (FAILED(hr)) {
+        return Fail(DeviceStatusFromHresult(hr), hr, "IAudioCaptureClient::ReleaseBuffer failed: hr = 0x%08x", hr);
+    }
+    return DEVICE_OK;
+}
+
+// ---- render ----
+
+WasapiRenderSink::WasapiRenderSink(IMMDevice* pMMDevice)
+    : m_stream(pMMDevice, NULL)
+    , m_pRenderClient(NULL)
+    , m_hnsPeriod(0)
+    , m_nBufferFrames(0)
+{
+}
+
+WasapiRenderSink::~WasapiRenderSink() {
+    m_stream.Stop();
+
+    if (NULL != m_pRenderClient) {
+        m_pRenderClient->Release();
+    }
+}
+
+DeviceStatus WasapiRenderSink::Open(const AudioFormat& desired, uint32_t nBufferMs) {
+    HRESULT hr = m_stream.Activate();
+    if (FAILED(hr)) {
+        return Fail(DeviceStatusFromHresult(hr), hr, "IMMDevice::Activate(IAudioClient) failed: hr = 0x%08x", hr);
+    }
+    IAudioClient* pAudioOutClient = m_stream.Client();
+
+    WAVEFORMATEXTENSIBLE wfxOut;
+    DWORD dwStreamFlags;
+    hr = NegotiateOutputFormat(pAudioOutClient, desired, &wfxOut, &m_format, &dwStreamFlags);
+    if (FAILED(hr)) {
+        return Fail(DeviceStatusFromHresult(hr), hr, "couldn't agree on an output format: hr = 0x%08x", hr);
+    }
+
+    hr = pAudioOutClient->Initialize(
+        AUDCLNT_SHAREMODE_SHARED,
+        AUDCLNT_STREAMFLAGS_EVENTCALLBACK | dwStreamFlags,
+        static_cast<REFERENCE_TIME>(nBufferMs) * 10000,
+        0,
+        reinterpret_cast<WAVEFORMATEX*>(&wfxOut),
+        NULL);
+    if (FAILED(hr)) {
+        return Fail(DeviceStatusFromHresult(hr), hr, "IAudioClient::Initialize failed: hr = 0x%08x", hr);
+    }
+
+    hr = pAudioOutClient->GetService(
+        __uuidof(IAudioRenderClient),
+        (void**)&m_pRenderClient);
+    if (FAILED(hr)) {
+        m_pRenderClient = NULL;
+        return Fail(DeviceStatusFromHresult(hr), hr, "IAudioClient::GetService(IAudioRenderClient) failed: hr = 0x%08x", hr);
+    }
+
+    // the actual size of the allocated buffer
+    hr = pAudioOutClient->GetBufferSize(&m_nBufferFrames);
+    if (FAILED(hr)) {
+        return Fail(DeviceStatusFromHresult(hr), hr, "IAudioClient::GetBufferSize failed: hr = 0x%08x", hr);
+    }
+
+    REFERENCE_TIME hnsPeriod;
+    hr = pAudioOutClient->GetDevicePeriod(&hnsPeriod, NULL);
+    if (FAILED(hr)) {
+        return Fail(DeviceStatusFromHresult(hr), hr, "IAudioClient::GetDevicePeriod failed: hr = 0x%08x", hr);
+    }
+    m_hnsPeriod = hnsPeriod;
+
+    // the render side is driven by its own event
+    hr = m_stream.SetEventHandle();
+    if (FAILED(hr)) {
+        return Fail(DeviceStatusFromHresult(hr), hr, "IAudioClient::SetEventHandle failed: hr = 0x%08x", hr);
+    }
+
+    return DEVICE_OK;
+}
+
+DeviceStatus WasapiRenderSink::Start() {
+    HRESULT hr = m_stream.Start();
+    if (FAILED(hr)) {
+        return Fail(DeviceStatusFromHresult(hr), hr, "IAudioClient::Start failed: hr = 0x%08x", hr);
+    }
+    return DEVICE_OK;
+}
+
+DeviceStatus WasapiRenderSink::EnterThread() {
+    HRESULT hr = m_stream.EnterThread();
+    if (FAILED(hr)) {
+        return Fail(DEVICE_FAILED, hr, "couldn't set up the render thread for audio: hr = 0x%08x", hr);
+    }
+    return DEVICE_OK;
+}
+
+DeviceStatus WasapiRenderSink::Wait(uint32_t nTimeoutMs) {
+    DWORD dwError;
+    DeviceStatus status = m_stream.Wait(nTimeoutMs, &dwError);
+    if (DEVICE_FAILED == status) {
+        return Fail(status, HRESULT_FROM_WIN32(dwError), "WaitForMultipleObjects failed: last error = %u", dwError);
+    }
+    return status;
+}
+
+DeviceStatus WasapiRenderSink::GetPadding(uint32_t& nPadding) {
+    UINT32 n;
+    HRESULT hr = m_stream.Client()->GetCurrentPadding(&n);
+    if (FAILED(hr)) {
+        return Fail(DeviceStatusFromHresult(hr), hr, "IAudioClient::GetCurrentPadding failed: hr = 0x%08x", hr);
+    }
+    nPadding = n;
+    return DEVICE_OK;
+}
+
+DeviceStatus WasapiRenderSink::GetBuffer(uint32_t nFrames, uint8_t** ppData) {
+    BYTE* pData;
+    HRESULT hr = m_pRenderClient->GetBuffer(nFrames, &pData);
+    if (FAILED(hr)) {
+        return Fail(DeviceStatusFromHresult(hr), hr, "IAudioRenderClient::GetBuffer failed: hr = 0x%08x", hr);
+    }
+    *ppData = pData;
+    return DEVICE_OK;
+}
+
+DeviceStatus WasapiRenderSink::ReleaseBuffer(uint32_t nFrames, bool bSilent) {
+    HRESULT hr = m_pRenderClient->ReleaseBuffer(nFrames, bSilent ? AUDCLNT_BUFFERFLAGS_SILENT : 0);
+    if (FAILED(hr)) {
+        return Fail(DeviceStatusFromHresult(hr), hr, "IAudioRenderClient::ReleaseBuffer failed: hr = 0x%08x", hr);
+    }
+    return DEVICE_OK;
+}
+
+// ---- formats ----
+
+HRESULT AudioFormatFromWaveFormat(const WAVEFORMATEX* pwfx, AudioFormat* pFormat) {
+    WORD wFormatTag = pwfx->wFormatTag;
+    if (pwfx->wFormatTag == WAVE_FORMAT_EXTENSIBLE) {
+        auto pwfxExtensible = reinterpret_cast<const WAVEFORMATEXTENSIBLE*>(pwfx);
+        if (IsEqualGUID(KSDATAFORMAT_SUBTYPE_PCM, pwfxExtensible->SubFormat)) {
+            wFormatTag = WAVE_FORMAT_PCM;
+        }
+        else if (IsEqualGUID(KSDATAFORMAT_SUBTYPE_IEEE_FLOAT, pwfxExtensible->SubFormat)) {
+            wFormatTag = WAVE_FORMAT_IEEE_FLOAT;
+        }
+        else {
+            OLECHAR subFormatGUID[39];
+            StringFromGUID2(pwfxExtensible->SubFormat, subFormatGUID, _countof(subFormatGUID));
+            ERR(L"extensible format not PCM, got %s", subFormatGUID);
+            return E_UNEXPECTED;
+        }
+    }
+
+    *pFormat = MakeAudioFormat(wFormatTag, pwfx->nChannels, pwfx->nSamplesPerSec, pwfx->wBitsPerSample);
+    return S_OK;
+}
+
+// the usual speaker layout for a demultiplexed stream of this many
+// channels, or none for the engine to map them in order
+static DWORD ChannelMaskFor(WORD nChannels) {
+    switch (nChannels) {
+    case 2: return SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT;
+    case 4: return SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT;
+    case 6: return SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_FRONT_CENTER | SPEAKER_LOW_FREQUENCY | SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT;
+    case 8: return SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_FRONT_CENTER | SPEAKER_LOW_FREQUENCY | SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT | SPEAKER_SIDE_LEFT | SPEAKER_SIDE_RIGHT;
+    default: return 0;
+    }
+}
+
+void WaveFormatFromAudioFormat(const AudioFormat& format, WAVEFORMATEXTENSIBLE* pwfx) {
+    ZeroMemory(pwfx, sizeof(*pwfx));
+    pwfx->Format.wFormatTag = WAVE_FORMAT_EXTENSIBLE;
+    pwfx->Format.nChannels = format.nChannels;
+    pwfx->Format.nSamplesPerSec = format.nSamplesPerSec;
+    pwfx->Format.wBitsPerSample = format.wBitsPerSample;
+    pwfx->Format.nBlockAlign = static_cast<WORD>(format.nBlockAlign);
+    pwfx->Format.nAvgBytesPerSec = format.nSamplesPerSec * format.nBlockAlign;
+    pwfx->Format.cbSize = sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX);
+    pwfx->Samples.wValidBitsPerSample = format.wBitsPerSample;
+    pwfx->dwChannelMask = ChannelMaskFor(format.nChannels);
+    pwfx->SubFormat = format.wFormatTag == AUDIOFORMAT_TAG_IEEE_FLOAT ? KSDATAFORMAT_SUBTYPE_IEEE_FLOAT : KSDATAFORMAT_SUBTYPE_PCM;
+}
+
+// picks the format the output stream is opened with, in order of preference:
+// the repacked format itself, the closest match the engine suggests if we can
+// convert to it, then the engine's mix sample type at our rate with the
+// engine doing any rate conversion
+HRESULT NegotiateOutputFormat(
+    IAudioClient* pAudioOutClient,
+    const AudioFormat& desired,
+    WAVEFORMATEXTENSIBLE* pwfxOut,
+    AudioFormat* pDeviceFormat,
+    DWORD* pdwStreamFlags
+) {
+    *pdwStreamFlags = 0;
+
+    WaveFormatFromAudioFormat(desired, pwfxOut);
+    *pDeviceFormat = desired;
+
+    WAVEFORMATEX* pwfxClosest = NULL;
+    HRESULT hr = pAudioOutClient->IsFormatSupported(
+        AUDCLNT_SHAREMODE_SHARED,
+        reinterpret_cast<WAVEFORMATEX*>(pwfxOut),
+        &pwfxClosest
+    );
+    CoTaskMemFreeOnExit freeClosest(pwfxClosest);
+
+    if (S_OK == hr) {
+        LOG(L"Output format: %u Hz %hs", desired.nSamplesPerSec, SampleTypeName(SampleTypeOf(desired)));
+        return S_OK;
+    }
+
+    if (S_FALSE == hr && NULL != pwfxClosest) {
+        AudioFormat closest;
+        if (
+            SUCCEEDED(AudioFormatFromWaveFormat(pwfxClosest, &closest)) &&
+            closest.nChannels == desired.nChannels &&
+            closest.nSamplesPerSec == desired.nSamplesPerSec &&
+            SampleTypeOf(closest) != SAMPLE_UNKNOWN
+        ) {
+            WaveFormatFromAudioFormat(closest, pwfxOut);
+            *pDeviceFormat = closest;
+            LOG(L"Output format: %u Hz %hs (closest match)", closest.nSamplesPerSec, SampleTypeName(SampleTypeOf(closest)));
+            return S_OK;
+        }
+    }
+    else if (FAILED(hr) && AUDCLNT_E_UNSUPPORTED_FORMAT != hr) {
+        ERR(L"IAudioClient::IsFormatSupported failed (output): hr = 0x%08x", hr);
+        return hr;
+    }
+
+    // fall back on the mix format's sample type and let the engine resample
+    WAVEFORMATEX* pwfxMix;
+    hr = pAudioOutClient->GetMixFormat(&pwfxMix);
+    if (FAILED(hr)) {
+        ERR(L"IAudioClient::GetMixFormat failed (output): hr = 0x%08x", hr);
+        return hr;
+    }
+    CoTaskMemFreeOnExit freeMix(pwfxMix);
+
+    AudioFormat mix;
+    hr = AudioFormatFromWaveFormat(pwfxMix, &mix);
+    if (FAILED(hr)) {
+        return hr;
+    }
+
+    if (SampleTypeOf(mix) == SAMPLE_UNKNOWN) {
+        ERR(L"can't convert to the output mix format (%u-bit, tag %u)", mix.wBitsPerSample, mix.wFormatTag);
+        return E_UNEXPECTED;
+    }
+
+    *pDeviceFormat = MakeAudioFormat(mix.wFormatTag, desired.nChannels, desired.nSamplesPerSec, mix.wBitsPerSample);
+    WaveFormatFromAudioFormat(*pDeviceFormat, pwfxOut);
+    *pdwStreamFlags = AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM | AUDCLNT_STREAMFLAGS_SRC_DEFAULT_QUALITY;
+    LOG(
+        L"Output format: %u Hz %hs, resampled by the audio engine to %u Hz",
+        desired.nSamplesPerSec, SampleTypeName(SampleTypeOf(*pDeviceFormat)), mix.nSamplesPerSec
+    );
+    return S_OK;
+}
@@ -0,0 +1,112 @@
+// wasapi.h
+
+// the WASAPI backend for the endpoint interface in device.h: shared mode,
+// event driven streams, a loopback capture source and render sinks
+//
+// failures keep their HRESULT as the endpoint's error code; the ones that
+// mean the device went away come back as DEVICE_LOST
+
+HRESULT AudioFormatFromWaveFormat(const WAVEFORMATEX* pwfx, AudioFormat* pFormat);
+void WaveFormatFromAudioFormat(const AudioFormat& format, WAVEFORMATEXTENSIBLE* pwfx);
+HRESULT NegotiateOutputFormat(
+    IAudioClient* pAudioOutClient,
+    const AudioFormat& desired,
+    WAVEFORMATEXTENSIBLE* pwfxOut,
+    AudioFormat* pDeviceFormat,
+    DWORD* pdwStreamFlags
+);
+
+DeviceStatus DeviceStatusFromHresult(HRESULT hr);
+
+// the IAudioClient, its event and the stop event, shared by both directions
+class WasapiStream {
+public:
+    // hStopEvent is the caller's, set to interrupt the stream; NULL to make one
+    WasapiStream(IMMDevice* pMMDevice, HANDLE hStopEvent);
+    ~WasapiStream();
+
+    HRESULT Activate();
+    HRESULT SetEventHandle();
+    IAudioClient* Client() const { return m_pAudioClient; }
+
+    HRESULT Start();
+    void Stop();
+
+    HRESULT EnterThread();
+    void LeaveThread();
+
+    // DEVICE_OK when the stream's event fires, DEVICE_STOPPED once the stop
+    // event has; *pdwError is GetLastError if waiting failed
+    DeviceStatus Wait(uint32_t nTimeoutMs, DWORD* pdwError);
+    void Interrupt();
+
+private:
+    WasapiStream(const WasapiStream &) = delete;
+    WasapiStream& operator=(const WasapiStream &) = delete;
+
+    IMMDevice* m_pMMDevice;
+    IAudioClient* m_pAudioClient;
+    HANDLE m_hEvent;
+    HANDLE m_hStopEvent;
+    bool m_bOwnStopEvent;
+    volatile LONG m_bStopped; // the stop event may be auto-reset, so remember it fired
+    bool m_bStarted;
+    HANDLE m_hTask;
+    bool m_bCoInitialized;
+};
+
+// loopback capture of a mono stream, in the device's mix format
+class WasapiCaptureSource : public CaptureSource {
+public:
+    WasapiCaptureSource(IMMDevice* pMMDevice, HANDLE hStopEvent);
+    ~WasapiCaptureSource();
+
+    const AudioFormat& Format() const override { return m_format; }
+    int64_t PeriodHns() const override { return m_hnsPeriod; }
+
+    DeviceStatus Open() override;
+    DeviceStatus Start() override;
+    void Stop() override { m_stream.Stop(); }
+    DeviceStatus EnterThread() override;
+    void LeaveThread() override { m_stream.LeaveThread(); }
+    DeviceStatus Wait(uint32_t nTimeoutMs) override;
+    void Interrupt() override { m_stream.Interrupt(); }
+
+    DeviceStatus GetPacket(CapturePacket& packet) override;
+    DeviceStatus ReleasePacket(uint32_t nFrames) override;
+
+private:
+    WasapiStream m_stream;
+    IAudioCaptureClient* m_pCaptureClient;
+    AudioFormat m_format;
+    int64_t m_hnsPeriod;
+};
+
+class WasapiRenderSink : public RenderSink {
+public:
+    WasapiRenderSink(IMMDevice* pMMDevice);
+    ~WasapiRenderSink();
+
+    const AudioFormat& Format() const override { return m_format; }
+    int64_t PeriodHns() const override { return m_hnsPeriod; }
+
+    DeviceStatus Open(const AudioFormat& desired, uint32_t nBufferMs) override;
+    uint32_t BufferFrames() const override { return m_nBufferFrames; }
+    DeviceStatus Start() override;
+    void Stop() override { m_stream.Stop(); }
+    DeviceStatus EnterThread() override;
+    void LeaveThread() override { m_stream.LeaveThread(); }
+    DeviceStatus Wait(uint32_t nTimeoutMs) override;
+    void Interrupt() override { m_stream.Interrupt(); }
+
+    DeviceStatus GetPadding(uint32_t& nPadding) override;
+    DeviceStatus GetBuffer(uint32_t nFrames, uint8_t** ppData) override;
+    DeviceStatus ReleaseBuffer(uint32_t nFrames, bool bSilent) override;
+
+private:
+    WasapiStream m_stream;
+    IAudioRenderClient* m_pRenderClient;
+    AudioFormat m_format;
+    int64_t m_hnsPeriod;
+    UINT32 m_nBufferFrames;
+};
@@ -0,0 +1,151 @@
+// wavfile.cpp
+
+#include "wavfile.h"
+
+#include <cstring>
+
+static uint16_t ReadLE16(const uint8_t *p) {
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+static uint32_t ReadLE32(const uint8_t *p) {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+        (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static uint64_t ReadLE64(const uint8_t *p) {
+    return static_cast<uint64_t>(ReadLE32(p)) | (static_cast<uint64_t>(ReadLE32(p + 4)) << 32);
+}
+
+static void WriteLE16(uint8_t *p, uint16_t v) {
+    p[0] = static_cast<uint8_t>(v);
+    p[1] = static_cast<uint8_t>(v >> 8);
+}
+
+static void WriteLE32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = static_cast<uint8_t>(v >> (8 * i));
+    }
+}
+
+static void WriteLE64(uint8_t *p, uint64_t v) {
+    WriteLE32(p, static_cast<uint32_t>(v));
+    WriteLE32(p + 4, static_cast<uint32_t>(v >> 32));
+}
+
+bool LooksLikeWav(const uint8_t *pHeader, size_t nHeaderBytes) {
+    return nHeaderBytes >= 12 &&
+        (0 == memcmp(pHeader, "RIFF", 4) || 0 == memcmp(pHeader, "RF64", 4)) &&
+        0 == memcmp(pHeader + 8, "WAVE", 4);
+}
+
+bool ParseWavHeader(const uint8_t *pHeader, size_t nHeaderBytes, uint64_t nFileBytes, WavInfo &info, std::string &error) {
+    if (!LooksLikeWav(pHeader, nHeaderBytes)) {
+        error = "not a RIFF/RF64 WAVE file";
+        return false;
+    }
+
+    bool bRF64 = 0 == memcmp(pHeader, "RF64", 4);
+    bool bHaveFormat = false;
+    uint64_t nDs64DataBytes = 0;
+    size_t nOffset = 12;
+
+    while (nOffset + 8 <= nHeaderBytes) {
+        const uint8_t *pChunk = pHeader + nOffset;
+        uint64_t nChunkBytes = ReadLE32(pChunk + 4);
+        size_t nBodyOffset = nOffset + 8;
+
+        if (0 == memcmp(pChunk, "ds64", 4)) {
+            if (nChunkBytes < 24 || nBodyOffset + 24 > nHeaderBytes) {
+                error = "truncated ds64 chunk";
+                return false;
+            }
+            nDs64DataBytes = ReadLE64(pChunk + 16);
+        }
+        else if (0 == memcmp(pChunk, "fmt ", 4)) {
+            if (nChunkBytes < 16 || nBodyOffset + 16 > nHeaderBytes) {
+                error = "truncated fmt chunk";
+                return false;
+            }
+
+            const uint8_t *pFmt = pChunk + 8;
+            uint16_t wFormatTag = ReadLE16(pFmt);
+            if (wFormatTag == AUDIOFORMAT_TAG_EXTENSIBLE) {
+                // the first two bytes of the SubFormat GUID are the real tag
+                if (nChunkBytes < 40 || nBodyOffset + 40 > nHeaderBytes) {
+                    error = "truncated extensible fmt chunk";
+                    return false;
+                }
+                wFormatTag = ReadLE16(pFmt + 24);
+            }
+
+            info.format.wFormatTag = wFormatTag;
+            info.format.nChannels = ReadLE16(pFmt + 2);
+            info.format.nSamplesPerSec = ReadLE32(pFmt + 4);
+            info.format.nBlockAlign = ReadLE16(pFmt + 12);
+            info.format.wBitsPerSample = ReadLE16(pFmt + 14);
+            bHaveFormat = true;
+        }
+        else if (0 == memcmp(pChunk, "data", 4)) {
+            if (!bHaveFormat) {
+                error = "data chunk before fmt chunk";
+                return false;
+            }
+
+            if (bRF64 && nChunkBytes == 0xFFFFFFFF) {
+                nChunkBytes = nDs64DataBytes;
+            }
+
+            info.nDataOffset = nBodyOffset;
+
+            // a capture that was cut off may claim more (or zero) data
+            uint64_t nAvailable = nFileBytes > nBodyOffset ? nFileBytes - nBodyOffset : 0;
+            info.nDataBytes = (nChunkBytes == 0 || nChunkBytes > nAvailable) ? nAvailable : nChunkBytes;
+            return true;
+        }
+
+        // anything after a chunk this big is out of reach of the header
+        if (nChunkBytes >= nHeaderBytes - nBodyOffset) {
+            break;
+        }
+
+        // chunks are padded to an even size
+        nOffset = nBodyOffset + static_cast<size_t>(nChunkBytes) + static_cast<size_t>(nChunkBytes & 1);
+    }
+
+    error = "no data chunk found in the first " + std::to_string(nHeaderBytes) + " bytes";
+    return false;
+}
+
+void BuildWavHeader(const AudioFormat &format, uint64_t nDataBytes, uint8_t *pHeader) {
+    uint64_t nRiffBytes = WAV_HEADER_BYTES - 8 + nDataBytes;
+    bool bRF64 = nRiffBytes > 0xFFFFFFFF;
+
+    memset(pHeader, 0, WAV_HEADER_BYTES);
+
+    memcpy(pHeader, bRF64 ? "RF64" : "RIFF", 4);
+    WriteLE32(pHeader + 4, bRF64 ? 0xFFFFFFFF : static_cast<uint32_t>(nRiffBytes));
+    memcpy(pHeader + 8, "WAVE", 4);
+
+    // reserved space that turns into a ds64 chunk once the file gets too big
+    memcpy(pHeader + 12, bRF64 ? "ds64" : "JUNK", 4);
+    WriteLE32(pHeader + 16, 28);
+    if (bRF64) {
+        WriteLE64(pHeader + 20, nRiffBytes);
+        WriteLE64(pHeader + 28, nDataBytes);
+        WriteLE64(pHeader + 36, format.nBlockAlign ? nDataBytes / format.nBlockAlign : 0);
+        WriteLE32(pHeader + 44, 0); // no table entries
+    }
+
+    memcpy(pHeader + 48, "fmt ", 4);
+    WriteLE32(pHeader + 52, 16);
+    WriteLE16(pHeader + 56, format.wFormatTag);
+    WriteLE16(pHeader + 58, format.nChannels);
+    WriteLE32(pHeader + 60, format.nSamplesPerSec);
+    WriteLE32(pHeader + 64, format.nSamplesPerSec * format.nBlockAlign);
+    WriteLE16(pHeader + 68, format.nBlockAlign);
+    WriteLE16(pHeader + 70, format.wBitsPerSample);
+
+    memcpy(pHeader + 72, "data", 4);
+    WriteLE32(pHeader + 76, bRF64 ? 0xFFFFFFFF : static_cast<uint32_t>(nDataBytes));
+}
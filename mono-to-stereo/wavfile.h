@@ -0,0 +1,36 @@
+// wavfile.h
+
+// minimal RIFF/RF64 WAVE header reading and writing
+//
+// headers are parsed from and written to memory so the caller decides how
+// the file itself is accessed (mapped, streamed, piped)
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "audioformat.h"
+
+struct WavInfo {
+    AudioFormat format;
+    uint64_t nDataOffset; // byte offset of the first sample
+    uint64_t nDataBytes;  // clamped to what is actually in the file
+};
+
+// parses the header at the start of a file of nFileBytes bytes
+// pHeader holds the first nHeaderBytes bytes of the file
+// returns false and fills error if this isn't a WAV file we can read
+bool ParseWavHeader(const uint8_t *pHeader, size_t nHeaderBytes, uint64_t nFileBytes, WavInfo &info, std::string &error);
+
+// quick check for a RIFF or RF64 WAVE signature
+bool LooksLikeWav(const uint8_t *pHeader, size_t nHeaderBytes);
+
+// size of the header written by BuildWavHeader
+// it is a plain RIFF header with room reserved to become RF64 later
+#define WAV_HEADER_BYTES 80
+
+// fills pHeader with WAV_HEADER_BYTES bytes describing nDataBytes of data
+// when nDataBytes doesn't fit in a RIFF header an RF64 header is produced
+void BuildWavHeader(const AudioFormat &format, uint64_t nDataBytes, uint8_t *pHeader);